@@ -12,6 +12,7 @@ UCDTOOLS_SRC_FILES := \
 LOCAL_SRC_FILES += $(UCDTOOLS_SRC_FILES)
 
 ESPEAK_SOURCES := \
+  src/libespeak-ng/bundle.c \
   src/libespeak-ng/compiledata.c \
   src/libespeak-ng/compiledict.c \
   src/libespeak-ng/compilembrola.c \
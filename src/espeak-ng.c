@@ -31,6 +31,21 @@
 #include <fcntl.h>
 #include <time.h>
 
+#ifdef HAVE_SYS_UN_H
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_WORKING_FORK)
+#define BATCH_MODE
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #include <espeak-ng/espeak_ng.h>
 #include <espeak-ng/speak_lib.h>
 
@@ -56,7 +71,9 @@ static const char *help_text =
     "\t   Amplitude, 0 to 200, default is 100\n"
     "-d <device>\n"
     "\t   Use the specified device to speak the audio on. If not specified, the\n"
-    "\t   default audio device is used.\n"
+    "\t   default audio device is used. The \"null\" device discards the\n"
+    "\t   audio, and \"file:<path>\" writes it to a raw 16-bit file, at the\n"
+    "\t   rate that it would be played.\n"
     "-g <integer>\n"
     "\t   Word gap. Pause between words, units of 10mS at the default speed\n"
     "-k <integer>\n"
@@ -79,9 +96,30 @@ static const char *help_text =
     "-x\t   Write phoneme mnemonics to stdout\n"
     "-X\t   Write phonemes mnemonics and translation trace to stdout\n"
     "-z\t   No final sentence pause at the end of the text\n"
+    "--alignment=<file>\n"
+    "\t   Write the start and end sample of each phoneme, with its word and\n"
+    "\t   text position, to this file as JSON lines\n"
+    "--clause-length=<integer>\n"
+    "\t   Longest clause, in bytes of text, before text without punctuation\n"
+    "\t   is split. The default is 800\n"
+    "--economy=<integer>\n"
+    "\t   Less processing for output at lower sample rates. 1=up to 7kHz,\n"
+    "\t   2=up to 3.8kHz (breath too) without echo, 3=also update the spectrum\n"
+    "\t   half as often. The default is 0, the full quality\n"
+    "--samplerate=<integer>\n"
+    "\t   Synthesize at this sample rate in Hz, from 8000 to 48000, instead of\n"
+    "\t   the sample rate of the phoneme data\n"
+    "--capture=<file>\n"
+    "\t   Write the commands which drive the wave generator to this file\n"
+    "--replay=<file>\n"
+    "\t   Speak the commands of a file written by --capture, instead of text\n"
     "--compile=<voice name>\n"
     "\t   Compile pronunciation rules and dictionary from the current\n"
     "\t   directory. <voice name> specifies the language\n"
+    "--compile-bundle=<file> [<languages>]\n"
+    "\t   Pack the phoneme data, voices and dictionaries into a single file,\n"
+    "\t   which can be used with --path. <languages> is a comma separated\n"
+    "\t   list, such as en,de. By default all languages are included\n"
     "--compile-debug=<voice name>\n"
     "\t   Compile pronunciation rules and dictionary from the current\n"
     "\t   directory, including line numbers for use with -X.\n"
@@ -94,7 +132,8 @@ static const char *help_text =
     "\t   Compile the phoneme data using <phsource-dir> or the default phsource directory\n"
     "--ipa      Write phonemes to stdout using International Phonetic Alphabet\n"
     "--path=\"<path>\"\n"
-    "\t   Specifies the directory containing the espeak-ng-data directory\n"
+    "\t   Specifies the directory containing the espeak-ng-data directory,\n"
+    "\t   or a data bundle created with --compile-bundle\n"
     "--pho      Write mbrola phoneme data (.pho) to stdout or to the file in --phonout\n"
     "--phonout=\"<filename>\"\n"
     "\t   Write phoneme output from -x -X --ipa and --pho to this file\n"
@@ -104,6 +143,16 @@ static const char *help_text =
     "--sep=<character>\n"
     "\t   Separate phonemes (from -x --ipa) with <character>.\n"
     "\t   Default is space, z means ZWJN character.\n"
+    "--server=<socket>\n"
+    "\t   Keep the engine loaded, and speak the text from --client requests\n"
+    "\t   on this Unix domain socket\n"
+    "--client=<socket>\n"
+    "\t   Send the text to the --server on <socket>. Use with -w or --stdout\n"
+    "--batch=<manifest>\n"
+    "\t   Speak each line of a TSV or JSONL manifest (id, text, voice, params)\n"
+    "\t   to <id>.wav, in the directory given by -w\n"
+    "--jobs=<integer>\n"
+    "\t   Number of processes used by --batch. The default is one per CPU\n"
     "--split=<minutes>\n"
     "\t   Starts a new WAV file every <minutes>.  Used with -w\n"
     "--stdout   Write speech output to stdout\n"
@@ -120,6 +169,8 @@ static const char *help_text =
 int samplerate;
 bool quiet = false;
 unsigned int samples_total = 0;
+static FILE *f_alignment = NULL;
+static unsigned int alignment_offset = 0;
 unsigned int samples_split = 0;
 unsigned int samples_split_seconds = 0;
 unsigned int wavefile_count = 0;
@@ -293,6 +344,969 @@ static int SynthCallback(short *wav, int numsamples, espeak_EVENT *events)
 	return 0;
 }
 
+static void WriteAlignment(void)
+{
+	// write the phonemes of the text that has just been spoken, as JSON lines
+	const espeak_ng_ALIGNMENT *alignment;
+	int count;
+	int ix;
+	int j;
+
+	if (f_alignment == NULL)
+		return;
+
+	espeak_ng_Synchronize();
+	alignment = espeak_ng_GetAlignment(&count);
+	for (ix = 0; ix < count; ix++) {
+		fprintf(f_alignment, "{\"sample_start\": %u, \"sample_end\": %u, \"phoneme\": \"",
+		        alignment_offset + alignment[ix].sample_start, alignment_offset + alignment[ix].sample_end);
+		for (j = 0; (j < (int)sizeof(alignment[ix].phoneme)) && (alignment[ix].phoneme[j] != 0); j++) {
+			if ((alignment[ix].phoneme[j] == '"') || (alignment[ix].phoneme[j] == '\\'))
+				fputc('\\', f_alignment);
+			fputc(alignment[ix].phoneme[j], f_alignment);
+		}
+		fprintf(f_alignment, "\", \"word_index\": %u, \"text_position\": %u}\n",
+		        alignment[ix].word_index, alignment[ix].text_position);
+	}
+	// the text that is spoken next follows on in the audio output
+	if (count > 0)
+		alignment_offset += alignment[count-1].sample_end;
+}
+
+static char *ReadText(FILE *f)
+{
+	// read the whole of the text from a file or stdin
+	char *text = NULL;
+	char *new_text;
+	size_t size = 0;
+	size_t max = 0;
+	size_t n;
+
+	do {
+		if (size + 1000 >= max) {
+			max += 0x10000;
+			if ((new_text = (char *)realloc(text, max)) == NULL) {
+				free(text);
+				return NULL;
+			}
+			text = new_text;
+		}
+		n = fread(text + size, 1, max - size - 1, f);
+		size += n;
+	} while (n > 0);
+
+	text[size] = 0;
+	if (f != stdin)
+		fclose(f);
+	return text;
+}
+
+#ifdef HAVE_SYS_UN_H
+// --server and --client
+// Each message on the socket is a FRAME_HEADER followed by `length` bytes of
+// data. Host byte order is used, as the socket is only available locally.
+
+#define FRAME_SPEAK   'S' // client: SERVER_REQUEST followed by the text
+#define FRAME_CANCEL  'C' // client: stop the current request
+#define FRAME_AUDIO   'A' // server: 16 bit mono samples
+#define FRAME_EVENT   'E' // server: SERVER_EVENT
+#define FRAME_DONE    'D' // server: int32_t espeak_ng_STATUS of the request
+
+#define MAX_REQUEST_TEXT  0x1000000
+
+typedef struct {
+	uint32_t type;
+	uint32_t length;
+} FRAME_HEADER;
+
+typedef struct {
+	int32_t flags;  // espeak_Synth() flags
+	int32_t rate;   // words per minute, 0 = the server's default
+	int32_t pitch;  // -1 = the server's default
+	int32_t volume; // -1 = the server's default
+	char voice[40]; // empty = the server's default
+} SERVER_REQUEST;
+
+typedef struct {
+	int32_t type; // espeak_EVENT_TYPE
+	int32_t text_position;
+	int32_t length;
+	int32_t audio_position;
+	int32_t sample;
+	int32_t number;
+	char name[32]; // mark name, or phoneme mnemonic
+} SERVER_EVENT;
+
+static int server_fd = -1;
+static char server_path[108];
+static char server_voice[40];
+static bool server_cancel = false;
+static char *server_next_data = NULL; // a request which arrived during the current one
+static volatile sig_atomic_t client_interrupted = 0;
+
+static int ReadFull(int fd, void *data, size_t length)
+{
+	// return: 0 = ok, -1 = end of file or error
+	char *p = (char *)data;
+	ssize_t n;
+	struct pollfd pfd;
+
+	while (length > 0) {
+		n = read(fd, p, length);
+		if (n > 0) {
+			p += n;
+			length -= n;
+		} else if (n == 0)
+			return -1;
+		else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+				return -1;
+		} else if (errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
+
+static char *ServerReadRequest(int fd, FRAME_HEADER *hdr)
+{
+	// Read the data of a FRAME_SPEAK, with a terminating zero after the text.
+	// return: the data, or NULL if it is not valid or could not be read
+	char *data;
+
+	if (hdr->type != FRAME_SPEAK || hdr->length < sizeof(SERVER_REQUEST) || hdr->length > sizeof(SERVER_REQUEST) + MAX_REQUEST_TEXT)
+		return NULL;
+	if ((data = (char *)malloc(hdr->length + 1)) == NULL)
+		return NULL;
+	if (ReadFull(fd, data, hdr->length) != 0) {
+		free(data);
+		return NULL;
+	}
+	data[hdr->length] = 0;
+	return data;
+}
+
+static int ServerCheckCancel(int fd)
+{
+	// A frame which arrived while a request is in progress: a FRAME_CANCEL
+	// stops it, and a FRAME_SPEAK is kept until it has finished.
+	// return: 0 = continue, -1 = cancelled, or the connection was closed
+	FRAME_HEADER hdr;
+
+	if (ReadFull(fd, &hdr, sizeof(hdr)) != 0)
+		return -1;
+	if (hdr.type == FRAME_CANCEL && hdr.length == 0) {
+		server_cancel = true;
+		return -1;
+	}
+	if ((server_next_data = ServerReadRequest(fd, &hdr)) == NULL)
+		return -1;
+	return 0;
+}
+
+static int ServerWrite(int fd, const void *data, size_t length)
+{
+	// Write to the client, waiting while its socket buffer is full so that a
+	// slow client holds up the synthesis, and checking for a cancel request.
+	// return: 0 = ok, -1 = cancelled, or the connection was closed
+	const char *p = (const char *)data;
+	ssize_t n;
+	struct pollfd pfd;
+
+	while (length > 0) {
+		// once a following request has been kept, the frames after it are
+		// left in the socket until it is handled
+		pfd.fd = fd;
+		pfd.events = (server_next_data == NULL) ? (POLLIN | POLLOUT) : POLLOUT;
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (pfd.revents & (POLLIN | POLLHUP)) {
+			if ((server_next_data != NULL) || (ServerCheckCancel(fd) != 0))
+				return -1;
+			continue;
+		}
+		if (pfd.revents & POLLERR)
+			return -1;
+
+		n = write(fd, p, length);
+		if (n > 0) {
+			p += n;
+			length -= n;
+		} else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
+
+static int ServerSend(int fd, uint32_t type, const void *data, size_t length)
+{
+	FRAME_HEADER hdr;
+
+	hdr.type = type;
+	hdr.length = length;
+	if (ServerWrite(fd, &hdr, sizeof(hdr)) != 0)
+		return -1;
+	return ServerWrite(fd, data, length);
+}
+
+static int ServerSendEvent(int fd, espeak_EVENT *event)
+{
+	SERVER_EVENT ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = event->type;
+	ev.text_position = event->text_position;
+	ev.length = event->length;
+	ev.audio_position = event->audio_position;
+	ev.sample = event->sample;
+	if ((event->type == espeakEVENT_MARK) || (event->type == espeakEVENT_PLAY)) {
+		if (event->id.name != NULL)
+			strncpy0(ev.name, event->id.name, sizeof(ev.name));
+	} else if (event->type == espeakEVENT_PHONEME)
+		memcpy(ev.name, event->id.string, sizeof(event->id.string));
+	else
+		ev.number = event->id.number;
+	return ServerSend(fd, FRAME_EVENT, &ev, sizeof(ev));
+}
+
+static int ServerSynthCallback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	int fd = (int)(intptr_t)events->user_data;
+
+	if (fd < 0) // warming up the engine, before any clients
+		return 0;
+
+	for (; events->type != espeakEVENT_LIST_TERMINATED; events++) {
+		if (ServerSendEvent(fd, events) != 0)
+			return 1;
+	}
+	if ((wav != NULL) && (numsamples > 0)) {
+		if (ServerSend(fd, FRAME_AUDIO, wav, numsamples*2) != 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void ServerConnection(int fd)
+{
+	// Handle the requests from one client. This runs in a child process with a
+	// copy of the server's engine, so the data and voice are already loaded.
+	FRAME_HEADER hdr;
+	SERVER_REQUEST req;
+	espeak_EVENT event;
+	char current_voice[sizeof(req.voice)];
+	char *data;
+	char *text;
+	int32_t status;
+	int default_rate = espeak_GetParameter(espeakRATE, 1);
+	int default_pitch = espeak_GetParameter(espeakPITCH, 1);
+	int default_volume = espeak_GetParameter(espeakVOLUME, 1);
+
+	current_voice[0] = 0;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	for (;;) {
+		if (server_next_data != NULL) {
+			// sent while the previous request was being spoken
+			data = server_next_data;
+			server_next_data = NULL;
+		} else {
+			if (ReadFull(fd, &hdr, sizeof(hdr)) != 0)
+				break;
+			if (hdr.type == FRAME_CANCEL && hdr.length == 0)
+				continue; // the request had already finished
+			if ((data = ServerReadRequest(fd, &hdr)) == NULL)
+				break;
+		}
+		memcpy(&req, data, sizeof(req));
+		text = data + sizeof(req);
+		req.voice[sizeof(req.voice)-1] = 0;
+
+		status = ENS_OK;
+		if (strcmp(req.voice, current_voice) != 0) {
+			// keep the voice loaded while the client uses the same one
+			status = espeak_ng_SetVoiceByName(req.voice[0] ? req.voice : server_voice);
+			strcpy(current_voice, status == ENS_OK ? req.voice : "");
+		}
+		if (status == ENS_OK) {
+			espeak_SetParameter(espeakRATE, req.rate > 0 ? req.rate : default_rate, 0);
+			espeak_SetParameter(espeakPITCH, req.pitch >= 0 ? req.pitch : default_pitch, 0);
+			espeak_SetParameter(espeakVOLUME, req.volume >= 0 ? req.volume : default_volume, 0);
+
+			memset(&event, 0, sizeof(event));
+			event.type = espeakEVENT_SAMPLERATE;
+			event.id.number = espeak_ng_GetSampleRate();
+			server_cancel = false;
+			if (ServerSendEvent(fd, &event) != 0)
+				status = ENS_SPEECH_STOPPED;
+			else
+				status = espeak_ng_Synthesize(text, strlen(text)+1, 0, POS_CHARACTER, 0, req.flags, NULL, (void *)(intptr_t)fd);
+		}
+		free(data);
+
+		if (status == ENS_SPEECH_STOPPED && !server_cancel)
+			break; // the client has gone
+		if (ServerSend(fd, FRAME_DONE, &status, sizeof(status)) != 0 && !server_cancel)
+			break;
+	}
+	free(server_next_data);
+	server_next_data = NULL;
+	close(fd);
+}
+
+static void ServerSignal(int sig)
+{
+	(void)sig; // unused
+	unlink(server_path);
+	_exit(0);
+}
+
+static int RunServer(const char *path, const char *voicename)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+	pid_t pid;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path is too long: '%s'\n", path);
+		return EXIT_FAILURE;
+	}
+
+	// warm up the engine, so that each connection starts with the data loaded
+	espeak_SetSynthCallback(ServerSynthCallback);
+	espeak_ng_Synthesize(" ", 2, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, (void *)(intptr_t)-1);
+
+	if ((server_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		return EXIT_FAILURE;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	strcpy(server_path, path);
+	strncpy0(server_voice, voicename, sizeof(server_voice));
+
+	if ((stat(path, &st) == 0) && S_ISSOCK(st.st_mode))
+		unlink(path); // left over from a previous server
+	if ((bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(server_fd, 16) != 0)) {
+		fprintf(stderr, "Can't listen on: '%s': %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	signal(SIGCHLD, SIG_IGN); // don't leave zombie processes
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, ServerSignal);
+	signal(SIGTERM, ServerSignal);
+
+	for (;;) {
+		if ((fd = accept(server_fd, NULL, NULL)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept");
+			break;
+		}
+
+		if ((pid = fork()) == 0) {
+			signal(SIGINT, SIG_DFL);
+			signal(SIGTERM, SIG_DFL);
+			close(server_fd);
+			ServerConnection(fd);
+			_exit(0);
+		}
+		if (pid < 0)
+			perror("fork");
+		close(fd);
+	}
+
+	close(server_fd);
+	unlink(server_path);
+	return EXIT_FAILURE;
+}
+
+static void ClientSignal(int sig)
+{
+	(void)sig; // unused
+	client_interrupted = 1;
+}
+
+static int RunClient(const char *path, SERVER_REQUEST *req, const char *text)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct pollfd pfd;
+	FRAME_HEADER hdr;
+	SERVER_EVENT ev;
+	espeak_EVENT events[2];
+	static short no_audio;
+	short *audio = NULL;
+	size_t audio_size = 0;
+	size_t text_len = strlen(text) + 1;
+	int32_t status = ENS_OK;
+	bool cancel_sent = false;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path is too long: '%s'\n", path);
+		return EXIT_FAILURE;
+	}
+	if (text_len > MAX_REQUEST_TEXT) {
+		espeak_ng_PrintStatusCodeMessage(ENOMEM, stderr, NULL);
+		return EXIT_FAILURE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) || (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+		fprintf(stderr, "Can't connect to: '%s': %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	// Ctrl+C cancels the request, and stops once the server has acknowledged it
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = ClientSignal;
+	sigaction(SIGINT, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	hdr.type = FRAME_SPEAK;
+	hdr.length = sizeof(*req) + text_len;
+	if ((write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) || (write(fd, req, sizeof(*req)) != sizeof(*req))
+	    || (write(fd, text, text_len) != (ssize_t)text_len)) {
+		fprintf(stderr, "Can't send the request to: '%s'\n", path);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	memset(events, 0, sizeof(events));
+	for (;;) {
+		if (client_interrupted && !cancel_sent) {
+			hdr.type = FRAME_CANCEL;
+			hdr.length = 0;
+			cancel_sent = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr);
+		}
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (ReadFull(fd, &hdr, sizeof(hdr)) != 0) {
+			status = ENS_SPEECH_STOPPED; // lost the connection
+			break;
+		}
+
+		if (hdr.type == FRAME_DONE && hdr.length == sizeof(status)) {
+			if (ReadFull(fd, &status, sizeof(status)) != 0)
+				status = ENS_SPEECH_STOPPED;
+			break;
+		} else if (hdr.type == FRAME_EVENT && hdr.length == sizeof(ev)) {
+			if (ReadFull(fd, &ev, sizeof(ev)) != 0)
+				break;
+			events[0].type = ev.type;
+			events[0].text_position = ev.text_position;
+			events[0].length = ev.length;
+			events[0].audio_position = ev.audio_position;
+			events[0].sample = ev.sample;
+			events[0].id.number = ev.number;
+			SynthCallback(&no_audio, 0, events);
+		} else if (hdr.type == FRAME_AUDIO && hdr.length <= MAX_REQUEST_TEXT) {
+			if (hdr.length > audio_size) {
+				short *new_audio = (short *)realloc(audio, hdr.length);
+				if (new_audio == NULL)
+					break;
+				audio = new_audio;
+				audio_size = hdr.length;
+			}
+			if (ReadFull(fd, audio, hdr.length) != 0)
+				break;
+			if (!cancel_sent)
+				SynthCallback(audio, hdr.length/2, events + 1);
+		} else
+			break;
+	}
+
+	free(audio);
+	close(fd);
+	CloseWavFile();
+
+	if (status != ENS_OK && status != ENS_SPEECH_STOPPED) {
+		espeak_ng_PrintStatusCodeMessage(status, stderr, NULL);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+#endif
+
+#ifdef BATCH_MODE
+// --batch
+// Each line of the manifest is an utterance, either as tab separated fields:
+//    id <tab> text [<tab> voice [<tab> rate=175,pitch=50,volume=100]]
+// or as a JSON object:
+//    {"id": "...", "text": "...", "voice": "...", "rate": 175, "pitch": 50, "volume": 100}
+// The speech for each one is written to <id>.wav (or <id>.raw, without a header).
+
+typedef struct {
+	char *id;
+	char *text;
+	char *voice;  // NULL = the default voice
+	int rate;     // 0 = the default
+	int pitch;    // -1 = the default
+	int volume;   // -1 = the default
+	int line;
+} BATCH_ENTRY;
+
+typedef struct {
+	int status;   // espeak_ng_STATUS, or -1 if not done
+	int samplerate;
+	unsigned int samples;
+} BATCH_RESULT;
+
+typedef struct { // shared between the worker processes
+	int next_entry;
+	BATCH_RESULT results[1];
+} BATCH_SHARED;
+
+static short *batch_audio = NULL;
+static size_t batch_audio_len = 0;
+static size_t batch_audio_max = 0;
+static int batch_samplerate;
+static int batch_defaults[3]; // rate, pitch, volume
+
+static int BatchSynthCallback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	// Collect the audio for the utterance in memory, to write in one go
+	short *new_audio;
+	size_t new_max;
+
+	for (; events->type != espeakEVENT_LIST_TERMINATED; events++) {
+		if (events->type == espeakEVENT_SAMPLERATE)
+			batch_samplerate = events->id.number;
+	}
+
+	if ((wav == NULL) || (numsamples <= 0))
+		return 0;
+
+	if (batch_audio_len + numsamples > batch_audio_max) {
+		new_max = batch_audio_max * 2;
+		while (batch_audio_len + numsamples > new_max)
+			new_max *= 2;
+		if ((new_audio = (short *)realloc(batch_audio, new_max * sizeof(short))) == NULL)
+			return 1;
+		batch_audio = new_audio;
+		batch_audio_max = new_max;
+	}
+	memcpy(&batch_audio[batch_audio_len], wav, numsamples * sizeof(short));
+	batch_audio_len += numsamples;
+	return 0;
+}
+
+static void SetLE32(unsigned char *p, unsigned int value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static espeak_ng_STATUS WriteBatchFile(const char *dir, const char *id)
+{
+	static unsigned char wave_hdr[44] = {
+		'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ',
+		0x10, 0, 0, 0, 1, 0, 1, 0,  0, 0, 0, 0, 0, 0, 0, 0,
+		2, 0, 0x10, 0, 'd', 'a', 't', 'a',  0, 0, 0, 0
+	};
+	char path[512];
+	const char *extn;
+	bool raw = false;
+	FILE *f;
+	size_t data_size = batch_audio_len * sizeof(short);
+	int error = 0;
+
+	extn = strrchr(id, '.');
+	if ((extn != NULL) && ((strcmp(extn, ".wav") == 0) || (raw = (strcmp(extn, ".raw") == 0))))
+		snprintf(path, sizeof(path), "%s/%s", dir, id);
+	else
+		snprintf(path, sizeof(path), "%s/%s.wav", dir, id);
+
+	if ((f = fopen(path, "wb")) == NULL)
+		return errno;
+
+	errno = 0;
+	if (!raw) {
+		SetLE32(&wave_hdr[4], data_size + 36);
+		SetLE32(&wave_hdr[24], batch_samplerate);
+		SetLE32(&wave_hdr[28], batch_samplerate * 2);
+		SetLE32(&wave_hdr[40], data_size);
+		if (fwrite(wave_hdr, 1, sizeof(wave_hdr), f) != sizeof(wave_hdr))
+			error = errno ? errno : EIO;
+	}
+	if ((error == 0) && (data_size > 0) && (fwrite(batch_audio, 1, data_size, f) != data_size))
+		error = errno ? errno : EIO;
+	if ((fclose(f) != 0) && (error == 0))
+		error = errno;
+	return error;
+}
+
+static espeak_ng_STATUS BatchSpeak(BATCH_ENTRY *entry, const char *dir, unsigned int synth_flags, const char *default_voice)
+{
+	const char *voice = entry->voice ? entry->voice : default_voice;
+	espeak_ng_STATUS status;
+
+	if (strcmp(voice, default_voice) != 0) {
+		// the default voice is already loaded
+		if ((status = espeak_ng_SetVoiceByName(voice)) != ENS_OK)
+			return status;
+	}
+	espeak_SetParameter(espeakRATE, entry->rate > 0 ? entry->rate : batch_defaults[0], 0);
+	espeak_SetParameter(espeakPITCH, entry->pitch >= 0 ? entry->pitch : batch_defaults[1], 0);
+	espeak_SetParameter(espeakVOLUME, entry->volume >= 0 ? entry->volume : batch_defaults[2], 0);
+
+	batch_audio_len = 0;
+	batch_samplerate = espeak_ng_GetSampleRate();
+	status = espeak_ng_Synthesize(entry->text, strlen(entry->text)+1, 0, POS_CHARACTER, 0, synth_flags, NULL, NULL);
+	if (status != ENS_OK)
+		return status;
+	return WriteBatchFile(dir, entry->id);
+}
+
+static char *BatchUnescape(char *p, char *end)
+{
+	// TSV fields: \t \n \\ escapes, and terminate the field at end
+	char *out = p;
+	char *start = p;
+
+	while (p < end) {
+		if ((*p == '\\') && (p+1 < end)) {
+			p++;
+			if (*p == 't')
+				*out++ = '\t';
+			else if (*p == 'n')
+				*out++ = '\n';
+			else
+				*out++ = *p;
+			p++;
+		} else
+			*out++ = *p++;
+	}
+	*out = 0;
+	return start;
+}
+
+static void BatchParam(BATCH_ENTRY *entry, const char *name, int value)
+{
+	if ((strcmp(name, "rate") == 0) || (strcmp(name, "s") == 0))
+		entry->rate = value;
+	else if ((strcmp(name, "pitch") == 0) || (strcmp(name, "p") == 0))
+		entry->pitch = value;
+	else if ((strcmp(name, "volume") == 0) || (strcmp(name, "a") == 0))
+		entry->volume = value;
+}
+
+static char *JsonString(char **pp)
+{
+	// Decode a JSON string in place. *pp points after the opening quote.
+	char *p = *pp;
+	char *out = p;
+	char *start = p;
+	unsigned int c;
+	unsigned int c2;
+
+	while (*p != '"') {
+		if (*p == 0)
+			return NULL;
+		if (*p != '\\') {
+			*out++ = *p++;
+			continue;
+		}
+		switch (*++p)
+		{
+		case 'b': *out++ = '\b'; break;
+		case 'f': *out++ = '\f'; break;
+		case 'n': *out++ = '\n'; break;
+		case 'r': *out++ = '\r'; break;
+		case 't': *out++ = '\t'; break;
+		case 'u':
+			if (sscanf(p+1, "%4x", &c) != 1)
+				return NULL;
+			p += 4;
+			if ((c >= 0xd800) && (c < 0xdc00) && (p[1] == '\\') && (p[2] == 'u') && (sscanf(p+3, "%4x", &c2) == 1)) {
+				c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00); // surrogate pair
+				p += 6;
+			}
+			if (c < 0x80)
+				*out++ = c;
+			else if (c < 0x800) {
+				*out++ = 0xc0 | (c >> 6);
+				*out++ = 0x80 | (c & 0x3f);
+			} else if (c < 0x10000) {
+				*out++ = 0xe0 | (c >> 12);
+				*out++ = 0x80 | ((c >> 6) & 0x3f);
+				*out++ = 0x80 | (c & 0x3f);
+			} else {
+				*out++ = 0xf0 | (c >> 18);
+				*out++ = 0x80 | ((c >> 12) & 0x3f);
+				*out++ = 0x80 | ((c >> 6) & 0x3f);
+				*out++ = 0x80 | (c & 0x3f);
+			}
+			break;
+		case 0:
+			return NULL;
+		default: // " \ /
+			*out++ = *p;
+			break;
+		}
+		p++;
+	}
+	*pp = p+1;
+	*out = 0;
+	return start;
+}
+
+static bool ParseJsonEntry(char *p, BATCH_ENTRY *entry)
+{
+	// a flat JSON object, with string and integer values
+	char *name;
+	char *value;
+
+	while (isspace(*p)) p++;
+	if (*p++ != '{')
+		return false;
+
+	for (;;) {
+		while (isspace(*p) || (*p == ',')) p++;
+		if (*p == '}')
+			return true;
+		if ((*p++ != '"') || ((name = JsonString(&p)) == NULL))
+			return false;
+		while (isspace(*p)) p++;
+		if (*p++ != ':')
+			return false;
+		while (isspace(*p)) p++;
+
+		if (*p == '"') {
+			p++;
+			if ((value = JsonString(&p)) == NULL)
+				return false;
+			if (strcmp(name, "id") == 0)
+				entry->id = value;
+			else if (strcmp(name, "text") == 0)
+				entry->text = value;
+			else if (strcmp(name, "voice") == 0)
+				entry->voice = value;
+		} else if ((*p == '-') || isdigit(*p))
+			BatchParam(entry, name, (int)strtol(p, &p, 10));
+		else
+			return false;
+	}
+}
+
+static bool ParseBatchEntry(char *line, BATCH_ENTRY *entry)
+{
+	char *field[4];
+	char *end;
+	char *p;
+	int n_fields;
+	char name[10];
+	int value;
+	int n;
+
+	while (isspace(*line)) line++;
+	if (*line == '{')
+		return ParseJsonEntry(line, entry);
+
+	for (n_fields = 0, p = line; n_fields < 4; n_fields++) {
+		field[n_fields] = p;
+		if ((end = strchr(p, '\t')) == NULL) {
+			end = p + strlen(p);
+			BatchUnescape(field[n_fields++], end);
+			break;
+		}
+		p = end+1;
+		BatchUnescape(field[n_fields], end);
+	}
+	if (n_fields < 2)
+		return false;
+
+	entry->id = field[0];
+	entry->text = field[1];
+	if ((n_fields > 2) && (field[2][0] != 0))
+		entry->voice = field[2];
+	if (n_fields > 3) {
+		for (p = field[3]; sscanf(p, " %9[a-z] = %d%n", name, &value, &n) == 2; p += n) {
+			BatchParam(entry, name, value);
+			while (isspace(p[n]) || (p[n] == ',')) n++;
+		}
+	}
+	return true;
+}
+
+static bool BatchValidId(const char *id)
+{
+	return (id[0] != 0) && (strchr(id, '/') == NULL) && (strcmp(id, ".") != 0) && (strcmp(id, "..") != 0);
+}
+
+static int RunBatch(const char *manifest, const char *dir, int n_jobs, unsigned int synth_flags, const char *default_voice)
+{
+	FILE *f;
+	char *text;
+	char *line;
+	char *next;
+	BATCH_ENTRY *entries = NULL;
+	BATCH_ENTRY *new_entries;
+	BATCH_SHARED *shared;
+	size_t shared_size;
+	int n_entries = 0;
+	int max_entries = 0;
+	int line_number;
+	int ix;
+	int job;
+	pid_t pid;
+	struct timespec start, end;
+	double elapsed;
+	double audio_seconds = 0;
+	int n_done = 0;
+	int n_failed = 0;
+
+	if ((f = fopen(manifest, "r")) == NULL) {
+		fprintf(stderr, "Failed to read file '%s'\n", manifest);
+		return EXIT_FAILURE;
+	}
+	if ((text = ReadText(f)) == NULL) {
+		espeak_ng_PrintStatusCodeMessage(ENOMEM, stderr, NULL);
+		return EXIT_FAILURE;
+	}
+
+	for (line = text, line_number = 1; *line != 0; line = next, line_number++) {
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = 0;
+		else
+			next = line + strlen(line);
+		if ((ix = strlen(line)) > 0 && line[ix-1] == '\r')
+			line[ix-1] = 0;
+		if ((line[0] == 0) || (line[0] == '#'))
+			continue;
+
+		if (n_entries >= max_entries) {
+			max_entries = max_entries ? max_entries * 2 : 256;
+			if ((new_entries = (BATCH_ENTRY *)realloc(entries, max_entries * sizeof(BATCH_ENTRY))) == NULL) {
+				espeak_ng_PrintStatusCodeMessage(ENOMEM, stderr, NULL);
+				return EXIT_FAILURE;
+			}
+			entries = new_entries;
+		}
+		memset(&entries[n_entries], 0, sizeof(BATCH_ENTRY));
+		entries[n_entries].pitch = -1;
+		entries[n_entries].volume = -1;
+		entries[n_entries].line = line_number;
+		if (!ParseBatchEntry(line, &entries[n_entries]) || (entries[n_entries].id == NULL) || (entries[n_entries].text == NULL)) {
+			fprintf(stderr, "%s:%d: expected an id and text\n", manifest, line_number);
+			n_failed++;
+			continue;
+		}
+		if (!BatchValidId(entries[n_entries].id)) {
+			// the file is written in the output directory, not elsewhere
+			fprintf(stderr, "%s:%d: the id is not a file name: '%s'\n", manifest, line_number, entries[n_entries].id);
+			n_failed++;
+			continue;
+		}
+		n_entries++;
+	}
+
+	shared_size = sizeof(BATCH_SHARED) + n_entries * sizeof(BATCH_RESULT);
+	shared = (BATCH_SHARED *)mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	shared->next_entry = 0;
+	for (ix = 0; ix < n_entries; ix++)
+		shared->results[ix].status = -1;
+
+	if (n_jobs <= 0)
+		n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_jobs > n_entries)
+		n_jobs = n_entries;
+	if (n_jobs < 1)
+		n_jobs = 1;
+
+	// the workers each have a copy of the initialized engine
+	espeak_SetSynthCallback(BatchSynthCallback);
+	batch_defaults[0] = espeak_GetParameter(espeakRATE, 1);
+	batch_defaults[1] = espeak_GetParameter(espeakPITCH, 1);
+	batch_defaults[2] = espeak_GetParameter(espeakVOLUME, 1);
+	batch_audio_max = 0x100000;
+	batch_audio = (short *)malloc(batch_audio_max * sizeof(short));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fflush(stdout);
+	for (job = 0; job < n_jobs; job++) {
+		if ((pid = fork()) < 0) {
+			perror("fork");
+			break;
+		}
+		if (pid > 0)
+			continue;
+
+		// worker: take the next entry from the shared list until there are none
+		// left. Each is spoken in a process of its own, forked from the engine as
+		// it was initialized, so that its output does not depend on the voice,
+		// parameters and synthesis state left by the entries before it.
+		while ((ix = __sync_fetch_and_add(&shared->next_entry, 1)) < n_entries) {
+			if ((pid = fork()) < 0) {
+				shared->results[ix].status = errno;
+				continue;
+			}
+			if (pid > 0) {
+				waitpid(pid, NULL, 0);
+				continue;
+			}
+			shared->results[ix].status = BatchSpeak(&entries[ix], dir, synth_flags, default_voice);
+			shared->results[ix].samplerate = batch_samplerate;
+			shared->results[ix].samples = batch_audio_len;
+			_exit(0);
+		}
+		_exit(0);
+	}
+	while (wait(NULL) > 0)
+		;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	for (ix = 0; ix < n_entries; ix++) {
+		BATCH_RESULT *result = &shared->results[ix];
+		if (result->status == ENS_OK) {
+			n_done++;
+			if (result->samplerate > 0)
+				audio_seconds += (double)result->samples / result->samplerate;
+		} else {
+			n_failed++;
+			fprintf(stderr, "%s:%d: %s: ", manifest, entries[ix].line, entries[ix].id);
+			if (result->status == -1)
+				fprintf(stderr, "not spoken\n");
+			else
+				espeak_ng_PrintStatusCodeMessage(result->status, stderr, NULL);
+		}
+	}
+
+	printf("%d files, %d failed, %.1f s of speech in %.2f s with %d jobs (%.1f files/s, %.1fx real time)\n",
+	       n_done, n_failed, audio_seconds, elapsed, n_jobs,
+	       elapsed > 0 ? n_done / elapsed : 0, elapsed > 0 ? audio_seconds / elapsed : 0);
+
+	munmap(shared, shared_size);
+	free(batch_audio);
+	free(entries);
+	free(text);
+	return n_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
+
 static void PrintVersion()
 {
 	const char *version;
@@ -324,6 +1338,17 @@ int main(int argc, char **argv)
 		{ "compile-intonations", no_argument, 0, 0x10f },
 		{ "compile-phonemes", optional_argument, 0, 0x110 },
 		{ "load",    no_argument,       0, 0x111 },
+		{ "clause-length", required_argument, 0, 0x112 },
+		{ "server",  required_argument, 0, 0x113 },
+		{ "client",  required_argument, 0, 0x114 },
+		{ "batch",   required_argument, 0, 0x115 },
+		{ "jobs",    required_argument, 0, 0x116 },
+		{ "alignment", required_argument, 0, 0x117 },
+		{ "compile-bundle", required_argument, 0, 0x118 },
+		{ "economy", required_argument, 0, 0x119 },
+		{ "samplerate", required_argument, 0, 0x11a },
+		{ "capture", required_argument, 0, 0x11b },
+		{ "replay",  required_argument, 0, 0x11c },
 		{ 0, 0, 0, 0 }
 	};
 
@@ -340,6 +1365,9 @@ int main(int argc, char **argv)
 	int flag_stdin = 0;
 	int flag_compile = 0;
 	int flag_load = 0;
+	const char *bundle_file = NULL;
+	const char *capture_file = NULL;
+	const char *replay_file = NULL;
 	int filesize = 0;
 	int synth_flags = espeakCHARS_AUTO | espeakPHONEMES | espeakENDPAUSE;
 
@@ -353,11 +1381,18 @@ int main(int argc, char **argv)
 	int phoneme_options = 0;
 	int option_linelength = 0;
 	int option_waveout = 0;
+	int option_clause_length = 0;
+	int option_economy = 0;
+	int option_samplerate = 0;
 	
 	espeak_VOICE voice_select;
 	char filename[200];
 	char voicename[40];
 	char devicename[200];
+	char server_socket[108];
+	char client_socket[108];
+	char batch_file[200];
+	int n_jobs = 0;
 	#define N_PUNCTLIST 100
 	wchar_t option_punctlist[N_PUNCTLIST];
 
@@ -365,6 +1400,9 @@ int main(int argc, char **argv)
 	wavefile[0] = 0;
 	filename[0] = 0;
 	devicename[0] = 0;
+	server_socket[0] = 0;
+	client_socket[0] = 0;
+	batch_file[0] = 0;
 	option_punctlist[0] = 0;
 
 	while (true) {
@@ -569,11 +1607,104 @@ int main(int argc, char **argv)
 		case 0x111: // --load
 			flag_load = 1;
 			break;
+		case 0x112: // --clause-length
+			option_clause_length = atoi(optarg2);
+			break;
+		case 0x113: // --server
+		case 0x114: // --client
+#ifdef HAVE_SYS_UN_H
+			strncpy0(c == 0x113 ? server_socket : client_socket, optarg2, sizeof(server_socket));
+			break;
+#else
+			fprintf(stderr, "--server and --client are not supported on this platform\n");
+			exit(EXIT_FAILURE);
+#endif
+		case 0x115: // --batch
+#ifdef BATCH_MODE
+			strncpy0(batch_file, optarg2, sizeof(batch_file));
+			break;
+#else
+			fprintf(stderr, "--batch is not supported on this platform\n");
+			exit(EXIT_FAILURE);
+#endif
+		case 0x116: // --jobs
+			n_jobs = atoi(optarg2);
+			break;
+		case 0x117: // --alignment
+			if ((f_alignment = fopen(optarg2, "w")) == NULL) {
+				fprintf(stderr, "Can't write to: %s\n", optarg2);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 0x118: // --compile-bundle
+			bundle_file = optarg2;
+			break;
+		case 0x119: // --economy
+			option_economy = atoi(optarg2);
+			break;
+		case 0x11a: // --samplerate
+			option_samplerate = atoi(optarg2);
+			break;
+		case 0x11b: // --capture
+			capture_file = optarg2;
+			break;
+		case 0x11c: // --replay
+			replay_file = optarg2;
+			break;
 		default:
 			exit(0);
 		}
 	}
 
+	if (bundle_file != NULL) {
+		// the text argument, if any, is the list of languages
+		espeak_ng_InitializePath(data_path);
+		espeak_ng_ERROR_CONTEXT context = NULL;
+		espeak_ng_STATUS result = espeak_ng_CompileBundle(bundle_file, optind < argc ? argv[optind] : NULL, stdout, &context);
+		if (result != ENS_OK) {
+			espeak_ng_PrintStatusCodeMessage(result, stderr, context);
+			espeak_ng_ClearErrorContext(&context);
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+#ifdef HAVE_SYS_UN_H
+	if (client_socket[0] != 0) {
+		// the server does the synthesis, so the data is not loaded here
+		SERVER_REQUEST req;
+
+		if (!option_waveout && !quiet) {
+			fprintf(stderr, "--client needs -w or --stdout\n");
+			exit(EXIT_FAILURE);
+		}
+
+		memset(&req, 0, sizeof(req));
+		req.flags = synth_flags;
+		req.rate = speed > 0 ? speed : 0;
+		req.pitch = pitch;
+		req.volume = volume;
+		strncpy0(req.voice, voicename, sizeof(req.voice));
+
+		if (filename[0] == 0 && optind < argc && flag_stdin == 0)
+			return RunClient(client_socket, &req, argv[optind]);
+
+		if (filename[0] == 0)
+			f_text = stdin;
+		else if ((f_text = fopen(filename, "r")) == NULL) {
+			fprintf(stderr, "Failed to read file '%s'\n", filename);
+			exit(EXIT_FAILURE);
+		}
+		if ((p_text = ReadText(f_text)) == NULL) {
+			espeak_ng_PrintStatusCodeMessage(ENOMEM, stderr, NULL);
+			exit(EXIT_FAILURE);
+		}
+		value = RunClient(client_socket, &req, p_text);
+		free(p_text);
+		return value;
+	}
+#endif
+
 	espeak_ng_InitializePath(data_path);
 	espeak_ng_ERROR_CONTEXT context = NULL;
 	espeak_ng_STATUS result = espeak_ng_Initialize(&context);
@@ -583,7 +1714,16 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	if (option_waveout || quiet) {
+	if (option_samplerate != 0) {
+		// before the output is initialized at the sample rate
+		result = espeak_ng_SetSampleRate(option_samplerate);
+		if (result != ENS_OK) {
+			espeak_ng_PrintStatusCodeMessage(result, stderr, NULL);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (option_waveout || quiet || server_socket[0] != 0 || batch_file[0] != 0) {
 		// writing to a file (or no output), we can use synchronous mode
 		result = espeak_ng_InitializeOutput(ENOUTPUT_MODE_SYNCHRONOUS, 0, devicename[0] ? devicename : NULL);
 		samplerate = espeak_ng_GetSampleRate();
@@ -598,6 +1738,10 @@ int main(int argc, char **argv)
 				*extn = 0;
 			}
 		}
+	} else if (replay_file != NULL) {
+		// the capture is replayed in the calling thread
+		result = espeak_ng_InitializeOutput(PLAYBACK_MODE | ENOUTPUT_MODE_SYNCHRONOUS, 0, devicename[0] ? devicename : NULL);
+		samplerate = espeak_ng_GetSampleRate();
 	} else {
 		// play the sound output
 		result = espeak_ng_InitializeOutput(PLAYBACK_MODE, 0, devicename[0] ? devicename : NULL);
@@ -655,8 +1799,60 @@ int main(int argc, char **argv)
 		espeak_SetParameter(espeakLINELENGTH, option_linelength, 0);
 	if (option_punctuation == 2)
 		espeak_SetPunctuationList(option_punctlist);
+	if (option_clause_length > 0) {
+		result = espeak_ng_SetClauseLength(option_clause_length);
+		if (result != ENS_OK) {
+			espeak_ng_PrintStatusCodeMessage(result, stderr, NULL);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (option_economy != 0) {
+		result = espeak_ng_SetEconomy(option_economy);
+		if (result != ENS_OK) {
+			espeak_ng_PrintStatusCodeMessage(result, stderr, NULL);
+			exit(EXIT_FAILURE);
+		}
+	}
 
 	espeak_SetPhonemeTrace(phoneme_options | (phonemes_separator << 8), f_phonemes_out);
+	if (f_alignment != NULL)
+		espeak_ng_SetAlignment(1);
+
+	if (capture_file != NULL) {
+		result = espeak_ng_StartCapture(capture_file);
+		if (result != ENS_OK) {
+			espeak_ng_PrintStatusCodeMessage(result, stderr, NULL);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (replay_file != NULL) {
+		result = espeak_ng_ReplayCapture(replay_file);
+		if (result != ENS_OK) {
+			espeak_ng_PrintStatusCodeMessage(result, stderr, NULL);
+			exit(EXIT_FAILURE);
+		}
+		WriteAlignment();
+		CloseWavFile();
+		espeak_ng_Terminate();
+		return 0;
+	}
+
+#ifdef HAVE_SYS_UN_H
+	if (server_socket[0] != 0) {
+		value = RunServer(server_socket, voicename);
+		espeak_ng_Terminate();
+		return value;
+	}
+#endif
+
+#ifdef BATCH_MODE
+	if (batch_file[0] != 0) {
+		value = RunBatch(batch_file, option_waveout ? wavefile : ".", n_jobs, synth_flags, voicename);
+		espeak_ng_Terminate();
+		return value;
+	}
+#endif
 
 	if (filename[0] == 0) {
 		if ((optind < argc) && (flag_stdin == 0)) {
@@ -689,6 +1885,7 @@ int main(int argc, char **argv)
 		int size;
 		size = strlen(p_text);
 		espeak_Synth(p_text, size+1, 0, POS_CHARACTER, 0, synth_flags, NULL, NULL);
+		WriteAlignment();
 	} else if (flag_stdin) {
 		size_t max = 1000;
 		if ((p_text = (char *)malloc(max)) == NULL) {
@@ -701,6 +1898,7 @@ int main(int argc, char **argv)
 			while (fgets(p_text, max, f_text) != NULL) {
 				p_text[max-1] = 0;
 				espeak_Synth(p_text, max, 0, POS_CHARACTER, 0, synth_flags, NULL, NULL);
+				WriteAlignment();
 				// Allow subprocesses to use the audio data through pipes.
 				fflush(stdout);
 			}
@@ -731,6 +1929,7 @@ int main(int argc, char **argv)
 			if (ix > 0) {
 				p_text[ix-1] = 0;
 				espeak_Synth(p_text, ix+1, 0, POS_CHARACTER, 0, synth_flags, NULL, NULL);
+				WriteAlignment();
 			}
 		}
 
@@ -744,12 +1943,15 @@ int main(int argc, char **argv)
 		fread(p_text, 1, filesize, f_text);
 		p_text[filesize] = 0;
 		espeak_Synth(p_text, filesize+1, 0, POS_CHARACTER, 0, synth_flags, NULL, NULL);
+		WriteAlignment();
 		fclose(f_text);
 
 		free(p_text);
 	}
 
 	result = espeak_ng_Synchronize();
+	if (result == ENS_OK)
+		result = espeak_ng_StopCapture();
 	if (result != ENS_OK) {
 		espeak_ng_PrintStatusCodeMessage(result, stderr, NULL);
 		exit(EXIT_FAILURE);
@@ -757,6 +1959,8 @@ int main(int argc, char **argv)
 
 	if (f_phonemes_out != stdout)
 		fclose(f_phonemes_out);
+	if (f_alignment != NULL)
+		fclose(f_alignment);
 
 	CloseWavFile();
 	espeak_ng_Terminate();
@@ -63,6 +63,9 @@ typedef enum {
 	/* eSpeak NG 1.49.2 */
 	ENS_UNKNOWN_PHONEME_FEATURE  = 0x10000FFF,
 	ENS_UNKNOWN_TEXT_ENCODING    = 0x100010FF,
+
+	/* eSpeak NG 1.51 */
+	ENS_CORRUPT_DATA             = 0x100011FF,
 } espeak_ng_STATUS;
 
 typedef enum {
@@ -189,6 +192,168 @@ espeak_ng_CompilePhonemeDataPath(long rate,
                                  FILE *log,
                                  espeak_ng_ERROR_CONTEXT *context);
 
+/* eSpeak NG 1.51 */
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_SetClauseLength(int length);
+
+/* Translate all of a text with the translator of the selected voice, which
+ * is shared with synthesis as for espeak_TextToPhonemes, so this is not
+ * thread safe. Returns ENS_VOICE_NOT_FOUND if no voice has been selected. */
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_TextToPhonemes(const void *text,
+                         int textmode,
+                         int phonememode,
+                         char *phonemes,
+                         size_t size);
+
+typedef struct
+{
+	unsigned int sample_start;  /* the first sample of the phoneme */
+	unsigned int sample_end;    /* the sample after the end of the phoneme */
+	unsigned int text_position; /* character position of the word in the text, starting at 1 */
+	unsigned int word_index;    /* the word number, as in espeakEVENT_WORD */
+	char phoneme[8];            /* the phoneme name, not zero terminated if it is 8 bytes */
+} espeak_ng_ALIGNMENT;
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_SetAlignment(int enable);
+
+ESPEAK_NG_API const espeak_ng_ALIGNMENT *
+espeak_ng_GetAlignment(int *count);
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_CompileBundle(const char *filename,
+                        const char *languages,
+                        FILE *log,
+                        espeak_ng_ERROR_CONTEXT *context);
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_InitializeBundle(const void *data,
+                           size_t size);
+
+typedef enum {
+	ENKLATT_DOUBLE = 0,
+	ENKLATT_FLOAT = 1,
+} espeak_ng_KLATT_PRECISION;
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_SetKlattPrecision(espeak_ng_KLATT_PRECISION precision);
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_BeginStream(unsigned int flags,
+                      unsigned int *unique_identifier,
+                      void *user_data);
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_AppendText(const void *text);
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_EndStream(void);
+
+typedef enum {
+	ENPRIORITY_NORMAL = 0,
+	ENPRIORITY_HIGH = 1,
+	ENPRIORITY_URGENT = 2,
+} espeak_ng_PRIORITY;
+
+typedef enum {
+	ENPREEMPT_NONE = 0,    /* wait for the current utterance to finish */
+	ENPREEMPT_RESUME = 1,  /* interrupt it at the end of a clause, and continue it afterwards */
+	ENPREEMPT_DISCARD = 2, /* interrupt it at the end of a clause, and drop the rest of it */
+} espeak_ng_PREEMPTION;
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_SynthesizeWithPriority(const void *text,
+                                 size_t size,
+                                 unsigned int flags,
+                                 espeak_ng_PRIORITY priority,
+                                 espeak_ng_PREEMPTION preemption,
+                                 unsigned int *unique_identifier,
+                                 void *user_data);
+
+typedef struct
+{
+	unsigned int queued;     /* the number of commands which are waiting */
+	unsigned int max_queued; /* the most commands which have been waiting at once */
+	unsigned int started;    /* the number of commands which have been taken from the queue */
+	unsigned int preempted;  /* the number of utterances interrupted by one of a higher priority */
+	double total_wait_ms;    /* the total time from queuing to starting of the started commands */
+	double max_wait_ms;      /* the longest time from queuing to starting */
+} espeak_ng_QUEUE_STATS;
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_GetQueueStats(espeak_ng_PRIORITY priority,
+                        espeak_ng_QUEUE_STATS *stats);
+
+/* In asynchronous mode, these are used from the next espeak_ng_InitializeOutput. */
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_SetPlaybackBuffer(unsigned int prefill_ms,
+                            unsigned int low_water_ms,
+                            unsigned int high_water_ms);
+
+typedef struct
+{
+	unsigned int buffers;     /* the number of buffers of samples which have been played */
+	unsigned int underruns;   /* the number of times that playback ran out of samples during an utterance */
+	unsigned long samples;    /* the number of samples which have been played */
+	unsigned int buffered_ms; /* the audio which is waiting to be played */
+	double total_latency_ms;  /* the total time from the synthesis of the buffers to their playback */
+	double max_latency_ms;    /* the longest time from the synthesis of a buffer to its playback */
+} espeak_ng_PLAYBACK_STATS;
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_GetPlaybackStats(espeak_ng_PLAYBACK_STATS *stats);
+
+typedef enum {
+	ENECONOMY_NONE = 0,   /* the full quality */
+	ENECONOMY_LOW = 1,    /* only generate harmonics up to 7 kHz, enough for 16 kHz output */
+	ENECONOMY_MEDIUM = 2, /* only up to 3.8 kHz (breath noise included), for 8 kHz output, with no echo */
+	ENECONOMY_HIGH = 3,   /* also update the harmonic spectrum every 128 samples instead of 64 */
+} espeak_ng_ECONOMY;
+
+/* In asynchronous mode, the change is queued after the text which has been given. */
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_SetEconomy(espeak_ng_ECONOMY level);
+
+/* Synthesize at a sample rate from 8000 to 48000 Hz, instead of the sample rate
+ * of the phoneme data. An espeakEVENT_SAMPLERATE event gives the new rate. In
+ * asynchronous mode, the change is queued after the text which has been given. */
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_SetSampleRate(int rate);
+
+typedef struct
+{
+	unsigned long lookups;  /* the number of spectrum sequences which have been looked up for a phoneme */
+	unsigned long hits;     /* the number of those which were in the cache */
+	unsigned int entries;   /* the number of sequences in the cache */
+	unsigned int evictions; /* the number of sequences which have been replaced by another one */
+} espeak_ng_FRAME_CACHE_STATS;
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_GetFrameCacheStats(espeak_ng_FRAME_CACHE_STATS *stats);
+
+/* Write the commands which drive the wave generator (the spectrum frames, pitch
+ * and amplitude envelopes, sampled sounds, markers and voice changes) to a
+ * file, from the next command that it plays until espeak_ng_StopCapture is
+ * called. MBROLA voices are not captured. */
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_StartCapture(const char *filename);
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_StopCapture(void);
+
+/* Play a capture through the wave generator alone, to the synth callback or
+ * audio device, in ENOUTPUT_MODE_SYNCHRONOUS. The samples are the same as
+ * those of the capture when each is the first output of its process. The
+ * file is only read by the library version which wrote it. */
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_ReplayCapture(const char *filename);
+
+/* In libespeak-ng-data, which is built by ./configure --with-embedded-data */
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_InitializeEmbeddedData(void);
+
 #ifdef __cplusplus
 }
 #endif
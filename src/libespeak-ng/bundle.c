@@ -0,0 +1,636 @@
+/*
+ * Copyright (C) 2026 eSpeak NG contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see: <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_FMEMOPEN
+#include <dirent.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <espeak-ng/espeak_ng.h>
+#include <espeak-ng/speak_lib.h>
+
+#include "bundle.h"
+#include "error.h"
+#include "speech.h"
+
+// how the bundle data is held
+enum {
+	BUNDLE_MALLOC,
+	BUNDLE_MAPPED,
+	BUNDLE_STATIC, // provided by the caller, for example compiled into the program
+};
+
+static char *bundle_path = NULL;
+static unsigned char *bundle_data = NULL;
+static size_t bundle_size = 0;
+static int bundle_storage = BUNDLE_MALLOC;
+static const BUNDLE_ENTRY *bundle_toc = NULL;
+static int n_bundle_entries = 0;
+static unsigned char *bundle_verified = NULL; // the crc of each entry has been checked
+
+uint32_t Crc32(uint32_t crc, const void *data, size_t length)
+{
+	static uint32_t table[256];
+	const unsigned char *p = data;
+	int ix;
+	int bit;
+
+	if (table[1] == 0) {
+		for (ix = 0; ix < 256; ix++) {
+			uint32_t c = ix;
+			for (bit = 0; bit < 8; bit++)
+				c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+			table[ix] = c;
+		}
+	}
+
+	crc = ~crc;
+	while (length-- > 0)
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void FreeBundleData(unsigned char *data, size_t size, int storage)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (storage == BUNDLE_MAPPED)
+		munmap(data, size);
+#else
+	(void)size; // unused parameter
+#endif
+	if (storage == BUNDLE_MALLOC)
+		free(data);
+}
+
+void FreeBundle(void)
+{
+	FreeBundleData(bundle_data, bundle_size, bundle_storage);
+	free(bundle_path);
+	free(bundle_verified);
+	bundle_path = NULL;
+	bundle_data = NULL;
+	bundle_size = 0;
+	bundle_storage = BUNDLE_MALLOC;
+	bundle_toc = NULL;
+	n_bundle_entries = 0;
+	bundle_verified = NULL;
+}
+
+static int SetBundle(const char *path, unsigned char *data, size_t size, int storage)
+{
+	// Use the data as the bundle, if it is valid
+	const BUNDLE_HEADER *header = (const BUNDLE_HEADER *)data;
+	const BUNDLE_ENTRY *toc = (const BUNDLE_ENTRY *)(data + sizeof(BUNDLE_HEADER));
+	size_t toc_size;
+	uint32_t ix;
+
+	if ((size < sizeof(BUNDLE_HEADER)) ||
+	    (memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic)) != 0) ||
+	    (header->version != BUNDLE_VERSION) ||
+	    (header->n_entries >= 0x10000))
+		return 0;
+
+	toc_size = header->n_entries * sizeof(BUNDLE_ENTRY);
+	if ((sizeof(BUNDLE_HEADER) + toc_size > size) || (Crc32(0, toc, toc_size) != header->toc_crc))
+		return 0;
+
+	for (ix = 0; ix < header->n_entries; ix++) {
+		if (((uint64_t)toc[ix].offset + toc[ix].length > size) || (toc[ix].name[N_BUNDLE_NAME-1] != 0))
+			return 0;
+	}
+
+	// the caller frees the data if it is not used
+	char *new_path = strdup(path);
+	unsigned char *verified = calloc(header->n_entries + 1, 1); // not NULL for an empty bundle
+	if ((new_path == NULL) || (verified == NULL)) {
+		free(new_path);
+		free(verified);
+		return 0;
+	}
+
+	FreeBundle();
+	bundle_path = new_path;
+	bundle_data = data;
+	bundle_size = size;
+	bundle_storage = storage;
+	bundle_toc = toc;
+	n_bundle_entries = header->n_entries;
+	bundle_verified = verified;
+	return 1;
+}
+
+int LoadBundle(const char *path)
+{
+	// Map a data bundle, so that the files in it are used in place.
+	// Returns 1 if path is a valid bundle.
+#ifdef HAVE_FMEMOPEN
+	int fd;
+	struct stat statbuf;
+	unsigned char *data;
+	int storage = BUNDLE_MALLOC;
+
+	if ((bundle_path != NULL) && (strcmp(path, bundle_path) == 0))
+		return 1;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+	if ((fstat(fd, &statbuf) != 0) || (statbuf.st_size < (off_t)sizeof(BUNDLE_HEADER))) {
+		close(fd);
+		return 0;
+	}
+
+#ifdef HAVE_SYS_MMAN_H
+	data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data != MAP_FAILED)
+		storage = BUNDLE_MAPPED;
+	else
+#endif
+	{
+		if ((data = malloc(statbuf.st_size)) != NULL) {
+			if (read(fd, data, statbuf.st_size) != statbuf.st_size) {
+				free(data);
+				data = NULL;
+			}
+		}
+	}
+	close(fd);
+	if (data == NULL)
+		return 0;
+
+	if (!SetBundle(path, data, statbuf.st_size, storage)) {
+		FreeBundleData(data, statbuf.st_size, storage);
+		return 0;
+	}
+	return 1;
+#else
+	(void)path; // unused parameter
+	return 0;
+#endif
+}
+
+int LoadBundleData(const char *path, const void *data, size_t size)
+{
+	// Use a bundle in memory, without copying it. The data must remain valid
+	// while it is in use. Returns 1 if the data is a valid bundle.
+#ifdef HAVE_FMEMOPEN
+	return SetBundle(path, (unsigned char *)data, size, BUNDLE_STATIC);
+#else
+	(void)path; // unused parameter
+	(void)data; // unused parameter
+	(void)size; // unused parameter
+	return 0;
+#endif
+}
+
+int IsBundlePath(const char *filename)
+{
+	// Is this a file within the bundle, rather than in a data directory?
+	if (bundle_path == NULL)
+		return 0;
+
+	size_t len = strlen(bundle_path);
+	return (strncmp(filename, bundle_path, len) == 0) && ((filename[len] == '/') || (filename[len] == PATHSEP));
+}
+
+static void BundleName(const char *filename, char *name)
+{
+	// The name of the entry, with '/' separators and no repeated separators
+	const char *p = filename + strlen(bundle_path);
+	int ix = 0;
+
+	while ((*p == '/') || (*p == PATHSEP))
+		p++;
+	for (; *p && (ix < N_BUNDLE_NAME-1); p++) {
+		char c = (*p == PATHSEP) ? '/' : *p;
+		if ((c == '/') && (p[1] == '/' || p[1] == PATHSEP || p[1] == 0))
+			continue;
+		name[ix++] = c;
+	}
+	name[ix] = 0;
+}
+
+static int FindEntry(const char *name)
+{
+	// The entries are sorted by name. Returns the index of the first entry
+	// which is not before name.
+	int lo = 0;
+	int hi = n_bundle_entries;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (strcmp(bundle_toc[mid].name, name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int GetBundleFileLength(const char *filename)
+{
+	// As GetFileLength: the size, -EISDIR for a directory, or -ENOENT
+	char name[N_BUNDLE_NAME+1];
+	int ix;
+	size_t len;
+
+	BundleName(filename, name);
+	ix = FindEntry(name);
+	if ((ix < n_bundle_entries) && (strcmp(bundle_toc[ix].name, name) == 0))
+		return bundle_toc[ix].length;
+
+	len = strlen(name);
+	name[len] = '/';
+	name[len+1] = 0;
+	ix = FindEntry(name);
+	if ((ix < n_bundle_entries) && (strncmp(bundle_toc[ix].name, name, len+1) == 0))
+		return -EISDIR;
+	return -ENOENT;
+}
+
+espeak_ng_STATUS GetBundleFile(const char *filename, const void **data, int *length)
+{
+	// A pointer to the data of the file in the bundle. The checksum is
+	// checked when the file is first used, so that the files which are not
+	// used are not read.
+	char name[N_BUNDLE_NAME];
+	int ix;
+
+	BundleName(filename, name);
+	ix = FindEntry(name);
+	if ((ix >= n_bundle_entries) || (strcmp(bundle_toc[ix].name, name) != 0))
+		return ENOENT;
+
+	const BUNDLE_ENTRY *entry = &bundle_toc[ix];
+	if (!bundle_verified[ix]) {
+		if (Crc32(0, bundle_data + entry->offset, entry->length) != entry->crc)
+			return ENS_CORRUPT_DATA;
+		bundle_verified[ix] = 1;
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MADV_DONTNEED)
+		if (bundle_storage == BUNDLE_MAPPED) {
+			// The check has read all of the file. Release the pages, so that
+			// only those which are used are loaded again, as for phondata.
+			uintptr_t page = sysconf(_SC_PAGESIZE);
+			uintptr_t start = ((uintptr_t)(bundle_data + entry->offset) + page - 1) & ~(page - 1);
+			uintptr_t end = (uintptr_t)(bundle_data + entry->offset + entry->length) & ~(page - 1);
+			if (end > start)
+				madvise((void *)start, end - start, MADV_DONTNEED);
+		}
+#endif
+	}
+
+	*data = bundle_data + entry->offset;
+	if (length != NULL)
+		*length = entry->length;
+	return ENS_OK;
+}
+
+const char *GetBundleFileName(int index)
+{
+	if ((index < 0) || (index >= n_bundle_entries))
+		return NULL;
+	return bundle_toc[index].name;
+}
+
+FILE *OpenDataFile(const char *filename, const char *mode)
+{
+	// Open a text file from espeak-ng-data, which may be in the bundle
+#ifdef HAVE_FMEMOPEN
+	if (IsBundlePath(filename)) {
+		const void *data;
+		int length;
+		espeak_ng_STATUS status = GetBundleFile(filename, &data, &length);
+
+		if (status != ENS_OK) {
+			errno = (status == ENS_CORRUPT_DATA) ? EIO : status;
+			return NULL;
+		}
+		if (length == 0) {
+			errno = ENOENT;
+			return NULL;
+		}
+		return fmemopen((void *)data, length, mode);
+	}
+#endif
+	return fopen(filename, mode);
+}
+
+void FreeDataFile(void *data)
+{
+	// Free data which has been read from a file, unless it is in the bundle
+	if ((data != NULL) && (bundle_data != NULL) &&
+	    ((unsigned char *)data >= bundle_data) && ((unsigned char *)data < bundle_data + bundle_size))
+		return;
+	free(data);
+}
+
+#ifdef HAVE_FMEMOPEN
+
+typedef struct {
+	char (*names)[N_BUNDLE_NAME];
+	int n_names;
+	int max_names;
+} BUNDLE_FILES;
+
+static int AddFile(BUNDLE_FILES *files, const char *name)
+{
+	int ix;
+
+	if (strlen(name) >= N_BUNDLE_NAME)
+		return 0;
+	for (ix = 0; ix < files->n_names; ix++) {
+		if (strcmp(files->names[ix], name) == 0)
+			return 1;
+	}
+
+	if (files->n_names >= files->max_names) {
+		int max_names = files->max_names ? files->max_names * 2 : 64;
+		char (*names)[N_BUNDLE_NAME] = realloc(files->names, max_names * N_BUNDLE_NAME);
+		if (names == NULL)
+			return 0;
+		files->names = names;
+		files->max_names = max_names;
+	}
+	strcpy(files->names[files->n_names++], name);
+	return 1;
+}
+
+static int AddDataFile(BUNDLE_FILES *files, const char *name)
+{
+	// Add a file in espeak-ng-data, if it exists
+	char path[sizeof(path_home)+N_BUNDLE_NAME+2];
+
+	sprintf(path, "%s%c%s", path_home, PATHSEP, name);
+	if (GetFileLength(path) <= 0)
+		return 0;
+	return AddFile(files, name);
+}
+
+static int MatchLanguage(const char *name, const char *languages)
+{
+	// Does the voice file name (without the directory) match one of the
+	// languages, as "en" matches "en" and "en-US"?
+	const char *p = languages;
+
+	if (languages == NULL)
+		return 1;
+
+	while (*p) {
+		size_t len = strcspn(p, ", ");
+		if ((len > 0) && (strncasecmp(name, p, len) == 0) && ((name[len] == 0) || (name[len] == '-')))
+			return 1;
+		p += len;
+		if (*p)
+			p++;
+	}
+	return 0;
+}
+
+static void AddVoiceDictionaries(BUNDLE_FILES *files, const char *name)
+{
+	// Add the dictionaries which are used by a voice file
+	char path[sizeof(path_home)+N_BUNDLE_NAME+2];
+	char buf[120];
+	char keyword[40];
+	char value[40];
+	int language_set = 0;
+	FILE *f;
+
+	sprintf(path, "%s%c%s", path_home, PATHSEP, name);
+	if ((f = fopen(path, "r")) == NULL)
+		return;
+
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		if (sscanf(buf, "%39s %39s", keyword, value) != 2)
+			continue;
+		if ((strcmp(keyword, "language") == 0) && !language_set) {
+			strtok(value, "-");
+			language_set = 1;
+		} else if (strcmp(keyword, "dictionary") != 0)
+			continue;
+		strcat(value, "_dict");
+		AddDataFile(files, value);
+	}
+	fclose(f);
+}
+
+static void AddDirectory(BUNDLE_FILES *files, const char *dir, const char *languages, int add_dictionaries)
+{
+	// Add the files in a directory of espeak-ng-data and its sub-directories.
+	// If languages is given, only the voice files for those languages are added.
+	char path[sizeof(path_home)+N_BUNDLE_NAME+2];
+	char name[N_BUNDLE_NAME+256];
+	DIR *d;
+	struct dirent *ent;
+
+	sprintf(path, "%s%c%s", path_home, PATHSEP, dir);
+	if ((d = opendir(path)) == NULL)
+		return;
+
+	while ((ent = readdir(d)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		snprintf(name, sizeof(name), "%s/%s", dir, ent->d_name);
+		if (strlen(name) >= N_BUNDLE_NAME)
+			continue;
+
+		sprintf(path, "%s%c%s", path_home, PATHSEP, name);
+		int ftype = GetFileLength(path);
+		if (ftype == -EISDIR)
+			AddDirectory(files, name, languages, add_dictionaries);
+		else if ((ftype > 0) && MatchLanguage(ent->d_name, languages)) {
+			AddFile(files, name);
+			if (add_dictionaries)
+				AddVoiceDictionaries(files, name);
+		}
+	}
+	closedir(d);
+}
+
+static int CompareNames(const void *a, const void *b)
+{
+	return strcmp((const char *)a, (const char *)b);
+}
+
+#endif
+
+#pragma GCC visibility push(default)
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_CompileBundle(const char *filename,
+                        const char *languages,
+                        FILE *log,
+                        espeak_ng_ERROR_CONTEXT *context)
+{
+#ifdef HAVE_FMEMOPEN
+	BUNDLE_FILES files = { NULL, 0, 0 };
+	char path[sizeof(path_home)+N_BUNDLE_NAME+2];
+	int ix;
+	FILE *f_in;
+	FILE *f_out;
+
+	if (!log) log = stderr;
+	if ((languages != NULL) && (languages[0] == 0))
+		languages = NULL;
+
+	AddDataFile(&files, "phontab");
+	AddDataFile(&files, "phonindex");
+	AddDataFile(&files, "phondata");
+	AddDataFile(&files, "intonations");
+	AddDataFile(&files, "config");
+	AddDirectory(&files, "voices", NULL, 0);
+
+	int n_required = files.n_names;
+	AddDirectory(&files, "lang", languages, 1);
+	if (languages == NULL) {
+		DIR *d;
+		struct dirent *ent;
+
+		if ((d = opendir(path_home)) != NULL) {
+			while ((ent = readdir(d)) != NULL) {
+				size_t len = strlen(ent->d_name);
+				if ((len > 5) && (strcmp(ent->d_name + len - 5, "_dict") == 0))
+					AddDataFile(&files, ent->d_name);
+			}
+			closedir(d);
+		}
+	} else {
+		const char *p = languages;
+		while (*p) {
+			char name[40];
+			size_t len = strcspn(p, ", ");
+			if ((len > 0) && (len < sizeof(name) - 5)) {
+				memcpy(name, p, len);
+				strcpy(name + len, "_dict");
+				AddDataFile(&files, name);
+			}
+			p += len;
+			if (*p)
+				p++;
+		}
+	}
+
+	if (files.n_names < 4 || files.n_names == n_required) {
+		// no phoneme data, or none of the languages were found
+		free(files.names);
+		sprintf(path, "%s%c%s", path_home, PATHSEP, files.n_names < 4 ? "phondata" : "lang");
+		return create_file_error_context(context, ENOENT, path);
+	}
+
+	qsort(files.names, files.n_names, N_BUNDLE_NAME, CompareNames);
+
+	// lay out the bundle in memory, then write it
+	uint32_t size = sizeof(BUNDLE_HEADER) + files.n_names * sizeof(BUNDLE_ENTRY);
+	for (ix = 0; ix < files.n_names; ix++) {
+		sprintf(path, "%s%c%s", path_home, PATHSEP, files.names[ix]);
+		size = (size + BUNDLE_ALIGN - 1) & ~(BUNDLE_ALIGN - 1);
+		size += GetFileLength(path);
+	}
+
+	unsigned char *data = calloc(size, 1);
+	if (data == NULL) {
+		free(files.names);
+		return ENOMEM;
+	}
+
+	BUNDLE_HEADER *header = (BUNDLE_HEADER *)data;
+	BUNDLE_ENTRY *toc = (BUNDLE_ENTRY *)(data + sizeof(BUNDLE_HEADER));
+	espeak_ng_STATUS status = ENS_OK;
+	uint32_t offset = sizeof(BUNDLE_HEADER) + files.n_names * sizeof(BUNDLE_ENTRY);
+
+	for (ix = 0; (ix < files.n_names) && (status == ENS_OK); ix++) {
+		sprintf(path, "%s%c%s", path_home, PATHSEP, files.names[ix]);
+		offset = (offset + BUNDLE_ALIGN - 1) & ~(BUNDLE_ALIGN - 1);
+		toc[ix].offset = offset;
+		toc[ix].length = GetFileLength(path);
+		strcpy(toc[ix].name, files.names[ix]);
+
+		if ((f_in = fopen(path, "rb")) == NULL) {
+			status = create_file_error_context(context, errno, path);
+			break;
+		}
+		if (fread(data + offset, 1, toc[ix].length, f_in) != toc[ix].length)
+			status = create_file_error_context(context, EIO, path);
+		fclose(f_in);
+
+		toc[ix].crc = Crc32(0, data + offset, toc[ix].length);
+		offset += toc[ix].length;
+	}
+
+	memcpy(header->magic, BUNDLE_MAGIC, sizeof(header->magic));
+	header->version = BUNDLE_VERSION;
+	header->n_entries = files.n_names;
+	header->toc_crc = Crc32(0, toc, files.n_names * sizeof(BUNDLE_ENTRY));
+
+	if ((status == ENS_OK) && ((f_out = fopen(filename, "wb")) == NULL))
+		status = create_file_error_context(context, errno, filename);
+
+	if (status == ENS_OK) {
+		size_t len = strlen(filename);
+		if ((len > 2) && (strcmp(filename + len - 2, ".c") == 0)) {
+			// C source for libespeak-ng-data
+			fprintf(f_out, "/* Generated by espeak-ng --compile-bundle. Do not edit. */\n\n");
+			fprintf(f_out, "#include <stddef.h>\n\n#include <espeak-ng/espeak_ng.h>\n\n");
+			fprintf(f_out, "#if defined(__GNUC__)\n__attribute__((aligned(%d)))\n#endif\n", BUNDLE_ALIGN);
+			fprintf(f_out, "static const unsigned char bundle_data[%u] = {", size);
+			for (offset = 0; offset < size; offset++)
+				fprintf(f_out, "%s%d,", (offset % 20) == 0 ? "\n\t" : "", data[offset]);
+			fprintf(f_out, "\n};\n\n");
+			fprintf(f_out, "ESPEAK_NG_API espeak_ng_STATUS\nespeak_ng_InitializeEmbeddedData(void)\n{\n");
+			fprintf(f_out, "\treturn espeak_ng_InitializeBundle(bundle_data, sizeof(bundle_data));\n}\n");
+		} else
+			fwrite(data, 1, size, f_out);
+
+		if ((ferror(f_out) | fclose(f_out)) != 0) {
+			status = create_file_error_context(context, errno, filename);
+			remove(filename);
+		}
+	}
+
+	if (status == ENS_OK)
+		fprintf(log, "Packed %d files, %u bytes, into %s\n", files.n_names, size, filename);
+
+	free(data);
+	free(files.names);
+	return status;
+#else
+	(void)filename; // unused parameter
+	(void)languages; // unused parameter
+	(void)log; // unused parameter
+	(void)context; // unused parameter
+	return ENS_NOT_SUPPORTED;
+#endif
+}
+
+#pragma GCC visibility pop
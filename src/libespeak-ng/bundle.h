@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2026 eSpeak NG contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see: <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ESPEAK_NG_BUNDLE_H
+#define ESPEAK_NG_BUNDLE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <espeak-ng/espeak_ng.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// A data bundle holds the files of espeak-ng-data in a single file:
+//   a BUNDLE_HEADER, then n_entries BUNDLE_ENTRY records, then the data of
+//   each file, starting on a BUNDLE_ALIGN byte boundary.
+// Numbers are in the byte order of the machine, as in phondata.
+
+#define BUNDLE_MAGIC    "ESNGBNDL"
+#define BUNDLE_VERSION  1
+#define BUNDLE_ALIGN    64
+#define N_BUNDLE_NAME   52
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_entries;
+	uint32_t toc_crc;     // crc32 of the BUNDLE_ENTRY records
+	uint32_t reserved[11];
+} BUNDLE_HEADER;          // 64 bytes
+
+typedef struct {
+	uint32_t offset;      // from the start of the bundle
+	uint32_t length;
+	uint32_t crc;         // crc32 of the file data
+	char name[N_BUNDLE_NAME]; // path within espeak-ng-data, with '/' separators
+} BUNDLE_ENTRY;           // 64 bytes
+
+uint32_t Crc32(uint32_t crc, const void *data, size_t length);
+
+int LoadBundle(const char *path);
+int LoadBundleData(const char *path, const void *data, size_t size);
+void FreeBundle(void);
+
+int IsBundlePath(const char *filename);
+int GetBundleFileLength(const char *filename);
+espeak_ng_STATUS GetBundleFile(const char *filename, const void **data, int *length);
+const char *GetBundleFileName(int index);
+
+FILE *OpenDataFile(const char *filename, const char *mode);
+void FreeDataFile(void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
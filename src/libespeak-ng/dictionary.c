@@ -31,6 +31,7 @@
 #include <espeak-ng/speak_lib.h>
 #include <espeak-ng/encoding.h>
 
+#include "bundle.h"
 #include "dictionary.h"
 #include "numbers.h"
 #include "readclause.h"
@@ -220,25 +221,36 @@ int LoadDictionary(Translator *tr, const char *name, int no_error)
 	size = GetFileLength(fname);
 
 	if (tr->data_dictlist != NULL) {
-		free(tr->data_dictlist);
+		FreeDataFile(tr->data_dictlist);
 		tr->data_dictlist = NULL;
 	}
 
-	f = fopen(fname, "rb");
-	if ((f == NULL) || (size <= 0)) {
-		if (no_error == 0)
-			fprintf(stderr, "Can't read dictionary file: '%s'\n", fname);
-		if (f != NULL)
-			fclose(f);
-		return 1;
-	}
+	if (IsBundlePath(fname)) {
+		// use the dictionary in place
+		const void *data;
+		if ((size <= 0) || (GetBundleFile(fname, &data, &size) != ENS_OK)) {
+			if (no_error == 0)
+				fprintf(stderr, "Can't read dictionary file: '%s'\n", fname);
+			return 1;
+		}
+		tr->data_dictlist = (char *)data;
+	} else {
+		f = fopen(fname, "rb");
+		if ((f == NULL) || (size <= 0)) {
+			if (no_error == 0)
+				fprintf(stderr, "Can't read dictionary file: '%s'\n", fname);
+			if (f != NULL)
+				fclose(f);
+			return 1;
+		}
 
-	if ((tr->data_dictlist = malloc(size)) == NULL) {
+		if ((tr->data_dictlist = malloc(size)) == NULL) {
+			fclose(f);
+			return 3;
+		}
+		size = fread(tr->data_dictlist, 1, size, f);
 		fclose(f);
-		return 3;
 	}
-	size = fread(tr->data_dictlist, 1, size, f);
-	fclose(f);
 
 	pw = (int *)(tr->data_dictlist);
 	length = Reverse4Bytes(pw[1]);
@@ -300,13 +312,10 @@ int HashDictionary(const char *string)
  */
 const char *EncodePhonemes(const char *p, char *outptr, int *bad_phoneme)
 {
-	int ix;
 	unsigned char c;
-	int count;     // num. of matching characters
-	int max;       // highest num. of matching found so far
+	int max;       // num. of matching characters
 	int max_ph;    // corresponding phoneme with highest matching
 	int consumed;
-	unsigned int mnemonic_word;
 
 	if (bad_phoneme != NULL)
 		*bad_phoneme = 0;
@@ -334,28 +343,7 @@ const char *EncodePhonemes(const char *p, char *outptr, int *bad_phoneme)
 		default:
 			// lookup the phoneme mnemonic, find the phoneme with the highest number of
 			// matching characters
-			max = -1;
-			max_ph = 0;
-
-			for (ix = 1; ix < n_phoneme_tab; ix++) {
-				if (phoneme_tab[ix] == NULL)
-					continue;
-				if (phoneme_tab[ix]->type == phINVALID)
-					continue; // this phoneme is not defined for this language
-
-				count = 0;
-				mnemonic_word = phoneme_tab[ix]->mnemonic;
-
-				while (((c = p[count]) > ' ') && (count < 4) &&
-				       (c == ((mnemonic_word >> (count*8)) & 0xff)))
-					count++;
-
-				if ((count > max) &&
-				    ((count == 4) || (((mnemonic_word >> (count*8)) & 0xff) == 0))) {
-					max = count;
-					max_ph = phoneme_tab[ix]->code;
-				}
-			}
+			max_ph = MatchPhonemeMnemonic(p, &max);
 
 			if (max_ph == 0) {
 				// not recognised, report and ignore
@@ -140,6 +140,9 @@ espeak_ng_GetStatusCodeMessage(espeak_ng_STATUS status,
 	case ENS_UNKNOWN_TEXT_ENCODING:
 		strncpy0(buffer, "The text encoding is not supported", length);
 		break;
+	case ENS_CORRUPT_DATA:
+		strncpy0(buffer, "The espeak-ng-data bundle is corrupt", length);
+		break;
 	default:
 		if ((status & ENS_GROUP_MASK) == ENS_GROUP_ERRNO)
 			strerror_r(status, buffer, length);
@@ -233,6 +233,66 @@ t_espeak_command *create_espeak_voice_spec(espeak_VOICE *voice)
 	return a_command;
 }
 
+t_espeak_command *create_espeak_stream(t_espeak_stream_control control, const void *text, size_t size, unsigned int flags, void *user_data)
+{
+	// text is only used by STREAM_APPEND
+	if ((control == STREAM_APPEND) && (!text || !size))
+		return NULL;
+
+	void *a_text = NULL;
+	t_espeak_stream *data = NULL;
+
+	t_espeak_command *a_command = (t_espeak_command *)malloc(sizeof(t_espeak_command));
+	if (!a_command)
+		return NULL;
+
+	if (control == STREAM_APPEND) {
+		a_text = malloc(size);
+		if (!a_text) {
+			free(a_command);
+			return NULL;
+		}
+		memcpy(a_text, text, size);
+	}
+
+	a_command->type = ET_STREAM;
+	a_command->state = CS_UNDEFINED;
+	data = &(a_command->u.my_stream);
+	data->control = control;
+	data->unique_identifier = (control == STREAM_BEGIN) ? ++my_current_text_id : 0;
+	data->text = a_text;
+	data->flags = flags;
+	data->user_data = user_data;
+
+	return a_command;
+}
+
+t_espeak_command *create_espeak_sample_rate(int rate)
+{
+	t_espeak_command *a_command = (t_espeak_command *)malloc(sizeof(t_espeak_command));
+	if (!a_command)
+		return NULL;
+
+	a_command->type = ET_SAMPLE_RATE;
+	a_command->state = CS_UNDEFINED;
+	a_command->u.my_sample_rate = rate;
+
+	return a_command;
+}
+
+t_espeak_command *create_espeak_economy(espeak_ng_ECONOMY level)
+{
+	t_espeak_command *a_command = (t_espeak_command *)malloc(sizeof(t_espeak_command));
+	if (!a_command)
+		return NULL;
+
+	a_command->type = ET_ECONOMY;
+	a_command->state = CS_UNDEFINED;
+	a_command->u.my_economy = level;
+
+	return a_command;
+}
+
 int delete_espeak_command(t_espeak_command *the_command)
 {
 	int a_status = 0;
@@ -262,12 +322,18 @@ int delete_espeak_command(t_espeak_command *the_command)
 			}
 		}
 			break;
+		case ET_STREAM:
+			if (the_command->u.my_stream.text)
+				free(the_command->u.my_stream.text);
+			break;
 		case ET_KEY:
 			if (the_command->u.my_key.key_name)
 				free((void *)(the_command->u.my_key.key_name));
 			break;
 		case ET_CHAR:
 		case ET_PARAMETER:
+		case ET_SAMPLE_RATE:
+		case ET_ECONOMY:
 			// No allocation
 			break;
 		case ET_PUNCTUATION_LIST:
@@ -332,6 +398,23 @@ void process_espeak_command(t_espeak_command *the_command)
 		sync_espeak_terminated_msg(data->unique_identifier, data->user_data);
 	}
 		break;
+	case ET_STREAM:
+	{
+		t_espeak_stream *data = &(the_command->u.my_stream);
+		switch (data->control)
+		{
+		case STREAM_BEGIN:
+			sync_espeak_BeginStream(data->unique_identifier, data->flags, data->user_data);
+			break;
+		case STREAM_APPEND:
+			sync_espeak_AppendText(data->text);
+			break;
+		case STREAM_END:
+			sync_espeak_EndStream();
+			break;
+		}
+	}
+		break;
 	case ET_KEY:
 	{
 		const char *data = the_command->u.my_key.key_name;
@@ -368,6 +451,12 @@ void process_espeak_command(t_espeak_command *the_command)
 		espeak_SetVoiceByProperties(data);
 	}
 		break;
+	case ET_SAMPLE_RATE:
+		sync_espeak_SetSampleRate(the_command->u.my_sample_rate);
+		break;
+	case ET_ECONOMY:
+		sync_espeak_SetEconomy(the_command->u.my_economy);
+		break;
 	default:
 		assert(0);
 		break;
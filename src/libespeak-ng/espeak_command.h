@@ -35,7 +35,10 @@ typedef enum {
 	ET_PUNCTUATION_LIST,
 	ET_VOICE_NAME,
 	ET_VOICE_SPEC,
-	ET_TERMINATED_MSG
+	ET_TERMINATED_MSG,
+	ET_STREAM,
+	ET_SAMPLE_RATE,
+	ET_ECONOMY
 } t_espeak_type;
 
 typedef struct {
@@ -75,6 +78,20 @@ typedef struct {
 	void *user_data;
 } t_espeak_terminated_msg;
 
+typedef enum {
+	STREAM_BEGIN,
+	STREAM_APPEND,
+	STREAM_END
+} t_espeak_stream_control;
+
+typedef struct {
+	t_espeak_stream_control control;
+	unsigned int unique_identifier;
+	void *text;
+	unsigned int flags;
+	void *user_data;
+} t_espeak_stream;
+
 
 typedef struct {
 	espeak_PARAMETER parameter;
@@ -102,6 +119,9 @@ typedef struct {
 		const char *my_voice_name;
 		espeak_VOICE my_voice_spec;
 		t_espeak_terminated_msg my_terminated_msg;
+		t_espeak_stream my_stream;
+		int my_sample_rate;
+		espeak_ng_ECONOMY my_economy;
 	} u;
 } t_espeak_command;
 
@@ -124,6 +144,12 @@ t_espeak_command *create_espeak_voice_name(const char *name);
 
 t_espeak_command *create_espeak_voice_spec(espeak_VOICE *voice_spec);
 
+t_espeak_command *create_espeak_stream(t_espeak_stream_control control, const void *text, size_t size, unsigned int flags, void *user_data);
+
+t_espeak_command *create_espeak_sample_rate(int rate);
+
+t_espeak_command *create_espeak_economy(espeak_ng_ECONOMY level);
+
 void process_espeak_command(t_espeak_command *the_command);
 
 int delete_espeak_command(t_espeak_command *the_command);
@@ -142,6 +168,12 @@ espeak_ng_STATUS SetParameter(int parameter, int value, int relative);
 
 int sync_espeak_terminated_msg(unsigned int unique_identifier, void *user_data);
 
+espeak_ng_STATUS sync_espeak_BeginStream(unsigned int unique_identifier, unsigned int flags, void *user_data);
+espeak_ng_STATUS sync_espeak_AppendText(const void *text);
+espeak_ng_STATUS sync_espeak_EndStream(void);
+espeak_ng_STATUS sync_espeak_SetSampleRate(int rate);
+espeak_ng_STATUS sync_espeak_SetEconomy(espeak_ng_ECONOMY level);
+
 #ifdef __cplusplus
 }
 #endif
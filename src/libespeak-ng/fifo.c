@@ -59,22 +59,53 @@ static bool my_stop_is_acknowledged = false;
 
 static void *say_thread(void *);
 
-static espeak_ng_STATUS push(t_espeak_command *the_command);
-static t_espeak_command *pop(void);
+// The priority of the running command, or -1. A text command of a lower
+// priority than a queued command which preempts it stops at the end of a
+// clause, when it is requeued to resume from there, or is dropped.
+static int my_running_priority = -1;
+static bool my_running_is_preemptible = false;
+static bool my_preempt_is_required = false;
+static espeak_ng_PREEMPTION my_preemption = ENPREEMPT_NONE;
+static bool my_command_is_preempted = false;
+static unsigned int my_preempted_position = 0;
+
+static espeak_ng_STATUS push(t_espeak_command *the_command, int priority, espeak_ng_PREEMPTION preemption);
+static espeak_ng_STATUS push_front(t_espeak_command *the_command, int priority);
+static t_espeak_command *pop(int *priority);
+static void check_preemption(void);
 static void init(int process_parameters);
 static int node_counter = 0;
 
 enum {
 	MAX_NODE_COUNTER = 400,
 	INACTIVITY_TIMEOUT = 50, // in ms, check that the stream is inactive
-	MAX_INACTIVITY_CHECK = 2
+	MAX_INACTIVITY_CHECK = 2,
+	N_PRIORITY = ENPRIORITY_URGENT + 1
 };
 
+// The commands of each priority are held in a ring, in the order that they
+// are to be run.
+typedef struct {
+	t_espeak_command *command;
+	espeak_ng_PREEMPTION preemption;
+	struct timespec queued;
+} fifo_entry;
+
+typedef struct {
+	fifo_entry entries[MAX_NODE_COUNTER];
+	int head;
+	int count;
+	espeak_ng_QUEUE_STATS stats;
+} fifo_ring;
+
+static fifo_ring rings[N_PRIORITY];
+
 void fifo_init()
 {
 	// security
 	pthread_mutex_init(&my_mutex, (const pthread_mutexattr_t *)NULL);
 	init(0);
+	memset(rings, 0, sizeof(rings));
 
 	assert(-1 != pthread_cond_init(&my_cond_command_is_running, NULL));
 	assert(-1 != pthread_cond_init(&my_cond_start_is_required, NULL));
@@ -108,7 +139,7 @@ espeak_ng_STATUS fifo_add_command(t_espeak_command *the_command)
 	if ((status = pthread_mutex_lock(&my_mutex)) != ENS_OK)
 		return status;
 
-	if ((status = push(the_command)) != ENS_OK) {
+	if ((status = push(the_command, ENPRIORITY_NORMAL, ENPREEMPT_NONE)) != ENS_OK) {
 		pthread_mutex_unlock(&my_mutex);
 		return status;
 	}
@@ -129,6 +160,11 @@ espeak_ng_STATUS fifo_add_command(t_espeak_command *the_command)
 }
 
 espeak_ng_STATUS fifo_add_commands(t_espeak_command *command1, t_espeak_command *command2)
+{
+	return fifo_add_priority_commands(command1, command2, ENPRIORITY_NORMAL, ENPREEMPT_NONE);
+}
+
+espeak_ng_STATUS fifo_add_priority_commands(t_espeak_command *command1, t_espeak_command *command2, espeak_ng_PRIORITY priority, espeak_ng_PREEMPTION preemption)
 {
 	espeak_ng_STATUS status;
 	if ((status = pthread_mutex_lock(&my_mutex)) != ENS_OK)
@@ -139,12 +175,12 @@ espeak_ng_STATUS fifo_add_commands(t_espeak_command *command1, t_espeak_command
 		return ENS_FIFO_BUFFER_FULL;
 	}
 
-	if ((status = push(command1)) != ENS_OK) {
+	if ((status = push(command1, priority, preemption)) != ENS_OK) {
 		pthread_mutex_unlock(&my_mutex);
 		return status;
 	}
 
-	if ((status = push(command2)) != ENS_OK) {
+	if ((status = push(command2, priority, ENPREEMPT_NONE)) != ENS_OK) {
 		pthread_mutex_unlock(&my_mutex);
 		return status;
 	}
@@ -196,6 +232,20 @@ int fifo_is_busy()
 	return my_command_is_running;
 }
 
+int fifo_preempt_at(unsigned int position)
+{
+	if (!my_preempt_is_required || !my_running_is_preemptible)
+		return 0;
+
+	if (pthread_mutex_lock(&my_mutex) != ENS_OK)
+		return 0;
+	my_command_is_preempted = true;
+	my_preempted_position = position;
+	rings[my_running_priority].stats.preempted++;
+	pthread_mutex_unlock(&my_mutex);
+	return 1;
+}
+
 static int sleep_until_start_request_or_inactivity()
 {
 	int a_start_is_required = false;
@@ -319,7 +369,8 @@ static void *say_thread(void *p)
 		while (my_command_is_running && !my_terminate_is_required) {
 			int a_status = pthread_mutex_lock(&my_mutex);
 			assert(!a_status);
-			t_espeak_command *a_command = (t_espeak_command *)pop();
+			int a_priority;
+			t_espeak_command *a_command = pop(&a_priority);
 
 			if (a_command == NULL) {
 				my_command_is_running = false;
@@ -329,10 +380,30 @@ static void *say_thread(void *p)
 
 				if (my_stop_is_required)
 					my_command_is_running = false;
+				my_running_priority = a_priority;
+				my_running_is_preemptible = (a_command->type == ET_TEXT);
+				my_command_is_preempted = false;
+				check_preemption();
 				a_status = pthread_mutex_unlock(&my_mutex);
 
 				if (my_command_is_running)
 					process_espeak_command(a_command);
+
+				a_status = pthread_mutex_lock(&my_mutex);
+				assert(!a_status);
+				if (my_command_is_preempted && (my_preemption == ENPREEMPT_RESUME) && !my_stop_is_required) {
+					// continue from the end of the last clause which was spoken
+					a_command->u.my_text.position = my_preempted_position;
+					a_command->u.my_text.position_type = POS_CHARACTER;
+					if (push_front(a_command, a_priority) == ENS_OK)
+						a_command = NULL;
+				}
+				my_running_priority = -1;
+				my_running_is_preemptible = false;
+				my_command_is_preempted = false;
+				my_preempt_is_required = false;
+				a_status = pthread_mutex_unlock(&my_mutex);
+
 				delete_espeak_command(a_command);
 			}
 		}
@@ -363,75 +434,136 @@ int fifo_is_command_enabled()
 	return 0 == my_stop_is_required;
 }
 
-typedef struct t_node {
-	t_espeak_command *data;
-	struct t_node *next;
-} node;
-
-static node *head = NULL;
-static node *tail = NULL;
-
-static espeak_ng_STATUS push(t_espeak_command *the_command)
+static espeak_ng_STATUS push(t_espeak_command *the_command, int priority, espeak_ng_PREEMPTION preemption)
 {
-	assert((!head && !tail) || (head && tail));
-
 	if (the_command == NULL)
 		return EINVAL;
 
+	if ((priority < 0) || (priority >= N_PRIORITY))
+		return EINVAL;
+
 	if (node_counter >= MAX_NODE_COUNTER)
 		return ENS_FIFO_BUFFER_FULL;
 
-	node *n = (node *)malloc(sizeof(node));
-	if (n == NULL)
-		return ENOMEM;
+	fifo_ring *ring = &rings[priority];
+	fifo_entry *entry = &ring->entries[(ring->head + ring->count) % MAX_NODE_COUNTER];
+	entry->command = the_command;
+	entry->preemption = preemption;
+	clock_gettime2(&entry->queued);
 
-	if (head == NULL) {
-		head = n;
-		tail = n;
-	} else {
-		tail->next = n;
-		tail = n;
-	}
+	ring->count++;
+	if ((unsigned int)ring->count > ring->stats.max_queued)
+		ring->stats.max_queued = ring->count;
+	node_counter++;
 
-	tail->next = NULL;
-	tail->data = the_command;
+	the_command->state = CS_PENDING;
+
+	if ((preemption != ENPREEMPT_NONE) && my_running_is_preemptible && (priority > my_running_priority))
+		check_preemption();
+
+	return ENS_OK;
+}
 
+static espeak_ng_STATUS push_front(t_espeak_command *the_command, int priority)
+{
+	if (node_counter >= MAX_NODE_COUNTER)
+		return ENS_FIFO_BUFFER_FULL;
+
+	fifo_ring *ring = &rings[priority];
+	ring->head = (ring->head + MAX_NODE_COUNTER - 1) % MAX_NODE_COUNTER;
+	fifo_entry *entry = &ring->entries[ring->head];
+	entry->command = the_command;
+	entry->preemption = ENPREEMPT_NONE;
+	clock_gettime2(&entry->queued);
+
+	ring->count++;
 	node_counter++;
 
 	the_command->state = CS_PENDING;
-
 	return ENS_OK;
 }
 
-static t_espeak_command *pop()
+static double elapsed_ms(const struct timespec *start)
 {
-	t_espeak_command *the_command = NULL;
+	struct timespec now;
+	clock_gettime2(&now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
 
-	assert((!head && !tail) || (head && tail));
+static t_espeak_command *pop(int *priority)
+{
+	int ix;
 
-	if (head != NULL) {
-		node *n = head;
-		the_command = n->data;
-		head = n->next;
-		free(n);
+	for (ix = N_PRIORITY-1; ix >= 0; ix--) {
+		fifo_ring *ring = &rings[ix];
+		if (ring->count == 0)
+			continue;
+
+		fifo_entry *entry = &ring->entries[ring->head];
+		ring->head = (ring->head + 1) % MAX_NODE_COUNTER;
+		ring->count--;
 		node_counter--;
+
+		double wait_ms = elapsed_ms(&entry->queued);
+		ring->stats.started++;
+		ring->stats.total_wait_ms += wait_ms;
+		if (wait_ms > ring->stats.max_wait_ms)
+			ring->stats.max_wait_ms = wait_ms;
+
+		if (priority != NULL)
+			*priority = ix;
+		return entry->command;
 	}
+	return NULL;
+}
 
-	if (head == NULL)
-		tail = NULL;
+static void check_preemption(void)
+{
+	// Look for a queued command which preempts the running command, taking
+	// the first of the highest priority.
+	int ix;
+	int n;
+
+	my_preempt_is_required = false;
+	if (!my_running_is_preemptible)
+		return;
+
+	for (ix = N_PRIORITY-1; ix > my_running_priority; ix--) {
+		fifo_ring *ring = &rings[ix];
+		for (n = 0; n < ring->count; n++) {
+			fifo_entry *entry = &ring->entries[(ring->head + n) % MAX_NODE_COUNTER];
+			if (entry->preemption != ENPREEMPT_NONE) {
+				my_preempt_is_required = true;
+				my_preemption = entry->preemption;
+				return;
+			}
+		}
+	}
+}
+
+espeak_ng_STATUS fifo_get_stats(espeak_ng_PRIORITY priority, espeak_ng_QUEUE_STATS *stats)
+{
+	espeak_ng_STATUS status;
+
+	if ((priority < 0) || (priority >= N_PRIORITY) || (stats == NULL))
+		return EINVAL;
 
-	return the_command;
+	if ((status = pthread_mutex_lock(&my_mutex)) != ENS_OK)
+		return status;
+	*stats = rings[priority].stats;
+	stats->queued = rings[priority].count;
+	return pthread_mutex_unlock(&my_mutex);
 }
 
 static void init(int process_parameters)
 {
 	t_espeak_command *c = NULL;
-	c = pop();
+	c = pop(NULL);
 	while (c != NULL) {
-		if (process_parameters && (c->type == ET_PARAMETER || c->type == ET_VOICE_NAME || c->type == ET_VOICE_SPEC))
+		if (process_parameters && (c->type == ET_PARAMETER || c->type == ET_VOICE_NAME || c->type == ET_VOICE_SPEC || c->type == ET_SAMPLE_RATE || c->type == ET_ECONOMY))
 			process_espeak_command(c);
 		delete_espeak_command(c);
-		c = pop();
+		c = pop(NULL);
 	}
 	node_counter = 0;
 }
@@ -46,6 +46,22 @@ espeak_ng_STATUS fifo_add_command(t_espeak_command *c);
 // In such a case, the calling function could wait and then add again these commands.
 espeak_ng_STATUS fifo_add_commands(t_espeak_command *c1, t_espeak_command *c2);
 
+// Add two espeak commands in a single transaction, to be run before the
+// commands of a lower priority.
+//
+// If preemption is not ENPREEMPT_NONE, a running text command of a lower
+// priority is stopped at the end of the current clause. It is then run again
+// from that point after the commands of a higher priority, or dropped.
+espeak_ng_STATUS fifo_add_priority_commands(t_espeak_command *c1, t_espeak_command *c2, espeak_ng_PRIORITY priority, espeak_ng_PREEMPTION preemption);
+
+// Called at the end of each clause of a text command, with the character
+// position of the next clause.
+// Returns 1 if the command should stop to be preempted; 0 otherwise.
+int fifo_preempt_at(unsigned int position);
+
+// Get the statistics of the commands of a priority.
+espeak_ng_STATUS fifo_get_stats(espeak_ng_PRIORITY priority, espeak_ng_QUEUE_STATS *stats);
+
 // The current running command must be stopped and the awaiting commands are cleared.
 espeak_ng_STATUS fifo_stop(void);
 
@@ -45,14 +45,7 @@
 #define SYL_EMPHASIS    2
 #define SYL_END_CLAUSE   4
 
-typedef struct {
-	char stress;
-	char env;
-	char flags; // bit 0=pitch rising, bit1=emnphasized, bit2=end of clause
-	char nextph_type;
-	unsigned char pitch1;
-	unsigned char pitch2;
-} SYLLABLE;
+SYLLABLE *syllable_tab = NULL; // one entry per vowel in the clause, allocated with the clause buffers
 
 static int tone_pitch_env; // used to return pitch envelope
 
@@ -947,7 +940,6 @@ void CalcPitches(Translator *tr, int clause_type)
 	PHONEME_TAB *ph;
 	int ph_end = n_phoneme_list;
 
-	SYLLABLE syllable_tab[N_PHONEME_LIST];
 	n_st = 0;
 	n_primary = 0;
 	for (ix = 0; ix < (n_phoneme_list-1); ix++) {
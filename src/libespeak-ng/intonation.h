@@ -28,6 +28,17 @@ extern "C"
 {
 #endif
 
+typedef struct {
+	char stress;
+	char env;
+	char flags; // bit 0=pitch rising, bit1=emnphasized, bit2=end of clause
+	char nextph_type;
+	unsigned char pitch1;
+	unsigned char pitch2;
+} SYLLABLE;
+
+extern SYLLABLE *syllable_tab;
+
 void CalcPitches(Translator *tr, int clause_type);
 
 #ifdef __cplusplus
@@ -25,6 +25,7 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -37,6 +38,7 @@
 #include "phoneme.h"
 #include "voice.h"
 #include "synthesize.h"
+#include "wavegen.h"
 #include "klatt.h"
 
 extern unsigned char *out_ptr;
@@ -46,11 +48,7 @@ extern WGEN_DATA wdata;
 static int nsamples;
 static int sample_count;
 
-#ifdef _MSC_VER
-#define getrandom(min, max) ((rand()%(int)(((max)+1)-(min)))+(min))
-#else
-#define getrandom(min, max) ((rand()%(long)(((max)+1)-(min)))+(min))
-#endif
+#define getrandom(min, max) ((long)(NoiseRandom(&kt_globals.noise_seed)%(uint32_t)(((max)+1)-(min)))+(min))
 
 // function prototypes for functions private to this file
 
@@ -64,6 +62,8 @@ static double DBtoLIN(long);
 static void frame_init(klatt_frame_ptr);
 static void setabc(long, long, resonator_ptr);
 static void setzeroabc(long, long, resonator_ptr);
+static void reuse_next_abc(long, long, int);
+static void setfloatabc(int);
 
 static klatt_frame_t kt_frame;
 static klatt_global_t kt_globals;
@@ -161,6 +161,98 @@ static double antiresonator2(resonator_ptr r, double input)
 	return (double)x;
 }
 
+/*
+   Single precision versions of the resonators, for ENKLATT_FLOAT.
+ */
+
+static float resonator_float(resonator_float_t *r, float input)
+{
+	float x;
+
+	x = r->a * input + r->b * r->p1 + r->c * r->p2;
+	r->p2 = r->p1;
+	r->p1 = x;
+
+	return x;
+}
+
+static float resonator2_float(resonator_float_t *r, float input)
+{
+	float x;
+
+	x = r->a * input + r->b * r->p1 + r->c * r->p2;
+	r->p2 = r->p1;
+	r->p1 = x;
+
+	r->a += r->a_inc;
+	r->b += r->b_inc;
+	r->c += r->c_inc;
+	return x;
+}
+
+static float antiresonator2_float(resonator_float_t *r, float input)
+{
+	float x;
+
+	x = r->a * input + r->b * r->p1 + r->c * r->p2;
+	r->p2 = r->p1;
+	r->p1 = input;
+
+	r->a += r->a_inc;
+	r->b += r->b_inc;
+	r->c += r->c_inc;
+	return x;
+}
+
+/*
+   function VOCAL_TRACT_FLOAT
+
+   The cascade and parallel vocal tract and output low-pass filter of
+   parwave(), in single precision. The parallel resonators have the sign of
+   their output folded into their 'a' coefficient, so that they are
+   independent of each other and their outputs are added together.
+ */
+
+static double vocal_tract_float(float glotout, float par_glotout, float sourc)
+{
+	resonator_float_t *rsn = kt_globals.rsn_float;
+	float casc_next_in;
+	float y[N_PARALLEL];
+	float out = 0;
+	int ix;
+
+	if (kt_globals.synthesis_model != ALL_PARALLEL) {
+		casc_next_in = antiresonator2_float(&rsn[Rnz], glotout);
+		casc_next_in = resonator_float(&rsn[Rnpc], casc_next_in);
+		casc_next_in = resonator_float(&rsn[R8c], casc_next_in);
+		casc_next_in = resonator_float(&rsn[R7c], casc_next_in);
+		casc_next_in = resonator_float(&rsn[R6c], casc_next_in);
+		casc_next_in = resonator2_float(&rsn[R5c], casc_next_in);
+		casc_next_in = resonator2_float(&rsn[R4c], casc_next_in);
+		casc_next_in = resonator2_float(&rsn[R3c], casc_next_in);
+		casc_next_in = resonator2_float(&rsn[R2c], casc_next_in);
+		out = resonator2_float(&rsn[R1c], casc_next_in);
+	}
+
+	// FNP and F1 are excited by the voicing, F2 to F6 by the frication and
+	// the first difference of the voicing. Each has an 'a' coefficient for
+	// both sources, one of which is zero, so that they can be calculated
+	// together.
+	for (ix = 0; ix < N_PARALLEL; ix++) {
+		y[ix] = kt_globals.par_a_voice[ix] * par_glotout + kt_globals.par_a_fric[ix] * sourc
+		      + kt_globals.par_b[ix] * kt_globals.par_p1[ix] + kt_globals.par_c[ix] * kt_globals.par_p2[ix];
+		kt_globals.par_p2[ix] = kt_globals.par_p1[ix];
+		kt_globals.par_p1[ix] = y[ix];
+	}
+
+	for (ix = 0; ix < N_PARALLEL; ix++)
+		out += y[ix];
+
+	out += (float)kt_globals.amp_bypas * sourc;
+
+	return resonator_float(&rsn[Rout], out);
+}
+
 /*
    function FLUTTER
 
@@ -236,6 +328,9 @@ static double sampled_source(int source_num)
 	return result;
 }
 
+// samples which parwave() writes to the output buffer together
+#define N_KLATT_BLOCK 64
+
 /*
    function PARWAVE
 
@@ -245,7 +340,8 @@ static double sampled_source(int source_num)
 static int parwave(klatt_frame_ptr frame)
 {
 	double temp;
-	int value;
+	int block[N_KLATT_BLOCK];
+	int n_block = 0;
 	double outbypas;
 	double out;
 	long n4;
@@ -260,6 +356,7 @@ static int parwave(klatt_frame_ptr frame)
 	static double glotlast;
 	static double sourc;
 	int ix;
+	int use_float = (kt_globals.precision == ENKLATT_FLOAT);
 
 	flutter(frame); // add f0 flutter
 
@@ -337,45 +434,50 @@ static int parwave(klatt_frame_ptr frame)
 
 		par_glotout += aspiration;
 
-		// Cascade vocal tract, excited by laryngeal sources.
-		// Nasal antiresonator, then formants FNP, F5, F4, F3, F2, F1
-
-		out = 0;
-		if (kt_globals.synthesis_model != ALL_PARALLEL) {
-			casc_next_in = antiresonator2(&(kt_globals.rsn[Rnz]), glotout);
-			casc_next_in = resonator(&(kt_globals.rsn[Rnpc]), casc_next_in);
-			casc_next_in = resonator(&(kt_globals.rsn[R8c]), casc_next_in);
-			casc_next_in = resonator(&(kt_globals.rsn[R7c]), casc_next_in);
-			casc_next_in = resonator(&(kt_globals.rsn[R6c]), casc_next_in);
-			casc_next_in = resonator2(&(kt_globals.rsn[R5c]), casc_next_in);
-			casc_next_in = resonator2(&(kt_globals.rsn[R4c]), casc_next_in);
-			casc_next_in = resonator2(&(kt_globals.rsn[R3c]), casc_next_in);
-			casc_next_in = resonator2(&(kt_globals.rsn[R2c]), casc_next_in);
-			out = resonator2(&(kt_globals.rsn[R1c]), casc_next_in);
-		}
+		if (use_float) {
+			out = vocal_tract_float(glotout, par_glotout, frics + par_glotout - glotlast);
+			glotlast = par_glotout;
+		} else {
+			// Cascade vocal tract, excited by laryngeal sources.
+			// Nasal antiresonator, then formants FNP, F5, F4, F3, F2, F1
+
+			out = 0;
+			if (kt_globals.synthesis_model != ALL_PARALLEL) {
+				casc_next_in = antiresonator2(&(kt_globals.rsn[Rnz]), glotout);
+				casc_next_in = resonator(&(kt_globals.rsn[Rnpc]), casc_next_in);
+				casc_next_in = resonator(&(kt_globals.rsn[R8c]), casc_next_in);
+				casc_next_in = resonator(&(kt_globals.rsn[R7c]), casc_next_in);
+				casc_next_in = resonator(&(kt_globals.rsn[R6c]), casc_next_in);
+				casc_next_in = resonator2(&(kt_globals.rsn[R5c]), casc_next_in);
+				casc_next_in = resonator2(&(kt_globals.rsn[R4c]), casc_next_in);
+				casc_next_in = resonator2(&(kt_globals.rsn[R3c]), casc_next_in);
+				casc_next_in = resonator2(&(kt_globals.rsn[R2c]), casc_next_in);
+				out = resonator2(&(kt_globals.rsn[R1c]), casc_next_in);
+			}
 
-		// Excite parallel F1 and FNP by voicing waveform
-		sourc = par_glotout; // Source is voicing plus aspiration
+			// Excite parallel F1 and FNP by voicing waveform
+			sourc = par_glotout; // Source is voicing plus aspiration
 
-		// Standard parallel vocal tract Formants F6,F5,F4,F3,F2,
-		// outputs added with alternating sign. Sound source for other
-		// parallel resonators is frication plus first difference of
-		// voicing waveform.
+			// Standard parallel vocal tract Formants F6,F5,F4,F3,F2,
+			// outputs added with alternating sign. Sound source for other
+			// parallel resonators is frication plus first difference of
+			// voicing waveform.
 
-		out += resonator(&(kt_globals.rsn[R1p]), sourc);
-		out += resonator(&(kt_globals.rsn[Rnpp]), sourc);
+			out += resonator(&(kt_globals.rsn[R1p]), sourc);
+			out += resonator(&(kt_globals.rsn[Rnpp]), sourc);
 
-		sourc = frics + par_glotout - glotlast;
-		glotlast = par_glotout;
+			sourc = frics + par_glotout - glotlast;
+			glotlast = par_glotout;
 
-		for (ix = R2p; ix <= R6p; ix++)
-			out = resonator(&(kt_globals.rsn[ix]), sourc) - out;
+			for (ix = R2p; ix <= R6p; ix++)
+				out = resonator(&(kt_globals.rsn[ix]), sourc) - out;
 
-		outbypas = kt_globals.amp_bypas * sourc;
+			outbypas = kt_globals.amp_bypas * sourc;
 
-		out = outbypas - out;
+			out = outbypas - out;
 
-		out = resonator(&(kt_globals.rsn[Rout]), out);
+			out = resonator(&(kt_globals.rsn[Rout]), out);
+		}
 		temp = (int)(out * wdata.amplitude * kt_globals.amp_gain0); // Convert back to integer
 
 		// mix with a recorded WAV if required for this phoneme
@@ -385,16 +487,19 @@ static int parwave(klatt_frame_ptr frame)
 		if (wdata.mix_wavefile_ix < wdata.n_mix_wavefile) {
 			if (wdata.mix_wave_scale == 0) {
 				// a 16 bit sample
-				c = wdata.mix_wavefile[wdata.mix_wavefile_ix+1];
-				sample = wdata.mix_wavefile[wdata.mix_wavefile_ix] + (c * 256);
+				c = wdata.mix_wavefile[wdata.mix_wavefile_ix+wdata.mix_wavefile_offset+1];
+				sample = wdata.mix_wavefile[wdata.mix_wavefile_ix+wdata.mix_wavefile_offset] + (c * 256);
 				wdata.mix_wavefile_ix += 2;
 			} else {
 				// a 8 bit sample, scaled
-				sample = (signed char)wdata.mix_wavefile[wdata.mix_wavefile_ix++] * wdata.mix_wave_scale;
+				sample = (signed char)wdata.mix_wavefile[wdata.mix_wavefile_offset+wdata.mix_wavefile_ix++] * wdata.mix_wave_scale;
 			}
 			int z2 = sample * wdata.amplitude_v / 1024;
 			z2 = (z2 * wdata.mix_wave_amp)/40;
 			temp += z2;
+
+			if ((wdata.mix_wavefile_ix + wdata.mix_wavefile_offset) >= wdata.mix_wavefile_max)  // reached the end of available WAV data
+				wdata.mix_wavefile_offset -= (wdata.mix_wavefile_max*3)/4;
 		}
 
 		// if fadeout is set, fade to zero over 64 samples, to avoid clicks at end of synthesis
@@ -403,26 +508,16 @@ static int parwave(klatt_frame_ptr frame)
 			temp = (temp * kt_globals.fadeout) / 64;
 		}
 
-		value = (int)temp + ((echo_buf[echo_tail++]*echo_amp) >> 8);
-		if (echo_tail >= N_ECHO_BUF)
-			echo_tail = 0;
-
-		if (value < -32768)
-			value = -32768;
-
-		if (value > 32767)
-			value =  32767;
-
-		*out_ptr++ = value;
-		*out_ptr++ = value >> 8;
-
-		echo_buf[echo_head++] = value;
-		if (echo_head >= N_ECHO_BUF)
-			echo_head = 0;
-
+		block[n_block++] = (int)temp;
 		sample_count++;
-		if (out_ptr + 2 > out_end)
-			return 1;
+
+		// the echo is added to the block, and it is clipped, as it is written out
+		if ((n_block == N_KLATT_BLOCK) || (out_ptr + n_block*2 + 2 > out_end) || (kt_globals.ns + 1 == kt_globals.nspfr)) {
+			WavegenOutput(block, n_block, 4);
+			n_block = 0;
+			if (out_ptr + 2 > out_end)
+				return 1;
+		}
 	}
 	return 0;
 }
@@ -437,6 +532,11 @@ void KlattReset(int control)
 		kt_globals.BLPhz = (630 * kt_globals.samrate) / 10000;
 		kt_globals.minus_pi_t = -M_PI / kt_globals.samrate;
 		kt_globals.two_pi_t = -2.0 * kt_globals.minus_pi_t;
+		// the coefficients depend on the sample rate, so calculate them again
+		for (r_ix = 0; r_ix < N_RSN; r_ix++) {
+			kt_globals.rsn[r_ix].bw = -1;
+			kt_globals.rsn_next[r_ix].bw = -1;
+		}
 		setabc(kt_globals.FLPhz, kt_globals.BLPhz, &(kt_globals.rsn[RLP]));
 	}
 
@@ -449,15 +549,31 @@ void KlattReset(int control)
 		for (r_ix = RGL; r_ix < N_RSN; r_ix++) {
 			kt_globals.rsn[r_ix].p1 = 0;
 			kt_globals.rsn[r_ix].p2 = 0;
+			kt_globals.rsn_float[r_ix].p1 = 0;
+			kt_globals.rsn_float[r_ix].p2 = 0;
 		}
 	}
 
 	for (r_ix = 0; r_ix <= R6p; r_ix++) {
 		kt_globals.rsn[r_ix].p1 = 0;
 		kt_globals.rsn[r_ix].p2 = 0;
+		kt_globals.rsn_float[r_ix].p1 = 0;
+		kt_globals.rsn_float[r_ix].p2 = 0;
+	}
+	for (r_ix = 0; r_ix < N_PARALLEL; r_ix++) {
+		kt_globals.par_p1[r_ix] = 0;
+		kt_globals.par_p2[r_ix] = 0;
 	}
 }
 
+espeak_ng_STATUS KlattSetPrecision(espeak_ng_KLATT_PRECISION precision)
+{
+	if ((precision != ENKLATT_DOUBLE) && (precision != ENKLATT_FLOAT))
+		return EINVAL;
+	kt_globals.precision = precision;
+	return ENS_OK;
+}
+
 /*
    function FRAME_INIT
 
@@ -468,6 +584,7 @@ static void frame_init(klatt_frame_ptr frame)
 {
 	double amp_par[7];
 	static double amp_par_factor[7] = { 0.6, 0.4, 0.15, 0.06, 0.04, 0.022, 0.03 };
+	static float par_sign[7] = { 1, 1, -1, 1, -1, 1, -1 }; // see parwave()
 	long Gain0_tmp;
 	int ix;
 
@@ -495,6 +612,8 @@ static void frame_init(klatt_frame_ptr frame)
 	// Set coefficients of variable cascade resonators
 	for (ix = 1; ix <= 9; ix++) {
 		// formants 1 to 8, plus nasal pole
+		if (ix <= 5)
+			reuse_next_abc(frame->Fhz[ix], frame->Bhz[ix], ix);
 		setabc(frame->Fhz[ix], frame->Bhz[ix], &(kt_globals.rsn[ix]));
 
 		if (ix <= 5) {
@@ -507,6 +626,7 @@ static void frame_init(klatt_frame_ptr frame)
 	}
 
 	// nasal zero anti-resonator
+	reuse_next_abc(frame->Fhz[F_NZ], frame->Bhz[F_NZ], Rnz);
 	setzeroabc(frame->Fhz[F_NZ], frame->Bhz[F_NZ], &(kt_globals.rsn[Rnz]));
 	setzeroabc(frame->Fhz_next[F_NZ], frame->Bhz_next[F_NZ], &(kt_globals.rsn_next[Rnz]));
 	kt_globals.rsn[F_NZ].a_inc = (kt_globals.rsn_next[F_NZ].a - kt_globals.rsn[F_NZ].a) / 64.0;
@@ -518,11 +638,29 @@ static void frame_init(klatt_frame_ptr frame)
 	for (ix = 0; ix <= 6; ix++) {
 		setabc(frame->Fhz[ix], frame->Bphz[ix], &(kt_globals.rsn[Rparallel+ix]));
 		kt_globals.rsn[Rparallel+ix].a *= amp_par[ix];
+
+		if (ix < R2p-Rparallel) {
+			kt_globals.par_a_voice[ix] = kt_globals.rsn[Rparallel+ix].a * par_sign[ix];
+			kt_globals.par_a_fric[ix] = 0;
+		} else {
+			kt_globals.par_a_voice[ix] = 0;
+			kt_globals.par_a_fric[ix] = kt_globals.rsn[Rparallel+ix].a * par_sign[ix];
+		}
+		kt_globals.par_b[ix] = kt_globals.rsn[Rparallel+ix].b;
+		kt_globals.par_c[ix] = kt_globals.rsn[Rparallel+ix].c;
+		if (fabsf(kt_globals.par_p1[ix]) < 1e-20f)
+			kt_globals.par_p1[ix] = 0;
+		if (fabsf(kt_globals.par_p2[ix]) < 1e-20f)
+			kt_globals.par_p2[ix] = 0;
 	}
 
 	// output low-pass filter
 
 	setabc((long)0.0, (long)(kt_globals.samrate/2), &(kt_globals.rsn[Rout]));
+
+	for (ix = Rnz; ix <= Rnpc; ix++)
+		setfloatabc(ix);
+	setfloatabc(Rout);
 }
 
 /*
@@ -721,19 +859,30 @@ static void setabc(long int f, long int bw, resonator_ptr rp)
 	double r;
 	double arg;
 
-	// Let r  =  exp(-pi bw t)
-	arg = kt_globals.minus_pi_t * bw;
-	r = exp(arg);
+	// Many of the resonators keep the same frequency and bandwidth from frame
+	// to frame, so only calculate the coefficients when these change.
+	if ((f != rp->f) || (bw != rp->bw)) {
+		// Let r  =  exp(-pi bw t)
+		arg = kt_globals.minus_pi_t * bw;
+		r = exp(arg);
 
-	// Let c  =  -r**2
-	rp->c = -(r * r);
+		// Let c  =  -r**2
+		rp->c0 = -(r * r);
 
-	// Let b = r * 2*cos(2 pi f t)
-	arg = kt_globals.two_pi_t * f;
-	rp->b = r * cos(arg) * 2.0;
+		// Let b = r * 2*cos(2 pi f t)
+		arg = kt_globals.two_pi_t * f;
+		rp->b0 = r * cos(arg) * 2.0;
 
-	// Let a = 1.0 - b - c
-	rp->a = 1.0 - rp->b - rp->c;
+		// Let a = 1.0 - b - c
+		rp->a0 = 1.0 - rp->b0 - rp->c0;
+
+		rp->f = f;
+		rp->bw = bw;
+	}
+
+	rp->a = rp->a0;
+	rp->b = rp->b0;
+	rp->c = rp->c0;
 }
 
 /*
@@ -748,6 +897,15 @@ static void setzeroabc(long int f, long int bw, resonator_ptr rp)
 	double r;
 	double arg;
 
+	if ((f == rp->f) && (bw == rp->bw)) {
+		rp->a = rp->a0;
+		rp->b = rp->b0;
+		rp->c = rp->c0;
+		return;
+	}
+	rp->f = f;
+	rp->bw = bw;
+
 	f = -f;
 
 	// First compute ordinary resonator coefficients
@@ -776,6 +934,58 @@ static void setzeroabc(long int f, long int bw, resonator_ptr rp)
 		rp->c *= -rp->a;
 		rp->b *= -rp->a;
 	}
+
+	rp->a0 = rp->a;
+	rp->b0 = rp->b;
+	rp->c0 = rp->c;
+}
+
+/*
+   function REUSE_NEXT_ABC
+
+   The frequency and bandwidth of a formant at the start of a frame are
+   usually those at the end of the previous frame, so take the coefficients
+   which were calculated for rsn_next, if they match.
+ */
+
+static void reuse_next_abc(long int f, long int bw, int ix)
+{
+	resonator_ptr rp = &(kt_globals.rsn[ix]);
+	resonator_ptr next = &(kt_globals.rsn_next[ix]);
+
+	if (((f != rp->f) || (bw != rp->bw)) && (f == next->f) && (bw == next->bw)) {
+		rp->f = f;
+		rp->bw = bw;
+		rp->a0 = next->a0;
+		rp->b0 = next->b0;
+		rp->c0 = next->c0;
+	}
+}
+
+/*
+   function SETFLOATABC
+
+   Copy the coefficients of a resonator to its single precision version.
+ */
+
+static void setfloatabc(int ix)
+{
+	resonator_ptr rp = &(kt_globals.rsn[ix]);
+	resonator_float_t *rf = &(kt_globals.rsn_float[ix]);
+
+	rf->a = rp->a;
+	rf->b = rp->b;
+	rf->c = rp->c;
+	rf->a_inc = rp->a_inc;
+	rf->b_inc = rp->b_inc;
+	rf->c_inc = rp->c_inc;
+
+	// Calculations with denormal numbers are slow on some processors, and the
+	// resonators reach them much sooner in single precision as they decay.
+	if (fabsf(rf->p1) < 1e-20f)
+		rf->p1 = 0;
+	if (fabsf(rf->p2) < 1e-20f)
+		rf->p2 = 0;
 }
 
 /*
@@ -938,8 +1148,6 @@ static void SetSynth_Klatt(int length, frame_t *fr1, frame_t *fr2, voice_t *v, i
 {
 	int ix;
 	double next;
-	int qix;
-	int cmd;
 	frame_t *fr3;
 	static frame_t prev_fr;
 
@@ -956,26 +1164,16 @@ static void SetSynth_Klatt(int length, frame_t *fr1, frame_t *fr2, voice_t *v, i
 		end_wave = 1; // fadeout at the end
 	if (control & 1) {
 		end_wave = 1;
-		for (qix = wcmdq_head+1;; qix++) {
-			if (qix >= N_WCMDQ) qix = 0;
-			if (qix == wcmdq_tail) break;
-
-			cmd = wcmdq[qix][0];
-			if (cmd == WCMD_KLATT) {
-				end_wave = 0; // next wave generation is from another spectrum
-
-				fr3 = (frame_t *)wcmdq[qix][2];
-				for (ix = 1; ix < 6; ix++) {
-					if (fr3->ffreq[ix] != fr2->ffreq[ix]) {
-						// there is a discontinuity in formants
-						end_wave = 2;
-						break;
-					}
+		if ((fr3 = WcmdqNextFrame(WCMD_KLATT)) != NULL) {
+			end_wave = 0; // next wave generation is from another spectrum
+
+			for (ix = 1; ix < 6; ix++) {
+				if (fr3->ffreq[ix] != fr2->ffreq[ix]) {
+					// there is a discontinuity in formants
+					end_wave = 2;
+					break;
 				}
-				break;
 			}
-			if ((cmd == WCMD_WAVE) || (cmd == WCMD_PAUSE))
-				break; // next is not from spectrum, so continue until end of wave cycle
 		}
 	}
 
@@ -1071,7 +1269,7 @@ void KlattInit()
 	sample_count = 0;
 
 	kt_globals.synthesis_model = CASCADE_PARALLEL;
-	kt_globals.samrate = 22050;
+	kt_globals.samrate = samplerate_native;
 
 	kt_globals.glsource = IMPULSIVE;
 	kt_globals.scale_wav = scale_wav_tab[kt_globals.glsource];
@@ -1081,6 +1279,7 @@ void KlattInit()
 	kt_globals.nspfr = (kt_globals.samrate * 10) / 1000;
 	kt_globals.outsl = 0;
 	kt_globals.f0_flutter = 20;
+	kt_globals.noise_seed = NOISE_SEED;
 
 	KlattReset(2);
 
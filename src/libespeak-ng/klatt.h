@@ -55,8 +55,24 @@ typedef struct {
 	double a_inc;
 	double b_inc;
 	double c_inc;
+	long f;     // the frequency and bandwidth for which a0, b0 and c0 were calculated
+	long bw;
+	double a0;
+	double b0;
+	double c0;
 } resonator_t, *resonator_ptr;
 
+typedef struct {
+	float a;
+	float b;
+	float c;
+	float p1;
+	float p2;
+	float a_inc;
+	float b_inc;
+	float c_inc;
+} resonator_float_t;
+
 /* Structure for Klatt Globals */
 
 typedef struct {
@@ -74,6 +90,7 @@ typedef struct {
 	long nopen;     /* Number of samples in open phase of period    */
 	long nmod;      /* Position in period to begin noise amp. modul */
 	long nrand;     /* Varible used by random number generator      */
+	uint32_t noise_seed; /* State of the random number generator    */
 	double pulse_shape_a; /* Makes waveshape of glottal pulse when open   */
 	double pulse_shape_b; /* Makes waveshape of glottal pulse when open   */
 	double minus_pi_t;
@@ -123,6 +140,19 @@ typedef struct {
 	resonator_t rsn[N_RSN];  // internal storage for resonators
 	resonator_t rsn_next[N_RSN];
 
+	// Single precision copies of the vocal tract resonators, used by
+	// ENKLATT_FLOAT. The parallel resonators Rnpp to R6p are held as arrays
+	// so that they can be calculated together.
+#define N_PARALLEL 8 // Rnpp to R6p, and one unused
+	int precision;
+	resonator_float_t rsn_float[N_RSN]; // Rnz to Rnpc, and Rout
+	float par_a_voice[N_PARALLEL];
+	float par_a_fric[N_PARALLEL];
+	float par_b[N_PARALLEL];
+	float par_c[N_PARALLEL];
+	float par_p1[N_PARALLEL];
+	float par_p2[N_PARALLEL];
+
 } klatt_global_t, *klatt_global_ptr;
 
 /* Structure for Klatt Parameters */
@@ -179,6 +209,7 @@ typedef struct {
 
 void KlattInit(void);
 void KlattReset(int control);
+espeak_ng_STATUS KlattSetPrecision(espeak_ng_KLATT_PRECISION precision);
 int Wavegen_Klatt2(int length, int resume, frame_t *fr1, frame_t *fr2);
 
 
@@ -37,6 +37,8 @@
 #include "synthesize.h"
 #include "translate.h"
 
+PHONEME_LIST *ph_list3 = NULL; // working copy of the clause, allocated with the clause buffers
+
 const unsigned char pause_phonemes[8] = {
 	0, phonPAUSE_VSHORT, phonPAUSE_SHORT, phonPAUSE, phonPAUSE_LONG, phonGLOTTALSTOP, phonPAUSE_LONG, phonPAUSE_LONG
 };
@@ -54,7 +56,7 @@ static int SubstitutePhonemes(PHONEME_LIST *plist_out, int n_ph_list2, PHONEME_L
 	PHONEME_TAB *next = NULL;
 	int deleted_sourceix = -1;
 
-	for (ix = 0; (ix < n_ph_list2) && (n_plist_out < N_PHONEME_LIST); ix++) {
+	for (ix = 0; (ix < n_ph_list2) && (n_plist_out < n_phoneme_list_max); ix++) {
 		plist2 = &ph_list2[ix];
 		if (deleted_sourceix != -1) {
 			plist2->sourceix = deleted_sourceix;
@@ -133,7 +135,6 @@ void MakePhonemeList(Translator *tr, int post_pause, bool start_sentence, int *n
 	int n_ph_list3;
 	PHONEME_LIST *plist3;
 	PHONEME_LIST *plist3_inserted = NULL;
-	PHONEME_LIST ph_list3[N_PHONEME_LIST];
 
 	PHONEME_LIST2 *plist2;
 	WORD_PH_DATA worddata;
@@ -270,7 +271,7 @@ void MakePhonemeList(Translator *tr, int post_pause, bool start_sentence, int *n
 
 	n_ph_list3 = SubstitutePhonemes(ph_list3, (int) *n_ph_list2, ph_list2) - 2;
 
-	for (j = 0; (j < n_ph_list3) && (ix < N_PHONEME_LIST-3);) {
+	for (j = 0; (j < n_ph_list3) && (ix < n_phoneme_list_max-3);) {
 		if (ph_list3[j].sourceix) {
 			// start of a word
 			int k;
@@ -298,7 +299,7 @@ void MakePhonemeList(Translator *tr, int post_pause, bool start_sentence, int *n
 	ph_list3[0].ph = ph;
 	word_start = 1;
 
-	for (j = 0; insert_ph || ((j < n_ph_list3) && (ix < N_PHONEME_LIST-3)); j++) {
+	for (j = 0; insert_ph || ((j < n_ph_list3) && (ix < n_phoneme_list_max-3)); j++) {
 		plist3 = &ph_list3[j];
 
 		inserted = false;
@@ -33,6 +33,8 @@ extern "C"
 }
 #endif
 
+extern PHONEME_LIST *ph_list3;
+
 void MakePhonemeList(Translator *tr,
 	int post_pause,
 	bool start_sentence,
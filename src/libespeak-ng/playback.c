@@ -0,0 +1,696 @@
+/*
+ * Copyright (C) 2026 eSpeak NG contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see: <http://www.gnu.org/licenses/>.
+ */
+
+// This source file is only used for asynchronious modes
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_PCAUDIOLIB_AUDIO_H
+#include <pcaudiolib/audio.h>
+#endif
+
+#include <espeak-ng/espeak_ng.h>
+#include <espeak-ng/speak_lib.h>
+
+#include "playback.h"
+#include "event.h"
+
+enum {
+	MAX_SAMPLERATE = 48000, // for the size of the ring
+	PERIOD_MS = 20,         // the most audio written to the device at once
+	SINK_LATENCY_MS = 40,   // the audio held by the null and file sinks, like the buffer of a sound card
+	N_MARKS = 1024
+};
+
+typedef enum {
+	SINK_NONE, // there is no audio output, so the samples are discarded
+	SINK_NULL,
+	SINK_FILE,
+	SINK_PCAUDIO
+} sink_type;
+
+typedef enum {
+	MARK_BUFFER, // the end of a buffer of samples, with its events
+	MARK_SAMPLERATE,
+	MARK_END     // the end of an utterance
+} mark_type;
+
+typedef struct {
+	size_t position;      // the number of samples written before the mark
+	mark_type type;
+	int length;           // MARK_BUFFER: the number of samples in the buffer
+	int samplerate;       // MARK_SAMPLERATE
+	double queued_ms;     // when the buffer was written
+	espeak_EVENT *events; // copies, terminated by espeakEVENT_LIST_TERMINATED, or NULL
+} playback_mark;
+
+// The samples and marks are passed from the synthesis thread to the playback
+// thread in rings with a single producer and a single consumer. Each index is
+// only changed by one of the threads, so the rings are not locked. my_mutex is
+// held to wait for samples or space, and for the statistics.
+static short *ring = NULL;
+static size_t ring_size = 0; // a power of 2
+static size_t samples_written = 0;
+static size_t samples_read = 0;
+static playback_mark marks[N_MARKS];
+static unsigned int marks_written = 0;
+static unsigned int marks_read = 0;
+
+#define load_index(index) __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define store_index(index, value) __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+
+// The ring is sized from high_water_ms, so playback_set_buffer() keeps the new
+// values until the next playback_init(), when the playback thread is stopped.
+static unsigned int prefill_ms = 60;
+static unsigned int low_water_ms = 250;
+static unsigned int high_water_ms = 500;
+static unsigned int new_prefill_ms = 60;
+static unsigned int new_low_water_ms = 250;
+static unsigned int new_high_water_ms = 500;
+
+// used by the synthesis thread
+static int write_samplerate = 0;
+static size_t end_position = 0; // samples_written at the last MARK_END
+
+// used by the playback thread
+static int play_samplerate = 0;
+
+static pthread_mutex_t my_mutex;
+static pthread_cond_t my_cond_data;  // samples, marks or a request have been added
+static pthread_cond_t my_cond_space; // samples have been played, or a request has been done
+static pthread_t my_thread;
+static bool thread_inited = false;
+static bool my_terminate_is_required = false;
+static unsigned int my_flush_count = 0;   // the flushes which have been requested
+static unsigned int my_flushed_count = 0; // the flushes done by the playback thread
+static bool my_playback_is_idle = true;   // there is nothing to play, and the device has been drained
+static espeak_ng_STATUS my_error = ENS_OK;
+static espeak_ng_PLAYBACK_STATS my_stats;
+
+static sink_type sink = SINK_NONE;
+static FILE *sink_file = NULL;
+static int sink_samplerate = 0; // 0 if the device is not open
+static double sink_end_ms = 0;  // when the null and file sinks will have played their samples
+#ifdef HAVE_PCAUDIOLIB_AUDIO_H
+static struct audio_object *sink_audio = NULL;
+#endif
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime2(&ts);
+	return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+static size_t ms_to_samples(unsigned int ms, int samplerate)
+{
+	size_t length = ((size_t)ms * samplerate) / 1000;
+	return (length > ring_size) ? ring_size : length;
+}
+
+static espeak_ng_STATUS sink_open(int samplerate)
+{
+#ifdef HAVE_PCAUDIOLIB_AUDIO_H
+	if (sink == SINK_PCAUDIO) {
+		int error = audio_object_open(sink_audio, AUDIO_OBJECT_FORMAT_S16LE, samplerate, 1);
+		if (error != 0) {
+			fprintf(stderr, "error: %s\n", audio_object_strerror(sink_audio, error));
+			return ENS_AUDIO_ERROR;
+		}
+	}
+#endif
+	sink_samplerate = samplerate;
+	sink_end_ms = now_ms();
+	return ENS_OK;
+}
+
+static void sink_close(void)
+{
+#ifdef HAVE_PCAUDIOLIB_AUDIO_H
+	if ((sink == SINK_PCAUDIO) && (sink_samplerate != 0))
+		audio_object_close(sink_audio);
+#endif
+	sink_samplerate = 0;
+}
+
+// Wait until the null and file sinks have remaining_ms of audio left to play.
+static void sink_wait(double remaining_ms)
+{
+	double delay_ms = sink_end_ms - remaining_ms - now_ms();
+	if (delay_ms > 0)
+		usleep((useconds_t)(delay_ms * 1000));
+}
+
+static void sink_write(const short *samples, size_t length)
+{
+	switch (sink)
+	{
+#ifdef HAVE_PCAUDIOLIB_AUDIO_H
+	case SINK_PCAUDIO:
+	{
+		int error = audio_object_write(sink_audio, (const char *)samples, 2*length);
+		if (error != 0)
+			fprintf(stderr, "error: %s\n", audio_object_strerror(sink_audio, error));
+		break;
+	}
+#endif
+	case SINK_FILE:
+	case SINK_NULL:
+	{
+		if (sink == SINK_FILE)
+			fwrite(samples, sizeof(short), length, sink_file);
+
+		double now = now_ms();
+		if (sink_end_ms < now)
+			sink_end_ms = now;
+		sink_end_ms += (length * 1000.0) / sink_samplerate;
+		sink_wait(SINK_LATENCY_MS);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+static void sink_drain(void)
+{
+#ifdef HAVE_PCAUDIOLIB_AUDIO_H
+	if ((sink == SINK_PCAUDIO) && (sink_samplerate != 0)) {
+		int error = audio_object_drain(sink_audio);
+		if (error != 0)
+			fprintf(stderr, "error: %s\n", audio_object_strerror(sink_audio, error));
+	}
+#endif
+	if (sink == SINK_FILE)
+		fflush(sink_file);
+	sink_wait(0);
+}
+
+static void sink_flush(void)
+{
+#ifdef HAVE_PCAUDIOLIB_AUDIO_H
+	if ((sink == SINK_PCAUDIO) && (sink_samplerate != 0))
+		audio_object_flush(sink_audio);
+#endif
+	sink_end_ms = now_ms();
+}
+
+static espeak_EVENT *copy_events(const espeak_EVENT *events)
+{
+	int n_events = 0;
+	while (events[n_events].type != espeakEVENT_LIST_TERMINATED)
+		n_events++;
+
+	espeak_EVENT *copy = (espeak_EVENT *)malloc(sizeof(espeak_EVENT) * (n_events + 1));
+	if (copy == NULL)
+		return NULL;
+
+	memcpy(copy, events, sizeof(espeak_EVENT) * (n_events + 1));
+	for (int i = 0; i < n_events; i++) {
+		// the names are in namedata, which is reused by the following clauses
+		if (((copy[i].type == espeakEVENT_MARK) || (copy[i].type == espeakEVENT_PLAY)) && copy[i].id.name)
+			copy[i].id.name = strdup(copy[i].id.name);
+	}
+	return copy;
+}
+
+static void free_events(espeak_EVENT *events)
+{
+	if (events == NULL)
+		return;
+
+	for (espeak_EVENT *event = events; event->type != espeakEVENT_LIST_TERMINATED; event++) {
+		if ((event->type == espeakEVENT_MARK) || (event->type == espeakEVENT_PLAY))
+			free((void *)event->id.name);
+	}
+	free(events);
+}
+
+static bool flush_is_required(void)
+{
+	return load_index(my_flush_count) != my_flushed_count || load_index(my_terminate_is_required);
+}
+
+static void declare_events(const espeak_EVENT *events)
+{
+	for (const espeak_EVENT *event = events; event->type != espeakEVENT_LIST_TERMINATED; event++) {
+		// Words with a size of 0, such as the last of the words "or", "ALT"
+		// and "" of "or ALT).", are not given to the callback.
+		if ((event->type == espeakEVENT_WORD) && (event->length == 0))
+			continue;
+
+		while ((event_declare((espeak_EVENT *)event) == ENS_EVENT_BUFFER_FULL) && !flush_is_required())
+			usleep(10000);
+	}
+}
+
+static espeak_ng_STATUS push_mark(mark_type type, int length, int samplerate, espeak_EVENT *events)
+{
+	if (marks_written - load_index(marks_read) >= N_MARKS) {
+		pthread_mutex_lock(&my_mutex);
+		while ((marks_written - marks_read >= N_MARKS) && !my_terminate_is_required)
+			pthread_cond_wait(&my_cond_space, &my_mutex);
+		pthread_mutex_unlock(&my_mutex);
+	}
+
+	playback_mark *mark = &marks[marks_written % N_MARKS];
+	mark->position = samples_written;
+	mark->type = type;
+	mark->length = length;
+	mark->samplerate = samplerate;
+	mark->queued_ms = now_ms();
+	mark->events = events;
+	store_index(marks_written, marks_written + 1);
+
+	pthread_mutex_lock(&my_mutex);
+	pthread_cond_signal(&my_cond_data);
+	pthread_mutex_unlock(&my_mutex);
+	return ENS_OK;
+}
+
+// Is there a mark after which no more samples will be added before it is played?
+static bool end_is_pending(void)
+{
+	unsigned int end = load_index(marks_written);
+	for (unsigned int ix = marks_read; ix != end; ix++) {
+		if (marks[ix % N_MARKS].type != MARK_BUFFER)
+			return true;
+	}
+	return false;
+}
+
+static bool mark_is_reached(const playback_mark *mark)
+{
+	// samples_read can be past the mark when the samples have been discarded
+	return (ptrdiff_t)(mark->position - samples_read) <= 0;
+}
+
+static bool play_mark(playback_mark *mark, bool playing, size_t available)
+{
+	switch (mark->type)
+	{
+	case MARK_BUFFER:
+		if (mark->events) {
+			declare_events(mark->events);
+			free_events(mark->events);
+			mark->events = NULL;
+		}
+		break;
+	case MARK_SAMPLERATE:
+		if (mark->samplerate != play_samplerate) {
+			// the samples at the previous rate are played before the device is opened again
+			if (sink_samplerate != 0) {
+				sink_drain();
+				sink_close();
+			}
+			play_samplerate = mark->samplerate;
+		}
+		break;
+	case MARK_END:
+		if (available == 0)
+			sink_drain();
+		playing = false;
+		break;
+	}
+	return playing;
+}
+
+// Discard the samples and marks which have been written.
+static void discard(void)
+{
+	unsigned int end = load_index(marks_written);
+	while (marks_read != end) {
+		playback_mark *mark = &marks[marks_read % N_MARKS];
+		free_events(mark->events);
+		mark->events = NULL;
+		if ((mark->type == MARK_SAMPLERATE) && (mark->samplerate != play_samplerate)) {
+			if (sink_samplerate != 0)
+				sink_close();
+			play_samplerate = mark->samplerate;
+		}
+		store_index(marks_read, marks_read + 1);
+	}
+	store_index(samples_read, load_index(samples_written));
+	sink_flush();
+}
+
+static void *playback_thread(void *p)
+{
+	(void)p; // unused
+
+	bool playing = false;
+
+	pthread_mutex_lock(&my_mutex);
+	while (!my_terminate_is_required) {
+		if (my_flushed_count != my_flush_count) {
+			unsigned int flush_count = my_flush_count;
+			pthread_mutex_unlock(&my_mutex);
+			discard();
+			pthread_mutex_lock(&my_mutex);
+
+			my_flushed_count = flush_count;
+			playing = false;
+			pthread_cond_broadcast(&my_cond_space);
+			continue;
+		}
+
+		size_t available = load_index(samples_written) - samples_read;
+		playback_mark *mark = NULL;
+		if (marks_read != load_index(marks_written))
+			mark = &marks[marks_read % N_MARKS];
+
+		if (mark && mark_is_reached(mark)) {
+			my_playback_is_idle = false;
+			if ((mark->type == MARK_BUFFER) && (mark->length > 0)) {
+				double latency_ms = now_ms() - mark->queued_ms;
+				my_stats.buffers++;
+				my_stats.total_latency_ms += latency_ms;
+				if (latency_ms > my_stats.max_latency_ms)
+					my_stats.max_latency_ms = latency_ms;
+			}
+			pthread_mutex_unlock(&my_mutex);
+			playing = play_mark(mark, playing, available);
+			pthread_mutex_lock(&my_mutex);
+
+			store_index(marks_read, marks_read + 1);
+			pthread_cond_broadcast(&my_cond_space);
+			continue;
+		}
+
+		if (!playing) {
+			// start when the prefill has been buffered, or the utterance has ended
+			playing = (available > 0) && ((available >= ms_to_samples(prefill_ms, play_samplerate)) || end_is_pending());
+		} else if (available == 0) {
+			// the synthesis has not kept up with the playback
+			my_stats.underruns++;
+			playing = false;
+		}
+
+		if (!playing) {
+			if ((available == 0) && (mark == NULL) && !my_playback_is_idle) {
+				my_playback_is_idle = true;
+				pthread_cond_broadcast(&my_cond_space);
+			}
+			pthread_cond_wait(&my_cond_data, &my_mutex);
+			continue;
+		}
+
+		my_playback_is_idle = false;
+		size_t length = available;
+		if (mark && (mark->position - samples_read < length))
+			length = mark->position - samples_read;
+		size_t offset = samples_read & (ring_size - 1);
+		if (length > ring_size - offset)
+			length = ring_size - offset;
+		size_t period = ms_to_samples(PERIOD_MS, play_samplerate);
+		if (length > period)
+			length = period;
+		pthread_mutex_unlock(&my_mutex);
+
+		espeak_ng_STATUS status = ENS_OK;
+		if (sink_samplerate == 0)
+			status = sink_open(play_samplerate);
+		if (status == ENS_OK)
+			sink_write(ring + offset, length);
+
+		pthread_mutex_lock(&my_mutex);
+		if (status != ENS_OK)
+			my_error = status; // the samples are discarded, and the error is returned to the synthesis
+		else
+			my_stats.samples += length;
+		store_index(samples_read, samples_read + length);
+		pthread_cond_broadcast(&my_cond_space);
+	}
+	pthread_mutex_unlock(&my_mutex);
+
+	return NULL;
+}
+
+espeak_ng_STATUS playback_set_buffer(unsigned int prefill, unsigned int low_water, unsigned int high_water)
+{
+	if ((high_water == 0) || (low_water >= high_water) || (prefill > high_water))
+		return EINVAL;
+
+	new_prefill_ms = prefill;
+	new_low_water_ms = low_water;
+	new_high_water_ms = high_water;
+	return ENS_OK;
+}
+
+espeak_ng_STATUS playback_init(const char *device, int samplerate)
+{
+	playback_terminate();
+
+	sink = SINK_NONE;
+	if (device && (strcmp(device, "null") == 0))
+		sink = SINK_NULL;
+	else if (device && (strncmp(device, "file:", 5) == 0)) {
+		if ((sink_file = fopen(device + 5, "wb")) == NULL)
+			return errno;
+		sink = SINK_FILE;
+	} else {
+#ifdef HAVE_PCAUDIOLIB_AUDIO_H
+		if (sink_audio == NULL)
+			sink_audio = create_audio_device_object(device, "eSpeak", "Text-to-Speech");
+		if (sink_audio != NULL)
+			sink = SINK_PCAUDIO;
+#endif
+	}
+
+	prefill_ms = new_prefill_ms;
+	low_water_ms = new_low_water_ms;
+	high_water_ms = new_high_water_ms;
+	size_t size = ((size_t)high_water_ms * MAX_SAMPLERATE) / 1000;
+	for (ring_size = 1024; ring_size < size; ring_size *= 2)
+		;
+	ring = (short *)malloc(ring_size * sizeof(short));
+	if (ring == NULL) {
+		if (sink_file)
+			fclose(sink_file);
+		sink_file = NULL;
+		return ENOMEM;
+	}
+
+	samples_written = samples_read = 0;
+	marks_written = marks_read = 0;
+	end_position = 0;
+	write_samplerate = play_samplerate = samplerate;
+	sink_samplerate = 0;
+	my_flush_count = my_flushed_count = 0;
+	my_playback_is_idle = true;
+	my_error = ENS_OK;
+	memset(&my_stats, 0, sizeof(my_stats));
+
+	pthread_mutex_init(&my_mutex, (const pthread_mutexattr_t *)NULL);
+	pthread_cond_init(&my_cond_data, NULL);
+	pthread_cond_init(&my_cond_space, NULL);
+
+	pthread_attr_t a_attrib;
+	if (pthread_attr_init(&a_attrib) == 0
+	    && pthread_attr_setdetachstate(&a_attrib, PTHREAD_CREATE_JOINABLE) == 0) {
+		thread_inited = (0 == pthread_create(&my_thread,
+		                                     &a_attrib,
+		                                     playback_thread,
+		                                     (void *)NULL));
+	}
+	pthread_attr_destroy(&a_attrib);
+
+	if (!thread_inited) {
+		playback_terminate();
+		return ENS_AUDIO_ERROR;
+	}
+	return ENS_OK;
+}
+
+espeak_ng_STATUS playback_write(const short *samples, int length, const espeak_EVENT *events)
+{
+	if (!thread_inited)
+		return ENS_NOT_INITIALIZED;
+
+	pthread_mutex_lock(&my_mutex);
+	unsigned int flush_count = my_flush_count;
+	espeak_ng_STATUS status = my_error;
+	my_error = ENS_OK;
+	pthread_mutex_unlock(&my_mutex);
+	if (status != ENS_OK)
+		return status;
+
+	size_t high_water = ms_to_samples(high_water_ms, write_samplerate);
+	size_t low_water = ms_to_samples(low_water_ms, write_samplerate);
+	int buffer_length = length;
+
+	while (length > 0) {
+		size_t buffered = samples_written - load_index(samples_read);
+		if (buffered >= high_water) {
+			// wait until the playback thread has played down to the low watermark
+			pthread_mutex_lock(&my_mutex);
+			while ((samples_written - samples_read > low_water) && (my_flush_count == flush_count) && !my_terminate_is_required)
+				pthread_cond_wait(&my_cond_space, &my_mutex);
+			bool flushed = (my_flush_count != flush_count) || my_terminate_is_required;
+			pthread_mutex_unlock(&my_mutex);
+			if (flushed)
+				return ENS_OK; // the samples are not wanted
+			continue;
+		}
+
+		size_t offset = samples_written & (ring_size - 1);
+		size_t n = high_water - buffered;
+		if (n > (size_t)length)
+			n = length;
+		if (n > ring_size - offset)
+			n = ring_size - offset;
+
+		memcpy(ring + offset, samples, n * sizeof(short));
+		samples += n;
+		length -= n;
+		store_index(samples_written, samples_written + n);
+
+		pthread_mutex_lock(&my_mutex);
+		pthread_cond_signal(&my_cond_data);
+		pthread_mutex_unlock(&my_mutex);
+	}
+
+	if ((buffer_length > 0) || events)
+		return push_mark(MARK_BUFFER, buffer_length, 0, events ? copy_events(events) : NULL);
+	return ENS_OK;
+}
+
+espeak_ng_STATUS playback_set_samplerate(int samplerate)
+{
+	if (!thread_inited)
+		return ENS_NOT_INITIALIZED;
+	if (samplerate == write_samplerate)
+		return ENS_OK;
+
+	write_samplerate = samplerate;
+	return push_mark(MARK_SAMPLERATE, 0, samplerate, NULL);
+}
+
+espeak_ng_STATUS playback_end(void)
+{
+	if (!thread_inited)
+		return ENS_NOT_INITIALIZED;
+	if (samples_written == end_position)
+		return ENS_OK;
+
+	end_position = samples_written;
+	return push_mark(MARK_END, 0, 0, NULL);
+}
+
+espeak_ng_STATUS playback_drain(void)
+{
+	espeak_ng_STATUS status = playback_end();
+	if (status != ENS_OK)
+		return status;
+
+	pthread_mutex_lock(&my_mutex);
+	unsigned int flush_count = my_flush_count;
+	while (!((samples_read == samples_written) && (marks_read == marks_written) && my_playback_is_idle)
+	       && (my_flush_count == flush_count) && !my_terminate_is_required)
+		pthread_cond_wait(&my_cond_space, &my_mutex);
+	status = my_error;
+	my_error = ENS_OK;
+	pthread_mutex_unlock(&my_mutex);
+	return status;
+}
+
+void playback_flush(void)
+{
+	if (!thread_inited)
+		return;
+
+	pthread_mutex_lock(&my_mutex);
+	unsigned int flush_count = ++my_flush_count;
+	pthread_cond_signal(&my_cond_data);
+	pthread_cond_broadcast(&my_cond_space); // the synthesis thread may be waiting for space
+	while (((int)(my_flushed_count - flush_count) < 0) && !my_terminate_is_required)
+		pthread_cond_wait(&my_cond_space, &my_mutex);
+	pthread_mutex_unlock(&my_mutex);
+}
+
+int playback_is_busy(void)
+{
+	if (!thread_inited)
+		return 0;
+
+	pthread_mutex_lock(&my_mutex);
+	int busy = !((samples_read == samples_written) && (marks_read == marks_written) && my_playback_is_idle);
+	pthread_mutex_unlock(&my_mutex);
+	return busy;
+}
+
+espeak_ng_STATUS playback_get_stats(espeak_ng_PLAYBACK_STATS *stats)
+{
+	if (stats == NULL)
+		return EINVAL;
+	if (!thread_inited)
+		return ENS_NOT_INITIALIZED;
+
+	pthread_mutex_lock(&my_mutex);
+	memcpy(stats, &my_stats, sizeof(my_stats));
+	stats->buffered_ms = ((samples_written - samples_read) * 1000) / write_samplerate;
+	pthread_mutex_unlock(&my_mutex);
+	return ENS_OK;
+}
+
+void playback_terminate(void)
+{
+	if (thread_inited) {
+		pthread_mutex_lock(&my_mutex);
+		my_terminate_is_required = true;
+		pthread_cond_broadcast(&my_cond_data);
+		pthread_cond_broadcast(&my_cond_space);
+		pthread_mutex_unlock(&my_mutex);
+		pthread_join(my_thread, NULL);
+		my_terminate_is_required = false;
+		thread_inited = false;
+	}
+
+	if (ring) {
+		discard();
+		sink_close();
+
+		pthread_mutex_destroy(&my_mutex);
+		pthread_cond_destroy(&my_cond_data);
+		pthread_cond_destroy(&my_cond_space);
+
+		free(ring);
+		ring = NULL;
+	}
+
+	if (sink_file) {
+		fclose(sink_file);
+		sink_file = NULL;
+	}
+#ifdef HAVE_PCAUDIOLIB_AUDIO_H
+	if (sink_audio) {
+		audio_object_destroy(sink_audio);
+		sink_audio = NULL;
+	}
+#endif
+	sink = SINK_NONE;
+}
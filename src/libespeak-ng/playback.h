@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2026 eSpeak NG contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see: <http://www.gnu.org/licenses/>.
+ */
+
+// Plays the synthesized samples on a thread of its own, so that the
+// synthesis of the following samples does not wait for the audio device.
+//
+// The samples are passed to the playback thread in a ring. Playback of an
+// utterance starts when the prefill has been buffered, and the synthesis
+// thread waits when the high watermark has been buffered, until the playback
+// thread has played down to the low watermark. The events of each buffer are
+// declared when its samples have been written to the audio device.
+
+#ifndef ESPEAK_NG_PLAYBACK_H
+#define ESPEAK_NG_PLAYBACK_H
+
+#include <espeak-ng/espeak_ng.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Set the prefill and watermarks, in mS, used by the next playback_init.
+espeak_ng_STATUS playback_set_buffer(unsigned int prefill_ms, unsigned int low_water_ms, unsigned int high_water_ms);
+
+// Start the playback thread, with the audio output of the device:
+//   "null" discards the samples at the rate that they would be played;
+//   "file:<path>" writes them to a file of raw 16-bit samples at that rate;
+//   otherwise the device is opened with pcaudiolib.
+espeak_ng_STATUS playback_init(const char *device, int samplerate);
+
+// Add samples, and the events which follow them, to be played. The events
+// are terminated by espeakEVENT_LIST_TERMINATED, and may be NULL.
+//
+// Note: this waits while the high watermark is buffered. It returns
+// ENS_AUDIO_ERROR if the audio device could not be opened or written.
+espeak_ng_STATUS playback_write(const short *samples, int length, const espeak_EVENT *events);
+
+// Play the following samples at a different sample rate.
+espeak_ng_STATUS playback_set_samplerate(int samplerate);
+
+// The end of an utterance: the samples are played even if less than the
+// prefill has been buffered, and the playback thread does not count running
+// out of samples as an underrun.
+espeak_ng_STATUS playback_end(void);
+
+// End the utterance, and wait until its samples have been played.
+espeak_ng_STATUS playback_drain(void);
+
+// Discard the samples and events which have not been played.
+void playback_flush(void);
+
+// Are there samples which have not been played?
+// Returns 1 if yes; 0 otherwise.
+int playback_is_busy(void);
+
+espeak_ng_STATUS playback_get_stats(espeak_ng_PLAYBACK_STATS *stats);
+
+// Stop the playback thread and close the audio device.
+void playback_terminate(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
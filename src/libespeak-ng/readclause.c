@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <wchar.h>
 #include <wctype.h>
@@ -61,6 +62,10 @@ espeak_ng_TEXT_DECODER *p_decoder = NULL;
 static int ungot_char;
 static const char *ungot_word = NULL;
 
+#define N_XML_BUF2 20
+static char ungot_string[N_XML_BUF2+4];
+static int ungot_string_ix = -1;
+
 static bool ignore_text = false; // set during <sub> ... </sub>  to ignore text which has been replaced by an alias
 static bool audio_text = false; // set during <audio> ... </audio>
 static bool clear_skipping_text = false; // next clause should clear the skipping_text flag
@@ -83,6 +88,44 @@ PARAM_STACK param_stack[N_PARAM_STACK];
 static int speech_parameters[N_SPEECH_PARAM]; // current values, from param_stack
 int saved_parameters[N_SPEECH_PARAM]; // Parameters saved on synthesis start
 
+// Text which is given as a stream may end part way through a clause.  If
+// ReadClause() reaches stream_end, it restores the state from the start of
+// the clause so that the clause is read again when more text has been added.
+const void *stream_end = NULL; // end of the text received so far, or NULL
+const void *stream_position = NULL; // where to continue reading the stream
+bool stream_underrun = false; // ReadClause() has reached stream_end
+static bool stream_reading = false;
+
+static struct {
+	int ungot_char;
+	int ungot_char2;
+	const char *ungot_word;
+	char ungot_string[N_XML_BUF2+4];
+	int ungot_string_ix;
+	int count_characters;
+	int skip_characters;
+	bool skipping_text;
+	bool clear_skipping_text;
+	bool ignore_text;
+	bool audio_text;
+	int sayas_mode;
+	int sayas_start;
+	int ssml_ignore_l_angle;
+	int n_ssml_stack;
+	SSML_STACK ssml_stack[N_SSML_STACK];
+	int n_param_stack;
+	PARAM_STACK param_stack[N_PARAM_STACK];
+	int speech_parameters[N_SPEECH_PARAM];
+	espeak_VOICE base_voice;
+	char base_voice_variant_name[40];
+	char current_voice_id[40];
+	const char *xmlbase;
+	int namedata_ix;
+	int option_punctuation;
+	int option_capitals;
+	wchar_t option_punctlist[N_PUNCTLIST];
+} stream_state;
+
 #define ESPEAKNG_CLAUSE_TYPE_PROPERTY_MASK 0xFFF0000000000000ull
 
 int clause_type_from_codepoint(uint32_t c)
@@ -156,11 +199,25 @@ static int IsRomanU(unsigned int c)
 	return 0;
 }
 
+static bool StreamUnderrun(void)
+{
+	// More text may be added to a stream, so its end is only treated as
+	// the end of the text while ReadClause() is looking for the end of a clause.
+	if ((stream_end == NULL) || (text_decoder_get_buffer(p_decoder) != stream_end))
+		return false;
+	if (stream_reading)
+		stream_underrun = true;
+	return true;
+}
+
 int Eof(void)
 {
 	if (ungot_char != 0)
 		return 0;
 
+	if (StreamUnderrun())
+		return stream_reading;
+
 	return text_decoder_eof(p_decoder);
 }
 
@@ -173,6 +230,9 @@ static int GetC(void)
 		return c1;
 	}
 
+	if (StreamUnderrun())
+		return 0;
+
 	count_characters++;
 	return text_decoder_getc(p_decoder);
 }
@@ -299,14 +359,141 @@ int Read4Bytes(FILE *f)
 	return acc;
 }
 
+static unsigned int GetLE16(const unsigned char *p)
+{
+	return p[0] + (p[1] << 8);
+}
+
+static unsigned int GetLE32(const unsigned char *p)
+{
+	return p[0] + (p[1] << 8) + (p[2] << 16) + ((unsigned int)p[3] << 24);
+}
+
+static espeak_ng_STATUS DecodeWavFile(const unsigned char *wav, int length, char **data, int *n_samples)
+{
+	// Convert a WAV file to mono, 16 bit little endian samples at the synthesis
+	// sample rate. PCM data of 8, 16, 24 or 32 bits and 32 bit float data are
+	// supported, with any number of channels.
+
+	const unsigned char *fmt = NULL;
+	const unsigned char *pcm = NULL;
+	unsigned int fmt_length = 0;
+	unsigned int pcm_length = 0;
+	unsigned int chunk_length;
+	int pos;
+	int format;
+	int channels;
+	int rate;
+	int bits;
+	int bytes_per_frame;
+	int n_frames;
+	int ix;
+	int ch;
+	int *mono;
+	unsigned char *out;
+
+	if ((length < 12) || (memcmp(wav, "RIFF", 4) != 0) || (memcmp(&wav[8], "WAVE", 4) != 0))
+		return ENS_NOT_SUPPORTED;
+
+	for (pos = 12; pos + 8 <= length; pos += 8 + chunk_length + (chunk_length & 1)) {
+		chunk_length = GetLE32(&wav[pos+4]);
+		if (chunk_length > (unsigned int)(length - pos - 8))
+			chunk_length = length - pos - 8; // truncated file
+		if ((memcmp(&wav[pos], "fmt ", 4) == 0) && (chunk_length >= 16)) {
+			fmt = &wav[pos+8];
+			fmt_length = chunk_length;
+		} else if (memcmp(&wav[pos], "data", 4) == 0) {
+			pcm = &wav[pos+8];
+			pcm_length = chunk_length;
+		}
+	}
+	if ((fmt == NULL) || (pcm == NULL))
+		return ENS_NOT_SUPPORTED;
+
+	format = GetLE16(&fmt[0]);
+	channels = GetLE16(&fmt[2]);
+	rate = GetLE32(&fmt[4]);
+	bits = GetLE16(&fmt[14]);
+	if ((format == 0xfffe) && (fmt_length >= 26))
+		format = GetLE16(&fmt[24]); // WAVE_FORMAT_EXTENSIBLE, use the sub-format
+
+	if ((channels < 1) || (rate < 1000) || (rate > 384000))
+		return ENS_NOT_SUPPORTED;
+	if (!((format == 1) && ((bits == 8) || (bits == 16) || (bits == 24) || (bits == 32))) && !((format == 3) && (bits == 32)))
+		return ENS_NOT_SUPPORTED;
+
+	bytes_per_frame = channels * (bits / 8);
+	n_frames = pcm_length / bytes_per_frame;
+
+	// mix down to mono, at 16 bit scale
+	if ((mono = (int *)malloc((n_frames + 1) * sizeof(int))) == NULL)
+		return ENOMEM;
+	for (ix = 0; ix < n_frames; ix++) {
+		const unsigned char *p = &pcm[ix * bytes_per_frame];
+		int sum = 0;
+
+		for (ch = 0; ch < channels; ch++) {
+			switch (bits)
+			{
+			case 8:
+				sum += (p[0] - 128) * 256;
+				break;
+			case 16:
+				sum += (short)GetLE16(p);
+				break;
+			case 24:
+				sum += (int)((p[0] << 8) + (p[1] << 16) + ((unsigned int)p[2] << 24)) >> 16;
+				break;
+			case 32:
+				if (format == 3) {
+					float f;
+					uint32_t u = GetLE32(p);
+					memcpy(&f, &u, sizeof(f));
+					if (f > 1.0f) f = 1.0f;
+					else if (f < -1.0f) f = -1.0f;
+					sum += (int)(f * 32767);
+				} else
+					sum += (int)GetLE32(p) >> 16;
+				break;
+			}
+			p += bits / 8;
+		}
+		mono[ix] = sum / channels;
+	}
+	mono[n_frames] = n_frames > 0 ? mono[n_frames-1] : 0;
+
+	*n_samples = (int)((double)n_frames * samplerate / rate);
+	if ((out = (unsigned char *)malloc(*n_samples * 2 + 2)) == NULL) {
+		free(mono);
+		return ENOMEM;
+	}
+	ResampleSamples(mono, n_frames, rate, out, *n_samples);
+	free(mono);
+
+	*data = (char *)out;
+	return ENS_OK;
+}
+
+static const char *SoundFilePath(const char *fname, char *buf, int size)
+{
+	if (fname[0] != '/') {
+		// a relative path, look in espeak-ng-data/soundicons
+		snprintf(buf, size, "%s%csoundicons%c%s", path_home, PATHSEP, PATHSEP, fname);
+		return buf;
+	}
+	return fname;
+}
+
 static espeak_ng_STATUS LoadSoundFile(const char *fname, int index, espeak_ng_ERROR_CONTEXT *context)
 {
 	FILE *f;
-	char *p;
-	int *ip;
+	unsigned char *wav;
+	char *data;
+	int n_samples;
 	int length;
-	char fname_temp[100];
-	char fname2[sizeof(path_home)+13+40];
+	struct stat statbuf;
+	espeak_ng_STATUS status;
+	char fname2[sizeof(path_home)+13+256];
 
 	if (fname == NULL) {
 		// filename is already in the table
@@ -316,80 +503,38 @@ static espeak_ng_STATUS LoadSoundFile(const char *fname, int index, espeak_ng_ER
 	if (fname == NULL)
 		return EINVAL;
 
-	if (fname[0] != '/') {
-		// a relative path, look in espeak-ng-data/soundicons
-		sprintf(fname2, "%s%csoundicons%c%s", path_home, PATHSEP, PATHSEP, fname);
-		fname = fname2;
-	}
-
-	f = NULL;
-	if ((f = fopen(fname, "rb")) != NULL) {
-		int ix;
-		int fd_temp;
-		int header[3];
-		char command[sizeof(fname2)+sizeof(fname2)+40];
-
-		if (fseek(f, 20, SEEK_SET) == -1) {
-			int error = errno;
-			fclose(f);
-			return create_file_error_context(context, error, fname);
-		}
-
-		for (ix = 0; ix < 3; ix++)
-			header[ix] = Read4Bytes(f);
-
-		// if the sound file is not mono, 16 bit signed, at the correct sample rate, then convert it
-		if ((header[0] != 0x10001) || (header[1] != samplerate) || (header[2] != samplerate*2)) {
-			fclose(f);
-			f = NULL;
-
-#ifdef HAVE_MKSTEMP
-			strcpy(fname_temp, "/tmp/espeakXXXXXX");
-			if ((fd_temp = mkstemp(fname_temp)) >= 0)
-				close(fd_temp);
-#else
-			strcpy(fname_temp, tmpnam(NULL));
-#endif
-
-			sprintf(command, "sox \"%s\" -r %d -c1 -t wav %s\n", fname, samplerate, fname_temp);
-			if (system(command) == 0)
-				fname = fname_temp;
-		}
-	}
+	fname = SoundFilePath(fname, fname2, sizeof(fname2));
 
-	if (f == NULL) {
-		f = fopen(fname, "rb");
-		if (f == NULL)
-			return create_file_error_context(context, errno, fname);
-	}
+	if (stat(fname, &statbuf) != 0)
+		return create_file_error_context(context, errno, fname);
+	if (S_ISDIR(statbuf.st_mode))
+		return create_file_error_context(context, EISDIR, fname);
+	length = statbuf.st_size;
 
-	length = GetFileLength(fname);
-	if (length < 0) { // length == -errno
-		fclose(f);
-		return create_file_error_context(context, -length, fname);
-	}
-	if (fseek(f, 0, SEEK_SET) == -1) {
-		int error = errno;
-		fclose(f);
-		return create_file_error_context(context, error, fname);
-	}
-	if ((p = (char *)realloc(soundicon_tab[index].data, length)) == NULL) {
+	if ((f = fopen(fname, "rb")) == NULL)
+		return create_file_error_context(context, errno, fname);
+	if ((wav = (unsigned char *)malloc(length)) == NULL) {
 		fclose(f);
 		return ENOMEM;
 	}
-	if (fread(p, 1, length, f) != length) {
+	if (fread(wav, 1, length, f) != (size_t)length) {
 		int error = errno;
 		fclose(f);
-		remove(fname_temp);
-		free(p);
+		free(wav);
 		return create_file_error_context(context, error, fname);
 	}
 	fclose(f);
-	remove(fname_temp);
 
-	ip = (int *)(&p[40]);
-	soundicon_tab[index].length = (*ip) / 2; // length in samples
-	soundicon_tab[index].data = p;
+	status = DecodeWavFile(wav, length, &data, &n_samples);
+	free(wav);
+	if (status != ENS_OK)
+		return status;
+
+	free(soundicon_tab[index].data);
+	soundicon_tab[index].data = data;
+	soundicon_tab[index].length = n_samples;
+	soundicon_tab[index].samplerate = samplerate;
+	soundicon_tab[index].mtime = statbuf.st_mtime;
 	return ENS_OK;
 }
 
@@ -400,7 +545,7 @@ static int LookupSoundicon(int c)
 
 	for (ix = N_SOUNDICON_SLOTS; ix < n_soundicon_tab; ix++) {
 		if (soundicon_tab[ix].name == c) {
-			if (soundicon_tab[ix].length == 0) {
+			if ((soundicon_tab[ix].length == 0) || (soundicon_tab[ix].samplerate != samplerate)) {
 				if (LoadSoundFile(NULL, ix, NULL) != ENS_OK)
 					return -1; // sound file is not available
 			}
@@ -410,29 +555,72 @@ static int LookupSoundicon(int c)
 	return -1;
 }
 
+static bool SoundIconInUse(int index)
+{
+	// Is the audio of the sound icon waiting to be played by wavegen?
+	int ix;
+
+	if (soundicon_tab[index].data == NULL)
+		return false;
+
+	for (ix = wcmdq_head; ix < wcmdq_tail; ix++) {
+		wcmd_t *q = WCMDQ(ix);
+		if ((q->cmd == WCMD_WAVE) && (q->u.wave.data == (unsigned char *)soundicon_tab[index].data))
+			return true;
+	}
+	return false;
+}
+
 int LoadSoundFile2(const char *fname)
 {
 	// Load a sound file into one of the reserved slots in the sound icon table
-	// (if it'snot already loaded)
+	// (if it's not already loaded). The least recently used slot is reused, and
+	// a file is loaded again if it has been modified.
 
 	int ix;
-	static int slot = -1;
+	int slot = -1;
+	struct stat statbuf;
+	char fname2[sizeof(path_home)+13+256];
+	static unsigned int use_count = 0;
 
+	use_count++;
 	for (ix = 0; ix < n_soundicon_tab; ix++) {
-		if (((soundicon_tab[ix].filename != NULL) && strcmp(fname, soundicon_tab[ix].filename) == 0))
-			return ix; // already loaded
+		if ((soundicon_tab[ix].filename != NULL) && strcmp(fname, soundicon_tab[ix].filename) == 0) {
+			if ((ix >= N_SOUNDICON_SLOTS) || (stat(SoundFilePath(fname, fname2, sizeof(fname2)), &statbuf) != 0) || (statbuf.st_mtime == soundicon_tab[ix].mtime)) {
+				if ((soundicon_tab[ix].samplerate != samplerate) && (LoadSoundFile(NULL, ix, NULL) != ENS_OK))
+					return -1; // loaded at a different sample rate, and could not be loaded again
+				soundicon_tab[ix].last_used = use_count;
+				return ix; // already loaded
+			}
+
+			// the file has changed
+			if (!SoundIconInUse(ix))
+				slot = ix;
+			else {
+				free(soundicon_tab[ix].filename);
+				soundicon_tab[ix].filename = NULL;
+			}
+			break;
+		}
 	}
 
-	// load the file into the next slot
-	slot++;
-	if (slot >= N_SOUNDICON_SLOTS)
-		slot = 0;
+	if (slot < 0) {
+		for (ix = 0; ix < N_SOUNDICON_SLOTS; ix++) {
+			if (SoundIconInUse(ix))
+				continue;
+			if ((slot < 0) || (soundicon_tab[ix].last_used < soundicon_tab[slot].last_used))
+				slot = ix;
+		}
+		if (slot < 0)
+			return -1; // all the slots are waiting to be played
+	}
 
 	if (LoadSoundFile(fname, slot, NULL) != ENS_OK)
 		return -1;
 
-	soundicon_tab[slot].filename = (char *)realloc(soundicon_tab[ix].filename, strlen(fname)+1);
-	strcpy(soundicon_tab[slot].filename, fname);
+	free(soundicon_tab[slot].filename);
+	soundicon_tab[slot].filename = strdup(fname);
+	soundicon_tab[slot].last_used = use_count;
 	return slot;
 }
 
@@ -613,7 +801,7 @@ static MNEM_TAB xml_char_mnemonics[] = {
 	{ NULL,   -1 }
 };
 
-int ReadClause(Translator *tr, char *buf, short *charix, int *charix_top, int n_buf, int *tone_type, char *voice_change)
+static int ReadClause2(Translator *tr, char *buf, short *charix, int *charix_top, int n_buf, int *tone_type, char *voice_change)
 {
 	/* Find the end of the current clause.
 	    Write the clause into  buf
@@ -651,10 +839,7 @@ int ReadClause(Translator *tr, char *buf, short *charix, int *charix_top, int n_
 	int end_clause_index = 0;
 	wchar_t xml_buf[N_XML_BUF+1];
 
-	#define N_XML_BUF2 20
 	char xml_buf2[N_XML_BUF2+2]; // for &<name> and &<number> sequences
-	static char ungot_string[N_XML_BUF2+4];
-	static int ungot_string_ix = -1;
 
 	if (clear_skipping_text) {
 		skipping_text = false;
@@ -1162,6 +1347,94 @@ int ReadClause(Translator *tr, char *buf, short *charix, int *charix_top, int n_
 	return CLAUSE_EOF; // end of file
 }
 
+static void SaveStreamState(void)
+{
+	stream_position = text_decoder_get_buffer(p_decoder);
+	stream_state.ungot_char = ungot_char;
+	stream_state.ungot_char2 = ungot_char2;
+	stream_state.ungot_word = ungot_word;
+	memcpy(stream_state.ungot_string, ungot_string, sizeof(ungot_string));
+	stream_state.ungot_string_ix = ungot_string_ix;
+	stream_state.count_characters = count_characters;
+	stream_state.skip_characters = skip_characters;
+	stream_state.skipping_text = skipping_text;
+	stream_state.clear_skipping_text = clear_skipping_text;
+	stream_state.ignore_text = ignore_text;
+	stream_state.audio_text = audio_text;
+	stream_state.sayas_mode = sayas_mode;
+	stream_state.sayas_start = sayas_start;
+	stream_state.ssml_ignore_l_angle = ssml_ignore_l_angle;
+	stream_state.n_ssml_stack = n_ssml_stack;
+	memcpy(stream_state.ssml_stack, ssml_stack, n_ssml_stack * sizeof(SSML_STACK));
+	stream_state.n_param_stack = n_param_stack;
+	memcpy(stream_state.param_stack, param_stack, n_param_stack * sizeof(PARAM_STACK));
+	memcpy(stream_state.speech_parameters, speech_parameters, sizeof(speech_parameters));
+	stream_state.base_voice = base_voice;
+	memcpy(stream_state.base_voice_variant_name, base_voice_variant_name, sizeof(base_voice_variant_name));
+	memcpy(stream_state.current_voice_id, current_voice_id, sizeof(current_voice_id));
+	stream_state.xmlbase = xmlbase;
+	stream_state.namedata_ix = namedata_ix;
+	stream_state.option_punctuation = option_punctuation;
+	stream_state.option_capitals = option_capitals;
+	memcpy(stream_state.option_punctlist, option_punctlist, sizeof(option_punctlist));
+}
+
+static void RestoreStreamState(void)
+{
+	// stream_position is used to restore the position of the text decoder
+	// when more text has been added to the stream
+	ungot_char = stream_state.ungot_char;
+	ungot_char2 = stream_state.ungot_char2;
+	ungot_word = stream_state.ungot_word;
+	memcpy(ungot_string, stream_state.ungot_string, sizeof(ungot_string));
+	ungot_string_ix = stream_state.ungot_string_ix;
+	count_characters = stream_state.count_characters;
+	skip_characters = stream_state.skip_characters;
+	skipping_text = stream_state.skipping_text;
+	clear_skipping_text = stream_state.clear_skipping_text;
+	ignore_text = stream_state.ignore_text;
+	audio_text = stream_state.audio_text;
+	sayas_mode = stream_state.sayas_mode;
+	sayas_start = stream_state.sayas_start;
+	ssml_ignore_l_angle = stream_state.ssml_ignore_l_angle;
+	n_ssml_stack = stream_state.n_ssml_stack;
+	memcpy(ssml_stack, stream_state.ssml_stack, n_ssml_stack * sizeof(SSML_STACK));
+	n_param_stack = stream_state.n_param_stack;
+	memcpy(param_stack, stream_state.param_stack, n_param_stack * sizeof(PARAM_STACK));
+	memcpy(speech_parameters, stream_state.speech_parameters, sizeof(speech_parameters));
+	base_voice = stream_state.base_voice;
+	memcpy(base_voice_variant_name, stream_state.base_voice_variant_name, sizeof(base_voice_variant_name));
+	memcpy(current_voice_id, stream_state.current_voice_id, sizeof(current_voice_id));
+	xmlbase = stream_state.xmlbase;
+	namedata_ix = stream_state.namedata_ix;
+	option_punctuation = stream_state.option_punctuation;
+	option_capitals = stream_state.option_capitals;
+	memcpy(option_punctlist, stream_state.option_punctlist, sizeof(option_punctlist));
+}
+
+int ReadClause(Translator *tr, char *buf, short *charix, int *charix_top, int n_buf, int *tone_type, char *voice_change)
+{
+	int terminator;
+
+	stream_underrun = false;
+	if (stream_end == NULL)
+		return ReadClause2(tr, buf, charix, charix_top, n_buf, tone_type, voice_change);
+
+	// the clause may not be complete yet, in which case it is read again
+	// from the start when more text has been added to the stream
+	SaveStreamState();
+	stream_reading = true;
+	terminator = ReadClause2(tr, buf, charix, charix_top, n_buf, tone_type, voice_change);
+	stream_reading = false;
+
+	if (stream_underrun) {
+		RestoreStreamState();
+		buf[0] = 0;
+		return CLAUSE_NONE;
+	}
+	return terminator;
+}
+
 void InitNamedata(void)
 {
 	namedata_ix = 0;
@@ -1198,4 +1471,7 @@ void InitText2(void)
 	sayas_mode = 0;
 
 	xmlbase = NULL;
+
+	stream_end = NULL;
+	stream_underrun = false;
 }
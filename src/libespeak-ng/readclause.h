@@ -34,6 +34,10 @@ typedef struct {
 
 extern PARAM_STACK param_stack[];
 
+extern const void *stream_end;
+extern const void *stream_position;
+extern bool stream_underrun;
+
 // Tests if all bytes of str up to size are null
 int is_str_totally_null(const char* str, int size);
 
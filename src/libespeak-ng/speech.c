@@ -48,6 +48,7 @@
 #include <espeak-ng/speak_lib.h>
 #include <espeak-ng/encoding.h>
 
+#include "bundle.h"
 #include "dictionary.h"
 #include "mbrola.h"
 #include "readclause.h"
@@ -62,6 +63,11 @@
 #include "espeak_command.h"
 #include "fifo.h"
 #include "event.h"
+#include "playback.h"
+
+#ifdef INCLUDE_KLATT
+#include "klatt.h"
+#endif
 
 unsigned char *outbuf = NULL;
 int outbuf_size = 0;
@@ -70,7 +76,7 @@ espeak_EVENT *event_list = NULL;
 int event_list_ix = 0;
 int n_event_list;
 long count_samples;
-#ifdef HAVE_PCAUDIOLIB_AUDIO_H
+#if defined(HAVE_PCAUDIOLIB_AUDIO_H) && !defined(USE_ASYNC)
 struct audio_object *my_audio = NULL;
 #endif
 
@@ -89,110 +95,125 @@ int (*phoneme_callback)(const char *) = NULL;
 char path_home[N_PATH_HOME]; // this is the espeak-ng-data directory
 extern int saved_parameters[N_SPEECH_PARAM]; // Parameters saved on synthesis start
 
+// espeak_ng_Cancel() increments cancel_count, which may be from another thread
+// than the one which is synthesizing. Each utterance keeps the value when it
+// starts, and synthesis stops when it changes.
+static int cancel_count = 0;
+static int utterance_cancel_count = 0;
+
+bool SynthesisCancelled(void)
+{
+	return __atomic_load_n(&cancel_count, __ATOMIC_ACQUIRE) != utterance_cancel_count;
+}
+
 void cancel_audio(void)
 {
-#ifdef HAVE_PCAUDIOLIB_AUDIO_H
 	if ((my_mode & ENOUTPUT_MODE_SPEAK_AUDIO) == ENOUTPUT_MODE_SPEAK_AUDIO) {
+#ifdef USE_ASYNC
+		playback_flush();
+#elif defined(HAVE_PCAUDIOLIB_AUDIO_H)
 		audio_object_flush(my_audio);
-	}
 #endif
+	}
 }
 
-static int dispatch_audio(short *outbuf, int length, espeak_EVENT *event)
-{
-	int a_wave_can_be_played = 1;
 #ifdef USE_ASYNC
-	if ((my_mode & ENOUTPUT_MODE_SYNCHRONOUS) == 0)
-		a_wave_can_be_played = fifo_is_command_enabled();
-#endif
 
-	switch ((int)my_mode)
-	{
-	case ENOUTPUT_MODE_SPEAK_AUDIO:
-	case ENOUTPUT_MODE_SPEAK_AUDIO | ENOUTPUT_MODE_SYNCHRONOUS:
-	{
-		int event_type = 0;
-		if (event)
-			event_type = event->type;
+// The samples are played by the playback thread, which declares the events
+// when the samples before them have been played. A NULL buffer and event list
+// indicates the end of the text.
+static int dispatch_audio(short *outbuf, int length, espeak_EVENT *event_list)
+{
+	if ((my_mode & ENOUTPUT_MODE_SYNCHRONOUS) == 0) {
+		if (!fifo_is_command_enabled())
+			return 1; // stop synthesis
+	}
 
-		if (event_type == espeakEVENT_SAMPLERATE) {
-			voice_samplerate = event->id.number;
+	if ((outbuf == NULL) && (event_list == NULL)) {
+		playback_end();
+		return 0;
+	}
 
-			if (out_samplerate != voice_samplerate) {
-#ifdef HAVE_PCAUDIOLIB_AUDIO_H
-				if (out_samplerate != 0) {
-					// sound was previously open with a different sample rate
-					audio_object_close(my_audio);
-					out_samplerate = 0;
-#ifdef HAVE_SLEEP
-					sleep(1);
-#endif
-				}
-#endif
-#ifdef HAVE_PCAUDIOLIB_AUDIO_H
-				int error = audio_object_open(my_audio, AUDIO_OBJECT_FORMAT_S16LE, voice_samplerate, 1);
-				if (error != 0) {
-					fprintf(stderr, "error: %s\n", audio_object_strerror(my_audio, error));
-					err = ENS_AUDIO_ERROR;
-					return -1;
-				}
-#endif
-				out_samplerate = voice_samplerate;
-#ifdef USE_ASYNC
-				if ((my_mode & ENOUTPUT_MODE_SYNCHRONOUS) == 0)
-					event_init();
-#endif
-			}
+	for (espeak_EVENT *event = event_list; event && (event->type != espeakEVENT_LIST_TERMINATED); event++) {
+		if (event->type != espeakEVENT_SAMPLERATE)
+			continue;
+
+		voice_samplerate = event->id.number;
+		if (out_samplerate != voice_samplerate) {
+			playback_set_samplerate(voice_samplerate);
+			out_samplerate = voice_samplerate;
 		}
+	}
+
+	// the events are only given to the callback in asynchronous mode
+	if ((my_mode & ENOUTPUT_MODE_SYNCHRONOUS) != 0)
+		event_list = NULL;
+
+	espeak_ng_STATUS status = playback_write(outbuf, length, event_list);
+	if (status != ENS_OK) {
+		err = status;
+		return -1;
+	}
+	return 0;
+}
+
+static int create_events(short *outbuf, int length, espeak_EVENT *event_list)
+{
+	return dispatch_audio(outbuf, length, event_list_ix ? event_list : NULL);
+}
+
+#else
 
+static int dispatch_audio(short *outbuf, int length, espeak_EVENT *event)
+{
+	int event_type = 0;
+	if (event)
+		event_type = event->type;
+
+	if (event_type == espeakEVENT_SAMPLERATE) {
+		voice_samplerate = event->id.number;
+
+		if (out_samplerate != voice_samplerate) {
 #ifdef HAVE_PCAUDIOLIB_AUDIO_H
-		if (out_samplerate == 0) {
+			if (out_samplerate != 0) {
+				// sound was previously open with a different sample rate
+				audio_object_drain(my_audio);
+				audio_object_close(my_audio);
+				out_samplerate = 0;
+			}
 			int error = audio_object_open(my_audio, AUDIO_OBJECT_FORMAT_S16LE, voice_samplerate, 1);
 			if (error != 0) {
 				fprintf(stderr, "error: %s\n", audio_object_strerror(my_audio, error));
 				err = ENS_AUDIO_ERROR;
 				return -1;
 			}
+#endif
 			out_samplerate = voice_samplerate;
 		}
-#endif
+	}
 
 #ifdef HAVE_PCAUDIOLIB_AUDIO_H
-		if (outbuf && length && a_wave_can_be_played) {
-			int error = audio_object_write(my_audio, (char *)outbuf, 2*length);
-			if (error != 0)
-				fprintf(stderr, "error: %s\n", audio_object_strerror(my_audio, error));
-		}
-#endif
-
-#ifdef USE_ASYNC
-		while (event && a_wave_can_be_played) {
-			// TBD: some event are filtered here but some insight might be given
-			// TBD: in synthesise.cpp for avoiding to create WORDs with size=0.
-			// TBD: For example sentence "or ALT)." returns three words
-			// "or", "ALT" and "".
-			// TBD: the last one has its size=0.
-			if ((event->type == espeakEVENT_WORD) && (event->length == 0))
-				break;
-			if ((my_mode & ENOUTPUT_MODE_SYNCHRONOUS) == 0) {
-				err = event_declare(event);
-				if (err != ENS_EVENT_BUFFER_FULL)
-					break;
-				usleep(10000);
-				a_wave_can_be_played = fifo_is_command_enabled();
-			} else
-				break;
+	if (out_samplerate == 0) {
+		int error = audio_object_open(my_audio, AUDIO_OBJECT_FORMAT_S16LE, voice_samplerate, 1);
+		if (error != 0) {
+			fprintf(stderr, "error: %s\n", audio_object_strerror(my_audio, error));
+			err = ENS_AUDIO_ERROR;
+			return -1;
 		}
-#endif
+		out_samplerate = voice_samplerate;
 	}
-		break;
-	case 0:
-		if (synth_callback)
-			synth_callback(outbuf, length, event);
-		break;
+
+	if (outbuf && length) {
+		int error = audio_object_write(my_audio, (char *)outbuf, 2*length);
+		if (error != 0)
+			fprintf(stderr, "error: %s\n", audio_object_strerror(my_audio, error));
 	}
+#else
+	(void)outbuf; // unused parameter
+	(void)length; // unused parameter
+#endif
 
-	return a_wave_can_be_played == 0; // 1 = stop synthesis, -1 = error
+	return 0; // 1 = stop synthesis, -1 = error
 }
 
 static int create_events(short *outbuf, int length, espeak_EVENT *event_list)
@@ -201,10 +222,7 @@ static int create_events(short *outbuf, int length, espeak_EVENT *event_list)
 	int i = 0;
 
 	// The audio data are written to the output device.
-	// The list of events in event_list (index: event_list_ix) is read:
-	// Each event is declared to the "event" object which stores them internally.
-	// The event object is responsible of calling the external callback
-	// as soon as the relevant audio sample is played.
+	// The list of events in event_list (index: event_list_ix) is read.
 
 	do { // for each event
 		espeak_EVENT *event;
@@ -219,6 +237,31 @@ static int create_events(short *outbuf, int length, espeak_EVENT *event_list)
 	return finished;
 }
 
+#endif
+
+// Called at the end of each utterance which is spoken on the audio device.
+static void end_audio(espeak_ng_STATUS status)
+{
+#ifdef USE_ASYNC
+	if (status == ENS_SPEECH_STOPPED)
+		playback_flush();
+	else if ((my_mode & ENOUTPUT_MODE_SYNCHRONOUS) == ENOUTPUT_MODE_SYNCHRONOUS) {
+		espeak_ng_STATUS error = playback_drain();
+		if (error != ENS_OK)
+			err = error;
+	} else
+		playback_end(); // the synthesis continues while the utterance is played
+#elif defined(HAVE_PCAUDIOLIB_AUDIO_H)
+	int error = (status == ENS_SPEECH_STOPPED)
+	          ? audio_object_flush(my_audio)
+	          : audio_object_drain(my_audio);
+	if (error != 0)
+		fprintf(stderr, "error: %s\n", audio_object_strerror(my_audio, error));
+#else
+	(void)status; // unused parameter
+#endif
+}
+
 #ifdef USE_ASYNC
 
 int sync_espeak_terminated_msg(uint32_t unique_identifier, void *user_data)
@@ -235,12 +278,8 @@ int sync_espeak_terminated_msg(uint32_t unique_identifier, void *user_data)
 	event_list[1].user_data = user_data;
 
 	if (my_mode == ENOUTPUT_MODE_SPEAK_AUDIO) {
-		while (1) {
-			err = event_declare(event_list);
-			if (err != ENS_EVENT_BUFFER_FULL)
-				break;
-			usleep(10000);
-		}
+		// declared by the playback thread after the samples of the message
+		err = playback_write(NULL, 0, event_list);
 	} else if (synth_callback)
 		finished = synth_callback(NULL, 0, event_list);
 	return finished;
@@ -260,7 +299,11 @@ static int check_data_path(const char *path, int allow_directory)
 		return 0;
 
 	snprintf(path_home, sizeof(path_home), "%s", path);
-	return GetFileLength(path_home) == -EISDIR;
+	if (GetFileLength(path_home) == -EISDIR)
+		return 1;
+
+	// a data bundle created by espeak_ng_CompileBundle
+	return LoadBundle(path_home);
 }
 
 #pragma GCC visibility push(default)
@@ -271,7 +314,18 @@ ESPEAK_NG_API espeak_ng_STATUS espeak_ng_InitializeOutput(espeak_ng_OUTPUT_MODE
 	my_mode = output_mode;
 	out_samplerate = 0;
 
-#ifdef HAVE_PCAUDIOLIB_AUDIO_H
+#ifdef USE_ASYNC
+	if ((my_mode & ENOUTPUT_MODE_SPEAK_AUDIO) == ENOUTPUT_MODE_SPEAK_AUDIO) {
+		espeak_ng_STATUS status = playback_init(device, voice_samplerate);
+		if (status != ENS_OK)
+			return status;
+		if ((my_mode & ENOUTPUT_MODE_SYNCHRONOUS) == 0) {
+			event_terminate();
+			event_init();
+		}
+	} else
+		playback_terminate();
+#elif defined(HAVE_PCAUDIOLIB_AUDIO_H)
 	if (my_audio == NULL)
 		my_audio = create_audio_device_object(device, "eSpeak", "Text-to-Speech");
 #endif
@@ -302,6 +356,9 @@ int GetFileLength(const char *filename)
 {
 	struct stat statbuf;
 
+	if (IsBundlePath(filename))
+		return GetBundleFileLength(filename);
+
 	if (stat(filename, &statbuf) != 0)
 		return -errno;
 
@@ -346,6 +403,24 @@ ESPEAK_NG_API void espeak_ng_InitializePath(const char *path)
 	strcpy(path_home, PATH_ESPEAK_DATA);
 }
 
+ESPEAK_NG_API espeak_ng_STATUS espeak_ng_InitializeBundle(const void *data, size_t size)
+{
+	// Use a data bundle in memory in place of espeak-ng-data. The files in it
+	// are used in place, so the data must not be freed while it is in use.
+	if (data == NULL)
+		return EINVAL;
+#ifdef HAVE_FMEMOPEN
+	if (!LoadBundleData("<espeak-ng-data>", data, size))
+		return ENS_CORRUPT_DATA;
+
+	strcpy(path_home, "<espeak-ng-data>");
+	return ENS_OK;
+#else
+	(void)size; // unused parameter
+	return ENS_NOT_SUPPORTED;
+#endif
+}
+
 const int param_defaults[N_SPEECH_PARAM] = {
 	0,   // silence (internal use)
 	espeakRATE_NORMAL, // rate wpm
@@ -420,13 +495,54 @@ ESPEAK_NG_API int espeak_ng_GetSampleRate(void)
 
 #pragma GCC visibility pop
 
-static espeak_ng_STATUS Synthesize(unsigned int unique_identifier, const void *text, int flags)
+// The phoneme timeline of the last utterance. Unlike event_list, this is not
+// limited to the events in one audio buffer.
+static espeak_ng_ALIGNMENT *alignment = NULL;
+static int n_alignment = 0;
+static int max_alignment = 0;
+static unsigned int alignment_word = 0;
+
+static void AddAlignment(unsigned int sample, unsigned int char_position, int value, int value2)
 {
-	// Fill the buffer with output sound
-	int length;
-	int finished = 0;
-	int count_buffers = 0;
+	espeak_ng_ALIGNMENT *new_alignment;
+	espeak_ng_ALIGNMENT *ap;
+
+	if (n_alignment >= max_alignment) {
+		int new_max = max_alignment ? max_alignment * 2 : 1024;
+		if ((new_alignment = (espeak_ng_ALIGNMENT *)realloc(alignment, new_max * sizeof(espeak_ng_ALIGNMENT))) == NULL)
+			return;
+		alignment = new_alignment;
+		max_alignment = new_max;
+	}
 
+	if (n_alignment > 0)
+		alignment[n_alignment-1].sample_end = sample;
+
+	ap = &alignment[n_alignment++];
+	ap->sample_start = sample;
+	ap->sample_end = sample;
+	ap->text_position = char_position & 0xffffff;
+	ap->word_index = alignment_word;
+	memcpy(&ap->phoneme[0], &value, 4);
+	memcpy(&ap->phoneme[4], &value2, 4);
+}
+
+static void EndAlignment(unsigned int sample)
+{
+	if ((n_alignment > 0) && (sample > alignment[n_alignment-1].sample_start))
+		alignment[n_alignment-1].sample_end = sample;
+}
+
+// Text which is given to espeak_ng_AppendText() is collected in stream_text.
+// It is followed by a null wchar_t, so that it can be decoded as a string.
+static char *stream_text = NULL;
+static size_t stream_length = 0; // in bytes, without the terminator
+static size_t stream_size = 0;
+static int stream_flags = 0;
+static bool stream_open = false;
+
+static espeak_ng_STATUS StartSynthesis(int flags)
+{
 	if ((outbuf == NULL) || (event_list == NULL))
 		return ENS_NOT_INITIALIZED;
 
@@ -435,6 +551,9 @@ static espeak_ng_STATUS Synthesize(unsigned int unique_identifier, const void *t
 	option_endpause = flags & espeakENDPAUSE;
 
 	count_samples = 0;
+	n_alignment = 0;
+	alignment_word = 0;
+	utterance_cancel_count = __atomic_load_n(&cancel_count, __ATOMIC_ACQUIRE);
 
 	espeak_ng_STATUS status;
 	if (translator == NULL) {
@@ -445,12 +564,34 @@ static espeak_ng_STATUS Synthesize(unsigned int unique_identifier, const void *t
 
 	if (p_decoder == NULL)
 		p_decoder = create_text_decoder();
+	return ENS_OK;
+}
 
-	status = text_decoder_decode_string_multibyte(p_decoder, text, translator->encoding, flags);
-	if (status != ENS_OK)
-		return status;
+// Pass the samples and events which have been written to outbuf to the audio
+// device or the synth callback.
+// Returns: 1 = stop synthesis, -1 = audio error, 0 otherwise.
+static int WriteBuffer(unsigned int unique_identifier)
+{
+	int length;
 
-	SpeakNextClause(0);
+	length = (out_ptr - outbuf)/2;
+	count_samples += length;
+	event_list[event_list_ix].type = espeakEVENT_LIST_TERMINATED; // indicates end of event list
+	event_list[event_list_ix].unique_identifier = unique_identifier;
+	event_list[event_list_ix].user_data = my_user_data;
+
+	if ((my_mode & ENOUTPUT_MODE_SPEAK_AUDIO) == ENOUTPUT_MODE_SPEAK_AUDIO)
+		return create_events((short *)outbuf, length, event_list);
+	else if (synth_callback)
+		return synth_callback((short *)outbuf, length, event_list) != 0;
+	return 0;
+}
+
+static espeak_ng_STATUS SynthesizeClauses(unsigned int unique_identifier)
+{
+	// Fill the buffer with output sound
+	int finished = 0;
+	int count_buffers = 0;
 
 	for (;;) {
 		out_ptr = outbuf;
@@ -458,21 +599,27 @@ static espeak_ng_STATUS Synthesize(unsigned int unique_identifier, const void *t
 		event_list_ix = 0;
 		WavegenFill();
 
-		length = (out_ptr - outbuf)/2;
-		count_samples += length;
-		event_list[event_list_ix].type = espeakEVENT_LIST_TERMINATED; // indicates end of event list
-		event_list[event_list_ix].unique_identifier = unique_identifier;
-		event_list[event_list_ix].user_data = my_user_data;
+		if (SynthesisCancelled()) {
+			// drop the part of the buffer which was filled before the cancel
+			SpeakNextClause(2); // stop
+			EndAlignment(count_samples);
+			stream_open = false;
+
+			// undo the changes which the text made to the parameters
+			embedded_value[EMBED_T] = 0; // reset echo for pronunciation announcements
+			for (int i = 0; i < N_SPEECH_PARAM; i++)
+				SetParameter(i, saved_parameters[i], 0);
+			return ENS_SPEECH_STOPPED;
+		}
 
 		count_buffers++;
-		if ((my_mode & ENOUTPUT_MODE_SPEAK_AUDIO) == ENOUTPUT_MODE_SPEAK_AUDIO) {
-			finished = create_events((short *)outbuf, length, event_list);
-			if (finished < 0)
-				return ENS_AUDIO_ERROR;
-		} else if (synth_callback)
-			finished = synth_callback((short *)outbuf, length, event_list);
+		finished = WriteBuffer(unique_identifier);
+		if (finished < 0)
+			return ENS_AUDIO_ERROR;
 		if (finished) {
 			SpeakNextClause(2); // stop
+			EndAlignment(count_samples);
+			stream_open = false;
 			return ENS_SPEECH_STOPPED;
 		}
 
@@ -485,7 +632,20 @@ static espeak_ng_STATUS Synthesize(unsigned int unique_identifier, const void *t
 				event_list[0].unique_identifier = my_unique_identifier;
 				event_list[0].user_data = my_user_data;
 
+#ifdef USE_ASYNC
+				if (((my_mode & ENOUTPUT_MODE_SYNCHRONOUS) == 0) && !stream_open && fifo_preempt_at(count_characters)) {
+					// a command of a higher priority is waiting, the fifo resumes or drops this one
+					SpeakNextClause(2); // stop
+					EndAlignment(count_samples);
+					return ENS_OK;
+				}
+#endif
+
 				if (SpeakNextClause(1) == 0) {
+					if (stream_underrun)
+						return ENS_OK; // continue when more text is added to the stream
+
+					EndAlignment(count_samples);
 					finished = 0;
 					if ((my_mode & ENOUTPUT_MODE_SPEAK_AUDIO) == ENOUTPUT_MODE_SPEAK_AUDIO) {
 						if (dispatch_audio(NULL, 0, NULL) < 0)
@@ -503,12 +663,212 @@ static espeak_ng_STATUS Synthesize(unsigned int unique_identifier, const void *t
 	}
 }
 
+static espeak_ng_STATUS ReplayClauses(void)
+{
+	// Fill the buffer with output sound from the capture
+	int finished;
+	bool end = false;
+	espeak_ng_STATUS status;
+
+	while (!end) {
+		out_ptr = outbuf;
+		out_end = &outbuf[outbuf_size];
+		event_list_ix = 0;
+		if ((status = WavegenReplayFill(&end)) != ENS_OK)
+			return status;
+
+		if (SynthesisCancelled())
+			return ENS_SPEECH_STOPPED;
+
+		finished = WriteBuffer(0);
+		if (finished < 0)
+			return ENS_AUDIO_ERROR;
+		if (finished)
+			return ENS_SPEECH_STOPPED;
+	}
+
+	EndAlignment(count_samples);
+	event_list[0].type = espeakEVENT_LIST_TERMINATED;
+	event_list[0].unique_identifier = 0;
+	event_list[0].user_data = NULL;
+	if ((my_mode & ENOUTPUT_MODE_SPEAK_AUDIO) == ENOUTPUT_MODE_SPEAK_AUDIO) {
+		if (dispatch_audio(NULL, 0, NULL) < 0)
+			return ENS_AUDIO_ERROR;
+	} else if (synth_callback)
+		synth_callback(NULL, 0, event_list); // NULL buffer ptr indicates end of data
+	return ENS_OK;
+}
+
+static espeak_ng_STATUS Synthesize(unsigned int unique_identifier, const void *text, int flags)
+{
+	espeak_ng_STATUS status = StartSynthesis(flags);
+	if (status != ENS_OK)
+		return status;
+
+	stream_open = false;
+	stream_end = NULL;
+
+	status = text_decoder_decode_string_multibyte(p_decoder, text, translator->encoding, flags);
+	if (status != ENS_OK)
+		return status;
+
+	SpeakNextClause(0);
+	return SynthesizeClauses(unique_identifier);
+}
+
+static size_t IncompleteUtf8(const char *text, size_t length)
+{
+	// Returns the number of bytes at the end of the text which are the start
+	// of a UTF-8 sequence whose other bytes have not been received yet.
+	size_t n;
+
+	for (n = 1; (n <= 3) && (n <= length); n++) {
+		unsigned char c = text[length-n];
+		if ((c & 0xc0) == 0xc0) {
+			// the first byte of a sequence of 2, 3 or 4 bytes
+			size_t needed = (c >= 0xf0) ? 4 : (c >= 0xe0) ? 3 : 2;
+			return (n < needed) ? n : 0;
+		}
+		if ((c & 0xc0) != 0x80)
+			return 0;
+	}
+	return 0;
+}
+
+static espeak_ng_STATUS DecodeStream(size_t offset)
+{
+	// Continue reading from offset, which is the start of a clause which has
+	// not been spoken yet.
+	espeak_ng_STATUS status = text_decoder_decode_string_multibyte(p_decoder, stream_text + offset, translator->encoding, stream_flags);
+	if (status != ENS_OK)
+		return status;
+
+	if (stream_open) {
+		size_t held = 0;
+		if (((stream_flags & 7) == espeakCHARS_AUTO) || ((stream_flags & 7) == espeakCHARS_UTF8))
+			held = IncompleteUtf8(stream_text, stream_length);
+		stream_end = stream_text + stream_length - held;
+	} else
+		stream_end = NULL;
+	return ENS_OK;
+}
+
+espeak_ng_STATUS sync_espeak_BeginStream(unsigned int unique_identifier, unsigned int flags, void *user_data)
+{
+	if ((flags & 7) == espeakCHARS_16BIT)
+		return ENS_UNKNOWN_TEXT_ENCODING;
+
+	InitText(flags);
+	my_unique_identifier = unique_identifier;
+	my_user_data = user_data;
+
+	for (int i = 0; i < N_SPEECH_PARAM; i++)
+		saved_parameters[i] = param_stack[0].parameter[i];
+
+	espeak_ng_STATUS status = StartSynthesis(flags);
+	if (status != ENS_OK)
+		return status;
+
+	if (stream_text == NULL) {
+		if ((stream_text = malloc(256)) == NULL)
+			return ENOMEM;
+		stream_size = 256;
+	}
+	stream_length = 0;
+	memset(stream_text, 0, sizeof(wchar_t));
+	stream_flags = flags;
+	stream_open = true;
+
+	status = DecodeStream(0);
+	if (status != ENS_OK) {
+		stream_open = false;
+		return status;
+	}
+
+	SpeakNextClause(0);
+	return ENS_OK;
+}
+
+espeak_ng_STATUS sync_espeak_AppendText(const void *text)
+{
+	size_t length;
+	size_t offset;
+
+	if (!stream_open)
+		return ENS_NOT_INITIALIZED;
+
+	if ((stream_flags & 7) == espeakCHARS_WCHAR)
+		length = wcslen((const wchar_t *)text) * sizeof(wchar_t);
+	else
+		length = strlen((const char *)text);
+
+	// the text before the clause which is being read has been spoken, so it
+	// is dropped rather than keeping all of the stream
+	offset = (const char *)stream_position - stream_text;
+	if (offset > 0) {
+		memmove(stream_text, stream_text + offset, stream_length - offset);
+		stream_length -= offset;
+		stream_position = stream_text;
+	}
+
+	if (stream_length + length + sizeof(wchar_t) > stream_size) {
+		size_t new_size = stream_size * 2;
+		char *new_text;
+
+		while (stream_length + length + sizeof(wchar_t) > new_size)
+			new_size *= 2;
+		if ((new_text = realloc(stream_text, new_size)) == NULL)
+			return ENOMEM;
+		stream_text = new_text;
+		stream_size = new_size;
+	}
+	memcpy(stream_text + stream_length, text, length);
+	stream_length += length;
+	memset(stream_text + stream_length, 0, sizeof(wchar_t));
+
+	espeak_ng_STATUS status = DecodeStream(0);
+	if (status != ENS_OK)
+		return status;
+
+	if ((SpeakNextClause(1) == 0) && stream_underrun)
+		return ENS_OK; // the first clause is not complete yet
+	return SynthesizeClauses(my_unique_identifier);
+}
+
+espeak_ng_STATUS sync_espeak_EndStream(void)
+{
+	if (!stream_open)
+		return ENS_NOT_INITIALIZED;
+
+	// the end of the text is now the end of the last clause
+	stream_open = false;
+	espeak_ng_STATUS status = DecodeStream((const char *)stream_position - stream_text);
+	if (status != ENS_OK)
+		return status;
+
+	SpeakNextClause(1);
+	status = SynthesizeClauses(my_unique_identifier);
+	if ((my_mode & ENOUTPUT_MODE_SPEAK_AUDIO) == ENOUTPUT_MODE_SPEAK_AUDIO)
+		end_audio(status);
+	return status;
+}
+
 void MarkerEvent(int type, unsigned int char_position, int value, int value2, unsigned char *out_ptr)
 {
 	// type: 1=word, 2=sentence, 3=named mark, 4=play audio, 5=end, 7=phoneme
 	espeak_EVENT *ep;
 	double time;
 
+	if (option_alignment) {
+		if (type == espeakEVENT_WORD)
+			alignment_word = value;
+		else if (type == espeakEVENT_PHONEME) {
+			AddAlignment(count_samples + mbrola_delay + (out_ptr - out_start)/2, char_position, value, value2);
+			if (!option_phoneme_events)
+				return; // only generated for the alignment
+		}
+	}
+
 	if ((event_list == NULL) || (event_list_ix >= (n_event_list-2)))
 		return;
 
@@ -564,15 +924,8 @@ espeak_ng_STATUS sync_espeak_Synth(unsigned int unique_identifier, const void *t
 	end_character_position = end_position;
 
 	espeak_ng_STATUS aStatus = Synthesize(unique_identifier, text, flags);
-#ifdef HAVE_PCAUDIOLIB_AUDIO_H
-	if ((my_mode & ENOUTPUT_MODE_SPEAK_AUDIO) == ENOUTPUT_MODE_SPEAK_AUDIO) {
-		int error = (aStatus == ENS_SPEECH_STOPPED)
-		          ? audio_object_flush(my_audio)
-		          : audio_object_drain(my_audio);
-		if (error != 0)
-			fprintf(stderr, "error: %s\n", audio_object_strerror(my_audio, error));
-	}
-#endif
+	if ((my_mode & ENOUTPUT_MODE_SPEAK_AUDIO) == ENOUTPUT_MODE_SPEAK_AUDIO)
+		end_audio(aStatus);
 
 	return aStatus;
 }
@@ -702,6 +1055,90 @@ espeak_ng_Synthesize(const void *text, size_t size,
 #endif
 }
 
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_SynthesizeWithPriority(const void *text, size_t size,
+                                 unsigned int flags,
+                                 espeak_ng_PRIORITY priority,
+                                 espeak_ng_PREEMPTION preemption,
+                                 unsigned int *unique_identifier,
+                                 void *user_data)
+{
+	static unsigned int temp_identifier;
+
+	if (unique_identifier == NULL)
+		unique_identifier = &temp_identifier;
+	*unique_identifier = 0;
+
+	if ((priority < ENPRIORITY_NORMAL) || (priority > ENPRIORITY_URGENT) ||
+	    (preemption < ENPREEMPT_NONE) || (preemption > ENPREEMPT_DISCARD))
+		return EINVAL;
+
+	if (my_mode & ENOUTPUT_MODE_SYNCHRONOUS)
+		return sync_espeak_Synth(0, text, 0, POS_CHARACTER, 0, flags, user_data);
+
+#ifdef USE_ASYNC
+	t_espeak_command *c1 = create_espeak_text(text, size, 0, POS_CHARACTER, 0, flags, user_data);
+	if (c1)
+		*unique_identifier = c1->u.my_text.unique_identifier;
+
+	t_espeak_command *c2 = create_espeak_terminated_msg(*unique_identifier, user_data);
+
+	if (c1 && c2) {
+		espeak_ng_STATUS status = fifo_add_priority_commands(c1, c2, priority, preemption);
+		if (status != ENS_OK) {
+			delete_espeak_command(c1);
+			delete_espeak_command(c2);
+		}
+		return status;
+	}
+
+	delete_espeak_command(c1);
+	delete_espeak_command(c2);
+	return ENOMEM;
+#else
+	(void)size; // unused in non-async modes
+	return sync_espeak_Synth(0, text, 0, POS_CHARACTER, 0, flags, user_data);
+#endif
+}
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_GetQueueStats(espeak_ng_PRIORITY priority, espeak_ng_QUEUE_STATS *stats)
+{
+#ifdef USE_ASYNC
+	if ((my_mode & ENOUTPUT_MODE_SYNCHRONOUS) == 0)
+		return fifo_get_stats(priority, stats);
+#else
+	(void)priority; // unused
+	(void)stats; // unused
+#endif
+	return ENS_NOT_SUPPORTED;
+}
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_SetPlaybackBuffer(unsigned int prefill_ms, unsigned int low_water_ms, unsigned int high_water_ms)
+{
+	// used when the audio output is next initialized
+#ifdef USE_ASYNC
+	return playback_set_buffer(prefill_ms, low_water_ms, high_water_ms);
+#else
+	(void)prefill_ms; // unused
+	(void)low_water_ms; // unused
+	(void)high_water_ms; // unused
+	return ENS_NOT_SUPPORTED;
+#endif
+}
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_GetPlaybackStats(espeak_ng_PLAYBACK_STATS *stats)
+{
+#ifdef USE_ASYNC
+	return playback_get_stats(stats);
+#else
+	(void)stats; // unused
+	return ENS_NOT_SUPPORTED;
+#endif
+}
+
 ESPEAK_NG_API espeak_ng_STATUS
 espeak_ng_SynthesizeMark(const void *text,
                          size_t size,
@@ -875,29 +1312,369 @@ ESPEAK_API const char *espeak_TextToPhonemes(const void **textptr, int textmode,
 	return GetTranslatedPhonemeString(phonememode);
 }
 
-ESPEAK_NG_API espeak_ng_STATUS espeak_ng_Cancel(void)
+ESPEAK_NG_API espeak_ng_STATUS espeak_ng_TextToPhonemes(const void *text, int textmode, int phonememode, char *phonemes, size_t size)
+{
+	/* Translate all of the text into phonemes, without synthesizing it.
+	   The phonemes for each clause are written to the phonemes buffer,
+	   separated by newlines. phonememode is as for espeak_TextToPhonemes.
+	   Returns ENOBUFS if the phonemes do not fit into the buffer.
+
+	   This is a wrapper of the translator which espeak_TextToPhonemes uses,
+	   for a whole text. Only espeak_ng_Initialize and a voice are needed,
+	   not espeak_ng_InitializeOutput. The translator is shared with
+	   synthesis, so this must not be called while text is being spoken, or
+	   from more than one thread at a time.
+	 */
+
+	espeak_ng_STATUS status = ENS_OK;
+	const char *clause;
+	size_t length = 0;
+	size_t n;
+
+	if ((phonemes == NULL) || (size == 0))
+		return EINVAL;
+	phonemes[0] = 0;
+
+	if (translator == NULL)
+		return ENS_VOICE_NOT_FOUND; // no voice has been selected
+
+	if (p_decoder == NULL) {
+		if ((p_decoder = create_text_decoder()) == NULL)
+			status = ENOMEM;
+	}
+
+	if (status == ENS_OK)
+		status = text_decoder_decode_string_multibyte(p_decoder, text, translator->encoding, textmode);
+
+	if (status == ENS_OK) {
+		InitText(espeakKEEP_NAMEDATA);
+		while (text_decoder_get_buffer(p_decoder) != NULL) {
+			TranslateClause(translator, NULL, NULL);
+			clause = GetTranslatedPhonemeString(phonememode);
+			if ((n = strlen(clause)) == 0)
+				continue;
+
+			if (length + n + 2 > size) {
+				status = ENOBUFS;
+				break;
+			}
+			if (length > 0)
+				phonemes[length++] = '\n';
+			memcpy(&phonemes[length], clause, n + 1);
+			length += n;
+		}
+	}
+	return status;
+}
+
+ESPEAK_NG_API espeak_ng_STATUS espeak_ng_SetAlignment(int enable)
+{
+	// Record the start and end sample of each phoneme that is spoken, for
+	// espeak_ng_GetAlignment. This does not depend on the size of the audio
+	// buffer, or on espeakINITIALIZE_PHONEME_EVENTS.
+	option_alignment = enable ? 1 : 0;
+	return ENS_OK;
+}
+
+ESPEAK_NG_API const espeak_ng_ALIGNMENT *espeak_ng_GetAlignment(int *count)
+{
+	// The phonemes of the last text that was synthesized. This is valid until
+	// the next text is synthesized.
+	*count = n_alignment;
+	return alignment;
+}
+
+ESPEAK_NG_API espeak_ng_STATUS espeak_ng_SetClauseLength(int length)
+{
+	// Set the limit for the text of a single clause, in UTF-8 bytes. Text
+	// without punctuation is only split into clauses when this is reached.
+	return SetClauseLength(length);
+}
+
+ESPEAK_NG_API espeak_ng_STATUS espeak_ng_SetKlattPrecision(espeak_ng_KLATT_PRECISION precision)
+{
+	// Select double or single precision arithmetic for the filters of the
+	// Klatt voices. This takes effect from the next frame.
+#ifdef INCLUDE_KLATT
+	return KlattSetPrecision(precision);
+#else
+	(void)precision; // unused parameter
+	return ENS_NOT_SUPPORTED;
+#endif
+}
+
+espeak_ng_STATUS sync_espeak_SetEconomy(espeak_ng_ECONOMY level)
 {
+	// Trade the quality of the harmonic synthesizer for less processing, for
+	// audio which is played at a lower sample rate. This should be set before
+	// speaking, as a change restarts the echo.
+	return WavegenSetEconomy(level);
+}
+
+ESPEAK_NG_API espeak_ng_STATUS espeak_ng_SetEconomy(espeak_ng_ECONOMY level)
+{
+	if ((level < ENECONOMY_NONE) || (level > ENECONOMY_HIGH))
+		return EINVAL;
+
 #ifdef USE_ASYNC
-	fifo_stop();
-	event_clear_all();
+	if (my_mode & ENOUTPUT_MODE_SYNCHRONOUS)
+		return sync_espeak_SetEconomy(level);
+
+	// the echo buffer is cleared by the synthesis thread, between the texts
+	// which are queued before and after this
+	t_espeak_command *c = create_espeak_economy(level);
+
+	espeak_ng_STATUS status = fifo_add_command(c);
+	if (status != ENS_OK)
+		delete_espeak_command(c);
+	return status;
+#else
+	return sync_espeak_SetEconomy(level);
 #endif
+}
+
+ESPEAK_NG_API espeak_ng_STATUS espeak_ng_GetFrameCacheStats(espeak_ng_FRAME_CACHE_STATS *stats)
+{
+	if (stats == NULL)
+		return EINVAL;
+	GetSpectCacheStats(stats);
+	return ENS_OK;
+}
+
+ESPEAK_NG_API espeak_ng_STATUS espeak_ng_StartCapture(const char *filename)
+{
+	FILE *f;
+
+	if (filename == NULL)
+		return EINVAL;
+	if ((f = fopen(filename, "wb")) == NULL)
+		return errno;
+	return WavegenStartCapture(f, outbuf_size);
+}
+
+ESPEAK_NG_API espeak_ng_STATUS espeak_ng_StopCapture(void)
+{
+	return WavegenStopCapture();
+}
+
+ESPEAK_NG_API espeak_ng_STATUS espeak_ng_ReplayCapture(const char *filename)
+{
+	// Play the commands of a capture through the wave generator, without the
+	// text processing. This is done in the calling thread, so it is not
+	// available in the asynchronous output modes.
+	FILE *f;
+	espeak_ng_STATUS status;
+	int buffer_size = 0;
+	int old_size = outbuf_size;
+	unsigned char *new_outbuf;
+
+	if ((my_mode & ENOUTPUT_MODE_SYNCHRONOUS) == 0)
+		return ENS_NOT_SUPPORTED;
+	if ((outbuf == NULL) || (event_list == NULL))
+		return ENS_NOT_INITIALIZED;
+	if (filename == NULL)
+		return EINVAL;
+	if ((f = fopen(filename, "rb")) == NULL)
+		return errno;
+
+	count_samples = 0;
+	n_alignment = 0;
+	alignment_word = 0;
+	utterance_cancel_count = __atomic_load_n(&cancel_count, __ATOMIC_ACQUIRE);
+	my_unique_identifier = 0;
+	my_user_data = NULL;
+	WcmdqStop();
+
+	if ((status = WavegenStartReplay(f, &buffer_size)) == ENS_OK) {
+		// split the samples into buffers of the size used by the capture
+		if (buffer_size > outbuf_size) {
+			if ((new_outbuf = (unsigned char *)realloc(outbuf, buffer_size)) == NULL)
+				status = ENOMEM;
+			else
+				out_start = outbuf = new_outbuf;
+		}
+		if (buffer_size > 0)
+			outbuf_size = buffer_size;
+		if (status == ENS_OK)
+			status = ReplayClauses();
+	}
+	WavegenStopReplay();
+	WcmdqStop();
+	fclose(f);
+	outbuf_size = old_size;
 
-#ifdef HAVE_PCAUDIOLIB_AUDIO_H
 	if ((my_mode & ENOUTPUT_MODE_SPEAK_AUDIO) == ENOUTPUT_MODE_SPEAK_AUDIO)
-		audio_object_flush(my_audio);
+		end_audio(status);
+	return status;
+}
+
+espeak_ng_STATUS sync_espeak_SetSampleRate(int rate)
+{
+	// Synthesize at this sample rate instead of the sample rate of phondata.
+	// The sampled sounds are resampled when they are first used at this rate.
+	if (rate == samplerate_native)
+		return ENS_OK;
+
+	WavegenSetSampleRate(rate);
+	VoiceSetSampleRate();
+	return DoVoiceChange(voice); // for the espeakEVENT_SAMPLERATE event
+}
+
+ESPEAK_NG_API espeak_ng_STATUS espeak_ng_SetSampleRate(int rate)
+{
+	if ((rate < 8000) || (rate > 48000))
+		return EINVAL;
+
+#ifdef USE_ASYNC
+	if (my_mode & ENOUTPUT_MODE_SYNCHRONOUS)
+		return sync_espeak_SetSampleRate(rate);
+
+	// the wave generator is changed by the synthesis thread, between the texts
+	// which are queued before and after this
+	t_espeak_command *c = create_espeak_sample_rate(rate);
+
+	espeak_ng_STATUS status = fifo_add_command(c);
+	if (status != ENS_OK)
+		delete_espeak_command(c);
+	return status;
+#else
+	return sync_espeak_SetSampleRate(rate);
 #endif
-	embedded_value[EMBED_T] = 0; // reset echo for pronunciation announcements
+}
 
-	for (int i = 0; i < N_SPEECH_PARAM; i++)
-		SetParameter(i, saved_parameters[i], 0);
+#ifdef USE_ASYNC
+// The stream which espeak_ng_AppendText() and espeak_ng_EndStream() add commands for
+static bool fifo_stream_open = false;
+static unsigned int fifo_stream_identifier = 0;
+static unsigned int fifo_stream_flags = 0;
+static void *fifo_stream_user_data = NULL;
+#endif
 
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_BeginStream(unsigned int flags,
+                      unsigned int *unique_identifier,
+                      void *user_data)
+{
+	// Start speaking text which is given in parts by espeak_ng_AppendText().
+	// Each clause is spoken when the text which follows it has been added.
+	static unsigned int temp_identifier;
+
+	if (unique_identifier == NULL)
+		unique_identifier = &temp_identifier;
+	*unique_identifier = 0;
+
+	if (my_mode & ENOUTPUT_MODE_SYNCHRONOUS)
+		return sync_espeak_BeginStream(0, flags, user_data);
+
+#ifdef USE_ASYNC
+	if ((flags & 7) == espeakCHARS_16BIT)
+		return ENS_UNKNOWN_TEXT_ENCODING;
+
+	t_espeak_command *c = create_espeak_stream(STREAM_BEGIN, NULL, 0, flags, user_data);
+	if (c == NULL)
+		return ENOMEM;
+
+	*unique_identifier = c->u.my_stream.unique_identifier;
+	espeak_ng_STATUS status = fifo_add_command(c);
+	if (status != ENS_OK) {
+		delete_espeak_command(c);
+		return status;
+	}
+
+	fifo_stream_open = true;
+	fifo_stream_identifier = *unique_identifier;
+	fifo_stream_flags = flags;
+	fifo_stream_user_data = user_data;
+	return ENS_OK;
+#else
+	return sync_espeak_BeginStream(0, flags, user_data);
+#endif
+}
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_AppendText(const void *text)
+{
+	if (text == NULL)
+		return EINVAL;
+
+	if (my_mode & ENOUTPUT_MODE_SYNCHRONOUS)
+		return sync_espeak_AppendText(text);
+
+#ifdef USE_ASYNC
+	if (!fifo_stream_open)
+		return ENS_NOT_INITIALIZED;
+
+	size_t size;
+	if ((fifo_stream_flags & 7) == espeakCHARS_WCHAR)
+		size = (wcslen((const wchar_t *)text) + 1) * sizeof(wchar_t);
+	else
+		size = strlen((const char *)text) + 1;
+
+	t_espeak_command *c = create_espeak_stream(STREAM_APPEND, text, size, fifo_stream_flags, NULL);
+	if (c == NULL)
+		return ENOMEM;
+
+	espeak_ng_STATUS status = fifo_add_command(c);
+	if (status != ENS_OK)
+		delete_espeak_command(c);
+	return status;
+#else
+	return sync_espeak_AppendText(text);
+#endif
+}
+
+ESPEAK_NG_API espeak_ng_STATUS
+espeak_ng_EndStream(void)
+{
+	// Speak the rest of the text which has been given to espeak_ng_AppendText().
+	if (my_mode & ENOUTPUT_MODE_SYNCHRONOUS)
+		return sync_espeak_EndStream();
+
+#ifdef USE_ASYNC
+	if (!fifo_stream_open)
+		return ENS_NOT_INITIALIZED;
+
+	t_espeak_command *c1 = create_espeak_stream(STREAM_END, NULL, 0, fifo_stream_flags, NULL);
+	t_espeak_command *c2 = create_espeak_terminated_msg(fifo_stream_identifier, fifo_stream_user_data);
+
+	if (c1 && c2) {
+		espeak_ng_STATUS status = fifo_add_commands(c1, c2);
+		if (status != ENS_OK) {
+			delete_espeak_command(c1);
+			delete_espeak_command(c2);
+		} else
+			fifo_stream_open = false;
+		return status;
+	}
+
+	delete_espeak_command(c1);
+	delete_espeak_command(c2);
+	return ENOMEM;
+#else
+	return sync_espeak_EndStream();
+#endif
+}
+
+ESPEAK_NG_API espeak_ng_STATUS espeak_ng_Cancel(void)
+{
+	__atomic_add_fetch(&cancel_count, 1, __ATOMIC_RELEASE);
+
+	// this also lets the synthesis continue if it is waiting for the audio
+	// to be played, so that it can stop
+	cancel_audio();
+
+#ifdef USE_ASYNC
+	fifo_stop();
+	cancel_audio(); // the samples which were written before the synthesis stopped
+	event_clear_all();
+#endif
 	return ENS_OK;
 }
 
 ESPEAK_API int espeak_IsPlaying(void)
 {
 #ifdef USE_ASYNC
-	return fifo_is_busy();
+	return fifo_is_busy() || playback_is_busy();
 #else
 	return 0;
 #endif
@@ -919,11 +1696,12 @@ ESPEAK_NG_API espeak_ng_STATUS espeak_ng_Terminate(void)
 #ifdef USE_ASYNC
 	fifo_stop();
 	fifo_terminate();
+	playback_terminate();
 	event_terminate();
 #endif
 
 	if ((my_mode & ENOUTPUT_MODE_SPEAK_AUDIO) == ENOUTPUT_MODE_SPEAK_AUDIO) {
-#ifdef HAVE_PCAUDIOLIB_AUDIO_H
+#if defined(HAVE_PCAUDIOLIB_AUDIO_H) && !defined(USE_ASYNC)
 		audio_object_close(my_audio);
 		audio_object_destroy(my_audio);
 		my_audio = NULL;
@@ -937,11 +1715,26 @@ ESPEAK_NG_API espeak_ng_STATUS espeak_ng_Terminate(void)
 	free(outbuf);
 	outbuf = NULL;
 
+	free(alignment);
+	alignment = NULL;
+	n_alignment = max_alignment = 0;
+
+	free(stream_text);
+	stream_text = NULL;
+	stream_length = stream_size = 0;
+	stream_open = false;
+
 	FreePhData();
 	FreeVoiceList();
+	FreeWcmdq();
+	FreeEcho();
+	FreeFramePool();
+	FreeSpectCache();
+	WavegenStopCapture();
 
 	DeleteTranslator(translator);
 	translator = NULL;
+	FreeClauseBuffers();
 
 	if (p_decoder != NULL) {
 		destroy_text_decoder(p_decoder);
@@ -20,6 +20,8 @@
 #ifndef ESPEAK_NG_SPEECH_H
 #define ESPEAK_NG_SPEECH_H
 
+#include <stdbool.h>
+
 #include <espeak-ng/espeak_ng.h>
 
 #include "mbrola.h"
@@ -67,6 +69,7 @@ int LookupMnem(MNEM_TAB *table, const char *string);
 const char *LookupMnemName(MNEM_TAB *table, const int value);
 
 void cancel_audio(void);
+bool SynthesisCancelled(void);
 
 extern char path_home[N_PATH_HOME];    // this is the espeak-ng-data directory
 
@@ -347,7 +347,7 @@ int MbrolaTranslate(PHONEME_LIST *plist, int n_phonemes, bool resume, FILE *f_mb
 	}
 
 	while (phix < n_phonemes) {
-		if (WcmdqFree() < MIN_WCMDQ)
+		if ((WcmdqFree() < MIN_WCMDQ) && !WcmdqGrow())
 			return 1;
 
 		ptr = mbr_buf;
@@ -362,9 +362,9 @@ int MbrolaTranslate(PHONEME_LIST *plist, int n_phonemes, bool resume, FILE *f_mb
 			DoEmbedded(&embedded_ix, p->sourceix);
 
 		if (p->newword & PHLIST_START_OF_SENTENCE)
-			DoMarker(espeakEVENT_SENTENCE, (p->sourceix & 0x7ff) + clause_start_char, 0, count_sentences);
+			DoMarker(espeakEVENT_SENTENCE, (p->sourceix & 0xffff) + clause_start_char, 0, count_sentences);
 		if (p->newword & PHLIST_START_OF_SENTENCE)
-			DoMarker(espeakEVENT_WORD, (p->sourceix & 0x7ff) + clause_start_char, p->sourceix >> 11, clause_start_word + word_count++);
+			DoMarker(espeakEVENT_WORD, (p->sourceix & 0xffff) + clause_start_char, p->sourceix >> 16, clause_start_word + word_count++);
 
 		name = GetMbrName(p, ph, ph_prev, ph_next, &name2, &len_percent, &control);
 		if (control & 1)
@@ -387,7 +387,7 @@ int MbrolaTranslate(PHONEME_LIST *plist, int n_phonemes, bool resume, FILE *f_mb
 		if (ph->code != phonEND_WORD) {
 			char phoneme_name[16];
 			WritePhMnemonic(phoneme_name, p->ph, p, option_phoneme_events & espeakINITIALIZE_PHONEME_IPA, NULL);
-			DoPhonemeMarker(espeakEVENT_PHONEME, (p->sourceix & 0x7ff) + clause_start_char, 0, phoneme_name);
+			DoPhonemeMarker(espeakEVENT_PHONEME, (p->sourceix & 0xffff) + clause_start_char, 0, phoneme_name);
 		}
 
 		ptr += sprintf(ptr, "%s\t", WordToString(name));
@@ -495,8 +495,8 @@ int MbrolaTranslate(PHONEME_LIST *plist, int n_phonemes, bool resume, FILE *f_mb
 				return 0;  // don't get stuck on error
 			if (res == 0)
 				return 1;
-			wcmdq[wcmdq_tail][0] = WCMD_MBROLA_DATA;
-			wcmdq[wcmdq_tail][1] = len;
+			WCMDQ(wcmdq_tail)->cmd = WCMD_MBROLA_DATA;
+			WCMDQ(wcmdq_tail)->length = len;
 			WcmdqInc();
 		}
 
@@ -507,8 +507,8 @@ int MbrolaTranslate(PHONEME_LIST *plist, int n_phonemes, bool resume, FILE *f_mb
 		flush_MBR();
 
 		// flush the mbrola output buffer
-		wcmdq[wcmdq_tail][0] = WCMD_MBROLA_DATA;
-		wcmdq[wcmdq_tail][1] = 500;
+		WCMDQ(wcmdq_tail)->cmd = WCMD_MBROLA_DATA;
+		WCMDQ(wcmdq_tail)->length = 500;
 		WcmdqInc();
 	}
 
@@ -27,10 +27,18 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_SYS_MMAN_H
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <espeak-ng/espeak_ng.h>
 #include <espeak-ng/speak_lib.h>
 #include <espeak-ng/encoding.h>
 
+#include "bundle.h"
 #include "readclause.h"
 #include "synthdata.h"
 
@@ -52,6 +60,7 @@ unsigned char phoneme_tab_flags[N_PHONEME_TAB];   // bit 0: not inherited
 unsigned short *phoneme_index = NULL;
 char *phondata_ptr = NULL;
 unsigned char *wavefile_data = NULL;
+static size_t phondata_mapped = 0; // the size of phondata, if it is mapped rather than read
 static unsigned char *phoneme_tab_data = NULL;
 
 int n_phoneme_tables;
@@ -64,6 +73,36 @@ int wavefile_amp;
 int seq_len_adjust;
 int vowel_transition[4];
 
+// An index of the mnemonics of the phonemes in phoneme_tab, which is built
+// when it is first used after a phoneme table is selected.
+#define N_MNEMONIC_HASH 1024 // a power of 2, more than twice the number of keys
+
+typedef struct {
+	unsigned int mnemonic;
+	short code;    // the first phoneme with this mnemonic, or -1
+	short encode;  // the first phoneme which EncodePhonemes matches to these characters, or -1
+} MNEMONIC_HASH;
+
+static MNEMONIC_HASH mnemonic_hash[N_MNEMONIC_HASH];
+static int mnemonic_empty; // a phoneme which EncodePhonemes matches to no characters, or 0
+static bool mnemonic_index_valid = false;
+
+// The sounds in phondata, resampled to the synthesis sample rate when it is
+// not the sample rate of phondata. A sound is resampled when it is first
+// used, and is kept until the sample rate is changed or phondata is loaded.
+typedef struct {
+	int index; // the offset of the sound in phondata
+	unsigned char *data;
+} RESAMPLED_SOUND;
+
+static int phondata_rate = 0;
+static int resampled_rate = 0; // the sample rate of the sounds in resampled_sounds
+static RESAMPLED_SOUND *resampled_sounds = NULL; // a power of 2 in size, or NULL
+static int n_resampled_sounds = 0;
+static int max_resampled_sounds = 0;
+
+static void FreeResampledSounds(void);
+
 static espeak_ng_STATUS ReadPhFile(void **ptr, const char *fname, int *size, espeak_ng_ERROR_CONTEXT *context)
 {
 	if (!ptr) return EINVAL;
@@ -73,6 +112,20 @@ static espeak_ng_STATUS ReadPhFile(void **ptr, const char *fname, int *size, esp
 	char buf[sizeof(path_home)+40];
 
 	sprintf(buf, "%s%c%s", path_home, PATHSEP, fname);
+	if (IsBundlePath(buf)) {
+		// use the data in place
+		const void *data;
+		espeak_ng_STATUS status = GetBundleFile(buf, &data, &length);
+		if (status != ENS_OK)
+			return create_file_error_context(context, status, buf);
+
+		FreeDataFile(*ptr);
+		*ptr = (void *)data;
+		if (size != NULL)
+			*size = length;
+		return ENS_OK;
+	}
+
 	length = GetFileLength(buf);
 	if (length < 0) // length == -errno
 		return create_file_error_context(context, -length, buf);
@@ -80,8 +133,7 @@ static espeak_ng_STATUS ReadPhFile(void **ptr, const char *fname, int *size, esp
 	if ((f_in = fopen(buf, "rb")) == NULL)
 		return create_file_error_context(context, errno, buf);
 
-	if (*ptr != NULL)
-		free(*ptr);
+	FreeDataFile(*ptr);
 
 	if ((*ptr = malloc(length)) == NULL) {
 		fclose(f_in);
@@ -100,6 +152,49 @@ static espeak_ng_STATUS ReadPhFile(void **ptr, const char *fname, int *size, esp
 	return ENS_OK;
 }
 
+static void FreePhondata(void)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (phondata_mapped != 0) {
+		munmap(phondata_ptr, phondata_mapped);
+		phondata_mapped = 0;
+		phondata_ptr = NULL;
+		return;
+	}
+#endif
+	FreeDataFile(phondata_ptr);
+	phondata_ptr = NULL;
+}
+
+static espeak_ng_STATUS ReadPhondata(espeak_ng_ERROR_CONTEXT *context)
+{
+	// phondata holds the spectra and wave data of the phonemes of every
+	// language, but a process usually speaks only a few of them. It is mapped
+	// rather than read, so that only the pages which are used are loaded.
+	FreePhondata();
+
+#ifdef HAVE_SYS_MMAN_H
+	char buf[sizeof(path_home)+40];
+	struct stat statbuf;
+	int fd;
+
+	sprintf(buf, "%s%c%s", path_home, PATHSEP, "phondata");
+	if (!IsBundlePath(buf) && ((fd = open(buf, O_RDONLY)) >= 0)) {
+		if ((fstat(fd, &statbuf) == 0) && (statbuf.st_size > 0)) {
+			void *data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data != MAP_FAILED) {
+				phondata_ptr = data;
+				phondata_mapped = statbuf.st_size;
+			}
+		}
+		close(fd);
+		if (phondata_ptr != NULL)
+			return ENS_OK;
+	}
+#endif
+	return ReadPhFile((void **)&phondata_ptr, "phondata", NULL, context);
+}
+
 espeak_ng_STATUS LoadPhData(int *srate, espeak_ng_ERROR_CONTEXT *context)
 {
 	int ix;
@@ -114,7 +209,8 @@ espeak_ng_STATUS LoadPhData(int *srate, espeak_ng_ERROR_CONTEXT *context)
 		return status;
 	if ((status = ReadPhFile((void **)&phoneme_index, "phonindex", NULL, context)) != ENS_OK)
 		return status;
-	if ((status = ReadPhFile((void **)&phondata_ptr, "phondata", NULL, context)) != ENS_OK)
+	mnemonic_index_valid = false;
+	if ((status = ReadPhondata(context)) != ENS_OK)
 		return status;
 	if ((status = ReadPhFile((void **)&tunes, "intonations", &length, context)) != ENS_OK)
 		return status;
@@ -132,6 +228,10 @@ espeak_ng_STATUS LoadPhData(int *srate, espeak_ng_ERROR_CONTEXT *context)
 	if (version != version_phdata)
 		return create_version_mismatch_error_context(context, path_home, version, version_phdata);
 
+	FreeResampledSounds();
+	FreeSpectCache(); // the sequences refer to the previous phondata
+	phondata_rate = rate;
+
 	// set up phoneme tables
 	p = phoneme_tab_data;
 	n_phoneme_tables = p[0];
@@ -158,27 +258,128 @@ espeak_ng_STATUS LoadPhData(int *srate, espeak_ng_ERROR_CONTEXT *context)
 
 void FreePhData(void)
 {
-	free(phoneme_tab_data);
-	free(phoneme_index);
-	free(phondata_ptr);
-	free(tunes);
+	FreeDataFile(phoneme_tab_data);
+	FreeDataFile(phoneme_index);
+	FreeResampledSounds();
+	FreePhondata();
+	FreeDataFile(tunes);
 	phoneme_tab_data = NULL;
 	phoneme_index = NULL;
 	phondata_ptr = NULL;
 	tunes = NULL;
 }
 
-int PhonemeCode(unsigned int mnem)
+static MNEMONIC_HASH *FindMnemonic(unsigned int mnem)
 {
+	// Returns the slot for this mnemonic, which is empty if it is not in the index
+	unsigned int ix = (mnem * 2654435761U) >> 22;
+	MNEMONIC_HASH *p;
+
+	for (;;) {
+		p = &mnemonic_hash[ix];
+		if (p->mnemonic == mnem || (p->code < 0 && p->encode < 0))
+			return p;
+		ix = (ix + 1) & (N_MNEMONIC_HASH - 1);
+	}
+}
+
+static void IndexMnemonics(void)
+{
+	// The first phoneme with a mnemonic takes precedence, as in a linear search
+	// of phoneme_tab.
 	int ix;
+	int len;
+	unsigned int mnem;
+	unsigned int c;
+	PHONEME_TAB *ph;
+	MNEMONIC_HASH *p;
+
+	memset(mnemonic_hash, 0xff, sizeof(mnemonic_hash));
+	mnemonic_empty = 0;
 
 	for (ix = 0; ix < n_phoneme_tab; ix++) {
-		if (phoneme_tab[ix] == NULL)
+		if ((ph = phoneme_tab[ix]) == NULL)
+			continue;
+
+		p = FindMnemonic(ph->mnemonic);
+		p->mnemonic = ph->mnemonic;
+		if (p->code < 0)
+			p->code = ph->code;
+
+		if ((ix == 0) || (ph->type == phINVALID))
 			continue;
-		if (phoneme_tab[ix]->mnemonic == mnem)
-			return phoneme_tab[ix]->code;
+
+		// EncodePhonemes matches the characters before the first zero byte, and
+		// stops at a space or control character
+		mnem = 0;
+		for (len = 0; len < 4; len++) {
+			if ((c = (ph->mnemonic >> (len*8)) & 0xff) == 0)
+				break;
+			if (c <= ' ')
+				break;
+			mnem |= (c << (len*8));
+		}
+		if ((len < 4) && (c != 0))
+			continue; // can not be matched
+
+		if (len == 0) {
+			if (mnemonic_empty == 0)
+				mnemonic_empty = ph->code;
+			continue;
+		}
+
+		p = FindMnemonic(mnem);
+		p->mnemonic = mnem;
+		if (p->encode < 0)
+			p->encode = ph->code;
 	}
-	return 0;
+	mnemonic_index_valid = true;
+}
+
+int PhonemeCode(unsigned int mnem)
+{
+	MNEMONIC_HASH *p;
+
+	if (!mnemonic_index_valid)
+		IndexMnemonics();
+
+	p = FindMnemonic(mnem);
+	if (p->code < 0)
+		return 0;
+	return p->code;
+}
+
+int MatchPhonemeMnemonic(const char *string, int *length)
+{
+	// Returns the valid phoneme of the current phoneme table with the longest
+	// mnemonic which matches the start of string, or 0 if none match.
+	// *length is set to the number of characters matched.
+	int len;
+	int n_chars;
+	unsigned int c;
+	unsigned int mnem = 0;
+	MNEMONIC_HASH *p;
+
+	if (!mnemonic_index_valid)
+		IndexMnemonics();
+
+	for (n_chars = 0; n_chars < 4; n_chars++) {
+		if ((c = (unsigned char)string[n_chars]) <= ' ')
+			break;
+		mnem |= (c << (n_chars*8));
+	}
+
+	for (len = n_chars; len > 0; len--) {
+		p = FindMnemonic(mnem);
+		if (p->encode > 0) {
+			*length = len;
+			return p->encode;
+		}
+		mnem &= ~(0xff << ((len-1)*8));
+	}
+
+	*length = 0;
+	return mnemonic_empty;
 }
 
 int LookupPhonemeString(const char *string)
@@ -331,6 +532,147 @@ unsigned char *GetEnvelope(int index)
 	return (unsigned char *)&phondata_ptr[index];
 }
 
+void ResampleSamples(const int *in, int n_in, int rate, unsigned char *out, int n_out)
+{
+	// Resample by linear interpolation, averaging over each output step when
+	// the sample rate is reduced. in[n_in] repeats the last sample.
+	double step = (double)rate / samplerate;
+	double x;
+	int ix;
+
+	for (ix = 0, x = 0; ix < n_out; ix++, x += step) {
+		int i1 = (int)x;
+		int value;
+
+		if (step > 1.0) {
+			int i2 = (int)(x + step);
+			int sum = 0;
+			int j;
+
+			if (i2 > n_in) i2 = n_in;
+			for (j = i1; j < i2; j++)
+				sum += in[j];
+			value = (i2 > i1) ? sum / (i2 - i1) : in[i1];
+		} else
+			value = in[i1] + (int)((in[i1+1] - in[i1]) * (x - i1));
+
+		if (value > 32767) value = 32767;
+		else if (value < -32768) value = -32768;
+		out[ix*2] = value & 0xff;
+		out[ix*2+1] = (value >> 8) & 0xff;
+	}
+}
+
+static void FreeResampledSounds(void)
+{
+	int ix;
+
+	for (ix = 0; ix < max_resampled_sounds; ix++)
+		free(resampled_sounds[ix].data);
+	free(resampled_sounds);
+	resampled_sounds = NULL;
+	n_resampled_sounds = max_resampled_sounds = 0;
+}
+
+static RESAMPLED_SOUND *FindResampledSound(int index)
+{
+	// Returns the slot for this sound, which is empty if it has not been resampled
+	unsigned int ix = (((unsigned int)index * 2654435761U) >> 12) & (max_resampled_sounds - 1);
+	RESAMPLED_SOUND *p;
+
+	for (;;) {
+		p = &resampled_sounds[ix];
+		if ((p->data == NULL) || (p->index == index))
+			return p;
+		ix = (ix + 1) & (max_resampled_sounds - 1);
+	}
+}
+
+static espeak_ng_STATUS GrowResampledSounds(void)
+{
+	RESAMPLED_SOUND *old = resampled_sounds;
+	int n_old = max_resampled_sounds;
+	int ix;
+
+	resampled_sounds = (RESAMPLED_SOUND *)calloc(n_old > 0 ? n_old * 2 : 256, sizeof(RESAMPLED_SOUND));
+	if (resampled_sounds == NULL) {
+		resampled_sounds = old;
+		return ENOMEM;
+	}
+	max_resampled_sounds = n_old > 0 ? n_old * 2 : 256;
+
+	for (ix = 0; ix < n_old; ix++) {
+		if (old[ix].data != NULL)
+			*FindResampledSound(old[ix].index) = old[ix];
+	}
+	free(old);
+	return ENS_OK;
+}
+
+unsigned char *GetSound(int index)
+{
+	// Returns the sound at this offset in phondata, at the synthesis sample
+	// rate, or NULL if there is not enough memory to resample it.
+	//
+	// The sound starts with a 4 byte header: bits 0-15 of its length in bytes
+	// in bytes 0 and 1, the scale factor of 8 bit samples (or 0 for 16 bit
+	// samples) in byte 2, and bits 16-23 of the length in byte 3.
+	RESAMPLED_SOUND *p;
+	unsigned char *sound = &wavefile_data[index];
+	unsigned char *data;
+	int *in;
+	int n_in;
+	int n_out;
+	int scale;
+	int ix;
+
+	if ((samplerate == phondata_rate) || (phondata_rate == 0))
+		return sound;
+
+	if (resampled_rate != samplerate) {
+		FreeResampledSounds();
+		resampled_rate = samplerate;
+	}
+	if ((n_resampled_sounds * 2 >= max_resampled_sounds) && (GrowResampledSounds() != ENS_OK))
+		return NULL;
+
+	p = FindResampledSound(index);
+	if (p->data != NULL)
+		return p->data;
+
+	// the samples at 16 bit scale
+	scale = sound[2];
+	n_in = sound[0] + (sound[1] << 8) + (sound[3] << 16);
+	if (scale == 0)
+		n_in /= 2;
+	if ((in = (int *)malloc((n_in + 1) * sizeof(int))) == NULL)
+		return NULL;
+	for (ix = 0; ix < n_in; ix++) {
+		if (scale == 0)
+			in[ix] = (short)(sound[4+ix*2] + (sound[5+ix*2] << 8));
+		else
+			in[ix] = (signed char)sound[4+ix] * scale;
+	}
+	in[n_in] = n_in > 0 ? in[n_in-1] : 0;
+
+	n_out = (int)((double)n_in * samplerate / phondata_rate);
+	if ((data = (unsigned char *)malloc(4 + n_out * 2 + 2)) == NULL) {
+		free(in);
+		return NULL;
+	}
+	data[0] = (n_out * 2) & 0xff;
+	data[1] = ((n_out * 2) >> 8) & 0xff;
+	data[2] = 0;
+	data[3] = ((n_out * 2) >> 16) & 0xff;
+	ResampleSamples(in, n_in, phondata_rate, &data[4], n_out);
+	free(in);
+
+	p->index = index;
+	p->data = data;
+	n_resampled_sounds++;
+	return data;
+}
+
 static void SetUpPhonemeTable(int number, bool recursing)
 {
 	int ix;
@@ -361,9 +703,15 @@ static void SetUpPhonemeTable(int number, bool recursing)
 
 void SelectPhonemeTable(int number)
 {
+	int prev_n_phoneme_tab = n_phoneme_tab;
+
 	n_phoneme_tab = 0;
 	SetUpPhonemeTable(number, false); // recursively for included phoneme tables
 	n_phoneme_tab++;
+
+	// selecting the same table again leaves phoneme_tab unchanged
+	if ((number != current_phoneme_table) || (n_phoneme_tab != prev_n_phoneme_tab))
+		mnemonic_index_valid = false;
 	current_phoneme_table = number;
 }
 
@@ -411,7 +759,7 @@ void LoadConfig(void)
 	}
 
 	sprintf(buf, "%s%c%s", path_home, PATHSEP, "config");
-	if ((f = fopen(buf, "r")) == NULL)
+	if ((f = OpenDataFile(buf, "r")) == NULL)
 		return;
 
 	while (fgets(buf, sizeof(buf), f) != NULL) {
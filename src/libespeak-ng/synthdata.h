@@ -40,6 +40,7 @@ void InterpretPhoneme2(int phcode,
 
 void FreePhData(void);
 unsigned char *GetEnvelope(int index);
+unsigned char *GetSound(int index);
 espeak_ng_STATUS LoadPhData(int *srate, espeak_ng_ERROR_CONTEXT *context);
 void LoadConfig(void);
 int LookupPhonemeString(const char *string);
@@ -50,8 +51,10 @@ frameref_t *LookupSpect(PHONEME_TAB *this_ph,
 		int *n_frames,
 		PHONEME_LIST *plist);
 
+int MatchPhonemeMnemonic(const char *string, int *length);
 int NumInstnWords(unsigned short *prog);
 int PhonemeCode(unsigned int mnem);
+void ResampleSamples(const int *in, int n_in, int rate, unsigned char *out, int n_out);
 void SelectPhonemeTable(int number);
 int  SelectPhonemeTableName(const char *name);
 
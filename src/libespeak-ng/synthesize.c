@@ -35,10 +35,12 @@
 #include "dictionary.h"
 #include "intonation.h"
 #include "mbrola.h"
+#include "readclause.h"
 #include "setlengths.h"
 #include "synthdata.h"
 #include "wavegen.h"
 
+#include "speech.h"
 #include "phoneme.h"
 #include "voice.h"
 #include "synthesize.h"
@@ -49,7 +51,8 @@ static void SmoothSpect(void);
 
 // list of phonemes in a clause
 int n_phoneme_list = 0;
-PHONEME_LIST phoneme_list[N_PHONEME_LIST+1];
+int n_phoneme_list_max = 0;
+PHONEME_LIST *phoneme_list = NULL; // allocated with the clause buffers, see TranslateClause()
 
 SPEED_FACTORS speed;
 
@@ -106,8 +109,8 @@ void SynthesizeInit()
 static void EndAmplitude(void)
 {
 	if (amp_length > 0) {
-		if (wcmdq[last_amp_cmd][1] == 0)
-			wcmdq[last_amp_cmd][1] = amp_length;
+		if (WCMDQ(last_amp_cmd)->length == 0)
+			WCMDQ(last_amp_cmd)->length = amp_length;
 		amp_length = 0;
 	}
 }
@@ -116,8 +119,8 @@ static void EndPitch(int voice_break)
 {
 	// posssible end of pitch envelope, fill in the length
 	if ((pitch_length > 0) && (last_pitch_cmd >= 0)) {
-		if (wcmdq[last_pitch_cmd][1] == 0)
-			wcmdq[last_pitch_cmd][1] = pitch_length;
+		if (WCMDQ(last_pitch_cmd)->length == 0)
+			WCMDQ(last_pitch_cmd)->length = pitch_length;
 		pitch_length = 0;
 	}
 
@@ -133,22 +136,22 @@ static void EndPitch(int voice_break)
 
 static void DoAmplitude(int amp, unsigned char *amp_env)
 {
-	intptr_t *q;
+	wcmd_t *q;
 
 	last_amp_cmd = wcmdq_tail;
 	amp_length = 0; // total length of vowel with this amplitude envelope
 
-	q = wcmdq[wcmdq_tail];
-	q[0] = WCMD_AMPLITUDE;
-	q[1] = 0; // fill in later from amp_length
-	q[2] = (intptr_t)amp_env;
-	q[3] = amp;
+	q = WCMDQ(wcmdq_tail);
+	q->cmd = WCMD_AMPLITUDE;
+	q->length = 0; // fill in later from amp_length
+	q->u.env.env = amp_env;
+	q->u.env.value1 = amp;
 	WcmdqInc();
 }
 
 static void DoPitch(unsigned char *env, int pitch1, int pitch2)
 {
-	intptr_t *q;
+	wcmd_t *q;
 
 	EndPitch(0);
 
@@ -164,11 +167,12 @@ static void DoPitch(unsigned char *env, int pitch1, int pitch2)
 	if (pitch2 < 0)
 		pitch2 = 0;
 
-	q = wcmdq[wcmdq_tail];
-	q[0] = WCMD_PITCH;
-	q[1] = 0; // length, fill in later from pitch_length
-	q[2] = (intptr_t)env;
-	q[3] = (pitch1 << 16) + pitch2;
+	q = WCMDQ(wcmdq_tail);
+	q->cmd = WCMD_PITCH;
+	q->length = 0; // length, fill in later from pitch_length
+	q->u.env.env = env;
+	q->u.env.value1 = pitch1;
+	q->u.env.value2 = pitch2;
 	WcmdqInc();
 }
 
@@ -211,14 +215,14 @@ static void DoPause(int length, int control)
 	}
 
 	EndPitch(1);
-	wcmdq[wcmdq_tail][0] = WCMD_PAUSE;
-	wcmdq[wcmdq_tail][1] = len;
+	WCMDQ(wcmdq_tail)->cmd = WCMD_PAUSE;
+	WCMDQ(wcmdq_tail)->length = len;
 	WcmdqInc();
 	last_frame = NULL;
 
 	if (fmt_amplitude != 0) {
-		wcmdq[wcmdq_tail][0] = WCMD_FMT_AMPLITUDE;
-		wcmdq[wcmdq_tail][1] = fmt_amplitude = 0;
+		WCMDQ(wcmdq_tail)->cmd = WCMD_FMT_AMPLITUDE;
+		WCMDQ(wcmdq_tail)->u.value = fmt_amplitude = 0;
 		WcmdqInc();
 	}
 }
@@ -233,13 +237,15 @@ static int DoSample2(int index, int which, int std_length, int control, int leng
 	int min_length;
 	int x;
 	int len4;
-	intptr_t *q;
+	wcmd_t *q;
 	unsigned char *p;
+	unsigned char *data;
 
 	index = index & 0x7fffff;
-	p = &wavefile_data[index];
+	if ((p = GetSound(index)) == NULL)
+		return 0;
 	wav_scale = p[2];
-	wav_length = (p[1] * 256);
+	wav_length = (p[3] << 16) + (p[1] * 256);
 	wav_length += p[0]; // length in bytes
 
 	if (wav_length == 0)
@@ -292,16 +298,18 @@ static int DoSample2(int index, int which, int std_length, int control, int leng
 
 	len4 = wav_length / 4;
 
-	index += 4;
+	data = &p[4];
 
 	if (which & 0x100) {
 		// mix this with synthesised wave
 		last_wcmdq = wcmdq_tail;
-		q = wcmdq[wcmdq_tail];
-		q[0] = WCMD_WAVE2;
-		q[1] = length | (wav_length << 16); // length in samples
-		q[2] = (intptr_t)(&wavefile_data[index]);
-		q[3] = wav_scale + (amp << 8);
+		q = WCMDQ(wcmdq_tail);
+		q->cmd = WCMD_WAVE2;
+		q->length = length; // length in samples
+		q->u.wave.wav_length = wav_length;
+		q->u.wave.data = data;
+		q->u.wave.scale = wav_scale;
+		q->u.wave.amp = amp;
 		WcmdqInc();
 		return length;
 	}
@@ -315,11 +323,12 @@ static int DoSample2(int index, int which, int std_length, int control, int leng
 	}
 
 	last_wcmdq = wcmdq_tail;
-	q = wcmdq[wcmdq_tail];
-	q[0] = WCMD_WAVE;
-	q[1] = x; // length in samples
-	q[2] = (intptr_t)(&wavefile_data[index]);
-	q[3] = wav_scale + (amp << 8);
+	q = WCMDQ(wcmdq_tail);
+	q->cmd = WCMD_WAVE;
+	q->length = x; // length in samples
+	q->u.wave.data = data;
+	q->u.wave.scale = wav_scale;
+	q->u.wave.amp = amp;
 	WcmdqInc();
 
 	while (length > len4*3) {
@@ -328,11 +337,12 @@ static int DoSample2(int index, int which, int std_length, int control, int leng
 			x *= 2;
 
 		last_wcmdq = wcmdq_tail;
-		q = wcmdq[wcmdq_tail];
-		q[0] = WCMD_WAVE;
-		q[1] = len4*2; // length in samples
-		q[2] = (intptr_t)(&wavefile_data[index+x]);
-		q[3] = wav_scale + (amp << 8);
+		q = WCMDQ(wcmdq_tail);
+		q->cmd = WCMD_WAVE;
+		q->length = len4*2; // length in samples
+		q->u.wave.data = &data[x];
+		q->u.wave.scale = wav_scale;
+		q->u.wave.amp = amp;
 		WcmdqInc();
 
 		length -= len4*2;
@@ -343,11 +353,12 @@ static int DoSample2(int index, int which, int std_length, int control, int leng
 		if (wav_scale == 0)
 			x *= 2;
 		last_wcmdq = wcmdq_tail;
-		q = wcmdq[wcmdq_tail];
-		q[0] = WCMD_WAVE;
-		q[1] = length; // length in samples
-		q[2] = (intptr_t)(&wavefile_data[index+x]);
-		q[3] = wav_scale + (amp << 8);
+		q = WCMDQ(wcmdq_tail);
+		q->cmd = WCMD_WAVE;
+		q->length = length; // length in samples
+		q->u.wave.data = &data[x];
+		q->u.wave.scale = wav_scale;
+		q->u.wave.amp = amp;
 		WcmdqInc();
 	}
 
@@ -380,20 +391,85 @@ int DoSample3(PHONEME_DATA *phdata, int length_mod, int amp)
 	return len;
 }
 
+// Temporary spectrum frames which are referenced from the wavegen queue. These
+// are allocated in blocks as a clause is generated, and are reused for the next
+// clause once wavegen has finished with them. The frames are aligned to a cache
+// line, so that reading a frame_t (64 bytes) does not touch two lines.
+#define N_FRAME_BLOCK 128
+#define FRAME_ALIGN   64
+typedef struct frame_block {
+	frame_t frames[N_FRAME_BLOCK];
+	struct frame_block *next;
+	unsigned char *data; // as returned by malloc, NULL for the first block
+} FRAME_BLOCK;
+
+static unsigned char frame_pool_data[sizeof(FRAME_BLOCK) + FRAME_ALIGN];
+static FRAME_BLOCK *frame_pool = NULL; // the first block, any others are allocated when needed
+static FRAME_BLOCK *frame_block = NULL;
+static int frame_ix = 0;
+
+static FRAME_BLOCK *AlignFrameBlock(unsigned char *data)
+{
+	return (FRAME_BLOCK *)(((uintptr_t)data + FRAME_ALIGN - 1) & ~(uintptr_t)(FRAME_ALIGN - 1));
+}
+
 static frame_t *AllocFrame()
 {
-	// Allocate a temporary spectrum frame for the wavegen queue. Use a pool which is big
-	// enough to use a round-robin without checks.
+	// Allocate a temporary spectrum frame for the wavegen queue.
 	// Only needed for modifying spectra for blending to consonants
 
-	#define N_FRAME_POOL N_WCMDQ
-	static int ix = 0;
-	static frame_t frame_pool[N_FRAME_POOL];
+	FRAME_BLOCK *block;
+	unsigned char *data;
 
-	ix++;
-	if (ix >= N_FRAME_POOL)
-		ix = 0;
-	return &frame_pool[ix];
+	if (frame_pool == NULL) {
+		frame_pool = frame_block = AlignFrameBlock(frame_pool_data);
+		frame_pool->next = NULL;
+		frame_pool->data = NULL;
+		frame_ix = 0;
+	}
+
+	if (frame_ix >= N_FRAME_BLOCK) {
+		if ((block = frame_block->next) == NULL) {
+			if ((data = (unsigned char *)malloc(sizeof(FRAME_BLOCK) + FRAME_ALIGN)) != NULL) {
+				block = AlignFrameBlock(data);
+				block->data = data;
+				block->next = NULL;
+				frame_block->next = block;
+			} else
+				block = frame_pool; // out of memory, reuse the oldest frames
+		}
+		frame_block = block;
+		frame_ix = 0;
+	}
+	return &frame_block->frames[frame_ix++];
+}
+
+static void ResetFramePool(void)
+{
+	// Reuse the frames, unless some are still referenced from the wavegen queue
+	int ix;
+
+	for (ix = wcmdq_head; ix < wcmdq_tail; ix++) {
+		if (WCMDQ(ix)->cmd <= WCMD_SPECT2)
+			return;
+	}
+	frame_block = frame_pool;
+	frame_ix = 0;
+}
+
+void FreeFramePool(void)
+{
+	FRAME_BLOCK *block;
+
+	if (frame_pool == NULL)
+		return;
+
+	while ((block = frame_pool->next) != NULL) {
+		frame_pool->next = block->next;
+		free(block->data);
+	}
+	frame_block = frame_pool;
+	frame_ix = 0;
 }
 
 static void set_frame_rms(frame_t *fr, int new_rms)
@@ -539,6 +615,8 @@ static int VowelCloseness(frame_t *fr)
 	return 0;
 }
 
+static bool transition_pause = false; // FormantTransition2() has added a pause
+
 int FormantTransition2(frameref_t *seq, int *n_frames, unsigned int data1, unsigned int data2, PHONEME_TAB *other_ph, int which)
 {
 	int ix;
@@ -658,8 +736,10 @@ int FormantTransition2(frameref_t *seq, int *n_frames, unsigned int data1, unsig
 			fr->frflags |= FRFLAG_BREAK; // don't merge with next frame
 	}
 
-	if (flags & 0x40)
+	if (flags & 0x40) {
 		DoPause(20, 0); // add a short pause after the consonant
+		transition_pause = true;
+	}
 
 	if (flags & 16)
 		return len;
@@ -670,7 +750,7 @@ static void SmoothSpect(void)
 {
 	// Limit the rate of frequence change of formants, to reduce chirping
 
-	intptr_t *q;
+	wcmd_t *q;
 	frame_t *frame;
 	frame_t *frame2;
 	frame_t *frame1;
@@ -690,30 +770,28 @@ static void SmoothSpect(void)
 		return;
 	}
 
-	q = wcmdq[syllable_centre];
-	frame_centre = (frame_t *)q[2];
+	q = WCMDQ(syllable_centre);
+	frame_centre = q->u.spect.frame1;
 
 	// backwards
-	ix = syllable_centre -1;
 	frame = frame2 = frame_centre;
-	for (;;) {
-		if (ix < 0) ix = N_WCMDQ-1;
-		q = wcmdq[ix];
+	for (ix = syllable_centre-1; ix >= syllable_start; ix--) {
+		q = WCMDQ(ix);
 
-		if (q[0] == WCMD_PAUSE || q[0] == WCMD_WAVE)
+		if (q->cmd == WCMD_PAUSE || q->cmd == WCMD_WAVE)
 			break;
 
-		if (q[0] <= WCMD_SPECT2) {
-			len = q[1] & 0xffff;
+		if (q->cmd <= WCMD_SPECT2) {
+			len = q->length;
 
-			frame1 = (frame_t *)q[3];
+			frame1 = q->u.spect.frame2;
 			if (frame1 == frame) {
-				q[3] = (intptr_t)frame2;
+				q->u.spect.frame2 = frame2;
 				frame1 = frame2;
 			} else
 				break; // doesn't follow on from previous frame
 
-			frame = frame2 = (frame_t *)q[2];
+			frame = frame2 = q->u.spect.frame1;
 			modified = false;
 
 			if (frame->frflags & FRFLAG_BREAK)
@@ -748,46 +826,40 @@ static void SmoothSpect(void)
 						modified = true;
 					}
 					frame2->ffreq[pk] = frame1->ffreq[pk] + allowed;
-					q[2] = (intptr_t)frame2;
+					q->u.spect.frame1 = frame2;
 				} else if (diff < -allowed) {
 					if (modified == false) {
 						frame2 = CopyFrame(frame, 0);
 						modified = true;
 					}
 					frame2->ffreq[pk] = frame1->ffreq[pk] - allowed;
-					q[2] = (intptr_t)frame2;
+					q->u.spect.frame1 = frame2;
 				}
 			}
 		}
-
-		if (ix == syllable_start)
-			break;
-		ix--;
 	}
 
 	// forwards
-	ix = syllable_centre;
-
 	frame = NULL;
-	for (;;) {
-		q = wcmdq[ix];
+	for (ix = syllable_centre; ix < syllable_end; ix++) {
+		q = WCMDQ(ix);
 
-		if (q[0] == WCMD_PAUSE || q[0] == WCMD_WAVE)
+		if (q->cmd == WCMD_PAUSE || q->cmd == WCMD_WAVE)
 			break;
 
-		if (q[0] <= WCMD_SPECT2) {
-			len = q[1] & 0xffff;
+		if (q->cmd <= WCMD_SPECT2) {
+			len = q->length;
 
-			frame1 = (frame_t *)q[2];
+			frame1 = q->u.spect.frame1;
 			if (frame != NULL) {
 				if (frame1 == frame) {
-					q[2] = (intptr_t)frame2;
+					q->u.spect.frame1 = frame2;
 					frame1 = frame2;
 				} else
 					break; // doesn't follow on from previous frame
 			}
 
-			frame = frame2 = (frame_t *)q[3];
+			frame = frame2 = q->u.spect.frame2;
 			modified = false;
 
 			if (frame1->frflags & FRFLAG_BREAK)
@@ -815,27 +887,178 @@ static void SmoothSpect(void)
 						modified = true;
 					}
 					frame2->ffreq[pk] = frame1->ffreq[pk] + allowed;
-					q[3] = (intptr_t)frame2;
+					q->u.spect.frame2 = frame2;
 				} else if (diff < -allowed) {
 					if (modified == false) {
 						frame2 = CopyFrame(frame, 0);
 						modified = true;
 					}
 					frame2->ffreq[pk] = frame1->ffreq[pk] - allowed;
-					q[3] = (intptr_t)frame2;
+					q->u.spect.frame2 = frame2;
 				}
 			}
 		}
-
-		ix++;
-		if (ix >= N_WCMDQ) ix = 0;
-		if (ix == syllable_end)
-			break;
 	}
 
 	syllable_start = syllable_end;
 }
 
+// The spectrum sequences from LookupSpect(), which are the same each time that
+// a phoneme is spoken in the same context. The frames which LookupSpect() has
+// modified for the context are kept with the sequence, and are copied into the
+// frame pool each time that it is used, as SmoothSpect() modifies copied frames
+// in place. The other frames are in phondata.
+#define N_SPECT_CACHE 1024 // a power of 2
+
+typedef struct {
+	FMT_PARAMS fmt; // without the amplitudes and wav_addr, which are not used
+	int which;
+	int vowel;
+	int lengthen;   // 1 + the length of phonLENGTHEN, if this phoneme is lengthened
+	int klatt;
+	int formant_factor;
+} SPECT_KEY;
+
+typedef struct {
+	SPECT_KEY key;
+	frameref_t *frames; // n_frames, followed by n_copied copies of modified frames
+	short n_frames;
+	short n_copied;
+	bool pause;
+	int seq_len_adjust;
+	int modn_flags;
+} SPECT_CACHE;
+
+static SPECT_CACHE *spect_cache = NULL;
+static bool spect_cache_enabled = true;
+static espeak_ng_FRAME_CACHE_STATS spect_cache_stats;
+
+void FreeSpectCache(void)
+{
+	int ix;
+
+	if (spect_cache != NULL) {
+		for (ix = 0; ix < N_SPECT_CACHE; ix++)
+			free(spect_cache[ix].frames);
+		free(spect_cache);
+		spect_cache = NULL;
+	}
+	memset(&spect_cache_stats, 0, sizeof(spect_cache_stats));
+}
+
+void SetSpectCache(bool enable)
+{
+	spect_cache_enabled = enable;
+}
+
+void GetSpectCacheStats(espeak_ng_FRAME_CACHE_STATS *stats)
+{
+	memcpy(stats, &spect_cache_stats, sizeof(spect_cache_stats));
+}
+
+static frameref_t *LookupSpectCached(PHONEME_TAB *this_ph, int which, FMT_PARAMS *fmt_params, int *n_frames, PHONEME_LIST *plist)
+{
+	static frameref_t frames_buf[N_SEQ_FRAMES];
+	SPECT_KEY key;
+	SPECT_CACHE *c;
+	frameref_t *frames;
+	frame_t *copies;
+	unsigned int hash;
+	int ix;
+	int jx;
+	int n_copied;
+
+	if (!spect_cache_enabled)
+		return LookupSpect(this_ph, which, fmt_params, n_frames, plist);
+
+	if ((spect_cache == NULL) && ((spect_cache = (SPECT_CACHE *)calloc(N_SPECT_CACHE, sizeof(SPECT_CACHE))) == NULL))
+		return LookupSpect(this_ph, which, fmt_params, n_frames, plist);
+
+	memset(&key, 0, sizeof(key));
+	key.fmt = *fmt_params;
+	key.fmt.fmt_amp = 0;
+	key.fmt.wav_addr = 0;
+	key.fmt.wav_amp = 0;
+	key.which = which;
+	key.vowel = (this_ph->type == phVOWEL);
+	if (plist->synthflags & SFLAG_LENGTHEN)
+		key.lengthen = 1 + phoneme_tab[phonLENGTHEN]->std_length;
+	key.klatt = voice->klattv[0];
+	key.formant_factor = voice->formant_factor;
+
+	hash = key.fmt.fmt_addr;
+	hash = (hash * 31) + key.fmt.fmt2_addr;
+	hash = (hash * 31) + key.fmt.transition0;
+	hash = (hash * 31) + key.fmt.transition1;
+	hash = (hash * 31) + key.fmt.std_length;
+	hash = (hash * 31) + key.fmt.fmt_length + (key.which << 8) + (key.lengthen << 12);
+	hash ^= hash >> 15;
+	hash *= 2246822519U;
+	hash ^= hash >> 13;
+	c = &spect_cache[hash & (N_SPECT_CACHE - 1)];
+
+	spect_cache_stats.lookups++;
+	if ((c->frames != NULL) && (memcmp(&c->key, &key, sizeof(key)) == 0)) {
+		spect_cache_stats.hits++;
+		memcpy(frames_buf, c->frames, c->n_frames * sizeof(frameref_t));
+		copies = (frame_t *)&c->frames[c->n_frames];
+		for (ix = 0; ix < c->n_frames; ix++) {
+			if ((frames_buf[ix].frame < copies) || (frames_buf[ix].frame >= copies + c->n_copied))
+				continue;
+			for (jx = 0; jx < ix; jx++) {
+				if (c->frames[jx].frame == c->frames[ix].frame)
+					break;
+			}
+			if (jx < ix)
+				frames_buf[ix].frame = frames_buf[jx].frame; // the same copy as an earlier frame
+			else if ((frames_buf[ix].frame = AllocFrame()) != NULL)
+				memcpy(frames_buf[ix].frame, c->frames[ix].frame, sizeof(frame_t));
+		}
+		seq_len_adjust = c->seq_len_adjust;
+		modn_flags = c->modn_flags;
+		if (c->pause)
+			DoPause(20, 0); // as added by FormantTransition2()
+		*n_frames = c->n_frames;
+		return frames_buf;
+	}
+
+	transition_pause = false;
+	if ((frames = LookupSpect(this_ph, which, fmt_params, n_frames, plist)) == NULL)
+		return NULL;
+	if (*n_frames > N_SEQ_FRAMES)
+		return frames;
+
+	// keep the sequence, with copies of the frames which are in the frame pool
+	n_copied = 0;
+	for (ix = 0; ix < *n_frames; ix++) {
+		if (frames[ix].frame->frflags & FRFLAG_COPIED)
+			n_copied++;
+	}
+	if (c->frames != NULL) {
+		free(c->frames);
+		spect_cache_stats.entries--;
+		spect_cache_stats.evictions++;
+	}
+	if ((c->frames = (frameref_t *)malloc(*n_frames * sizeof(frameref_t) + n_copied * sizeof(frame_t))) == NULL)
+		return frames;
+	spect_cache_stats.entries++;
+	memcpy(c->frames, frames, *n_frames * sizeof(frameref_t));
+	copies = (frame_t *)&c->frames[*n_frames];
+	for (ix = 0, n_copied = 0; ix < *n_frames; ix++) {
+		if (frames[ix].frame->frflags & FRFLAG_COPIED) {
+			memcpy(&copies[n_copied], frames[ix].frame, sizeof(frame_t));
+			c->frames[ix].frame = &copies[n_copied++];
+		}
+	}
+	c->key = key;
+	c->n_frames = *n_frames;
+	c->n_copied = n_copied;
+	c->pause = transition_pause;
+	c->seq_len_adjust = seq_len_adjust;
+	c->modn_flags = modn_flags;
+	return frames;
+}
+
 static void StartSyllable(void)
 {
 	// start of syllable, if not already started
@@ -856,7 +1079,7 @@ int DoSpect2(PHONEME_TAB *this_ph, int which, FMT_PARAMS *fmt_params,  PHONEME_L
 	frame_t *frame2;
 	frame_t *fr;
 	int ix;
-	intptr_t *q;
+	wcmd_t *q;
 	int len;
 	int frame_length;
 	int length_factor;
@@ -889,15 +1112,15 @@ int DoSpect2(PHONEME_TAB *this_ph, int which, FMT_PARAMS *fmt_params,  PHONEME_L
 	}
 
 	modn_flags = 0;
-	frames = LookupSpect(this_ph, which, fmt_params, &n_frames, plist);
+	frames = LookupSpectCached(this_ph, which, fmt_params, &n_frames, plist);
 	if (frames == NULL)
 		return 0; // not found
 
 	if (fmt_params->fmt_amp != fmt_amplitude) {
 		// an amplitude adjustment is specified for this sequence
-		q = wcmdq[wcmdq_tail];
-		q[0] = WCMD_FMT_AMPLITUDE;
-		q[1] = fmt_amplitude = fmt_params->fmt_amp;
+		q = WCMDQ(wcmdq_tail);
+		q->cmd = WCMD_FMT_AMPLITUDE;
+		q->u.value = fmt_amplitude = fmt_params->fmt_amp;
 		WcmdqInc();
 	}
 
@@ -930,7 +1153,7 @@ int DoSpect2(PHONEME_TAB *this_ph, int which, FMT_PARAMS *fmt_params,  PHONEME_L
 		if (((last_frame->length < 2) || (last_frame->frflags & FRFLAG_VOWEL_CENTRE))
 		    && !(last_frame->frflags & FRFLAG_BREAK)) {
 			// last frame of previous sequence was zero-length, replace with first of this sequence
-			wcmdq[last_wcmdq][3] = (intptr_t)frame1;
+			WCMDQ(last_wcmdq)->u.spect.frame2 = frame1;
 
 			if (last_frame->frflags & FRFLAG_BREAK_LF) {
 				// but flag indicates keep HF peaks in last segment
@@ -940,7 +1163,7 @@ int DoSpect2(PHONEME_TAB *this_ph, int which, FMT_PARAMS *fmt_params,  PHONEME_L
 						fr->ffreq[ix] = last_frame->ffreq[ix];
 					fr->fheight[ix] = last_frame->fheight[ix];
 				}
-				wcmdq[last_wcmdq][3] = (intptr_t)fr;
+				WCMDQ(last_wcmdq)->u.spect.frame2 = fr;
 			}
 		}
 	}
@@ -1003,11 +1226,12 @@ int DoSpect2(PHONEME_TAB *this_ph, int which, FMT_PARAMS *fmt_params,  PHONEME_L
 			last_wcmdq = wcmdq_tail;
 
 			if (modulation >= 0) {
-				q = wcmdq[wcmdq_tail];
-				q[0] = wcmd_spect;
-				q[1] = len + (modulation << 16);
-				q[2] = (intptr_t)frame1;
-				q[3] = (intptr_t)frame2;
+				q = WCMDQ(wcmdq_tail);
+				q->cmd = wcmd_spect;
+				q->length = len;
+				q->u.spect.modulation = modulation;
+				q->u.spect.frame1 = frame1;
+				q->u.spect.frame2 = frame2;
 
 				WcmdqInc();
 			}
@@ -1017,9 +1241,9 @@ int DoSpect2(PHONEME_TAB *this_ph, int which, FMT_PARAMS *fmt_params,  PHONEME_L
 	}
 
 	if ((which != 1) && (fmt_amplitude != 0)) {
-		q = wcmdq[wcmdq_tail];
-		q[0] = WCMD_FMT_AMPLITUDE;
-		q[1] = fmt_amplitude = 0;
+		q = WCMDQ(wcmdq_tail);
+		q->cmd = WCMD_FMT_AMPLITUDE;
+		q->u.value = fmt_amplitude = 0;
 		WcmdqInc();
 	}
 
@@ -1031,10 +1255,14 @@ void DoMarker(int type, int char_posn, int length, int value)
 	// This could be used to return an index to the word currently being spoken
 	// Type 1=word, 2=sentence, 3=named marker, 4=play audio, 5=end
 
-	if (WcmdqFree() > 5) {
-		wcmdq[wcmdq_tail][0] = WCMD_MARKER + (type << 8);
-		wcmdq[wcmdq_tail][1] = (char_posn & 0xffffff) | (length << 24);
-		wcmdq[wcmdq_tail][2] = value;
+	wcmd_t *q;
+
+	if ((WcmdqFree() > 5) || WcmdqGrow()) {
+		q = WCMDQ(wcmdq_tail);
+		q->cmd = WCMD_MARKER;
+		q->u.marker.type = type;
+		q->u.marker.char_position = (char_posn & 0xffffff) | (length << 24);
+		q->u.marker.value = value;
 		WcmdqInc();
 	}
 }
@@ -1044,14 +1272,17 @@ void DoPhonemeMarker(int type, int char_posn, int length, char *name)
 	// This could be used to return an index to the word currently being spoken
 	// Type 7=phoneme
 
+	wcmd_t *q;
 	int *p;
 
-	if (WcmdqFree() > 5) {
-		wcmdq[wcmdq_tail][0] = WCMD_MARKER + (type << 8);
-		wcmdq[wcmdq_tail][1] = (char_posn & 0xffffff) | (length << 24);
+	if ((WcmdqFree() > 5) || WcmdqGrow()) {
+		q = WCMDQ(wcmdq_tail);
+		q->cmd = WCMD_MARKER;
+		q->u.marker.type = type;
+		q->u.marker.char_position = (char_posn & 0xffffff) | (length << 24);
 		p = (int *)name;
-		wcmdq[wcmdq_tail][2] = p[0]; // up to 8 bytes of UTF8 characters
-		wcmdq[wcmdq_tail][3] = p[1];
+		q->u.marker.value = p[0]; // up to 8 bytes of UTF8 characters
+		q->u.marker.value2 = p[1];
 		WcmdqInc();
 	}
 }
@@ -1060,8 +1291,8 @@ void DoPhonemeMarker(int type, int char_posn, int length, char *name)
 void DoSonicSpeed(int value)
 {
 	// value, multiplier * 1024
-	wcmdq[wcmdq_tail][0] = WCMD_SONIC_SPEED;
-	wcmdq[wcmdq_tail][1] = value;
+	WCMDQ(wcmdq_tail)->cmd = WCMD_SONIC_SPEED;
+	WCMDQ(wcmdq_tail)->u.value = value;
 	WcmdqInc();
 }
 #endif
@@ -1073,8 +1304,8 @@ espeak_ng_STATUS DoVoiceChange(voice_t *v)
 	if ((v2 = (voice_t *)malloc(sizeof(voice_t))) == NULL)
 		return ENOMEM;
 	memcpy(v2, v, sizeof(voice_t));
-	wcmdq[wcmdq_tail][0] = WCMD_VOICE;
-	wcmdq[wcmdq_tail][2] = (intptr_t)v2;
+	WCMDQ(wcmdq_tail)->cmd = WCMD_VOICE;
+	WCMDQ(wcmdq_tail)->u.voice = v2;
 	WcmdqInc();
 	return ENS_OK;
 }
@@ -1085,6 +1316,7 @@ void DoEmbedded(int *embix, int sourceix)
 	unsigned int word; // bit 7=last command for this word, bits 5,6 sign, bits 0-4 command
 	unsigned int value;
 	int command;
+	wcmd_t *q;
 
 	do {
 		word = embedded_list[*embix];
@@ -1106,25 +1338,28 @@ void DoEmbedded(int *embix, int sourceix)
 			if ((int)value < n_soundicon_tab) {
 				if (soundicon_tab[value].length != 0) {
 					DoPause(10, 0); // ensure a break in the speech
-					wcmdq[wcmdq_tail][0] = WCMD_WAVE;
-					wcmdq[wcmdq_tail][1] = soundicon_tab[value].length;
-					wcmdq[wcmdq_tail][2] = (intptr_t)soundicon_tab[value].data + 44; // skip WAV header
-					wcmdq[wcmdq_tail][3] = 0x1500; // 16 bit data, amp=21
+					q = WCMDQ(wcmdq_tail);
+					q->cmd = WCMD_WAVE;
+					q->length = soundicon_tab[value].length;
+					q->u.wave.data = (unsigned char *)soundicon_tab[value].data;
+					q->u.wave.scale = 0; // 16 bit data
+					q->u.wave.amp = 21;
 					WcmdqInc();
 				}
 			}
 			break;
 		case EMBED_M: // named marker
-			DoMarker(espeakEVENT_MARK, (sourceix & 0x7ff) + clause_start_char, 0, value);
+			DoMarker(espeakEVENT_MARK, (sourceix & 0xffff) + clause_start_char, 0, value);
 			break;
 		case EMBED_U: // play sound
 			DoMarker(espeakEVENT_PLAY, count_characters+1, 0, value); // always occurs at end of clause
 			break;
 		default:
 			DoPause(10, 0); // ensure a break in the speech
-			wcmdq[wcmdq_tail][0] = WCMD_EMBEDDED;
-			wcmdq[wcmdq_tail][1] = command;
-			wcmdq[wcmdq_tail][2] = value;
+			q = WCMDQ(wcmdq_tail);
+			q->cmd = WCMD_EMBEDDED;
+			q->u.embedded.command = command;
+			q->u.embedded.value = value;
 			WcmdqInc();
 			break;
 		}
@@ -1169,6 +1404,8 @@ int Generate(PHONEME_LIST *phoneme_list, int *n_ph, bool resume)
 		return MbrolaGenerate(phoneme_list, n_ph, resume);
 
 	if (resume == false) {
+		WcmdqRebase();
+		ResetFramePool();
 		ix = 1;
 		embedded_ix = 0;
 		word_count = 0;
@@ -1185,7 +1422,7 @@ int Generate(PHONEME_LIST *phoneme_list, int *n_ph, bool resume)
 		DoPause(0, 0); // isolate from the previous clause
 	}
 
-	while ((ix < (*n_ph)) && (ix < N_PHONEME_LIST-2)) {
+	while ((ix < (*n_ph)) && (ix < n_phoneme_list_max-2)) {
 		p = &phoneme_list[ix];
 
 		if (p->type == phPAUSE)
@@ -1195,9 +1432,12 @@ int Generate(PHONEME_LIST *phoneme_list, int *n_ph, bool resume)
 		else
 			free_min = MIN_WCMDQ;
 
-		if (WcmdqFree() <= free_min)
+		if ((WcmdqFree() <= free_min) && !WcmdqGrow())
 			return 1; // wait
 
+		if (SynthesisCancelled())
+			return 1; // the caller stops when it sees the cancel
+
 		prev = &phoneme_list[ix-1];
 		next = &phoneme_list[ix+1];
 		next2 = &phoneme_list[ix+2];
@@ -1211,13 +1451,13 @@ int Generate(PHONEME_LIST *phoneme_list, int *n_ph, bool resume)
 			} else
 				last_frame = NULL;
 
-			sourceix = (p->sourceix & 0x7ff) + clause_start_char;
+			sourceix = (p->sourceix & 0xffff) + clause_start_char;
 
 			if (p->newword & PHLIST_START_OF_SENTENCE)
 				DoMarker(espeakEVENT_SENTENCE, sourceix, 0, count_sentences); // start of sentence
 
 			if (p->newword & PHLIST_START_OF_WORD)
-				DoMarker(espeakEVENT_WORD, sourceix, p->sourceix >> 11, clause_start_word + word_count++); // NOTE, this count doesn't include multiple-word pronunciations in *_list. eg (of a)
+				DoMarker(espeakEVENT_WORD, sourceix, p->sourceix >> 16, clause_start_word + word_count++); // NOTE, this count doesn't include multiple-word pronunciations in *_list. eg (of a)
 		}
 
 		EndAmplitude();
@@ -1226,7 +1466,7 @@ int Generate(PHONEME_LIST *phoneme_list, int *n_ph, bool resume)
 			DoPause(p->prepause, 1);
 
 		done_phoneme_marker = false;
-		if (option_phoneme_events && (p->ph->code != phonEND_WORD)) {
+		if ((option_phoneme_events || option_alignment) && (p->ph->code != phonEND_WORD)) {
 			if ((p->type == phVOWEL) && (prev->type == phLIQUID || prev->type == phNASAL)) {
 				// For vowels following a liquid or nasal, do the phoneme event after the vowel-start
 			} else {
@@ -1493,7 +1733,7 @@ int Generate(PHONEME_LIST *phoneme_list, int *n_ph, bool resume)
 				DoSpect2(ph, 1, &fmtp, p, modulation);
 			}
 
-			if ((option_phoneme_events) && (done_phoneme_marker == false)) {
+			if ((option_phoneme_events || option_alignment) && (done_phoneme_marker == false)) {
 				WritePhMnemonic(phoneme_name, p->ph, p, use_ipa, NULL);
 				DoPhonemeMarker(espeakEVENT_PHONEME, sourceix, 0, phoneme_name);
 			}
@@ -1564,6 +1804,8 @@ int SpeakNextClause(int control)
 	// read the next clause from the input text file, translate it, and generate
 	// entries in the wavegen command queue
 	TranslateClause(translator, &clause_tone, &voice_change);
+	if (stream_underrun)
+		return 0;
 
 	CalcPitches(translator, clause_tone);
 	CalcLengths(translator);
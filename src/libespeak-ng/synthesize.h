@@ -27,13 +27,14 @@ extern "C"
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
 #include <espeak-ng/espeak_ng.h>
 #include "phoneme.h"
 #include "voice.h"
 
 #define espeakINITIALIZE_PHONEME_IPA 0x0002 // move this to speak_lib.h, after eSpeak version 1.46.02
 
-#define N_PHONEME_LIST 1000 // enough for source[N_TR_SOURCE] full of text, else it will truncate
+#define N_PHONEME_LIST 1000 // enough for source[N_TR_SOURCE] full of text, grown for longer clauses
 
 #define N_SEQ_FRAMES  25 // max frames in a spectrum sequence (real max is ablut 8)
 #define STEPSIZE      64 // 2.9mS at 22 kHz sample rate
@@ -149,13 +150,19 @@ typedef struct {
 	int amplitude_fmt; // percentage amplitude adjustment for formant synthesis
 } WGEN_DATA;
 
-typedef struct {
-	double a;
-	double b;
-	double c;
-	double x1;
-	double x2;
-} RESONATOR;
+// The noise sources use their own xorshift pseudo-random number generators,
+// instead of rand() which has one locked state for the whole process.
+#define NOISE_SEED 0x2545f491
+
+static inline uint32_t NoiseRandom(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
 
 typedef struct {
 	short length_total; // not used
@@ -182,7 +189,7 @@ typedef struct {
 	unsigned short synthflags; // NOTE Put shorts on 32bit boundaries, because of RISC OS compiler bug?
 	unsigned char phcode;
 	unsigned char stresslevel;
-	unsigned short sourceix;  // ix into the original source text string, only set at the start of a word
+	unsigned int sourceix;    // bits 0-15 ix into the original source text string, bits 16-20 word length, only set at the start of a word
 	unsigned char wordstress; // the highest level stress in this word
 	unsigned char tone_ph;    // tone phoneme to use with this vowel
 } PHONEME_LIST2;
@@ -197,7 +204,7 @@ typedef struct {
 	unsigned short synthflags;
 	unsigned char phcode;
 	unsigned char stresslevel;
-	unsigned short sourceix;  // ix into the original source text string, only set at the start of a word
+	unsigned int sourceix;    // bits 0-15 ix into the original source text string, bits 16-20 word length, only set at the start of a word
 	unsigned char wordstress; // the highest level stress in this word
 	unsigned char tone_ph;    // tone phoneme to use with this vowel
 
@@ -338,9 +345,12 @@ typedef struct {
 
 typedef struct {
 	int name;
-	int length;
-	char *data;
+	int length;     // in samples
+	char *data;     // mono 16 bit samples at the synthesis sample rate
+	int samplerate; // the synthesis sample rate when the file was loaded
 	char *filename;
+	time_t mtime;   // modification time of the file when it was loaded
+	unsigned int last_used; // for reusing the least recently used slot
 } SOUND_ICON;
 
 typedef struct {
@@ -407,7 +417,9 @@ extern PHONEME_TAB *phoneme_tab[N_PHONEME_TAB];
 
 // list of phonemes in a clause
 extern int n_phoneme_list;
-extern PHONEME_LIST phoneme_list[N_PHONEME_LIST+1];
+extern int n_phoneme_list_max; // number of entries in phoneme_list (plus an end marker) and ph_list2
+extern PHONEME_LIST *phoneme_list;
+extern PHONEME_LIST2 *ph_list2;
 extern unsigned int embedded_list[];
 
 extern unsigned char env_fall[128];
@@ -434,13 +446,56 @@ extern unsigned char pitch_adjust_tab[MAX_PITCH_VALUE+1];
 #define WCMD_FMT_AMPLITUDE 14
 #define WCMD_SONIC_SPEED 15
 
-#define N_WCMDQ   170
+#define N_WCMDQ       256      // initial size of wcmdq, a power of 2
+#define N_WCMDQ_MAX   0x10000  // the queue grows to hold a whole clause, up to this size
 #define MIN_WCMDQ  25   // need this many free entries before adding new phoneme
 
-extern intptr_t wcmdq[N_WCMDQ][4];
+typedef struct {
+	int cmd;    // WCMD_*
+	int length; // length in samples
+	union {
+		struct { // WCMD_SPECT, WCMD_SPECT2, WCMD_KLATT, WCMD_KLATT2
+			frame_t *frame1;
+			frame_t *frame2;
+			int modulation;
+		} spect;
+		struct { // WCMD_WAVE, WCMD_WAVE2
+			unsigned char *data;
+			int wav_length; // WCMD_WAVE2, length of the wave data in samples
+			int scale; // 0 = 16 bit samples
+			int amp;
+		} wave;
+		struct { // WCMD_AMPLITUDE, WCMD_PITCH
+			unsigned char *env;
+			int value1; // amplitude, or start pitch
+			int value2; // end pitch
+		} env;
+		struct { // WCMD_MARKER
+			int type;
+			unsigned int char_position; // bits 0-23 position, bits 24-31 length
+			int value;
+			int value2;
+		} marker;
+		struct { // WCMD_EMBEDDED
+			int command;
+			int value;
+		} embedded;
+		voice_t *voice; // WCMD_VOICE
+		int value; // WCMD_FMT_AMPLITUDE, WCMD_SONIC_SPEED
+	} u;
+} wcmd_t;
+
+// wcmdq_head and wcmdq_tail count the commands which have been taken from and
+// added to the queue. The queue entry for index ix is WCMDQ(ix).
+extern wcmd_t *wcmdq;
+extern int n_wcmdq;
 extern int wcmdq_head;
 extern int wcmdq_tail;
 
+#define WCMDQ(ix)  (&wcmdq[(ix) & (n_wcmdq-1)])
+
+frame_t *WcmdqNextFrame(int cmd);
+
 void MarkerEvent(int type, unsigned int char_position, int value, int value2, unsigned char *out_ptr);
 
 extern unsigned char *wavefile_data;
@@ -451,13 +506,11 @@ extern int wavefile_ix;
 extern int wavefile_amp;
 extern int vowel_transition[4];
 
-#define N_ECHO_BUF 5500   // max of 250mS at 22050 Hz
-extern int echo_head;
-extern int echo_tail;
-extern int echo_amp;
-extern short echo_buf[N_ECHO_BUF];
-
 void SynthesizeInit(void);
+void FreeFramePool(void);
+void FreeSpectCache(void);
+void SetSpectCache(bool enable);
+void GetSpectCacheStats(espeak_ng_FRAME_CACHE_STATS *stats);
 int  Generate(PHONEME_LIST *phoneme_list, int *n_ph, bool resume);
 void MakeWave2(PHONEME_LIST *p, int n_ph);
 int  SpeakNextClause(int control);
@@ -487,8 +540,8 @@ extern espeak_EVENT *event_list;
 extern t_espeak_callback *synth_callback;
 extern const int version_phdata;
 
-#define N_SOUNDICON_TAB  80   // total entries in soundicon_tab
-#define N_SOUNDICON_SLOTS 4    // number of slots reserved for dynamic loading of audio files
+#define N_SOUNDICON_TAB  96   // total entries in soundicon_tab
+#define N_SOUNDICON_SLOTS 16   // number of slots reserved for dynamic loading of audio files
 extern int n_soundicon_tab;
 extern SOUND_ICON soundicon_tab[N_SOUNDICON_TAB];
 
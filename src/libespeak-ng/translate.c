@@ -20,6 +20,7 @@
 #include "config.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -32,7 +33,9 @@
 #include <espeak-ng/speak_lib.h>
 #include <espeak-ng/encoding.h>
 
+#include "bundle.h"
 #include "dictionary.h"
+#include "intonation.h"
 #include "numbers.h"
 #include "phonemelist.h"
 #include "readclause.h"
@@ -52,6 +55,7 @@ FILE *f_trans = NULL; // phoneme output text
 int option_tone_flags = 0; // bit 8=emphasize allcaps, bit 9=emphasize penultimate stress
 int option_phonemes = 0;
 int option_phoneme_events = 0;
+int option_alignment = 0;
 int option_endpause = 0; // suppress pause after end of text
 int option_capitals = 0;
 int option_punctuation = 0;
@@ -61,6 +65,7 @@ static int option_emphasis = 0; // 0=normal, 1=normal, 2=weak, 3=moderate, 4=str
 int option_ssml = 0;
 int option_phoneme_input = 0; // allow [[phonemes]] in input
 int option_wordgap = 0;
+int option_clause_length = N_TR_SOURCE;
 
 static int count_sayas_digits;
 int skip_sentences;
@@ -86,7 +91,7 @@ ALPHABET *current_alphabet;
 // these were previously in translator class
 char word_phonemes[N_WORD_PHONEMES]; // a word translated into phoneme codes
 int n_ph_list2;
-PHONEME_LIST2 ph_list2[N_PHONEME_LIST]; // first stage of text->phonemes
+PHONEME_LIST2 *ph_list2 = NULL; // first stage of text->phonemes
 
 wchar_t option_punctlist[N_PUNCTLIST] = { 0 };
 char ctrl_embedded = '\001'; // to allow an alternative CTRL for embedded commands
@@ -99,8 +104,19 @@ static int embedded_ix;
 static int embedded_read;
 unsigned int embedded_list[N_EMBEDDED_LIST];
 
-// the source text of a single clause (UTF8 bytes)
-static char source[N_TR_SOURCE+40]; // extra space for embedded command & voice change info at end
+// The buffers for a single clause are carved out of one allocation (the
+// clause arena). This is sized for option_clause_length bytes of source text,
+// grown when a clause needs more words or phonemes than the previous ones,
+// and then reused for every following clause.
+static char *clause_arena = NULL;
+static size_t clause_arena_size = 0;
+static int n_clause_source = 0;
+static int n_clause_words = 0;
+
+static char *source = NULL; // the source text of a single clause (UTF8 bytes), with extra space for embedded command & voice change info at end
+static char *sbuf = NULL;
+static short *charix = NULL;
+static WORD_TAB *words = NULL;
 
 int n_replace_phonemes;
 REPLACE_PHONEMES replace_phonemes[N_REPLACE_PHONEMES];
@@ -285,7 +301,7 @@ void DeleteTranslator(Translator *tr)
 	if (!tr) return;
 
 	if (tr->data_dictlist != NULL)
-		free(tr->data_dictlist);
+		FreeDataFile(tr->data_dictlist);
 	free(tr);
 }
 
@@ -1330,7 +1346,7 @@ static int TranslateWord2(Translator *tr, char *word, WORD_TAB *wtab, int pre_pa
 
 	len = wtab->length;
 	if (len > 31) len = 31;
-	source_ix = (wtab->sourceix & 0x7ff) | (len << 11); // bits 0-10 sourceix, bits 11-15 word length
+	source_ix = wtab->sourceix | (len << 16); // bits 0-15 sourceix, bits 16-20 word length
 
 	word_flags = wtab[0].flags;
 	if (word_flags & FLAG_EMBEDDED) {
@@ -1551,7 +1567,7 @@ static int TranslateWord2(Translator *tr, char *word, WORD_TAB *wtab, int pre_pa
 	if ((flags & FLAG_FOUND) && !(flags & FLAG_TEXTMODE))
 		found_dict_flag = SFLAG_DICTIONARY;
 
-	while ((pre_pause > 0) && (n_ph_list2 < N_PHONEME_LIST-4)) {
+	while ((pre_pause > 0) && (n_ph_list2 < n_phoneme_list_max-4)) {
 		// add pause phonemes here. Either because of punctuation (brackets or quotes) in the
 		// text, or because the word is marked in the dictionary lookup as a conjunction
 		if (pre_pause > 1) {
@@ -1605,7 +1621,7 @@ static int TranslateWord2(Translator *tr, char *word, WORD_TAB *wtab, int pre_pa
 		p[1] = 0;
 	}
 
-	while (((ph_code = *p++) != 0) && (n_ph_list2 < N_PHONEME_LIST-4)) {
+	while (((ph_code = *p++) != 0) && (n_ph_list2 < n_phoneme_list_max-4)) {
 		if (ph_code == 255)
 			continue; // unknown phoneme
 
@@ -1978,6 +1994,81 @@ static int UpperCaseInWord(Translator *tr, char *word, int c)
 	return 0;
 }
 
+static size_t ClauseBufferSize(size_t size)
+{
+	// keep each buffer in the clause arena aligned for any of the types stored in it
+	return (size + 15) & ~(size_t)15;
+}
+
+static espeak_ng_STATUS AllocClauseBuffers(int n_source, int n_words, int n_phonemes)
+{
+	// The source text and charix[] are at the start of the arena, so that they
+	// are kept when the arena is grown after ReadClause() has filled them.
+	size_t size_source = ClauseBufferSize(n_source + 40);
+	size_t size_charix = ClauseBufferSize((n_source + 4) * sizeof(short));
+	size_t size_sbuf = ClauseBufferSize(n_source);
+	size_t size_words = ClauseBufferSize(n_words * sizeof(WORD_TAB));
+	size_t size_ph_list2 = ClauseBufferSize(n_phonemes * sizeof(PHONEME_LIST2));
+	size_t size_ph_list = ClauseBufferSize((n_phonemes + 1) * sizeof(PHONEME_LIST));
+	size_t size_syllables = ClauseBufferSize(n_phonemes * sizeof(SYLLABLE));
+	size_t size = size_source + size_charix + size_sbuf + size_words + size_ph_list2 + size_ph_list*2 + size_syllables;
+	char *p;
+
+	if (size > clause_arena_size) {
+		if ((p = (char *)realloc(clause_arena, size)) == NULL)
+			return ENOMEM;
+		clause_arena = p;
+		clause_arena_size = size;
+	}
+
+	p = clause_arena;
+	source = p;
+	p += size_source;
+	charix = (short *)p;
+	p += size_charix;
+	sbuf = p;
+	p += size_sbuf;
+	words = (WORD_TAB *)p;
+	p += size_words;
+	ph_list2 = (PHONEME_LIST2 *)p;
+	p += size_ph_list2;
+	phoneme_list = (PHONEME_LIST *)p;
+	p += size_ph_list;
+	ph_list3 = (PHONEME_LIST *)p;
+	p += size_ph_list;
+	syllable_tab = (SYLLABLE *)p;
+
+	n_clause_source = n_source;
+	n_clause_words = n_words;
+	n_phoneme_list_max = n_phonemes;
+	return ENS_OK;
+}
+
+espeak_ng_STATUS SetClauseLength(int length)
+{
+	if ((length < 100) || (length > N_TR_SOURCE_MAX))
+		return EINVAL;
+
+	option_clause_length = length;
+	return ENS_OK;
+}
+
+void FreeClauseBuffers(void)
+{
+	free(clause_arena);
+	clause_arena = NULL;
+	clause_arena_size = 0;
+
+	source = sbuf = NULL;
+	charix = NULL;
+	words = NULL;
+	ph_list2 = NULL;
+	phoneme_list = ph_list3 = NULL;
+	syllable_tab = NULL;
+	n_clause_source = n_clause_words = n_phoneme_list_max = 0;
+	n_phoneme_list = 0;
+}
+
 void TranslateClause(Translator *tr, int *tone_out, char **voice_change)
 {
 	int ix;
@@ -2015,19 +2106,21 @@ void TranslateClause(Translator *tr, int *tone_out, char **voice_change)
 	int n_digits;
 	int charix_top = 0;
 
-	short charix[N_TR_SOURCE+4];
-	WORD_TAB words[N_CLAUSE_WORDS];
 	static char voice_change_name[40];
 	int word_count = 0; // index into words
 
-	char sbuf[N_TR_SOURCE];
-
 	int terminator;
 	int tone;
+	int length;
 
 	if (tr == NULL)
 		return;
 
+	if (AllocClauseBuffers(option_clause_length, N_CLAUSE_WORDS, N_PHONEME_LIST) != ENS_OK) {
+		n_phoneme_list = 0;
+		return;
+	}
+
 	embedded_ix = 0;
 	embedded_read = 0;
 	pre_pause = 0;
@@ -2037,9 +2130,23 @@ void TranslateClause(Translator *tr, int *tone_out, char **voice_change)
 		clause_start_char = 0;
 	clause_start_word = count_words + 1;
 
-	for (ix = 0; ix < N_TR_SOURCE; ix++)
+	for (ix = 0; ix < n_clause_source; ix++)
 		charix[ix] = 0;
-	terminator = ReadClause(tr, source, charix, &charix_top, N_TR_SOURCE, &tone, voice_change_name);
+	terminator = ReadClause(tr, source, charix, &charix_top, n_clause_source, &tone, voice_change_name);
+	if (stream_underrun) {
+		// wait for the rest of the clause to be added to the stream
+		n_phoneme_list = 0;
+		return;
+	}
+
+	// a long clause needs more words and phonemes, in proportion to its length
+	length = strlen(source);
+	if (length > N_TR_SOURCE) {
+		if (AllocClauseBuffers(n_clause_source, (N_CLAUSE_WORDS * length) / N_TR_SOURCE, (N_PHONEME_LIST * length) / N_TR_SOURCE) != ENS_OK) {
+			n_phoneme_list = 0;
+			return;
+		}
+	}
 
 	if (tone_out != NULL) {
 		if (tone == 0)
@@ -2124,7 +2231,7 @@ void TranslateClause(Translator *tr, int *tone_out, char **voice_change)
 	}
 	words[0].length = k;
 
-	while (!finished && (ix < (int)sizeof(sbuf) - 1) && (n_ph_list2 < N_PHONEME_LIST-4)) {
+	while (!finished && (ix < n_clause_source - 1) && (n_ph_list2 < n_phoneme_list_max-4)) {
 		prev_out2 = prev_out;
 		utf8_in2(&prev_out, &sbuf[ix-1], 1);
 
@@ -2469,7 +2576,7 @@ void TranslateClause(Translator *tr, int *tone_out, char **voice_change)
 			// end of 'word'
 			sbuf[ix++] = ' ';
 
-			if ((word_count < N_CLAUSE_WORDS-1) && (ix > words[word_count].start)) {
+			if ((word_count < n_clause_words-1) && (ix > words[word_count].start)) {
 				if (embedded_count > 0) {
 					// there are embedded commands before this word
 					embedded_list[embedded_ix-1] |= 0x80; // terminate list of commands for this word
@@ -2520,7 +2627,7 @@ void TranslateClause(Translator *tr, int *tone_out, char **voice_change)
 				space_inserted = false;
 			}
 		} else {
-			if ((ix < (N_TR_SOURCE - 4)))
+			if ((ix < (n_clause_source - 4)))
 				ix += utf8_out(c, &sbuf[ix]);
 		}
 		if (pre_pause_add > pre_pause)
@@ -2713,8 +2820,8 @@ void TranslateClause(Translator *tr, int *tone_out, char **voice_change)
 		clause_pause = 10;
 
 	MakePhonemeList(tr, clause_pause, new_sentence2, &n_ph_list2, ph_list2);
-	phoneme_list[N_PHONEME_LIST].ph = NULL; // recognize end of phoneme_list array, in Generate()
-	phoneme_list[N_PHONEME_LIST].sourceix = 1;
+	phoneme_list[n_phoneme_list_max].ph = NULL; // recognize end of phoneme_list array, in Generate()
+	phoneme_list[n_phoneme_list_max].sourceix = 1;
 
 	if (embedded_count) { // ???? is this needed
 		phoneme_list[n_phoneme_list-2].synthflags = SFLAG_EMBEDDED;
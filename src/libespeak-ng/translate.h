@@ -38,8 +38,9 @@ extern "C"
 
 #define N_WORD_PHONEMES  200 // max phonemes in a word
 #define N_WORD_BYTES     160 // max bytes for the UTF8 characters in a word
-#define N_CLAUSE_WORDS   300 // max words in a clause
-#define N_TR_SOURCE      800 // the source text of a single clause (UTF8 bytes)
+#define N_CLAUSE_WORDS   300 // max words in a clause of N_TR_SOURCE bytes
+#define N_TR_SOURCE      800 // default limit for the source text of a single clause (UTF8 bytes)
+#define N_TR_SOURCE_MAX 32000 // charix[] and WORD_TAB.start are 16 bit
 
 #define N_RULE_GROUP2    120 // max num of two-letter rule chains
 #define N_HASH_DICT     1024
@@ -650,6 +651,7 @@ typedef struct {
 extern int option_tone_flags;
 extern int option_phonemes;
 extern int option_phoneme_events;
+extern int option_alignment;
 extern int option_linelength;     // treat lines shorter than this as end-of-clause
 extern int option_capitals;
 extern int option_punctuation;
@@ -658,6 +660,7 @@ extern int option_ssml;
 extern int option_phoneme_input;   // allow [[phonemes]] in input text
 extern int option_sayas;
 extern int option_wordgap;
+extern int option_clause_length;   // limit for the source text of a single clause (UTF8 bytes)
 
 extern int count_characters;
 extern int count_sentences;
@@ -720,6 +723,8 @@ void ApplySpecialAttribute2(Translator *tr, char *phonemes, int dict_flags);
 
 int TranslateWord(Translator *tr, char *word1, WORD_TAB *wtab, char *word_out);
 void TranslateClause(Translator *tr, int *tone, char **voice_change);
+espeak_ng_STATUS SetClauseLength(int length);
+void FreeClauseBuffers(void);
 
 void SetVoiceStack(espeak_VOICE *v, const char *variant_name);
 
@@ -38,7 +38,9 @@
 #include <espeak-ng/speak_lib.h>
 #include <espeak-ng/encoding.h>
 
+#include "bundle.h"
 #include "dictionary.h"
+#include "mbrola.h"
 #include "readclause.h"
 #include "synthdata.h"
 #include "wavegen.h"
@@ -424,6 +426,22 @@ void VoiceReset(int tone_only)
 	}
 }
 
+void VoiceSetSampleRate(void)
+{
+	// Update the current voice after the synthesis sample rate has been
+	// changed. An MBROLA voice keeps its own sample rate.
+	int pk;
+
+	if (mbrola_name[0] == 0)
+		voice->samplerate = samplerate_native;
+
+	InitBreath();
+	for (pk = 0; pk < N_PEAKS; pk++)
+		formant_rate[pk] = (formant_rate_22050[pk] * 22050)/samplerate;
+
+	SetSpeed(3); // for the minimum length of sampled sounds
+}
+
 static void VoiceFormant(char *p)
 {
 	// Set parameters for a formant
@@ -548,7 +566,7 @@ voice_t *LoadVoice(const char *vname, int control)
 		}
 	}
 
-	f_voice = fopen(buf, "r");
+	f_voice = OpenDataFile(buf, "r");
 
 	language_type = "en"; // default
 	if (f_voice == NULL) {
@@ -1390,6 +1408,36 @@ static void GetVoices(const char *path, int len_path_voices, int is_language_fil
 	int ftype;
 	char fname[sizeof(path_home)+100];
 
+	if (IsBundlePath(path)) {
+		// the bundle holds all the files within the directory, including
+		// those in its sub-directories
+		const char *name;
+		size_t len_path = strlen(path);
+		int ix;
+
+		for (ix = 0; (name = GetBundleFileName(ix)) != NULL; ix++) {
+			if (n_voices_list >= (N_VOICES_LIST-2)) {
+				fprintf(stderr, "Warning: maximum number %d of (N_VOICES_LIST = %d - 1) reached\n", n_voices_list + 1, N_VOICES_LIST);
+				break; // voices list is full
+			}
+
+			snprintf(fname, sizeof(fname), "%s%c%s", path_home, PATHSEP, name);
+			if ((strncmp(fname, path, len_path) != 0) || (fname[len_path] != '/'))
+				continue;
+
+			if ((f_voice = OpenDataFile(fname, "r")) == NULL)
+				continue;
+
+			// pass voice file name within the voices directory
+			voice_data = ReadVoiceFile(f_voice, fname+len_path_voices, is_language_file);
+			fclose(f_voice);
+
+			if (voice_data != NULL)
+				voices_list[n_voices_list++] = voice_data;
+		}
+		return;
+	}
+
 #ifdef PLATFORM_WINDOWS
 	WIN32_FIND_DATAA FindFileData;
 	HANDLE hFind = INVALID_HANDLE_VALUE;
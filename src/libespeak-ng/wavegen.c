@@ -22,6 +22,7 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -55,6 +56,7 @@ voice_t *wvoice = NULL;
 
 FILE *f_log = NULL;
 static int option_harmonic1 = 10;
+static espeak_ng_ECONOMY option_economy = ENECONOMY_NONE;
 static int flutter_amp = 64;
 
 static int general_amplitude = 60;
@@ -70,14 +72,36 @@ static wavegen_peaks_t peaks[N_PEAKS];
 static int peak_harmonic[N_PEAKS];
 static int peak_height[N_PEAKS];
 
-int echo_head;
-int echo_tail;
-int echo_amp = 0;
-short echo_buf[N_ECHO_BUF];
+// samples generated together between the parameter updates in Wavegen()
+#define WAVEGEN_BLOCK 8
+
+// The highest frequency, in Hz, of the harmonics and HF peaks at each economy
+// level, or 0 for 95% of the Nyquist frequency.
+static const int economy_max_freq[] = { 0, 7000, 3800, 3800 };
+
+// the echo delay line, which holds N_ECHO_DELAY mS at the sample rate
+#define N_ECHO_DELAY 250
+static short *echo_buf = NULL;
+static int n_echo_buf = 0;
+static int echo_head;
+static int echo_tail;
+static int echo_delay = 0; // samples between echo_tail and echo_head
+static int echo_amp = 0;
 static int echo_length = 0; // period (in sample\) to ensure completion of echo at the end of speech, set in WavegenSetEcho()
 
 static int voicing;
-static RESONATOR rbreath[N_PEAKS];
+
+// the breath formants 1 to N_PEAKS-1, as single precision resonators
+#define N_BREATH (N_PEAKS-1)
+static struct {
+	float a[N_BREATH];
+	float b[N_BREATH];
+	float c[N_BREATH];
+	float x1[N_BREATH];
+	float x2[N_BREATH];
+	int amp[N_BREATH];
+} breath;
+static uint32_t breath_seed = NOISE_SEED;
 
 static int harm_sqrt_n = 0;
 
@@ -117,7 +141,9 @@ unsigned char *out_start;
 unsigned char *out_end;
 
 // the queue of operations passed to wavegen from sythesize
-intptr_t wcmdq[N_WCMDQ][4];
+static wcmd_t wcmdq_initial[N_WCMDQ];
+wcmd_t *wcmdq = wcmdq_initial;
+int n_wcmdq = N_WCMDQ;
 int wcmdq_head = 0;
 int wcmdq_tail = 0;
 
@@ -208,10 +234,12 @@ static const unsigned char Flutter_tab[N_FLUTTER] = {
 #define N_WAVEMULT 128
 static int wavemult_offset = 0;
 static int wavemult_max = 0;
+static int wavemult_fact = 60;
+static unsigned char wavemult[N_WAVEMULT];
 
 // the presets are for 22050 Hz sample rate.
-// A different rate will need to recalculate the presets in WavegenInit()
-static unsigned char wavemult[N_WAVEMULT] = {
+// A different rate will need to recalculate them in WavegenSetSampleRate()
+static const unsigned char wavemult_22050[N_WAVEMULT] = {
 	  0,   0,   0,   2,   3,   5,   8,  11,  14,  18,  22,  27,  32,  37,  43,  49,
 	 55,  62,  69,  76,  83,  90,  98, 105, 113, 121, 128, 136, 144, 152, 159, 166,
 	174, 181, 188, 194, 201, 207, 213, 218, 224, 228, 233, 237, 240, 244, 246, 249,
@@ -257,27 +285,74 @@ void WcmdqStop()
 
 int WcmdqFree()
 {
-	int i;
-	i = wcmdq_head - wcmdq_tail;
-	if (i <= 0) i += N_WCMDQ;
-	return i;
+	return n_wcmdq - WcmdqUsed();
 }
 
 int WcmdqUsed()
 {
-	return N_WCMDQ - WcmdqFree();
+	return wcmdq_tail - wcmdq_head;
 }
 
 void WcmdqInc()
 {
 	wcmdq_tail++;
-	if (wcmdq_tail >= N_WCMDQ) wcmdq_tail = 0;
 }
 
 static void WcmdqIncHead()
 {
 	wcmdq_head++;
-	if (wcmdq_head >= N_WCMDQ) wcmdq_head = 0;
+}
+
+bool WcmdqGrow()
+{
+	// Double the size of the queue, so that synthesize can generate a whole
+	// clause without waiting for wavegen to use it.
+	// return: false  the queue is at its maximum size, or out of memory
+	wcmd_t *new_wcmdq;
+	int new_size;
+	int ix;
+
+	if (n_wcmdq >= N_WCMDQ_MAX)
+		return false;
+
+	new_size = n_wcmdq * 2;
+	if ((new_wcmdq = (wcmd_t *)malloc(new_size * sizeof(wcmd_t))) == NULL)
+		return false;
+
+	// Keep the most recent n_wcmdq entries, including any which wavegen has
+	// already used, as synthesize may still look back at these.
+	ix = wcmdq_tail - n_wcmdq;
+	if (ix < 0)
+		ix = 0;
+	for (; ix < wcmdq_tail; ix++)
+		new_wcmdq[ix & (new_size-1)] = *WCMDQ(ix);
+
+	if (wcmdq != wcmdq_initial)
+		free(wcmdq);
+	wcmdq = new_wcmdq;
+	n_wcmdq = new_size;
+	return true;
+}
+
+void WcmdqRebase()
+{
+	// Called at the start of a clause, to keep the queue indices small. The
+	// entries don't move, as the offset is a multiple of n_wcmdq.
+	int offset;
+
+	offset = wcmdq_head & ~(n_wcmdq-1);
+	wcmdq_head -= offset;
+	wcmdq_tail -= offset;
+}
+
+void FreeWcmdq()
+{
+	if (wcmdq != wcmdq_initial)
+		free(wcmdq);
+	wcmdq = wcmdq_initial;
+	n_wcmdq = N_WCMDQ;
+	wcmdq_head = 0;
+	wcmdq_tail = 0;
 }
 
 #define PEAKSHAPEW 256
@@ -324,52 +399,90 @@ static unsigned char pk_shape2[PEAKSHAPEW+1] = {
 
 static unsigned char *pk_shape;
 
-void WavegenInit(int rate, int wavemult_fact)
+static void WavegenSetEcho(void);
+
+void WavegenSetSampleRate(int rate)
 {
+	// An MBROLA voice keeps its own sample rate until it is unloaded.
 	int ix;
 	double x;
 
-	if (wavemult_fact == 0)
-		wavemult_fact = 60; // default
-
-	wvoice = NULL;
-	samplerate = samplerate_native = rate;
-	PHASE_INC_FACTOR = 0x8000000 / samplerate; // assumes pitch is Hz*32
-	Flutter_inc = (64 * samplerate)/rate;
-	samplecount = 0;
-	nsamples = 0;
-	wavephase = 0x7fffffff;
-	max_hval = 0;
-
-	wdata.amplitude = 32;
-	wdata.amplitude_fmt = 100;
-
-	for (ix = 0; ix < N_EMBEDDED_VALUES; ix++)
-		embedded_value[ix] = embedded_default[ix];
+	if (mbrola_name[0] == 0)
+		samplerate = rate;
+	samplerate_native = rate;
+	PHASE_INC_FACTOR = 0x8000000 / rate; // assumes pitch is Hz*32
 
 	// set up window to generate a spread of harmonics from a
 	// single peak for HF peaks
-	wavemult_max = (samplerate * wavemult_fact)/(256 * 50);
+	wavemult_max = (rate * wavemult_fact)/(256 * 50);
 	if (wavemult_max > N_WAVEMULT) wavemult_max = N_WAVEMULT;
 
 	wavemult_offset = wavemult_max/2;
 
-	if (samplerate != 22050) {
+	if (rate == 22050) {
 		// wavemult table has preset values for 22050 Hz, we only need to
 		// recalculate them if we have a different sample rate
+		memcpy(wavemult, wavemult_22050, sizeof(wavemult));
+	} else {
+		memset(wavemult, 0, sizeof(wavemult));
 		for (ix = 0; ix < wavemult_max; ix++) {
 			x = 127*(1.0 - cos((M_PI*2)*ix/wavemult_max));
 			wavemult[ix] = (int)x;
 		}
 	}
 
-	pk_shape = pk_shape2;
+	// the echo delay line depends on the sample rate
+	short *new_echo_buf = (short *)realloc(echo_buf, sizeof(short) * ((N_ECHO_DELAY * rate)/1000 + 1));
+	if (new_echo_buf != NULL) {
+		echo_buf = new_echo_buf;
+		n_echo_buf = (N_ECHO_DELAY * rate)/1000 + 1;
+	}
+	WavegenSetEcho();
 
 #ifdef INCLUDE_KLATT
 	KlattInit();
 #endif
 }
 
+void WavegenInit(int rate, int wavemult_factor)
+{
+	int ix;
+
+	if (wavemult_factor == 0)
+		wavemult_factor = 60; // default
+
+	wvoice = NULL;
+	wavemult_fact = wavemult_factor;
+	samplerate = samplerate_native = rate;
+	Flutter_inc = (64 * samplerate)/rate;
+	samplecount = 0;
+	nsamples = 0;
+	wavephase = 0x7fffffff;
+	max_hval = 0;
+
+	wdata.amplitude = 32;
+	wdata.amplitude_fmt = 100;
+
+	for (ix = 0; ix < N_EMBEDDED_VALUES; ix++)
+		embedded_value[ix] = embedded_default[ix];
+
+	pk_shape = pk_shape2;
+	breath_seed = NOISE_SEED;
+
+	echo_amp = 0;
+	echo_delay = 0;
+	WavegenSetSampleRate(rate);
+}
+
+void FreeEcho(void)
+{
+	free(echo_buf);
+	echo_buf = NULL;
+	n_echo_buf = 0;
+	echo_amp = 0;
+	echo_delay = 0;
+}
+
 int GetAmplitude(void)
 {
 	int amp;
@@ -394,12 +507,13 @@ static void WavegenSetEcho(void)
 	delay = wvoice->echo_delay;
 	amp = wvoice->echo_amp;
 
-	if (delay >= N_ECHO_BUF)
-		delay = N_ECHO_BUF-1;
+	if (delay > N_ECHO_DELAY)
+		delay = N_ECHO_DELAY;
 	if (amp > 100)
 		amp = 100;
 
-	memset(echo_buf, 0, sizeof(echo_buf));
+	if (echo_buf != NULL)
+		memset(echo_buf, 0, sizeof(short) * n_echo_buf);
 	echo_tail = 0;
 
 	if (embedded_value[EMBED_H] > 0) {
@@ -407,11 +521,13 @@ static void WavegenSetEcho(void)
 		amp = embedded_value[EMBED_H];
 		delay = 130;
 	}
-
-	if (delay == 0)
+	if (option_economy >= ENECONOMY_MEDIUM)
 		amp = 0;
 
 	echo_head = (delay * samplerate)/1000;
+	if ((echo_head < WAVEGEN_BLOCK) || (echo_head >= n_echo_buf))
+		amp = 0;
+	echo_delay = echo_head;
 	echo_length = echo_head; // ensure completion of echo at the end of speech. Use 1 delay period?
 	if (amp == 0)
 		echo_length = 0;
@@ -457,6 +573,13 @@ int PeaksToHarmspect(wavegen_peaks_t *peaks, int pitch, int *htab, int control)
 	// restrict highest harmonic to half the samplerate
 	hmax_samplerate = (((samplerate * 19)/40) << 16)/pitch; // only 95% of Nyquist freq
 
+	if (economy_max_freq[option_economy] > 0) {
+		// only the harmonics which are needed at a lower output samplerate
+		x = (economy_max_freq[option_economy] << 16)/pitch;
+		if (x < hmax_samplerate)
+			hmax_samplerate = x;
+	}
+
 	if (hmax > hmax_samplerate)
 		hmax = hmax_samplerate;
 
@@ -586,40 +709,34 @@ static void AdvanceParameters()
 	}
 }
 
-static double resonator(RESONATOR *r, double input)
-{
-	double x;
-
-	x = r->a * input + r->b * r->x1 + r->c * r->x2;
-	r->x2 = r->x1;
-	r->x1 = x;
-
-	return x;
-}
-
-static void setresonator(RESONATOR *rp, int freq, int bwidth, int init)
+static void setresonator(int pk, int freq, int bwidth, int init)
 {
+	// pk      Breath formant, 1 to N_PEAKS-1
 	// freq    Frequency of resonator in Hz
 	// bwidth  Bandwidth of resonator in Hz
 	// init    Initialize internal data
 
 	double x;
 	double arg;
+	double b, c;
 
+	pk--;
 	if (init) {
-		rp->x1 = 0;
-		rp->x2 = 0;
+		breath.x1[pk] = 0;
+		breath.x2[pk] = 0;
 	}
 
 	arg = minus_pi_t * bwidth;
 	x = exp(arg);
 
-	rp->c = -(x * x);
+	c = -(x * x);
 
 	arg = two_pi_t * freq;
-	rp->b = x * cos(arg) * 2.0;
+	b = x * cos(arg) * 2.0;
 
-	rp->a = 1.0 - rp->b - rp->c;
+	breath.a[pk] = (float)(1.0 - b - c);
+	breath.b[pk] = (float)b;
+	breath.c[pk] = (float)c;
 }
 
 void InitBreath(void)
@@ -629,8 +746,10 @@ void InitBreath(void)
 	minus_pi_t = -M_PI / samplerate;
 	two_pi_t = -2.0 * minus_pi_t;
 
-	for (ix = 0; ix < N_PEAKS; ix++)
-		setresonator(&rbreath[ix], 2000, 200, 1);
+	for (ix = 1; ix < N_PEAKS; ix++) {
+		setresonator(ix, 2000, 200, 1);
+		breath.amp[ix-1] = 0;
+	}
 }
 
 static void SetBreath()
@@ -641,34 +760,172 @@ static void SetBreath()
 		return;
 
 	for (pk = 1; pk < N_PEAKS; pk++) {
+		if ((option_economy >= ENECONOMY_MEDIUM) && ((peaks[pk].freq >> 16) > economy_max_freq[option_economy])) {
+			// whispered voices are made of the breath noise, so only the
+			// formants above the frequency limit are left out
+			breath.amp[pk-1] = 0;
+			continue;
+		}
 		if (wvoice->breath[pk] != 0) {
 			// breath[0] indicates that some breath formants are needed
 			// set the freq from the current synthesis formant and the width from the voice data
-			setresonator(&rbreath[pk], peaks[pk].freq >> 16, wvoice->breathw[pk], 0);
+			setresonator(pk, peaks[pk].freq >> 16, wvoice->breathw[pk], 0);
 		}
+		breath.amp[pk-1] = wvoice->breath[pk] * (peaks[pk].height >> 14);
 	}
 }
 
-static int ApplyBreath(void)
+// Generate n samples of breath noise. The breath formants are filtered side
+// by side for each sample, rather than one after the other.
+static void ApplyBreath(int *value, int n)
 {
-	if (wvoice == NULL)
-		return 0;
+	int ix;
+	int pk;
+	int sum;
+	float noise;
+	float x;
+	float x1[N_BREATH];
+	float x2[N_BREATH];
+
+	memcpy(x1, breath.x1, sizeof(x1));
+	memcpy(x2, breath.x2, sizeof(x2));
+
+	for (ix = 0; ix < n; ix++) {
+		noise = (float)((int)(NoiseRandom(&breath_seed) & 0x3fff) - 0x2000);
+
+		sum = 0;
+		for (pk = 0; pk < N_BREATH; pk++) {
+			x = breath.a[pk] * noise + breath.b[pk] * x1[pk] + breath.c[pk] * x2[pk];
+			x2[pk] = x1[pk];
+			x1[pk] = x;
+			sum += (int)x * breath.amp[pk];
+		}
+		value[ix] = sum;
+	}
 
-	int value = 0;
-	int noise;
+	memcpy(breath.x1, x1, sizeof(x1));
+	memcpy(breath.x2, x2, sizeof(x2));
+}
+
+// Add the delayed output to a block of n samples. The block must not be
+// longer than the delay, so that none of its own samples are needed.
+static void EchoAdd(int *samples, int n)
+{
 	int ix;
-	int amp;
+	int k;
 
-	// use two random numbers, for alternate formants
-	noise = (rand() & 0x3fff) - 0x2000;
+	while (n > 0) {
+		k = n;
+		if (k > n_echo_buf - echo_tail)
+			k = n_echo_buf - echo_tail;
 
-	for (ix = 1; ix < N_PEAKS; ix++) {
-		if ((amp = wvoice->breath[ix]) != 0) {
-			amp *= (peaks[ix].height >> 14);
-			value += (int)resonator(&rbreath[ix], noise) * amp;
+		for (ix = 0; ix < k; ix++)
+			samples[ix] += (echo_buf[echo_tail+ix] * echo_amp) >> 8;
+
+		samples += k;
+		n -= k;
+		if ((echo_tail += k) >= n_echo_buf)
+			echo_tail = 0;
+	}
+}
+
+// Feed n output samples back into the delay line, scaled by feedback/4.
+static void EchoStore(const unsigned char *p, int n, int feedback)
+{
+	int ix;
+	int k;
+	int value;
+
+	while (n > 0) {
+		k = n;
+		if (k > n_echo_buf - echo_head)
+			k = n_echo_buf - echo_head;
+
+		for (ix = 0; ix < k; ix++) {
+			value = p[ix*2] + ((signed char)p[ix*2+1] * 256);
+			echo_buf[echo_head+ix] = (value * feedback)/4;
 		}
+
+		p += k*2;
+		n -= k;
+		if ((echo_head += k) >= n_echo_buf)
+			echo_head = 0;
+	}
+}
+
+#define N_ECHO_BLOCK 256
+
+// Add the echo to the samples from p to end, which have just been written by
+// PlaySilence().
+static void ApplyEcho(unsigned char *p, unsigned char *end, int feedback)
+{
+	int block[N_ECHO_BLOCK];
+	int n;
+	int ix;
+	int value;
+
+	if (echo_amp == 0)
+		return;
+
+	while (p < end) {
+		n = (end - p)/2;
+		if (n > N_ECHO_BLOCK)
+			n = N_ECHO_BLOCK;
+		if (n > echo_delay)
+			n = echo_delay;
+
+		for (ix = 0; ix < n; ix++)
+			block[ix] = p[ix*2] + ((signed char)p[ix*2+1] * 256);
+
+		EchoAdd(block, n);
+
+		for (ix = 0; ix < n; ix++) {
+			value = block[ix];
+			if (value > 32767)
+				value = 32767;
+			else if (value < -32768)
+				value = -32768;
+			p[ix*2] = value;
+			p[ix*2+1] = value >> 8;
+		}
+
+		EchoStore(p, n, feedback);
+		p += n*2;
+	}
+}
+
+// Write n samples from PlayWave() or the Klatt synthesizer to the output
+// buffer. As in Wavegen(), the echo is added before the samples are clipped to
+// 16 bits, and they are fed back into it scaled by feedback/4.
+void WavegenOutput(int *samples, int n, int feedback)
+{
+	int k;
+	int ix;
+	int value;
+
+	while (n > 0) {
+		k = n;
+		if (echo_amp != 0) {
+			if (k > echo_delay)
+				k = echo_delay;
+			EchoAdd(samples, k);
+		}
+
+		for (ix = 0; ix < k; ix++) {
+			value = samples[ix];
+			if (value > 32767)
+				value = 32767;
+			else if (value < -32768)
+				value = -32768;
+			*out_ptr++ = value;
+			*out_ptr++ = value >> 8;
+		}
+
+		if (echo_amp != 0)
+			EchoStore(out_ptr - k*2, k, feedback);
+		samples += k;
+		n -= k;
 	}
-	return value;
 }
 
 static int Wavegen()
@@ -682,7 +939,6 @@ static int Wavegen()
 	int h;
 	int ix;
 	int z, z1, z2;
-	int echo;
 	int ov;
 	static int maxh, maxh2;
 	int pk;
@@ -694,6 +950,18 @@ static int Wavegen()
 	static int h_switch_sign = 0;
 	static int cycle_count = 0;
 	static int amplitude2 = 0; // adjusted for pitch
+	int block[WAVEGEN_BLOCK];
+	int breath_block[WAVEGEN_BLOCK];
+	int n_block;
+	int n;
+	bool finished;
+	int spect_mask = 0x3f; // recalculate the harmonic spectrum every 64 samples ...
+	int step_mask = 0x07; // ... and interpolate the low harmonics every 8 samples
+
+	if (option_economy >= ENECONOMY_HIGH) {
+		spect_mask = 0x7f;
+		step_mask = 0x0f;
+	}
 
 	// continue until the output buffer is full, or
 	// the required number of samples have been produced
@@ -722,131 +990,158 @@ static int Wavegen()
 			cycle_samples = samplerate/(wdata.pitch >> 12); // sr/(pitch*2)
 			hf_factor = wdata.pitch >> 11;
 
-			maxh = maxh2;
-			harmspect = hspect[hswitch];
-			hswitch ^= 1;
-			maxh2 = PeaksToHarmspect(peaks, wdata.pitch<<4, hspect[hswitch], 1);
+			if ((samplecount & spect_mask) == 0) {
+				maxh = maxh2;
+				harmspect = hspect[hswitch];
+				hswitch ^= 1;
+				maxh2 = PeaksToHarmspect(peaks, wdata.pitch<<4, hspect[hswitch], 1);
+			} else {
+				for (h = 1; h < N_LOWHARM && h <= maxh2 && h <= maxh; h++)
+					harmspect[h] += harm_inc[h];
+			}
 
 			SetBreath();
 		} else if ((samplecount & 0x07) == 0) {
-			for (h = 1; h < N_LOWHARM && h <= maxh2 && h <= maxh; h++)
-				harmspect[h] += harm_inc[h];
+			if ((samplecount & step_mask) == 0) {
+				for (h = 1; h < N_LOWHARM && h <= maxh2 && h <= maxh; h++)
+					harmspect[h] += harm_inc[h];
+			}
 
 			// bring automatic gain control back towards unity
 			if (agc < 256) agc++;
 		}
 
-		samplecount++;
-
-		if (wavephase > 0) {
-			wavephase += phaseinc;
-			if (wavephase < 0) {
-				// sign has changed, reached a quiet point in the waveform
-				cbytes = wavemult_offset - (cycle_samples)/2;
-				if (samplecount > nsamples)
-					return 0;
+		// The parameters are constant until the next multiple of 8 samples, so
+		// generate the samples up to there as a block, without checking for
+		// the updates or for the end of the output buffer on each sample.
+		n_block = WAVEGEN_BLOCK - (samplecount & 0x07);
+		if ((end_wave == 0) && (samplecount < nsamples) && (n_block > nsamples - samplecount))
+			n_block = nsamples - samplecount;
+		if (n_block > (out_end - out_ptr) / 2)
+			n_block = (out_end - out_ptr) / 2;
+		if (n_block < 1)
+			n_block = 1;
 
-				cycle_count++;
+		if (wvoice->breath[0])
+			ApplyBreath(breath_block, n_block);
+
+		finished = false;
+		for (n = 0; n < n_block; n++) {
+			samplecount++;
+
+			if (wavephase > 0) {
+				wavephase += phaseinc;
+				if (wavephase < 0) {
+					// sign has changed, reached a quiet point in the waveform
+					cbytes = wavemult_offset - (cycle_samples)/2;
+					if (samplecount > nsamples) {
+						finished = true;
+						break;
+					}
 
-				for (pk = wvoice->n_harmonic_peaks+1; pk < N_PEAKS; pk++) {
-					// find the nearest harmonic for HF peaks where we don't use shape
-					peak_harmonic[pk] = ((peaks[pk].freq / (wdata.pitch*8)) + 1) / 2;
-				}
+					cycle_count++;
 
-				// adjust amplitude to compensate for fewer harmonics at higher pitch
-				amplitude2 = (wdata.amplitude * (wdata.pitch >> 8) * wdata.amplitude_fmt)/(10000 << 3);
+					for (pk = wvoice->n_harmonic_peaks+1; pk < N_PEAKS; pk++) {
+						// find the nearest harmonic for HF peaks where we don't use shape
+						peak_harmonic[pk] = ((peaks[pk].freq / (wdata.pitch*8)) + 1) / 2;
+					}
 
-				if (glottal_flag > 0) {
-					if (glottal_flag == 3) {
-						if ((nsamples-samplecount) < (cycle_samples*2)) {
-							// Vowel before glottal-stop.
-							// This is the start of the penultimate cycle, reduce its amplitude
+					// adjust amplitude to compensate for fewer harmonics at higher pitch
+					amplitude2 = (wdata.amplitude * (wdata.pitch >> 8) * wdata.amplitude_fmt)/(10000 << 3);
+
+					if (glottal_flag > 0) {
+						if (glottal_flag == 3) {
+							if ((nsamples-samplecount) < (cycle_samples*2)) {
+								// Vowel before glottal-stop.
+								// This is the start of the penultimate cycle, reduce its amplitude
+								glottal_flag = 2;
+								amplitude2 = (amplitude2 *  glottal_reduce)/256;
+							}
+						} else if (glottal_flag == 4) {
+							// Vowel following a glottal-stop.
+							// This is the start of the second cycle, reduce its amplitude
 							glottal_flag = 2;
-							amplitude2 = (amplitude2 *  glottal_reduce)/256;
-						}
-					} else if (glottal_flag == 4) {
-						// Vowel following a glottal-stop.
-						// This is the start of the second cycle, reduce its amplitude
-						glottal_flag = 2;
-						amplitude2 = (amplitude2 * glottal_reduce)/256;
-					} else
-						glottal_flag--;
-				}
+							amplitude2 = (amplitude2 * glottal_reduce)/256;
+						} else
+							glottal_flag--;
+					}
 
-				if (amplitude_env != NULL) {
-					// amplitude envelope is only used for creaky voice effect on certain vowels/tones
-					if ((ix = amp_ix>>8) > 127) ix = 127;
-					amp = amplitude_env[ix];
-					amplitude2 = (amplitude2 * amp)/128;
-				}
+					if (amplitude_env != NULL) {
+						// amplitude envelope is only used for creaky voice effect on certain vowels/tones
+						if ((ix = amp_ix>>8) > 127) ix = 127;
+						amp = amplitude_env[ix];
+						amplitude2 = (amplitude2 * amp)/128;
+					}
 
-				// introduce roughness into the sound by reducing the amplitude of
-				modn_period = 0;
-				if (voice->roughness < N_ROUGHNESS) {
-					modn_period = modulation_tab[voice->roughness][modulation_type];
-					modn_amp = modn_period & 0xf;
-					modn_period = modn_period >> 4;
-				}
+					// introduce roughness into the sound by reducing the amplitude of
+					modn_period = 0;
+					if (wvoice->roughness < N_ROUGHNESS) {
+						modn_period = modulation_tab[wvoice->roughness][modulation_type];
+						modn_amp = modn_period & 0xf;
+						modn_period = modn_period >> 4;
+					}
 
-				if (modn_period != 0) {
-					if (modn_period == 0xf) {
-						// just once */
-						amplitude2 = (amplitude2 * modn_amp)/16;
-						modulation_type = 0;
-					} else {
-						// reduce amplitude every [modn_period} cycles
-						if ((cycle_count % modn_period) == 0)
+					if (modn_period != 0) {
+						if (modn_period == 0xf) {
+							// just once */
 							amplitude2 = (amplitude2 * modn_amp)/16;
+							modulation_type = 0;
+						} else {
+							// reduce amplitude every [modn_period} cycles
+							if ((cycle_count % modn_period) == 0)
+								amplitude2 = (amplitude2 * modn_amp)/16;
+						}
 					}
 				}
-			}
-		} else
-			wavephase += phaseinc;
-		waveph = (unsigned short)(wavephase >> 16);
-		total = 0;
-
-		// apply HF peaks, formants 6,7,8
-		// add a single harmonic and then spread this my multiplying by a
-		// window.  This is to reduce the processing power needed to add the
-		// higher frequence harmonics.
-		cbytes++;
-		if (cbytes >= 0 && cbytes < wavemult_max) {
-			for (pk = wvoice->n_harmonic_peaks+1; pk < N_PEAKS; pk++) {
-				theta = peak_harmonic[pk] * waveph;
-				total += (long)sin_tab[theta >> 5] * peak_height[pk];
-			}
+			} else
+				wavephase += phaseinc;
+			waveph = (unsigned short)(wavephase >> 16);
+			total = 0;
+
+			// apply HF peaks, formants 6,7,8
+			// add a single harmonic and then spread this my multiplying by a
+			// window.  This is to reduce the processing power needed to add the
+			// higher frequence harmonics.
+			cbytes++;
+			if (cbytes >= 0 && cbytes < wavemult_max) {
+				for (pk = wvoice->n_harmonic_peaks+1; pk < N_PEAKS; pk++) {
+					theta = peak_harmonic[pk] * waveph;
+					total += (long)sin_tab[theta >> 5] * peak_height[pk];
+				}
 
-			// spread the peaks by multiplying by a window
-			total = (long)(total / hf_factor) * wavemult[cbytes];
-		}
+				// spread the peaks by multiplying by a window
+				total = (long)(total / hf_factor) * wavemult[cbytes];
+			}
 
-		// apply main peaks, formants 0 to 5
+			// apply main peaks, formants 0 to 5
 #ifdef USE_ASSEMBLER_1
-		// use an optimised routine for this loop, if available
-		total += AddSineWaves(waveph, h_switch_sign, maxh, harmspect);  // call an assembler code routine
+			// use an optimised routine for this loop, if available
+			total += AddSineWaves(waveph, h_switch_sign, maxh, harmspect);  // call an assembler code routine
 #else
-		theta = waveph;
+			theta = waveph;
 
-		for (h = 1; h <= h_switch_sign; h++) {
-			total += ((int)sin_tab[theta >> 5] * harmspect[h]);
-			theta += waveph;
-		}
-		while (h <= maxh) {
-			total -= ((int)sin_tab[theta >> 5] * harmspect[h]);
-			theta += waveph;
-			h++;
-		}
+			for (h = 1; h <= h_switch_sign; h++) {
+				total += ((int)sin_tab[theta >> 5] * harmspect[h]);
+				theta += waveph;
+			}
+			while (h <= maxh) {
+				total -= ((int)sin_tab[theta >> 5] * harmspect[h]);
+				theta += waveph;
+				h++;
+			}
 #endif
 
-		if (voicing != 64)
-			total = (total >> 6) * voicing;
+			if (voicing != 64)
+				total = (total >> 6) * voicing;
 
-		if (wvoice->breath[0])
-			total +=  ApplyBreath();
+			if (wvoice->breath[0])
+				total += breath_block[n];
+
+			block[n] = ((total>>8) * amplitude2) >> 13;
+		}
 
 		// mix with sampled wave if required
-		z2 = 0;
-		if (wdata.mix_wavefile_ix < wdata.n_mix_wavefile) {
+		for (ix = 0; (ix < n) && (wdata.mix_wavefile_ix < wdata.n_mix_wavefile); ix++) {
 			if (wdata.mix_wave_scale == 0) {
 				// a 16 bit sample
 				c = wdata.mix_wavefile[wdata.mix_wavefile_ix+wdata.mix_wavefile_offset+1];
@@ -861,34 +1156,37 @@ static int Wavegen()
 
 			if ((wdata.mix_wavefile_ix + wdata.mix_wavefile_offset) >= wdata.mix_wavefile_max)  // reached the end of available WAV data
 				wdata.mix_wavefile_offset -= (wdata.mix_wavefile_max*3)/4;
-		}
-
-		z1 = z2 + (((total>>8) * amplitude2) >> 13);
 
-		echo = (echo_buf[echo_tail++] * echo_amp);
-		z1 += echo >> 8;
-		if (echo_tail >= N_ECHO_BUF)
-			echo_tail = 0;
+			block[ix] += z2;
+		}
 
-		z = (z1 * agc) >> 8;
+		if (echo_amp != 0)
+			EchoAdd(block, n);
 
-		// check for overflow, 16bit signed samples
-		if (z >= 32768) {
-			ov = 8388608/z1 - 1;      // 8388608 is 2^23, i.e. max value * 256
-			if (ov < agc) agc = ov;    // set agc to number of 1/256ths to multiply the sample by
-			z = (z1 * agc) >> 8;      // reduce sample by agc value to prevent overflow
-		} else if (z <= -32768) {
-			ov = -8388608/z1 - 1;
-			if (ov < agc) agc = ov;
+		// scale the block into 16 bit samples
+		for (ix = 0; ix < n; ix++) {
+			z1 = block[ix];
 			z = (z1 * agc) >> 8;
+
+			// check for overflow, 16bit signed samples
+			if (z >= 32768) {
+				ov = 8388608/z1 - 1;      // 8388608 is 2^23, i.e. max value * 256
+				if (ov < agc) agc = ov;    // set agc to number of 1/256ths to multiply the sample by
+				z = (z1 * agc) >> 8;      // reduce sample by agc value to prevent overflow
+			} else if (z <= -32768) {
+				ov = -8388608/z1 - 1;
+				if (ov < agc) agc = ov;
+				z = (z1 * agc) >> 8;
+			}
+			*out_ptr++ = z;
+			*out_ptr++ = z >> 8;
 		}
-		*out_ptr++ = z;
-		*out_ptr++ = z >> 8;
 
-		echo_buf[echo_head++] = z;
-		if (echo_head >= N_ECHO_BUF)
-			echo_head = 0;
+		if (echo_amp != 0)
+			EchoStore(out_ptr - n*2, n, 4);
 
+		if (finished)
+			return 0;
 		if (out_ptr + 2 > out_end)
 			return 1;
 	}
@@ -897,7 +1195,6 @@ static int Wavegen()
 static int PlaySilence(int length, bool resume)
 {
 	static int n_samples;
-	int value = 0;
 
 	nsamples = 0;
 	samplecount = 0;
@@ -910,17 +1207,8 @@ static int PlaySilence(int length, bool resume)
 		n_samples = length;
 
 	while (n_samples-- > 0) {
-		value = (echo_buf[echo_tail++] * echo_amp) >> 8;
-
-		if (echo_tail >= N_ECHO_BUF)
-			echo_tail = 0;
-
-		*out_ptr++ = value;
-		*out_ptr++ = value >> 8;
-
-		echo_buf[echo_head++] = value;
-		if (echo_head >= N_ECHO_BUF)
-			echo_head = 0;
+		*out_ptr++ = 0;
+		*out_ptr++ = 0;
 
 		if (out_ptr + 2 > out_end)
 			return 1;
@@ -932,6 +1220,9 @@ static int PlayWave(int length, bool resume, unsigned char *data, int scale, int
 {
 	static int n_samples;
 	static int ix = 0;
+	int block[N_ECHO_BLOCK];
+	int n;
+	int k;
 	int value;
 	signed char c;
 
@@ -943,37 +1234,31 @@ static int PlayWave(int length, bool resume, unsigned char *data, int scale, int
 	nsamples = 0;
 	samplecount = 0;
 
-	while (n_samples-- > 0) {
-		if (scale == 0) {
-			// 16 bits data
-			c = data[ix+1];
-			value = data[ix] + (c * 256);
-			ix += 2;
-		} else {
-			// 8 bit data, shift by the specified scale factor
-			value = (signed char)data[ix++] * scale;
+	while (n_samples > 0) {
+		n = n_samples;
+		if (n > N_ECHO_BLOCK)
+			n = N_ECHO_BLOCK;
+		if (n > (out_end - out_ptr)/2)
+			n = (out_end - out_ptr)/2;
+
+		for (k = 0; k < n; k++) {
+			if (scale == 0) {
+				// 16 bits data
+				c = data[ix+1];
+				value = data[ix] + (c * 256);
+				ix += 2;
+			} else {
+				// 8 bit data, shift by the specified scale factor
+				value = (signed char)data[ix++] * scale;
+			}
+			value *= (consonant_amp * general_amplitude); // reduce strength of consonant
+			value = value >> 10;
+			block[k] = (value * amp)/32;
 		}
-		value *= (consonant_amp * general_amplitude); // reduce strength of consonant
-		value = value >> 10;
-		value = (value * amp)/32;
-
-		value += ((echo_buf[echo_tail++] * echo_amp) >> 8);
-
-		if (value > 32767)
-			value = 32768;
-		else if (value < -32768)
-			value = -32768;
 
-		if (echo_tail >= N_ECHO_BUF)
-			echo_tail = 0;
-
-		out_ptr[0] = value;
-		out_ptr[1] = value >> 8;
-		out_ptr += 2;
-
-		echo_buf[echo_head++] = (value*3)/4;
-		if (echo_head >= N_ECHO_BUF)
-			echo_head = 0;
+		// the echo is added before the samples are clipped
+		WavegenOutput(block, n, 3);
+		n_samples -= n;
 
 		if (out_ptr + 2 > out_end)
 			return 1;
@@ -1055,6 +1340,15 @@ void SetEmbedded(int control, int value)
 	}
 }
 
+espeak_ng_STATUS WavegenSetEconomy(espeak_ng_ECONOMY level)
+{
+	if ((level < ENECONOMY_NONE) || (level > ENECONOMY_HIGH))
+		return EINVAL;
+	option_economy = level;
+	WavegenSetEcho(); // the echo is switched off at ENECONOMY_MEDIUM and above
+	return ENS_OK;
+}
+
 void WavegenSetVoice(voice_t *v)
 {
 	static voice_t v2;
@@ -1068,6 +1362,7 @@ void WavegenSetVoice(voice_t *v)
 		pk_shape = pk_shape2;
 
 	consonant_amp = (v->consonant_amp * 26) /100;
+	option_harmonic1 = 10;
 	if (samplerate <= 11000) {
 		consonant_amp = consonant_amp*2; // emphasize consonants at low sample rates
 		option_harmonic1 = 6;
@@ -1155,8 +1450,6 @@ static void SetSynth(int length, int modn, frame_t *fr1, frame_t *fr2, voice_t *
 	double next;
 	int length2;
 	int length4;
-	int qix;
-	int cmd;
 	static int glottal_reduce_tab1[4] = { 0x30, 0x30, 0x40, 0x50 }; // vowel before [?], amp * 1/256
 	static int glottal_reduce_tab2[4] = { 0x90, 0xa0, 0xb0, 0xc0 }; // vowel after [?], amp * 1/256
 
@@ -1176,18 +1469,8 @@ static void SetSynth(int length, int modn, frame_t *fr1, frame_t *fr2, voice_t *
 		glottal_reduce = glottal_reduce_tab2[(modn >> 8) & 3];
 	}
 
-	for (qix = wcmdq_head+1;; qix++) {
-		if (qix >= N_WCMDQ) qix = 0;
-		if (qix == wcmdq_tail) break;
-
-		cmd = wcmdq[qix][0];
-		if (cmd == WCMD_SPECT) {
-			end_wave = 0; // next wave generation is from another spectrum
-			break;
-		}
-		if ((cmd == WCMD_WAVE) || (cmd == WCMD_PAUSE))
-			break; // next is not from spectrum, so continue until end of wave cycle
-	}
+	if (WcmdqNextFrame(WCMD_SPECT) != NULL)
+		end_wave = 0; // next wave generation is from another spectrum
 
 	// round the length to a multiple of the stepsize
 	length2 = (length + STEPSIZE/2) & ~0x3f;
@@ -1252,37 +1535,376 @@ void Write4Bytes(FILE *f, int value)
 	}
 }
 
+// The capture of the commands which WavegenFill2() takes from wcmdq, with the
+// frames, envelopes and wave data that they refer to, so that the wave
+// generator can be driven again from the file alone by WavegenReplayFill().
+//
+// The file is a CAPTURE_HEADER followed by CAPTURE_RECORDs. The frames and
+// data are written once, before the first command which uses them, and are
+// then referred to by their index. A CAPTURE_STATE record is written when
+// the voice, embedded values or sample rate have changed other than by a
+// command, e.g. by espeak_SetParameter() between utterances. The byte order
+// and structure layouts are those of the library which wrote the file.
+//
+// WavegenFill2() returns when it finds the queue empty, and continues any
+// echo with silence, so the points at which that happened are recorded to
+// give the same buffers when the capture is replayed. The look ahead of
+// SetSynth() and SetSynth_Klatt() is recorded with each spectrum command, as
+// the queue may not have held the following commands when it was captured.
+// The size of the output buffer is in the header, as the Klatt synthesizer
+// does not give quite the same samples when they are split differently.
+
+#define CAPTURE_VERSION 1
+
+#define CAPTURE_STATE  -1 // followed by a CAPTURED_STATE
+#define CAPTURE_FRAME  -2 // followed by a frame_t
+#define CAPTURE_DATA   -3 // followed by length bytes of an envelope or wave
+#define CAPTURE_EMPTY  -4 // WavegenFill2() found the queue empty
+
+typedef struct {
+	char magic[4]; // "ESWC"
+	int version;
+	int state_size;
+	int frame_size;
+	int buffer_size; // bytes of the output buffer, or 0 if not known
+} CAPTURE_HEADER;
+
+typedef struct {
+	int samplerate;
+	int economy;
+	int general_amplitude;
+	int sonic_speed; // speed * 1024
+	int embedded_value[N_EMBEDDED_VALUES];
+	int has_voice;
+	voice_t voice;
+} CAPTURED_STATE;
+
+typedef struct {
+	int cmd;    // WCMD_*, or CAPTURE_*
+	int length; // the length of the command, or of the data which follows
+	int value[4];
+} CAPTURE_RECORD;
+
+// frames which are compared with each new frame, as consecutive spectrum
+// commands usually share one
+#define N_CAPTURE_FRAMES 8
+
+typedef struct {
+	const unsigned char *data;
+	int length;
+	uint32_t hash; // in case the data has been replaced at the same address
+	int index;
+} CAPTURED_DATA;
+
+static FILE *f_capture = NULL;
+static bool capture_has_state;
+static CAPTURED_STATE capture_state;
+static frame_t capture_frames[N_CAPTURE_FRAMES];
+static int n_capture_frames;
+static CAPTURED_DATA *capture_data = NULL; // hash table, by address
+static int capture_data_size;
+static int n_capture_data;
+
+// blocks of frames and data read from a capture
+#define N_REPLAY_BLOCK 256
+
+static struct {
+	FILE *f;
+	frame_t **frames;
+	int n_frames;
+	unsigned char **data;
+	int *data_length; // bytes of each data, which the commands must not read beyond
+	int n_data;
+	frame_t **next;  // the look ahead of each command in wcmdq, by index & (N_WCMDQ_MAX-1)
+	bool empty;      // the queue is to be emptied before the next commands are added
+	bool end;        // the end of the file has been read
+} replay;
+
+frame_t *WcmdqNextFrame(int cmd)
+{
+	// The first frame of the next command of this type in the queue, if it
+	// comes before any wave or pause command. Otherwise NULL.
+	int qix;
+	wcmd_t *q;
+
+	if (replay.f != NULL)
+		return replay.next[wcmdq_head & (N_WCMDQ_MAX-1)];
+
+	for (qix = wcmdq_head+1; qix < wcmdq_tail; qix++) {
+		q = WCMDQ(qix);
+		if (q->cmd == cmd)
+			return q->u.spect.frame1;
+		if ((q->cmd == WCMD_WAVE) || (q->cmd == WCMD_PAUSE))
+			break; // next is not from spectrum, so continue until end of wave cycle
+	}
+	return NULL;
+}
+
+static uint32_t CaptureHash(const unsigned char *data, int length)
+{
+	uint32_t hash = 2166136261U;
+
+	while (length-- > 0)
+		hash = (hash ^ *data++) * 16777619U;
+	return hash;
+}
+
+static void CaptureWrite(int cmd, int length, int v0, int v1, int v2, int v3, const void *data, int size)
+{
+	CAPTURE_RECORD rec;
+
+	rec.cmd = cmd;
+	rec.length = length;
+	rec.value[0] = v0;
+	rec.value[1] = v1;
+	rec.value[2] = v2;
+	rec.value[3] = v3;
+	fwrite(&rec, sizeof(rec), 1, f_capture);
+	if (size > 0)
+		fwrite(data, size, 1, f_capture);
+}
+
+static int CaptureFrame(const frame_t *fr)
+{
+	int ix;
+
+	if (fr == NULL)
+		return -1;
+
+	for (ix = n_capture_frames-1; (ix >= 0) && (ix >= n_capture_frames-N_CAPTURE_FRAMES); ix--) {
+		if (memcmp(&capture_frames[ix % N_CAPTURE_FRAMES], fr, sizeof(frame_t)) == 0)
+			return ix;
+	}
+
+	CaptureWrite(CAPTURE_FRAME, sizeof(frame_t), 0, 0, 0, 0, fr, sizeof(frame_t));
+	memcpy(&capture_frames[n_capture_frames % N_CAPTURE_FRAMES], fr, sizeof(frame_t));
+	return n_capture_frames++;
+}
+
+static int CaptureData(const unsigned char *data, int length)
+{
+	CAPTURED_DATA *p;
+	CAPTURED_DATA *old;
+	int old_size;
+	int ix;
+	uint32_t hash;
+
+	if (data == NULL)
+		return -1;
+
+	if (n_capture_data*2 >= capture_data_size) {
+		old = capture_data;
+		old_size = capture_data_size;
+		if ((p = (CAPTURED_DATA *)calloc(old_size ? old_size*2 : 256, sizeof(CAPTURED_DATA))) == NULL)
+			return -1;
+		capture_data = p;
+		capture_data_size = old_size ? old_size*2 : 256;
+		for (ix = 0; ix < old_size; ix++) {
+			if (old[ix].data == NULL)
+				continue;
+			p = &capture_data[((uintptr_t)old[ix].data >> 4) & (capture_data_size-1)];
+			while (p->data != NULL)
+				p = (p == &capture_data[capture_data_size-1]) ? capture_data : p+1;
+			*p = old[ix];
+		}
+		free(old);
+	}
+
+	hash = CaptureHash(data, length);
+	p = &capture_data[((uintptr_t)data >> 4) & (capture_data_size-1)];
+	while (p->data != NULL) {
+		if ((p->data == data) && (p->length == length) && (p->hash == hash))
+			return p->index;
+		p = (p == &capture_data[capture_data_size-1]) ? capture_data : p+1;
+	}
+
+	CaptureWrite(CAPTURE_DATA, length, 0, 0, 0, 0, data, length);
+	p->data = data;
+	p->length = length;
+	p->hash = hash;
+	p->index = n_capture_data++;
+	return p->index;
+}
+
+static void CaptureState(bool write)
+{
+	// Write the state if it has changed since the previous command. Otherwise
+	// just note it, after a command which changed it.
+	CAPTURED_STATE state;
+
+	memset(&state, 0, sizeof(state));
+	state.samplerate = samplerate_native;
+	state.economy = option_economy;
+	state.general_amplitude = general_amplitude;
+#if HAVE_SONIC_H
+	state.sonic_speed = (int)(sonicSpeed * 1024);
+#else
+	state.sonic_speed = 1024;
+#endif
+	memcpy(state.embedded_value, embedded_value, sizeof(state.embedded_value));
+	if (wvoice != NULL) {
+		state.has_voice = 1;
+		memcpy(&state.voice, wvoice, sizeof(voice_t));
+	}
+
+	if (capture_has_state && (memcmp(&state, &capture_state, sizeof(state)) == 0))
+		return;
+
+	if (write)
+		CaptureWrite(CAPTURE_STATE, sizeof(state), 0, 0, 0, 0, &state, sizeof(state));
+	memcpy(&capture_state, &state, sizeof(state));
+	capture_has_state = true;
+}
+
+static void CaptureCommand(wcmd_t *q)
+{
+	int frame1;
+	int frame2;
+	int next;
+	int data;
+
+	CaptureState(true);
+
+	switch (q->cmd)
+	{
+	case WCMD_SPECT:
+	case WCMD_SPECT2:
+	case WCMD_KLATT:
+	case WCMD_KLATT2:
+		frame1 = CaptureFrame(q->u.spect.frame1);
+		frame2 = CaptureFrame(q->u.spect.frame2);
+		next = CaptureFrame(WcmdqNextFrame(((q->cmd == WCMD_SPECT) || (q->cmd == WCMD_SPECT2)) ? WCMD_SPECT : WCMD_KLATT));
+		CaptureWrite(q->cmd, q->length, q->u.spect.modulation, frame1, frame2, next, NULL, 0);
+		break;
+	case WCMD_WAVE:
+		data = CaptureData(q->u.wave.data, q->length * (q->u.wave.scale ? 1 : 2));
+		CaptureWrite(q->cmd, q->length, data, 0, q->u.wave.scale, q->u.wave.amp, NULL, 0);
+		break;
+	case WCMD_WAVE2:
+		data = CaptureData(q->u.wave.data, q->u.wave.wav_length * (q->u.wave.scale ? 1 : 2));
+		CaptureWrite(q->cmd, q->length, data, q->u.wave.wav_length, q->u.wave.scale, q->u.wave.amp, NULL, 0);
+		break;
+	case WCMD_PITCH:
+	case WCMD_AMPLITUDE:
+		data = CaptureData(q->u.env.env, ENV_LEN);
+		CaptureWrite(q->cmd, q->length, data, q->u.env.value1, q->u.env.value2, 0, NULL, 0);
+		break;
+	case WCMD_MARKER:
+		CaptureWrite(q->cmd, q->length, q->u.marker.type, q->u.marker.char_position, q->u.marker.value, q->u.marker.value2, NULL, 0);
+		break;
+	case WCMD_VOICE:
+		CaptureWrite(q->cmd, sizeof(voice_t), 0, 0, 0, 0, q->u.voice, sizeof(voice_t));
+		break;
+	case WCMD_EMBEDDED:
+		CaptureWrite(q->cmd, q->length, q->u.embedded.command, q->u.embedded.value, 0, 0, NULL, 0);
+		break;
+	case WCMD_PAUSE:
+		CaptureWrite(q->cmd, q->length, 0, 0, 0, 0, NULL, 0);
+		break;
+	case WCMD_FMT_AMPLITUDE:
+	case WCMD_SONIC_SPEED:
+		CaptureWrite(q->cmd, q->length, q->u.value, 0, 0, 0, NULL, 0);
+		break;
+	}
+	// WCMD_MBROLA_DATA is not captured, as the samples come from the MBROLA process
+}
+
+espeak_ng_STATUS WavegenStartCapture(FILE *f, int buffer_size)
+{
+	CAPTURE_HEADER header;
+
+	WavegenStopCapture();
+
+	memcpy(header.magic, "ESWC", 4);
+	header.version = CAPTURE_VERSION;
+	header.state_size = sizeof(CAPTURED_STATE);
+	header.frame_size = sizeof(frame_t);
+	header.buffer_size = buffer_size;
+	if (fwrite(&header, sizeof(header), 1, f) != 1) {
+		int error = errno;
+		fclose(f);
+		return error;
+	}
+
+	capture_has_state = false;
+	n_capture_frames = 0;
+	n_capture_data = 0;
+	f_capture = f;
+	return ENS_OK;
+}
+
+espeak_ng_STATUS WavegenStopCapture(void)
+{
+	int error = 0;
+
+	if (f_capture != NULL) {
+		if (ferror(f_capture))
+			error = EIO;
+		if ((fclose(f_capture) != 0) && (error == 0))
+			error = errno;
+		f_capture = NULL;
+	}
+
+	free(capture_data);
+	capture_data = NULL;
+	capture_data_size = 0;
+	return error;
+}
+
+// samples generated between the checks for espeak_ng_Cancel() in WavegenFill2()
+#define N_CANCEL_BLOCK 1024
+
 static int WavegenFill2()
 {
 	// Pick up next wavegen commands from the queue
-	// return: 0  output buffer has been filled
+	// return: 0  output buffer has been filled, or synthesis has been cancelled
 	// return: 1  input command queue is now empty
-	intptr_t *q;
+	wcmd_t *q;
 	int length;
 	int result;
 	int marker_type;
+	unsigned char *p;
+	unsigned char *buf_end = out_end;
 	static bool resume = false;
 	static int echo_complete = 0;
 
-	while (out_ptr < out_end) {
+	while (out_ptr < buf_end) {
+		if (SynthesisCancelled())
+			break;
+
+		// fill the buffer in blocks, so that a cancel is noticed part way through
+		out_end = buf_end;
+		if ((out_end - out_ptr) > 2*N_CANCEL_BLOCK)
+			out_end = out_ptr + 2*N_CANCEL_BLOCK;
+
+		p = out_ptr;
 		if (WcmdqUsed() <= 0) {
+			if (resume == false) {
+				if (f_capture != NULL)
+					CaptureWrite(CAPTURE_EMPTY, 0, 0, 0, 0, 0, NULL, 0);
+				replay.empty = false;
+			}
 			if (echo_complete > 0) {
 				// continue to play silence until echo is completed
 				resume = PlaySilence(echo_complete, resume);
+				ApplyEcho(p, out_ptr, 4);
 				if (resume == true)
-					return 0; // not yet finished
+					continue; // not yet finished
 			}
+			out_end = buf_end;
 			return 1; // queue empty, close sound channel
 		}
 
 		result = 0;
-		q = wcmdq[wcmdq_head];
-		length = q[1];
+		q = WCMDQ(wcmdq_head);
+		length = q->length;
+		if ((f_capture != NULL) && (resume == false))
+			CaptureCommand(q);
 
-		switch (q[0] & 0xff)
+		switch (q->cmd)
 		{
 		case WCMD_PITCH:
-			SetPitch(length, (unsigned char *)q[2], q[3] >> 16, q[3] & 0xffff);
+			SetPitch(length, q->u.env.env, q->u.env.value1, q->u.env.value2);
 			break;
 		case WCMD_PAUSE:
 			if (resume == false)
@@ -1293,6 +1915,7 @@ static int WavegenFill2()
 			KlattReset(1);
 #endif
 			result = PlaySilence(length, resume);
+			ApplyEcho(p, out_ptr, 4);
 			break;
 		case WCMD_WAVE:
 			echo_complete = echo_length;
@@ -1300,67 +1923,72 @@ static int WavegenFill2()
 #ifdef INCLUDE_KLATT
 			KlattReset(1);
 #endif
-			result = PlayWave(length, resume, (unsigned char *)q[2], q[3] & 0xff, q[3] >> 8);
+			result = PlayWave(length, resume, q->u.wave.data, q->u.wave.scale, q->u.wave.amp);
 			break;
 		case WCMD_WAVE2:
 			// wave file to be played at the same time as synthesis
-			wdata.mix_wave_amp = q[3] >> 8;
-			wdata.mix_wave_scale = q[3] & 0xff;
-			wdata.n_mix_wavefile = (length & 0xffff);
-			wdata.mix_wavefile_max = (length >> 16) & 0xffff;
+			wdata.mix_wave_amp = q->u.wave.amp;
+			wdata.mix_wave_scale = q->u.wave.scale;
+			wdata.n_mix_wavefile = length;
+			wdata.mix_wavefile_max = q->u.wave.wav_length;
 			if (wdata.mix_wave_scale == 0) {
 				wdata.n_mix_wavefile *= 2;
 				wdata.mix_wavefile_max *= 2;
 			}
 			wdata.mix_wavefile_ix = 0;
 			wdata.mix_wavefile_offset = 0;
-			wdata.mix_wavefile = (unsigned char *)q[2];
+			wdata.mix_wavefile = q->u.wave.data;
 			break;
 		case WCMD_SPECT2: // as WCMD_SPECT but stop any concurrent wave file
 			wdata.n_mix_wavefile = 0; // ... and drop through to WCMD_SPECT case
 		case WCMD_SPECT:
 			echo_complete = echo_length;
-			result = Wavegen2(length & 0xffff, q[1] >> 16, resume, (frame_t *)q[2], (frame_t *)q[3]);
+			result = Wavegen2(length, q->u.spect.modulation, resume, q->u.spect.frame1, q->u.spect.frame2);
 			break;
 #ifdef INCLUDE_KLATT
 		case WCMD_KLATT2: // as WCMD_SPECT but stop any concurrent wave file
 			wdata.n_mix_wavefile = 0; // ... and drop through to WCMD_SPECT case
 		case WCMD_KLATT:
+			// not split into blocks, as the Klatt synthesizer starts a new frame when it resumes
+			out_end = buf_end;
 			echo_complete = echo_length;
-			result = Wavegen_Klatt2(length & 0xffff, resume, (frame_t *)q[2], (frame_t *)q[3]);
+			result = Wavegen_Klatt2(length, resume, q->u.spect.frame1, q->u.spect.frame2);
 			break;
 #endif
 		case WCMD_MARKER:
-			marker_type = q[0] >> 8;
-			MarkerEvent(marker_type, q[1], q[2], q[3], out_ptr);
+			marker_type = q->u.marker.type;
+			MarkerEvent(marker_type, q->u.marker.char_position, q->u.marker.value, q->u.marker.value2, out_ptr);
 			if (marker_type == 1) // word marker
-				current_source_index = q[1] & 0xffffff;
+				current_source_index = q->u.marker.char_position & 0xffffff;
 			break;
 		case WCMD_AMPLITUDE:
-			SetAmplitude(length, (unsigned char *)q[2], q[3]);
+			SetAmplitude(length, q->u.env.env, q->u.env.value1);
 			break;
 		case WCMD_VOICE:
-			WavegenSetVoice((voice_t *)q[2]);
-			free((voice_t *)q[2]);
+			WavegenSetVoice(q->u.voice);
+			free(q->u.voice);
 			break;
 		case WCMD_EMBEDDED:
-			SetEmbedded(q[1], q[2]);
+			SetEmbedded(q->u.embedded.command, q->u.embedded.value);
 			break;
 		case WCMD_MBROLA_DATA:
 			if (wvoice != NULL)
 				result = MbrolaFill(length, resume, (general_amplitude * wvoice->voicing)/64);
 			break;
 		case WCMD_FMT_AMPLITUDE:
-			if ((wdata.amplitude_fmt = q[1]) == 0)
+			if ((wdata.amplitude_fmt = q->u.value) == 0)
 				wdata.amplitude_fmt = 100; // percentage, but value=0 means 100%
 			break;
 #if HAVE_SONIC_H
 		case WCMD_SONIC_SPEED:
-			sonicSpeed = (double)q[1] / 1024;
+			sonicSpeed = (double)q->u.value / 1024;
 			break;
 #endif
 		}
 
+		if ((f_capture != NULL) && ((q->cmd == WCMD_VOICE) || (q->cmd == WCMD_EMBEDDED) || (q->cmd == WCMD_SONIC_SPEED)))
+			CaptureState(false); // these commands change the state
+
 		if (result == 0) {
 			WcmdqIncHead();
 			resume = false;
@@ -1368,6 +1996,7 @@ static int WavegenFill2()
 			resume = true;
 	}
 
+	out_end = buf_end;
 	return 0;
 }
 
@@ -1377,7 +2006,7 @@ static int SpeedUp(short *outbuf, int length_in, int length_out, int end_of_text
 {
 	if (length_in > 0) {
 		if (sonicSpeedupStream == NULL)
-			sonicSpeedupStream = sonicCreateStream(22050, 1);
+			sonicSpeedupStream = sonicCreateStream(samplerate, 1);
 		if (sonicGetSpeed(sonicSpeedupStream) != sonicSpeed)
 			sonicSetSpeed(sonicSpeedupStream, sonicSpeed);
 
@@ -1418,3 +2047,264 @@ int WavegenFill(void)
 #endif
 	return finished;
 }
+
+espeak_ng_STATUS WavegenStartReplay(FILE *f, int *buffer_size)
+{
+	CAPTURE_HEADER header;
+
+	if ((fread(&header, sizeof(header), 1, f) != 1) || (memcmp(header.magic, "ESWC", 4) != 0)
+	    || (header.version != CAPTURE_VERSION) || (header.state_size != sizeof(CAPTURED_STATE))
+	    || (header.frame_size != sizeof(frame_t)))
+		return ENS_CORRUPT_DATA;
+
+	memset(&replay, 0, sizeof(replay));
+	if ((replay.next = (frame_t **)calloc(N_WCMDQ_MAX, sizeof(frame_t *))) == NULL)
+		return ENOMEM;
+	replay.f = f;
+	*buffer_size = header.buffer_size;
+	return ENS_OK;
+}
+
+void WavegenStopReplay(void)
+{
+	int ix;
+
+	if (replay.f == NULL)
+		return;
+
+	// the commands which have not been played refer to the frames and data
+	for (; wcmdq_head < wcmdq_tail; wcmdq_head++) {
+		if (WCMDQ(wcmdq_head)->cmd == WCMD_VOICE)
+			free(WCMDQ(wcmdq_head)->u.voice);
+	}
+
+	for (ix = 0; ix < replay.n_frames; ix += N_REPLAY_BLOCK)
+		free(replay.frames[ix / N_REPLAY_BLOCK]);
+	free(replay.frames);
+	for (ix = 0; ix < replay.n_data; ix++)
+		free(replay.data[ix]);
+	free(replay.data);
+	free(replay.data_length);
+	free(replay.next);
+	memset(&replay, 0, sizeof(replay));
+}
+
+static void ReplayState(CAPTURED_STATE *state)
+{
+	// Apply the state as it was when the following commands were captured.
+	if (state->samplerate != samplerate_native) {
+		WavegenSetSampleRate(state->samplerate);
+		InitBreath();
+	}
+	if (state->economy != (int)option_economy)
+		WavegenSetEconomy(state->economy);
+	memcpy(embedded_value, state->embedded_value, sizeof(embedded_value));
+	if (state->has_voice && ((wvoice == NULL) || (memcmp(wvoice, &state->voice, sizeof(voice_t)) != 0)))
+		WavegenSetVoice(&state->voice);
+	general_amplitude = state->general_amplitude;
+#if HAVE_SONIC_H
+	sonicSpeed = (double)state->sonic_speed / 1024;
+#endif
+}
+
+static frame_t *ReplayFrame(int index)
+{
+	if ((index < 0) || (index >= replay.n_frames))
+		return NULL;
+	return &replay.frames[index / N_REPLAY_BLOCK][index % N_REPLAY_BLOCK];
+}
+
+static unsigned char *ReplayData(int index, int length)
+{
+	// The data, if it holds at least length bytes. Otherwise NULL.
+	if ((index < 0) || (index >= replay.n_data))
+		return NULL;
+	if ((length < 0) || (length > replay.data_length[index]))
+		return NULL;
+	return replay.data[index];
+}
+
+static espeak_ng_STATUS ReplayRead(CAPTURE_RECORD *rec, void **data)
+{
+	// Read a record, with the frame, data, state or voice which follows it into
+	// new memory.
+	void *p;
+	void **blocks;
+	int ix;
+
+	*data = NULL;
+	if (fread(rec, sizeof(CAPTURE_RECORD), 1, replay.f) != 1) {
+		replay.end = true;
+		return ferror(replay.f) ? EIO : ENS_OK;
+	}
+
+	switch (rec->cmd)
+	{
+	case CAPTURE_FRAME:
+		if (rec->length != sizeof(frame_t))
+			return ENS_CORRUPT_DATA;
+		if ((replay.n_frames % N_REPLAY_BLOCK) == 0) {
+			ix = replay.n_frames / N_REPLAY_BLOCK;
+			if ((blocks = realloc(replay.frames, (ix+1) * sizeof(frame_t *))) == NULL)
+				return ENOMEM;
+			replay.frames = (frame_t **)blocks;
+			if ((replay.frames[ix] = (frame_t *)malloc(N_REPLAY_BLOCK * sizeof(frame_t))) == NULL)
+				return ENOMEM;
+		}
+		p = ReplayFrame(replay.n_frames++);
+		break;
+	case CAPTURE_DATA:
+		if ((rec->length < 0) || (rec->length > 0x1000000))
+			return ENS_CORRUPT_DATA;
+		if ((replay.n_data % N_REPLAY_BLOCK) == 0) {
+			if ((blocks = realloc(replay.data, (replay.n_data + N_REPLAY_BLOCK) * sizeof(unsigned char *))) == NULL)
+				return ENOMEM;
+			replay.data = (unsigned char **)blocks;
+			if ((blocks = realloc(replay.data_length, (replay.n_data + N_REPLAY_BLOCK) * sizeof(int))) == NULL)
+				return ENOMEM;
+			replay.data_length = (int *)blocks;
+		}
+		if ((p = malloc(rec->length + 1)) == NULL)
+			return ENOMEM;
+		replay.data_length[replay.n_data] = rec->length;
+		replay.data[replay.n_data++] = (unsigned char *)p;
+		break;
+	case CAPTURE_STATE:
+		if (rec->length != sizeof(CAPTURED_STATE))
+			return ENS_CORRUPT_DATA;
+		if ((p = malloc(rec->length)) == NULL)
+			return ENOMEM;
+		*data = p;
+		break;
+	case WCMD_VOICE:
+		if (rec->length != sizeof(voice_t))
+			return ENS_CORRUPT_DATA;
+		if ((p = malloc(rec->length)) == NULL)
+			return ENOMEM;
+		*data = p;
+		break;
+	default:
+		return ENS_OK;
+	}
+
+	if (fread(p, rec->length, 1, replay.f) != 1) {
+		free(*data);
+		*data = NULL;
+		return ENS_CORRUPT_DATA;
+	}
+	return ENS_OK;
+}
+
+static espeak_ng_STATUS ReplayCommands(void)
+{
+	// Add the commands to wcmdq, up to the next point at which it was empty.
+	CAPTURE_RECORD rec;
+	wcmd_t *q;
+	void *data;
+	int length;
+	espeak_ng_STATUS status;
+
+	while (!replay.empty && !replay.end) {
+		if ((WcmdqFree() <= 1) && !WcmdqGrow())
+			return ENS_OK; // continue when some of the queue has been played
+
+		if ((status = ReplayRead(&rec, &data)) != ENS_OK)
+			return status;
+		if (replay.end)
+			break;
+
+		q = WCMDQ(wcmdq_tail);
+		q->cmd = rec.cmd;
+		q->length = rec.length;
+		replay.next[wcmdq_tail & (N_WCMDQ_MAX-1)] = NULL;
+
+		switch (rec.cmd)
+		{
+		case CAPTURE_STATE:
+			// applied now, as it is written at the start of a clause
+			ReplayState((CAPTURED_STATE *)data);
+			free(data);
+			continue;
+		case CAPTURE_FRAME:
+		case CAPTURE_DATA:
+			continue;
+		case CAPTURE_EMPTY:
+			replay.empty = true;
+			continue;
+		case WCMD_SPECT:
+		case WCMD_SPECT2:
+		case WCMD_KLATT:
+		case WCMD_KLATT2:
+			q->u.spect.modulation = rec.value[0];
+			q->u.spect.frame1 = ReplayFrame(rec.value[1]);
+			q->u.spect.frame2 = ReplayFrame(rec.value[2]);
+			replay.next[wcmdq_tail & (N_WCMDQ_MAX-1)] = ReplayFrame(rec.value[3]);
+			if ((q->u.spect.frame1 == NULL) || (q->u.spect.frame2 == NULL))
+				return ENS_CORRUPT_DATA;
+			break;
+		case WCMD_WAVE:
+		case WCMD_WAVE2:
+			q->u.wave.wav_length = rec.value[1];
+			q->u.wave.scale = rec.value[2];
+			q->u.wave.amp = rec.value[3];
+			// PlayWave() plays the length of a WAVE command from its data, and
+			// a WAVE2 command mixes its data from the start again at wav_length
+			if (rec.cmd == WCMD_WAVE)
+				length = rec.length;
+			else if ((length = rec.value[1]) <= 0)
+				return ENS_CORRUPT_DATA;
+			if ((length < 0) || (length > 0x1000000))
+				return ENS_CORRUPT_DATA;
+			q->u.wave.data = ReplayData(rec.value[0], length * (q->u.wave.scale ? 1 : 2));
+			if (q->u.wave.data == NULL)
+				return ENS_CORRUPT_DATA;
+			break;
+		case WCMD_PITCH:
+		case WCMD_AMPLITUDE:
+			q->u.env.env = ReplayData(rec.value[0], ENV_LEN);
+			q->u.env.value1 = rec.value[1];
+			q->u.env.value2 = rec.value[2];
+			if ((q->u.env.env == NULL) && (rec.value[0] != -1)) // -1 for no envelope
+				return ENS_CORRUPT_DATA;
+			break;
+		case WCMD_MARKER:
+			if ((rec.value[0] == espeakEVENT_MARK) || (rec.value[0] == espeakEVENT_PLAY))
+				continue; // these refer to names in the text which was spoken
+			q->u.marker.type = rec.value[0];
+			q->u.marker.char_position = rec.value[1];
+			q->u.marker.value = rec.value[2];
+			q->u.marker.value2 = rec.value[3];
+			break;
+		case WCMD_VOICE:
+			q->length = 0;
+			q->u.voice = (voice_t *)data;
+			break;
+		case WCMD_EMBEDDED:
+			q->u.embedded.command = rec.value[0];
+			q->u.embedded.value = rec.value[1];
+			break;
+		case WCMD_PAUSE:
+		case WCMD_FMT_AMPLITUDE:
+		case WCMD_SONIC_SPEED:
+			q->u.value = rec.value[0];
+			break;
+		default:
+			return ENS_CORRUPT_DATA;
+		}
+		WcmdqInc();
+	}
+	return ENS_OK;
+}
+
+espeak_ng_STATUS WavegenReplayFill(bool *end)
+{
+	espeak_ng_STATUS status;
+
+	if ((status = ReplayCommands()) != ENS_OK)
+		return status;
+
+	WavegenFill();
+
+	*end = replay.end && !replay.empty && (WcmdqUsed() == 0);
+	return ENS_OK;
+}
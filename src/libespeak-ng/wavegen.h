@@ -21,6 +21,9 @@
 #ifndef ESPEAK_NG_WAVEGEN_H
 #define ESPEAK_NG_WAVEGEN_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
 #include "voice.h"
 
 #ifdef __cplusplus
@@ -59,14 +62,36 @@ void SetPitch2(voice_t *voice,
 
 void WavegenInit(int rate,
 		int wavemult_fact);
+void FreeEcho(void);
+void WavegenOutput(int *samples,
+		int n,
+		int feedback);
 
 
 int WavegenFill(void);
+espeak_ng_STATUS WavegenSetEconomy(espeak_ng_ECONOMY level);
+void WavegenSetSampleRate(int rate);
 void WavegenSetVoice(voice_t *v);
 int WcmdqFree(void);
 void WcmdqStop(void);
 int WcmdqUsed(void);
 void WcmdqInc(void);
+bool WcmdqGrow(void);
+void WcmdqRebase(void);
+void FreeWcmdq(void);
+
+// Write the commands which the wave generator takes from wcmdq to the file,
+// with the size in bytes of the output buffer which it fills.
+espeak_ng_STATUS WavegenStartCapture(FILE *f, int buffer_size);
+espeak_ng_STATUS WavegenStopCapture(void);
+
+// Drive the wave generator from the commands of a capture, instead of wcmdq.
+// WavegenReplayFill() fills the output buffer, and sets end when all of the
+// commands have been played. The output buffer should be of the size which
+// WavegenStartReplay() gives, if that is not 0.
+espeak_ng_STATUS WavegenStartReplay(FILE *f, int *buffer_size);
+espeak_ng_STATUS WavegenReplayFill(bool *end);
+void WavegenStopReplay(void);
 
 #ifdef __cplusplus
 }
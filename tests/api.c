@@ -19,19 +19,39 @@
 #include "config.h"
 
 #include <assert.h>
+#include <errno.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
 
 #include <espeak-ng/espeak_ng.h>
 #include <espeak-ng/speak_lib.h>
 #include <espeak-ng/encoding.h>
 
+#include "dictionary.h"
+#include "readclause.h"
+#include "wavegen.h"
 #include "speech.h"
 #include "phoneme.h"
 #include "voice.h"
 #include "synthesize.h"
+#include "synthdata.h"
 #include "translate.h"
 
+static double
+elapsed_ms(struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
 // region espeak_Initialize
 
 static void
@@ -536,6 +556,1126 @@ test_espeak_set_voice_by_properties_with_invalid_language()
 	assert(p_decoder == NULL);
 }
 
+// endregion
+// region espeak_ng_SetClauseLength
+
+static int
+count_clauses(const char *text)
+{
+	int count = 0;
+	const void *p = text;
+	while (p != NULL) {
+		assert(espeak_TextToPhonemes(&p, espeakCHARS_AUTO, 0) != NULL);
+		count++;
+	}
+	return count;
+}
+
+static void
+test_espeak_ng_set_clause_length()
+{
+	printf("testing espeak_ng_SetClauseLength\n");
+
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0) == 22050);
+	assert(espeak_ng_SetVoiceByName("en") == ENS_OK);
+
+	assert(espeak_ng_SetClauseLength(99) == EINVAL);
+	assert(espeak_ng_SetClauseLength(N_TR_SOURCE_MAX+1) == EINVAL);
+	assert(option_clause_length == N_TR_SOURCE);
+
+	// 100 KB of text without any punctuation, such as a log file
+	static const char *words[] = { "connection ", "timeout ", "server ", "request ", "cache " };
+	const size_t size = 100*1024;
+	char *text = malloc(size+16);
+	size_t len = 0;
+	for (int i = 0; len < size; i++) {
+		strcpy(text+len, words[i % 5]);
+		len += strlen(words[i % 5]);
+	}
+
+	clock_t start = clock();
+	int n_clauses = count_clauses(text);
+	printf("... %d clauses of %d bytes in %.2fs\n", n_clauses, N_TR_SOURCE, (double)(clock() - start)/CLOCKS_PER_SEC);
+	assert(n_clauses > (int)(len / N_TR_SOURCE));
+	assert(n_phoneme_list_max == N_PHONEME_LIST);
+
+	assert(espeak_ng_SetClauseLength(N_TR_SOURCE_MAX) == ENS_OK);
+	start = clock();
+	n_clauses = count_clauses(text);
+	printf("... %d clauses of %d bytes in %.2fs\n", n_clauses, N_TR_SOURCE_MAX, (double)(clock() - start)/CLOCKS_PER_SEC);
+	assert(n_clauses <= (int)(len / (N_TR_SOURCE_MAX - 100)) + 1);
+	// the phoneme lists only grow in proportion to the clause length
+	assert(n_phoneme_list_max > N_PHONEME_LIST);
+	assert(n_phoneme_list_max <= (N_PHONEME_LIST * N_TR_SOURCE_MAX) / N_TR_SOURCE);
+
+	assert(espeak_ng_SetClauseLength(N_TR_SOURCE) == ENS_OK);
+	free(text);
+
+	assert(espeak_Terminate() == EE_OK);
+	assert(phoneme_list == NULL);
+	assert(n_phoneme_list_max == 0);
+}
+
+// endregion
+// region LoadSoundFile2
+
+static void
+write_wav_file(const char *filename, int rate, int channels, int bits, int n_frames, const int *values)
+{
+	FILE *f = fopen(filename, "wb");
+	assert(f != NULL);
+
+	int data_length = n_frames * channels * (bits / 8);
+	unsigned char header[44] = {
+		'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+		'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, channels, 0,
+		rate & 0xff, (rate >> 8) & 0xff, (rate >> 16) & 0xff, 0, 0, 0, 0, 0, channels * (bits / 8), 0, bits, 0,
+		'd', 'a', 't', 'a', data_length & 0xff, (data_length >> 8) & 0xff, (data_length >> 16) & 0xff, 0
+	};
+	header[4] = (data_length + 36) & 0xff;
+	header[5] = ((data_length + 36) >> 8) & 0xff;
+	header[6] = ((data_length + 36) >> 16) & 0xff;
+	assert(fwrite(header, 1, sizeof(header), f) == sizeof(header));
+
+	for (int i = 0; i < n_frames; i++) {
+		for (int ch = 0; ch < channels; ch++) {
+			if (bits == 8)
+				fputc(values[ch] / 256 + 128, f);
+			else {
+				fputc(values[ch] & 0xff, f);
+				fputc((values[ch] >> 8) & 0xff, f);
+			}
+		}
+	}
+	fclose(f);
+}
+
+static int
+sound_icon_sample(int index, int ix)
+{
+	const unsigned char *data = (const unsigned char *)soundicon_tab[index].data;
+	return (short)(data[ix*2] + (data[ix*2+1] << 8));
+}
+
+static void
+test_load_sound_file()
+{
+	printf("testing LoadSoundFile2\n");
+
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0) == 22050);
+
+	char dir[] = "/tmp/espeak-ng-test-XXXXXX";
+	char filename[100];
+	char other[100];
+	assert(mkdtemp(dir) != NULL);
+
+	// stereo at 44.1 kHz is mixed down to mono at 22.05 kHz
+	static const int stereo[2] = { 1000, 3000 };
+	sprintf(filename, "%s/stereo.wav", dir);
+	write_wav_file(filename, 44100, 2, 16, 4410, stereo);
+	int index = LoadSoundFile2(filename);
+	assert(index >= 0 && index < N_SOUNDICON_SLOTS);
+	assert(soundicon_tab[index].length == 2205);
+	assert(sound_icon_sample(index, 0) == 2000);
+	assert(sound_icon_sample(index, 2204) == 2000);
+
+	// loaded files are kept, until they are modified
+	char *data = soundicon_tab[index].data;
+	assert(LoadSoundFile2(filename) == index);
+	assert(soundicon_tab[index].data == data);
+
+	static const int mono[1] = { -2560 };
+	write_wav_file(filename, 11025, 1, 8, 2205, mono);
+	struct utimbuf times = { time(NULL) + 10, time(NULL) + 10 };
+	assert(utime(filename, &times) == 0);
+	assert(LoadSoundFile2(filename) == index);
+	assert(soundicon_tab[index].length == 4410);
+	assert(sound_icon_sample(index, 0) == -2560);
+	assert(sound_icon_sample(index, 4409) == -2560);
+
+	// the least recently used file is replaced when all the slots are used
+	for (int i = 0; i < N_SOUNDICON_SLOTS; i++) {
+		sprintf(other, "%s/%d.wav", dir, i);
+		write_wav_file(other, 22050, 1, 16, 100, stereo);
+		assert(LoadSoundFile2(other) >= 0);
+		assert(LoadSoundFile2(filename) == index);
+	}
+	sprintf(other, "%s/0.wav", dir);
+	assert(LoadSoundFile2(other) != index);
+
+	// not a WAV file
+	sprintf(other, "%s/text.wav", dir);
+	FILE *f = fopen(other, "w");
+	assert(f != NULL);
+	fputs("not a wav file\n", f);
+	fclose(f);
+	assert(LoadSoundFile2(other) == -1);
+
+	for (int i = 0; i < N_SOUNDICON_SLOTS; i++) {
+		sprintf(other, "%s/%d.wav", dir, i);
+		remove(other);
+	}
+	sprintf(other, "%s/text.wav", dir);
+	remove(other);
+	remove(filename);
+	rmdir(dir);
+
+	assert(espeak_Terminate() == EE_OK);
+}
+
+// endregion
+// region espeak_ng_TextToPhonemes
+
+static const char *phonemes_text = "Hello world. This is a test of the phoneme translation, with several clauses; and numbers: 123.";
+
+static void
+test_espeak_ng_text_to_phonemes()
+{
+	printf("testing espeak_ng_TextToPhonemes\n");
+
+	char phonemes[1000];
+	espeak_ng_InitializePath(NULL);
+	assert(espeak_ng_Initialize(NULL) == ENS_OK);
+	assert(espeak_ng_TextToPhonemes(phonemes_text, espeakCHARS_AUTO, 0, phonemes, sizeof(phonemes)) == ENS_VOICE_NOT_FOUND);
+	assert(espeak_ng_SetVoiceByName("en") == ENS_OK);
+	assert(event_list == NULL); // the audio output is not needed
+
+	// the same as the phonemes of each clause from espeak_TextToPhonemes
+	char expected[1000] = "";
+	const void *p = phonemes_text;
+	while (p != NULL) {
+		const char *clause = espeak_TextToPhonemes(&p, espeakCHARS_AUTO, 0);
+		if (*clause == 0)
+			continue;
+		if (expected[0] != 0)
+			strcat(expected, "\n");
+		strcat(expected, clause);
+	}
+
+	assert(espeak_ng_TextToPhonemes(phonemes_text, espeakCHARS_AUTO, 0, phonemes, sizeof(phonemes)) == ENS_OK);
+	assert(strcmp(phonemes, expected) == 0);
+	assert(strchr(phonemes, '\n') != NULL);
+
+	assert(espeak_ng_TextToPhonemes(phonemes_text, espeakCHARS_AUTO, 0, phonemes, 10) == ENOBUFS);
+	assert(strlen(phonemes) < 10);
+	assert(espeak_ng_TextToPhonemes(phonemes_text, espeakCHARS_AUTO, 0, NULL, 10) == EINVAL);
+	assert(espeak_ng_TextToPhonemes("", espeakCHARS_AUTO, 0, phonemes, sizeof(phonemes)) == ENS_OK);
+	assert(phonemes[0] == 0);
+
+	clock_t start = clock();
+	size_t n_bytes = 0;
+	for (int i = 0; i < 200; i++) {
+		assert(espeak_ng_TextToPhonemes(phonemes_text, espeakCHARS_AUTO, espeakPHONEMES_IPA, phonemes, sizeof(phonemes)) == ENS_OK);
+		n_bytes += strlen(phonemes_text);
+	}
+	double elapsed = (double)(clock() - start)/CLOCKS_PER_SEC;
+	printf("... %.0f KB of text per second\n", elapsed > 0 ? n_bytes / elapsed / 1024 : 0);
+
+	assert(espeak_Terminate() == EE_OK);
+}
+
+// endregion
+// region espeak_ng_SetAlignment
+
+static int alignment_samples;
+static int alignment_phoneme_events;
+
+static int
+alignment_callback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	(void)wav; // unused parameter
+	alignment_samples += numsamples;
+	for (; events->type != espeakEVENT_LIST_TERMINATED; events++) {
+		if (events->type == espeakEVENT_PHONEME)
+			alignment_phoneme_events++;
+	}
+	return 0;
+}
+
+static void
+test_espeak_ng_alignment()
+{
+	printf("testing espeak_ng_SetAlignment\n");
+
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0) == 22050);
+	assert(espeak_ng_SetVoiceByName("en") == ENS_OK);
+	espeak_SetSynthCallback(alignment_callback);
+	assert(espeak_SetParameter(espeakRATE, 450, 0) == EE_OK);
+
+	int count = -1;
+	assert(espeak_ng_GetAlignment(&count) == NULL);
+	assert(count == 0);
+
+	assert(espeak_ng_SetAlignment(1) == ENS_OK);
+	const char *test = "The alignment records every phoneme, even when the event list of a buffer is full. "
+	                   "This sentence is spoken quickly so that many phonemes fall into each buffer.";
+	alignment_samples = 0;
+	assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_ng_Synchronize() == ENS_OK);
+
+	const espeak_ng_ALIGNMENT *alignment = espeak_ng_GetAlignment(&count);
+	assert(alignment != NULL);
+	assert(count > 80);
+	assert(alignment_phoneme_events == 0); // phoneme events were not requested
+	for (int i = 0; i < count; i++) {
+		assert(alignment[i].sample_start <= alignment[i].sample_end);
+		assert(alignment[i].phoneme[sizeof(alignment[i].phoneme)-1] == 0);
+		if (i > 0) {
+			assert(alignment[i].sample_start == alignment[i-1].sample_end);
+			assert(alignment[i].word_index >= alignment[i-1].word_index);
+		}
+	}
+	assert(alignment[count-1].sample_end == (unsigned int)alignment_samples);
+	assert(alignment[count-1].word_index >= 28); // 28 words of text
+
+	assert(espeak_ng_SetAlignment(0) == ENS_OK);
+	assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_ng_Synchronize() == ENS_OK);
+	espeak_ng_GetAlignment(&count);
+	assert(count == 0);
+
+	assert(espeak_Terminate() == EE_OK);
+}
+
+// endregion
+// region sample capture
+
+#define N_CAPTURE_SAMPLES 200000
+
+static short capture_samples[N_CAPTURE_SAMPLES];
+static int capture_length;
+
+static int
+capture_callback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	(void)events; // unused parameter
+	if ((wav != NULL) && (capture_length + numsamples <= N_CAPTURE_SAMPLES))
+		memcpy(capture_samples + capture_length, wav, numsamples * sizeof(short));
+	capture_length += numsamples;
+	return 0;
+}
+
+// endregion
+// region espeak_ng_SetKlattPrecision
+
+static void
+test_espeak_ng_set_klatt_precision()
+{
+	printf("testing espeak_ng_SetKlattPrecision\n");
+
+	if (espeak_ng_SetKlattPrecision(ENKLATT_DOUBLE) == ENS_NOT_SUPPORTED) {
+		printf("... skipped, the Klatt synthesizer is not enabled\n");
+		return;
+	}
+	assert(espeak_ng_SetKlattPrecision((espeak_ng_KLATT_PRECISION)2) == EINVAL);
+
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0) == 22050);
+	assert(espeak_ng_SetVoiceByName("en+klatt") == ENS_OK);
+	espeak_SetSynthCallback(capture_callback);
+
+	// The Klatt synthesizer keeps its state from one text to the next, so the
+	// two precisions are compared in separate processes which start from the
+	// same state.
+	int fd[2];
+	assert(pipe(fd) == 0);
+	pid_t pid = fork();
+	assert(pid >= 0);
+	assert(espeak_ng_SetKlattPrecision(pid == 0 ? ENKLATT_FLOAT : ENKLATT_DOUBLE) == ENS_OK);
+
+	const char *test = "The quick brown fox jumps over the lazy dog. She sells sea shells, 12345 times.";
+	capture_length = 0;
+	assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_ng_Synchronize() == ENS_OK);
+	assert(capture_length > 0 && capture_length <= N_CAPTURE_SAMPLES);
+
+	if (pid == 0) {
+		int ok = (write(fd[1], &capture_length, sizeof(int)) == sizeof(int))
+		      && (write(fd[1], capture_samples, capture_length * sizeof(short)) == (ssize_t)(capture_length * sizeof(short)));
+		_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	int float_length = 0;
+	short *float_samples = malloc(N_CAPTURE_SAMPLES * sizeof(short));
+	size_t size = 0;
+	ssize_t n;
+	assert(read(fd[0], &float_length, sizeof(int)) == sizeof(int));
+	assert(float_length == capture_length);
+	while (size < float_length * sizeof(short) && (n = read(fd[0], (char *)float_samples + size, float_length * sizeof(short) - size)) > 0)
+		size += n;
+	assert(size == float_length * sizeof(short));
+
+	int status;
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	close(fd[0]);
+	close(fd[1]);
+
+	// The single precision filters are expected to be at least 60 dB below
+	// the signal, and within a few samples values of it.
+	double signal = 0;
+	double error = 0;
+	int max_diff = 0;
+	for (int i = 0; i < capture_length; i++) {
+		int diff = abs(capture_samples[i] - float_samples[i]);
+		signal += (double)capture_samples[i] * capture_samples[i];
+		error += (double)diff * diff;
+		if (diff > max_diff)
+			max_diff = diff;
+	}
+	printf("... %d samples, at most %d apart\n", capture_length, max_diff);
+	assert(signal > 0);
+	assert(error * 1000000 < signal);
+	assert(max_diff <= 32);
+
+	free(float_samples);
+	assert(espeak_ng_SetKlattPrecision(ENKLATT_DOUBLE) == ENS_OK);
+	assert(espeak_Terminate() == EE_OK);
+}
+
+// endregion
+// region espeak_ng_SetEconomy
+
+static double
+economy_energy(const short *samples, int length)
+{
+	double energy = 0;
+	for (int i = 0; i < length; i++)
+		energy += (double)samples[i] * samples[i];
+	return energy;
+}
+
+static void
+test_espeak_ng_set_economy()
+{
+	printf("testing espeak_ng_SetEconomy\n");
+
+	assert(espeak_ng_SetEconomy((espeak_ng_ECONOMY)4) == EINVAL);
+	assert(espeak_ng_SetEconomy((espeak_ng_ECONOMY)-1) == EINVAL);
+
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0) == 22050);
+	assert(espeak_ng_SetVoiceByName("en+f3") == ENS_OK); // with breath and echo
+	espeak_SetSynthCallback(capture_callback);
+
+	const char *test = "The quick brown fox jumps over the lazy dog. She sells sea shells, 12345 times.";
+	short *full_samples = malloc(N_CAPTURE_SAMPLES * sizeof(short));
+
+	// The length differs slightly from one text to the next, as the pitch of
+	// the end of a text is carried over to the next one. The first text after
+	// the voice is selected starts from a different pitch, so it is not used.
+	for (int run = 0; run < 2; run++) {
+		capture_length = 0;
+		assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	}
+	int full_length = capture_length;
+	assert(full_length > 0 && full_length <= N_CAPTURE_SAMPLES);
+	memcpy(full_samples, capture_samples, full_length * sizeof(short));
+	double full_energy = economy_energy(full_samples, full_length);
+
+	for (int level = ENECONOMY_LOW; level <= ENECONOMY_HIGH; level++) {
+		assert(espeak_ng_SetEconomy(level) == ENS_OK);
+		capture_length = 0;
+		assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+		assert(capture_length > 0 && capture_length <= N_CAPTURE_SAMPLES);
+
+		// The timing is unchanged, and the loudness is about the same.
+		double energy = economy_energy(capture_samples, capture_length);
+		printf("... level %d: %d samples, %.2f of the energy\n", level, capture_length, energy / full_energy);
+		assert(abs(capture_length - full_length) < full_length / 100);
+		assert(energy > full_energy * 0.75 && energy < full_energy * 1.33);
+		if (level >= ENECONOMY_MEDIUM)
+			assert(memcmp(capture_samples, full_samples, full_length * sizeof(short)) != 0);
+	}
+
+	free(full_samples);
+	assert(espeak_ng_SetEconomy(ENECONOMY_NONE) == ENS_OK);
+	assert(espeak_Terminate() == EE_OK);
+
+	// in asynchronous mode, the change is made by the synthesis thread after
+	// the text which is being spoken
+	assert(espeak_Initialize(AUDIO_OUTPUT_RETRIEVAL, 0, NULL, 0) == 22050);
+	assert(espeak_ng_SetVoiceByName("en+f3") == ENS_OK);
+	espeak_SetSynthCallback(capture_callback);
+
+	capture_length = 0;
+	assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_ng_SetEconomy(ENECONOMY_MEDIUM) == ENS_OK);
+	assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_Synchronize() == EE_OK);
+	assert(capture_length > full_length * 3 / 2); // both texts are spoken
+
+	assert(espeak_ng_SetEconomy(ENECONOMY_NONE) == ENS_OK);
+	assert(espeak_Terminate() == EE_OK);
+}
+
+// endregion
+// region espeak_ng_SetSampleRate
+
+static int samplerate_length;
+static int samplerate_event;
+
+static int
+samplerate_callback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	(void)wav; // unused parameter
+	samplerate_length += numsamples;
+	for (; events->type != espeakEVENT_LIST_TERMINATED; events++) {
+		if (events->type == espeakEVENT_SAMPLERATE)
+			samplerate_event = events->id.number;
+	}
+	return 0;
+}
+
+static void
+test_espeak_ng_set_sample_rate()
+{
+	printf("testing espeak_ng_SetSampleRate\n");
+
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0) == 22050);
+	assert(espeak_ng_SetVoiceByName(ESPEAKNG_DEFAULT_VOICE) == ENS_OK);
+	espeak_SetSynthCallback(samplerate_callback);
+
+	assert(espeak_ng_SetSampleRate(7999) == EINVAL);
+	assert(espeak_ng_SetSampleRate(48001) == EINVAL);
+	assert(espeak_ng_GetSampleRate() == 22050);
+
+	// with sampled sounds, which are resampled to the new rate
+	const char *test = "The quick brown fox jumps over the lazy dog. She sells sea shells.";
+	samplerate_length = 0;
+	assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	double seconds = samplerate_length / 22050.0;
+	assert(samplerate_length > 0);
+
+	static const int rates[] = { 16000, 44100, 8000, 48000, 22050 };
+	for (int i = 0; i < (int)(sizeof(rates)/sizeof(rates[0])); i++) {
+		assert(espeak_ng_SetSampleRate(rates[i]) == ENS_OK);
+		assert(espeak_ng_GetSampleRate() == rates[i]);
+
+		samplerate_length = 0;
+		samplerate_event = 0;
+		assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+		printf("... %d Hz: %.3f seconds\n", rates[i], (double)samplerate_length / rates[i]);
+		assert(samplerate_event == rates[i]);
+		assert(samplerate_length > seconds * rates[i] * 0.97);
+		assert(samplerate_length < seconds * rates[i] * 1.03);
+	}
+
+	// the Klatt synthesizer, slow enough that the voiced fricatives are longer
+	// than their sampled sounds, which are mixed from the start again
+	const char *fricatives = "Zebras have vivid visions of the azure seas.";
+	assert(espeak_ng_SetVoiceByName("en+klatt") == ENS_OK);
+	assert(espeak_ng_SetParameter(espeakRATE, 90, 0) == ENS_OK);
+	assert(espeak_ng_SetSampleRate(22050) == ENS_OK);
+	samplerate_length = 0;
+	assert(espeak_ng_Synthesize(fricatives, strlen(fricatives)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	seconds = samplerate_length / 22050.0;
+	assert(samplerate_length > 0);
+
+	assert(espeak_ng_SetSampleRate(16000) == ENS_OK);
+	samplerate_length = 0;
+	assert(espeak_ng_Synthesize(fricatives, strlen(fricatives)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	printf("... klatt at 16000 Hz: %.3f seconds\n", (double)samplerate_length / 16000);
+	assert(samplerate_length > seconds * 16000 * 0.97);
+	assert(samplerate_length < seconds * 16000 * 1.03);
+
+	assert(espeak_Terminate() == EE_OK);
+
+	// in asynchronous mode, the change is made by the synthesis thread after
+	// the text which is being spoken
+	assert(espeak_Initialize(AUDIO_OUTPUT_RETRIEVAL, 0, NULL, 0) == 22050);
+	assert(espeak_ng_SetVoiceByName(ESPEAKNG_DEFAULT_VOICE) == ENS_OK);
+	espeak_SetSynthCallback(samplerate_callback);
+
+	samplerate_event = 0;
+	assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_ng_SetSampleRate(16000) == ENS_OK);
+	assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_Synchronize() == EE_OK);
+	assert(samplerate_event == 16000);
+	assert(espeak_ng_GetSampleRate() == 16000);
+
+	assert(espeak_Terminate() == EE_OK);
+}
+
+// endregion
+// region noise sources
+
+static unsigned int noise_hash;
+static int noise_length;
+
+static int
+noise_callback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	(void)events; // unused parameter
+	if (wav == NULL)
+		return 0;
+	for (int i = 0; i < numsamples; i++)
+		noise_hash = (noise_hash ^ (unsigned short)wav[i]) * 16777619;
+	noise_length += numsamples;
+	return 0;
+}
+
+static void
+test_noise_sources()
+{
+	printf("testing noise sources\n");
+
+	// The breath and frication noise have their own random number
+	// generators, so the output is not changed by other users of rand().
+	// The synthesizer keeps its state from one text to the next, so the
+	// output is compared in separate processes which start from the same
+	// state.
+	int fd[2];
+	assert(pipe(fd) == 0);
+	pid_t pid = fork();
+	assert(pid >= 0);
+	srand(pid == 0 ? 2 : 1);
+
+	const char *test = "She sells sea shells by the sea shore.";
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0) == 22050);
+	assert(espeak_ng_SetVoiceByName("en+whisper") == ENS_OK);
+	espeak_SetSynthCallback(noise_callback);
+	noise_hash = 2166136261u;
+	noise_length = 0;
+	assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_ng_Synchronize() == ENS_OK);
+	assert(noise_length > 0);
+
+	if (pid == 0) {
+		int ok = (write(fd[1], &noise_length, sizeof(int)) == sizeof(int))
+		      && (write(fd[1], &noise_hash, sizeof(unsigned int)) == sizeof(unsigned int));
+		_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	int length;
+	unsigned int hash;
+	assert(read(fd[0], &length, sizeof(int)) == sizeof(int));
+	assert(read(fd[0], &hash, sizeof(unsigned int)) == sizeof(unsigned int));
+
+	int status;
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	close(fd[0]);
+	close(fd[1]);
+
+	printf("... %d samples\n", noise_length);
+	assert(length == noise_length);
+	assert(hash == noise_hash);
+
+	assert(espeak_Terminate() == EE_OK);
+}
+
+// endregion
+// region text streams
+
+static int stream_first_audio;
+static int stream_words;
+static struct timespec stream_start;
+static double stream_first_ms;
+
+static int
+stream_callback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	if (wav != NULL && numsamples > 0 && stream_first_audio == 0) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		stream_first_audio = stream_words;
+		stream_first_ms = (now.tv_sec - stream_start.tv_sec) * 1000.0 + (now.tv_nsec - stream_start.tv_nsec) / 1000000.0;
+	}
+	return noise_callback(wav, numsamples, events);
+}
+
+static void
+test_text_stream()
+{
+	printf("testing text streams\n");
+
+	assert(espeak_ng_AppendText("hello") == ENS_NOT_INITIALIZED);
+	assert(espeak_ng_EndStream() == ENS_NOT_INITIALIZED);
+
+	// Text which is given one word at a time is spoken in the same way as
+	// the complete text. The outputs are compared in separate processes, as
+	// in test_noise_sources.
+	const char *words[] = {
+		"The ", "text ", "arrives ", "one ", "word ", "at ", "a ", "time, ",
+		"as ", "it ", "is ", "generated. ", "Each ", "clause ", "is ", "spoken ",
+		"when ", "the ", "next ", "word ", "has ", "arrived, ", "in ", "the ",
+		"caf\xc3", "\xa9.", NULL
+	};
+	char text[512] = { 0 };
+	int n_words = 0;
+	for (const char **w = words; *w != NULL; w++, n_words++)
+		strcat(text, *w);
+
+	int fd[2];
+	assert(pipe(fd) == 0);
+	pid_t pid = fork();
+	assert(pid >= 0);
+
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0) == 22050);
+	assert(espeak_ng_SetVoiceByName("en") == ENS_OK);
+	espeak_SetSynthCallback(stream_callback);
+	noise_hash = 2166136261u;
+	noise_length = 0;
+	stream_first_audio = 0;
+	stream_words = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &stream_start);
+	if (pid == 0) {
+		// sentence buffered: all of the text is available before it is spoken
+		stream_words = n_words;
+		assert(espeak_ng_Synthesize(text, strlen(text)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	} else {
+		assert(espeak_ng_BeginStream(espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+		for (const char **w = words; *w != NULL; w++) {
+			stream_words++;
+			assert(espeak_ng_AppendText(*w) == ENS_OK);
+		}
+		assert(espeak_ng_EndStream() == ENS_OK);
+		assert(espeak_ng_EndStream() == ENS_NOT_INITIALIZED);
+	}
+	assert(espeak_ng_Synchronize() == ENS_OK);
+	assert(noise_length > 0);
+
+	if (pid == 0) {
+		int ok = (write(fd[1], &noise_length, sizeof(int)) == sizeof(int))
+		      && (write(fd[1], &noise_hash, sizeof(unsigned int)) == sizeof(unsigned int))
+		      && (write(fd[1], &stream_first_ms, sizeof(double)) == sizeof(double));
+		_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	int length;
+	unsigned int hash;
+	double buffered_ms;
+	assert(read(fd[0], &length, sizeof(int)) == sizeof(int));
+	assert(read(fd[0], &hash, sizeof(unsigned int)) == sizeof(unsigned int));
+	assert(read(fd[0], &buffered_ms, sizeof(double)) == sizeof(double));
+
+	int status;
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	close(fd[0]);
+	close(fd[1]);
+
+	// The time to the first audio does not include the time for the text to
+	// arrive, which is the main difference when the text is generated.
+	printf("... buffered: first audio after word %d of %d, %.1fms\n", n_words, n_words, buffered_ms);
+	printf("... streamed: first audio after word %d of %d, %.1fms\n", stream_first_audio, n_words, stream_first_ms);
+	assert(stream_first_audio > 0 && stream_first_audio < n_words);
+	assert(length == noise_length);
+	assert(hash == noise_hash);
+
+	assert(espeak_Terminate() == EE_OK);
+}
+
+// endregion
+// region spectrum sequence cache
+
+static unsigned int
+fnv_hash(unsigned int hash, const void *data, size_t length)
+{
+	for (size_t i = 0; i < length; i++)
+		hash = (hash ^ ((const unsigned char *)data)[i]) * 16777619U;
+	return hash;
+}
+
+// the phonemes of the first clause, which are given to the phoneme callback
+// before the clause is generated
+static PHONEME_LIST spect_plist[N_PHONEME_LIST+1];
+static int spect_n_ph;
+
+static int
+spect_phoneme_callback(const char *phonemes)
+{
+	(void)phonemes; // unused parameter
+	if ((spect_n_ph == 0) && (n_phoneme_list > 0) && (n_phoneme_list < N_PHONEME_LIST)) {
+		memcpy(spect_plist, phoneme_list, (n_phoneme_list + 1) * sizeof(PHONEME_LIST));
+		spect_n_ph = n_phoneme_list;
+	}
+	return 0;
+}
+
+static unsigned int
+generate_hash(void)
+{
+	// Generate the wavegen commands for the phonemes of the clause, and
+	// return a hash of the commands and the frames which they refer to.
+	unsigned int hash = 2166136261U;
+	bool resume = false;
+	int more;
+
+	do {
+		int n_ph = spect_n_ph;
+		more = Generate(spect_plist, &n_ph, resume);
+		for (int ix = wcmdq_head; ix < wcmdq_tail; ix++) {
+			wcmd_t *q = WCMDQ(ix);
+			hash = fnv_hash(hash, &q->cmd, sizeof(q->cmd));
+			hash = fnv_hash(hash, &q->length, sizeof(q->length));
+			if (q->cmd <= WCMD_SPECT2) {
+				hash = fnv_hash(hash, q->u.spect.frame1, sizeof(frame_t));
+				hash = fnv_hash(hash, q->u.spect.frame2, sizeof(frame_t));
+			}
+		}
+		WcmdqStop();
+		resume = true;
+	} while (more);
+	return hash;
+}
+
+static void
+test_spect_cache()
+{
+	printf("testing the spectrum sequence cache\n");
+
+	const char *test = "the quick brown fox jumps over the lazy dog while she sells sea shells by the sea shore "
+	                   "and zebras have vivid visions of thunder and lightning over the rolling hills";
+	static const char *voices[] = { "en", "en+klatt3", "de", "fr" };
+	espeak_ng_FRAME_CACHE_STATS stats;
+
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0) == 22050);
+	assert(espeak_ng_GetFrameCacheStats(NULL) == EINVAL);
+	espeak_SetPhonemeCallback(spect_phoneme_callback);
+
+	// The cached sequences give the same frames as LookupSpect(), the first
+	// time that they are looked up and when they are found in the cache.
+	for (int i = 0; i < (int)(sizeof(voices)/sizeof(voices[0])); i++) {
+		assert(espeak_ng_SetVoiceByName(voices[i]) == ENS_OK);
+		spect_n_ph = 0;
+		assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+		assert(spect_n_ph > 50);
+
+		// the first time is different, as Generate() continues from the end
+		// of the clause which was spoken
+		SetSpectCache(false);
+		generate_hash();
+		unsigned int expected = generate_hash();
+		SetSpectCache(true);
+		FreeSpectCache();
+		assert(generate_hash() == expected);
+		assert(generate_hash() == expected);
+
+		assert(espeak_ng_GetFrameCacheStats(&stats) == ENS_OK);
+		assert(stats.hits * 2 >= stats.lookups);
+		assert(stats.entries > 0);
+	}
+
+	// the time to generate the wavegen commands, without and with the cache
+	double generate_ms[2] = { 0, 0 };
+	struct timespec start;
+	for (int cached = 0; cached < 2; cached++) {
+		SetSpectCache(cached);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int run = 0; run < 200; run++)
+			generate_hash();
+		generate_ms[cached] = elapsed_ms(&start);
+	}
+	espeak_SetPhonemeCallback(NULL);
+	assert(espeak_ng_GetFrameCacheStats(&stats) == ENS_OK);
+	printf("... generated in %.1fms, %.1fms with the cache, %lu of %lu found\n",
+	       generate_ms[0], generate_ms[1], stats.hits, stats.lookups);
+
+	assert(espeak_Terminate() == EE_OK);
+}
+
+// endregion
+// region phoneme mnemonics
+
+static int
+match_mnemonic_linear(const char *p, int *length)
+{
+	// the linear search of phoneme_tab which was used by EncodePhonemes
+	int max = -1;
+	int max_ph = 0;
+	for (int ix = 1; ix < n_phoneme_tab; ix++) {
+		if (phoneme_tab[ix] == NULL || phoneme_tab[ix]->type == phINVALID)
+			continue;
+
+		int count = 0;
+		unsigned int mnemonic_word = phoneme_tab[ix]->mnemonic;
+		unsigned char c;
+		while (((c = p[count]) > ' ') && (count < 4) &&
+		       (c == ((mnemonic_word >> (count*8)) & 0xff)))
+			count++;
+
+		if ((count > max) &&
+		    ((count == 4) || (((mnemonic_word >> (count*8)) & 0xff) == 0))) {
+			max = count;
+			max_ph = phoneme_tab[ix]->code;
+		}
+	}
+	*length = max;
+	return max_ph;
+}
+
+static void
+test_phoneme_mnemonics()
+{
+	printf("testing phoneme mnemonics\n");
+
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0) == 22050);
+	assert(espeak_ng_SetVoiceByName("en") == ENS_OK);
+
+	// Each mnemonic of each phoneme table, followed by the start of each other
+	// mnemonic, matches the same phoneme as a linear search of phoneme_tab.
+	int n_tests = 0;
+	for (int table = 0; table < n_phoneme_tables; table++) {
+		SelectPhonemeTable(table);
+
+		for (int ix = 0; ix < n_phoneme_tab; ix++) {
+			if (phoneme_tab[ix] == NULL)
+				continue;
+
+			unsigned int mnem = phoneme_tab[ix]->mnemonic;
+			int code = 0;
+			for (int jx = 0; jx < n_phoneme_tab; jx++) {
+				if (phoneme_tab[jx] != NULL && phoneme_tab[jx]->mnemonic == mnem) {
+					code = phoneme_tab[jx]->code;
+					break;
+				}
+			}
+			assert(PhonemeCode(mnem) == code);
+
+			for (int next = 0; next < n_phoneme_tab; next++) {
+				char string[10];
+				memset(string, 0, sizeof(string));
+				memcpy(string, &mnem, 4);
+				size_t len = strlen(string);
+				if (next > 0 && phoneme_tab[next] != NULL)
+					memcpy(string + len, &phoneme_tab[next]->mnemonic, 4);
+				else
+					string[len] = " |x"[next % 3];
+
+				for (size_t start = 0; start <= len; start++) {
+					int length;
+					int expected_length;
+					int ph = MatchPhonemeMnemonic(string + start, &length);
+					int expected = match_mnemonic_linear(string + start, &expected_length);
+					assert(ph == expected);
+					if (expected != 0)
+						assert(length == (expected_length < 0 ? 0 : expected_length));
+					n_tests++;
+				}
+			}
+		}
+	}
+	assert(PhonemeCode(0x7e7e7e7e) == 0);
+	printf("... %d strings in %d tables\n", n_tests, n_phoneme_tables);
+
+	// The index follows the selected phoneme table.
+	char encoded[N_WORD_PHONEMES];
+	char expected[N_WORD_PHONEMES];
+	assert(SelectPhonemeTableName("de") >= 0);
+	EncodePhonemes("'aUs@n", expected, NULL);
+	assert(SelectPhonemeTableName("en") >= 0);
+	EncodePhonemes("'aUs@n", encoded, NULL);
+	assert(SelectPhonemeTableName("de") >= 0);
+	EncodePhonemes("'aUs@n", encoded, NULL);
+	assert(strcmp(encoded, expected) == 0);
+
+	assert(espeak_Terminate() == EE_OK);
+}
+
+// endregion
+// region cancel
+
+// The time from espeak_ng_Cancel() to the end of synthesis, which can be set
+// with -DMAX_CANCEL_LATENCY_MS=n for slow machines.
+#ifndef MAX_CANCEL_LATENCY_MS
+#define MAX_CANCEL_LATENCY_MS 50
+#endif
+
+static volatile int cancel_requested;
+static int cancel_samples;
+static int cancel_samples_after;
+static bool cancel_end_of_data;
+static struct timespec cancel_time;
+
+static int
+cancel_callback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	(void)events; // unused
+
+	if (wav == NULL)
+		cancel_end_of_data = true;
+	cancel_samples += numsamples;
+	if (cancel_requested)
+		cancel_samples_after += numsamples;
+	return 0;
+}
+
+static void *
+cancel_thread(void *delay_ms)
+{
+	usleep(*(int *)delay_ms * 1000);
+	clock_gettime(CLOCK_MONOTONIC, &cancel_time);
+	cancel_requested = 1;
+	assert(espeak_ng_Cancel() == ENS_OK);
+	return NULL;
+}
+
+static void
+test_cancel()
+{
+	printf("testing espeak_ng_Cancel\n");
+
+	// With a buffer of 20 seconds, each sentence is given to the callback in
+	// one call, which used to be the only place where synthesis could stop.
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 20000, NULL, 0) == 22050);
+	assert(espeak_ng_SetVoiceByName("en") == ENS_OK);
+	espeak_SetSynthCallback(cancel_callback);
+
+	char text[4000];
+	text[0] = 0;
+	while (strlen(text) < sizeof(text) - 200)
+		strcat(text, "The quick brown fox jumps over the lazy dog, which does not notice. ");
+
+	cancel_requested = 0;
+	cancel_samples = 0;
+	cancel_samples_after = 0;
+	cancel_end_of_data = false;
+
+	int delay_ms = 10;
+	pthread_t thread;
+	assert(pthread_create(&thread, NULL, cancel_thread, &delay_ms) == 0);
+	assert(espeak_ng_Synthesize(text, strlen(text)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_SPEECH_STOPPED);
+	double latency_ms = elapsed_ms(&cancel_time);
+	assert(pthread_join(thread, NULL) == 0);
+
+	printf("... stopped %.2fms after the cancel, %d samples before it\n", latency_ms, cancel_samples);
+	assert(cancel_requested);
+	assert(cancel_samples_after == 0);
+	assert(cancel_end_of_data == false);
+	assert(latency_ms <= MAX_CANCEL_LATENCY_MS);
+
+	// The cancel only applies to the utterance which was being spoken.
+	cancel_requested = 0;
+	cancel_samples = 0;
+	assert(espeak_ng_Synthesize("Hello.", 7, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(cancel_samples > 0);
+	assert(cancel_end_of_data == true);
+
+	assert(espeak_Terminate() == EE_OK);
+}
+
+// endregion
+// region phondata
+
+static int
+phondata_mappings(int *rss, int *size)
+{
+	// Returns the number of mappings of phondata, or -1 if /proc/self/smaps
+	// cannot be read.
+	FILE *f = fopen("/proc/self/smaps", "r");
+	if (f == NULL)
+		return -1;
+
+	char line[512];
+	unsigned long start, end;
+	int count = 0, in_phondata = 0, kb;
+	*rss = *size = 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			char *p = strrchr(line, '/');
+			in_phondata = (p != NULL) && (strcmp(p, "/phondata\n") == 0);
+			count += in_phondata;
+		} else if (in_phondata && sscanf(line, "Rss: %d kB", &kb) == 1)
+			*rss += kb;
+		else if (in_phondata && sscanf(line, "Size: %d kB", &kb) == 1)
+			*size += kb;
+	}
+	fclose(f);
+	return count;
+}
+
+static void
+test_phondata_mapped()
+{
+	printf("testing phondata mapping\n");
+
+	// Initialize twice, to check that the first mapping is released.
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0) == 22050);
+	assert(espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0) == 22050);
+	assert(espeak_ng_SetVoiceByName("en") == ENS_OK);
+	const char *test = "The quick brown fox jumps over the lazy dog.";
+	assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_ng_Synchronize() == ENS_OK);
+
+	int rss, size;
+	int count = phondata_mappings(&rss, &size);
+#ifdef HAVE_SYS_MMAN_H
+	assert(count == 1 || count == -1);
+	if (count == 1)
+		printf("... phondata %d KB of %d KB resident\n", rss, size);
+#else
+	assert(count <= 0);
+#endif
+
+	assert(espeak_Terminate() == EE_OK);
+	assert(phondata_mappings(&rss, &size) <= 0);
+}
+
+// endregion
+// region espeak_ng_InitializeBundle
+
+static int bundle_samples;
+
+static int
+bundle_callback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	(void)wav; // unused parameter
+	(void)events; // unused parameter
+	bundle_samples += numsamples;
+	return 0;
+}
+
+static void
+test_espeak_ng_initialize_bundle()
+{
+	printf("testing espeak_ng_InitializeBundle\n");
+
+	char dir[] = "/tmp/espeak-ng-bundle-XXXXXX";
+	char filename[100];
+	assert(mkdtemp(dir) != NULL);
+	sprintf(filename, "%s/en.bundle", dir);
+
+	espeak_ng_InitializePath(NULL);
+	FILE *log = fopen("/dev/null", "w");
+	assert(espeak_ng_CompileBundle(filename, "en", log, NULL) == ENS_OK);
+	fclose(log);
+
+	FILE *f = fopen(filename, "rb");
+	assert(f != NULL);
+	assert(fseek(f, 0, SEEK_END) == 0);
+	size_t size = ftell(f);
+	rewind(f);
+	char *data = malloc(size);
+	assert(fread(data, 1, size, f) == size);
+	fclose(f);
+
+	assert(espeak_ng_InitializeBundle(data, size) == ENS_OK);
+	assert(espeak_ng_Initialize(NULL) == ENS_OK);
+	assert(espeak_ng_InitializeOutput(ENOUTPUT_MODE_SYNCHRONOUS, 0, NULL) == ENS_OK);
+	espeak_SetSynthCallback(bundle_callback);
+	assert(espeak_ng_SetVoiceByName("fr") != ENS_OK); // not in the bundle
+	assert(espeak_ng_SetVoiceByName("en") == ENS_OK);
+
+	// tests/bundle.test checks that the audio is the same as with espeak-ng-data
+	const char *test = "One two three.";
+	bundle_samples = 0;
+	assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_ng_Synchronize() == ENS_OK);
+	assert(bundle_samples > 0);
+	assert(espeak_ng_Terminate() == ENS_OK);
+
+	assert(espeak_ng_InitializeBundle(NULL, 0) == EINVAL);
+	data[0] = 'X';
+	assert(espeak_ng_InitializeBundle(data, size) == ENS_CORRUPT_DATA);
+
+	espeak_ng_InitializePath(NULL);
+	free(data);
+	remove(filename);
+	rmdir(dir);
+}
+
 // endregion
 
 int
@@ -571,6 +1711,28 @@ main(int argc, char **argv)
 	test_espeak_set_voice_by_properties_with_valid_language();
 	test_espeak_set_voice_by_properties_with_invalid_language();
 
+	test_espeak_ng_set_clause_length();
+
+	test_load_sound_file();
+
+	test_espeak_ng_text_to_phonemes();
+
+	test_espeak_ng_alignment();
+
+	test_espeak_ng_set_klatt_precision();
+	test_espeak_ng_set_economy();
+	test_espeak_ng_set_sample_rate();
+
+	test_noise_sources();
+	test_text_stream();
+	test_phoneme_mnemonics();
+	test_spect_cache();
+	test_cancel();
+
+	test_phondata_mapped();
+
+	test_espeak_ng_initialize_bundle();
+
 	free(progdir);
 
 	return EXIT_SUCCESS;
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2026 eSpeak NG contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see: <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <espeak-ng/espeak_ng.h>
+#include <espeak-ng/speak_lib.h>
+
+static int n_samples = 0;
+
+static int
+synth_callback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	(void)wav; // unused parameter
+	(void)events; // unused parameter
+	n_samples += numsamples;
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	(void)argc; // unused parameter
+	(void)argv; // unused parameter
+
+	printf("testing espeak_ng_InitializeEmbeddedData\n");
+
+	// there is no data directory
+	setenv("ESPEAK_DATA_PATH", "/nonexistent", 1);
+	setenv("HOME", "/nonexistent", 1);
+
+	assert(espeak_ng_InitializeEmbeddedData() == ENS_OK);
+	assert(espeak_ng_Initialize(NULL) == ENS_OK);
+	assert(espeak_ng_InitializeOutput(ENOUTPUT_MODE_SYNCHRONOUS, 0, NULL) == ENS_OK);
+	espeak_SetSynthCallback(synth_callback);
+	assert(espeak_ng_SetVoiceByName(ESPEAKNG_DEFAULT_VOICE) == ENS_OK);
+
+	const char *test = "One two three.";
+	assert(espeak_ng_Synthesize(test, strlen(test)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_ng_Synchronize() == ENS_OK);
+	assert(n_samples > 10000);
+
+	const espeak_VOICE **voices = espeak_ListVoices(NULL);
+	assert(voices != NULL && voices[0] != NULL);
+
+	assert(espeak_ng_Terminate() == ENS_OK);
+	return EXIT_SUCCESS;
+}
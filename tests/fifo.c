@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2026 eSpeak NG contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see: <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <espeak-ng/espeak_ng.h>
+#include <espeak-ng/speak_lib.h>
+
+// The word and end of message events, in the order that they are given to
+// the callback by the synthesis thread.
+typedef struct {
+	espeak_EVENT_TYPE type;
+	unsigned int unique_identifier;
+	int text_position;
+} test_event;
+
+#define N_EVENTS 1000
+static test_event events[N_EVENTS];
+static int n_events;
+
+// The callback waits while hold is set, so that the utterance which is being
+// synthesized is still running when the other commands are queued.
+static volatile int hold;
+static volatile int holding;
+
+static const char *long_text =
+	"The first sentence is spoken before the interruption. "
+	"The second sentence may be interrupted, or may not be. "
+	"The third sentence is the last one.";
+static const char *urgent_text = "Urgent message.";
+static const char *other_text = "Another message.";
+
+static int
+synth_callback(short *wav, int numsamples, espeak_EVENT *list)
+{
+	(void)wav; // unused parameter
+	(void)numsamples; // unused parameter
+
+	for (; list->type != espeakEVENT_LIST_TERMINATED; list++) {
+		if ((list->type == espeakEVENT_WORD) || (list->type == espeakEVENT_MSG_TERMINATED)) {
+			assert(n_events < N_EVENTS);
+			events[n_events].type = list->type;
+			events[n_events].unique_identifier = list->unique_identifier;
+			events[n_events].text_position = list->text_position;
+			n_events++;
+		}
+	}
+
+	while (hold) {
+		holding = 1;
+		usleep(1000);
+	}
+	return 0;
+}
+
+static void
+wait_until_holding(void)
+{
+	while (!holding)
+		usleep(1000);
+}
+
+static void
+release(void)
+{
+	holding = 0;
+	hold = 0;
+}
+
+// The utterances in the order that their words were spoken, as a string of
+// the letters given for each unique identifier.
+static void
+spoken_order(char *order, unsigned int *ids, const char *letters)
+{
+	int n = 0;
+	for (int i = 0; i < n_events; i++) {
+		if (events[i].type != espeakEVENT_WORD)
+			continue;
+		for (int j = 0; letters[j]; j++) {
+			if ((events[i].unique_identifier == ids[j]) && ((n == 0) || (order[n-1] != letters[j])))
+				order[n++] = letters[j];
+		}
+	}
+	order[n] = 0;
+}
+
+static int
+word_positions(unsigned int id, int *positions)
+{
+	int n = 0;
+	for (int i = 0; i < n_events; i++) {
+		if ((events[i].type == espeakEVENT_WORD) && (events[i].unique_identifier == id))
+			positions[n++] = events[i].text_position;
+	}
+	return n;
+}
+
+static int
+terminated_count(unsigned int id)
+{
+	int n = 0;
+	for (int i = 0; i < n_events; i++) {
+		if ((events[i].type == espeakEVENT_MSG_TERMINATED) && (events[i].unique_identifier == id))
+			n++;
+	}
+	return n;
+}
+
+static void
+synthesize(const char *text, espeak_ng_PRIORITY priority, espeak_ng_PREEMPTION preemption, unsigned int *id)
+{
+	assert(espeak_ng_SynthesizeWithPriority(text, strlen(text)+1, espeakCHARS_AUTO, priority, preemption, id, NULL) == ENS_OK);
+}
+
+int
+main(int argc, char **argv)
+{
+	(void)argc; // unused parameter
+	(void)argv; // unused parameter
+
+	assert(espeak_Initialize(AUDIO_OUTPUT_RETRIEVAL, 0, NULL, 0) == 22050);
+	espeak_SetSynthCallback(synth_callback);
+	assert(espeak_ng_SetVoiceByName(ESPEAKNG_DEFAULT_VOICE) == ENS_OK);
+
+	unsigned int ids[3];
+	char order[20];
+	int expected[100];
+	int positions[100];
+
+	printf("testing espeak_ng_SynthesizeWithPriority\n");
+	assert(espeak_ng_SynthesizeWithPriority(long_text, strlen(long_text)+1, espeakCHARS_AUTO, 3, ENPREEMPT_NONE, NULL, NULL) == EINVAL);
+	assert(espeak_ng_SynthesizeWithPriority(long_text, strlen(long_text)+1, espeakCHARS_AUTO, ENPRIORITY_HIGH, 3, NULL, NULL) == EINVAL);
+
+	n_events = 0;
+	synthesize(long_text, ENPRIORITY_NORMAL, ENPREEMPT_NONE, &ids[0]);
+	assert(espeak_ng_Synchronize() == ENS_OK);
+	int n_expected = word_positions(ids[0], expected);
+	assert(n_expected > 10);
+	assert(terminated_count(ids[0]) == 1);
+
+	printf("testing a high priority message which waits\n");
+	n_events = 0;
+	hold = 1;
+	synthesize(long_text, ENPRIORITY_NORMAL, ENPREEMPT_NONE, &ids[0]);
+	wait_until_holding();
+	synthesize(other_text, ENPRIORITY_NORMAL, ENPREEMPT_NONE, &ids[1]);
+	synthesize(urgent_text, ENPRIORITY_HIGH, ENPREEMPT_NONE, &ids[2]);
+	release();
+	assert(espeak_ng_Synchronize() == ENS_OK);
+	spoken_order(order, ids, "LOU");
+	assert(strcmp(order, "LUO") == 0);
+	assert(word_positions(ids[0], positions) == n_expected);
+	assert(memcmp(positions, expected, n_expected * sizeof(int)) == 0);
+
+	printf("testing a preempted message which resumes\n");
+	n_events = 0;
+	hold = 1;
+	synthesize(long_text, ENPRIORITY_NORMAL, ENPREEMPT_NONE, &ids[0]);
+	wait_until_holding();
+	synthesize(urgent_text, ENPRIORITY_URGENT, ENPREEMPT_RESUME, &ids[1]);
+	release();
+	assert(espeak_ng_Synchronize() == ENS_OK);
+	spoken_order(order, ids, "LU");
+	assert(strcmp(order, "LUL") == 0);
+	// each word is spoken once, and none are missed
+	assert(word_positions(ids[0], positions) == n_expected);
+	assert(memcmp(positions, expected, n_expected * sizeof(int)) == 0);
+	assert(terminated_count(ids[0]) == 1);
+	assert(terminated_count(ids[1]) == 1);
+
+	printf("testing a preempted message which is discarded\n");
+	n_events = 0;
+	hold = 1;
+	synthesize(long_text, ENPRIORITY_NORMAL, ENPREEMPT_NONE, &ids[0]);
+	wait_until_holding();
+	synthesize(urgent_text, ENPRIORITY_HIGH, ENPREEMPT_DISCARD, &ids[1]);
+	release();
+	assert(espeak_ng_Synchronize() == ENS_OK);
+	spoken_order(order, ids, "LU");
+	assert(strcmp(order, "LU") == 0);
+	int n_spoken = word_positions(ids[0], positions);
+	assert(n_spoken > 0 && n_spoken < n_expected);
+	assert(memcmp(positions, expected, n_spoken * sizeof(int)) == 0);
+	assert(terminated_count(ids[0]) == 1);
+
+	printf("testing espeak_ng_GetQueueStats\n");
+	espeak_ng_QUEUE_STATS stats;
+	assert(espeak_ng_GetQueueStats(ENPRIORITY_NORMAL, &stats) == ENS_OK);
+	printf("... normal: %u started, %u preempted, %u most queued, wait %.1fms max %.1fms\n",
+	       stats.started, stats.preempted, stats.max_queued, stats.total_wait_ms, stats.max_wait_ms);
+	assert(stats.queued == 0);
+	assert(stats.preempted == 2);
+	assert(stats.started == 11); // the text and end of message commands, and the resumed text
+	assert(stats.max_queued >= 3);
+	assert(espeak_ng_GetQueueStats(ENPRIORITY_HIGH, &stats) == ENS_OK);
+	assert(stats.started == 4);
+	assert(stats.preempted == 0);
+	assert(espeak_ng_GetQueueStats(ENPRIORITY_URGENT, &stats) == ENS_OK);
+	assert(stats.started == 2);
+	assert(espeak_ng_GetQueueStats(3, &stats) == EINVAL);
+
+	assert(espeak_ng_Terminate() == ENS_OK);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2026 eSpeak NG contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see: <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <espeak-ng/espeak_ng.h>
+#include <espeak-ng/speak_lib.h>
+
+#define SAMPLE_RATE 22050
+#define RAW_FILE "playback-test.raw"
+
+// Long enough to wrap around the ring of samples.
+static const char *test_text =
+	"The quick brown fox jumps over the lazy dog, "
+	"and the lazy dog does not jump over the quick brown fox.";
+
+static short *retrieved = NULL;
+static int n_retrieved = 0;
+
+static volatile int n_words = 0;
+static volatile double last_word_ms = 0;
+static volatile double terminated_ms = 0;
+
+static double
+now_ms(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec*1000.0 + tv.tv_usec/1000.0;
+}
+
+static int
+synth_callback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	if (wav && numsamples > 0) { // retrieval mode
+		retrieved = realloc(retrieved, (n_retrieved + numsamples) * sizeof(short));
+		assert(retrieved != NULL);
+		memcpy(retrieved + n_retrieved, wav, numsamples * sizeof(short));
+		n_retrieved += numsamples;
+	}
+
+	for (; events->type != espeakEVENT_LIST_TERMINATED; events++) {
+		if (events->type == espeakEVENT_WORD) {
+			n_words++;
+			last_word_ms = now_ms();
+		} else if (events->type == espeakEVENT_MSG_TERMINATED)
+			terminated_ms = now_ms();
+	}
+	return 0;
+}
+
+static long
+file_length(const char *filename)
+{
+	FILE *f = fopen(filename, "rb");
+	assert(f != NULL);
+	fseek(f, 0, SEEK_END);
+	long length = ftell(f);
+	fclose(f);
+	return length;
+}
+
+static void
+initialize(void)
+{
+	espeak_ng_InitializePath(NULL);
+	assert(espeak_ng_Initialize(NULL) == ENS_OK);
+	espeak_SetSynthCallback(synth_callback);
+	assert(espeak_ng_SetVoiceByName(ESPEAKNG_DEFAULT_VOICE) == ENS_OK);
+}
+
+static void
+test_playback_file(void)
+{
+	printf("testing playback to a file\n");
+
+	espeak_ng_PLAYBACK_STATS stats;
+	assert(espeak_ng_SetPlaybackBuffer(100, 400, 200) == EINVAL);
+	assert(espeak_ng_SetPlaybackBuffer(500, 200, 400) == EINVAL);
+	assert(espeak_ng_SetPlaybackBuffer(100, 200, 400) == ENS_OK);
+
+	// the length of the utterance, which varies slightly with the state left by
+	// the previous utterance
+	assert(espeak_ng_InitializeOutput(ENOUTPUT_MODE_SYNCHRONOUS, 0, NULL) == ENS_OK);
+	assert(espeak_ng_GetPlaybackStats(&stats) == ENS_NOT_INITIALIZED);
+	assert(espeak_ng_Synthesize(test_text, strlen(test_text)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	double duration_ms = (n_retrieved * 1000.0) / SAMPLE_RATE;
+	assert(duration_ms > 2000);
+
+	assert(espeak_ng_InitializeOutput(ENOUTPUT_MODE_SPEAK_AUDIO, 0, "file:" RAW_FILE) == ENS_OK);
+	n_words = 0;
+	terminated_ms = 0;
+	double start_ms = now_ms();
+	assert(espeak_ng_Synthesize(test_text, strlen(test_text)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_ng_Synchronize() == ENS_OK);
+	double end_ms = now_ms();
+	while (terminated_ms == 0)
+		usleep(10000);
+
+	assert(espeak_ng_GetPlaybackStats(&stats) == ENS_OK);
+	printf("... %.0fms of audio played in %.0fms, %u buffers, latency %.1fms max %.1fms\n",
+	       duration_ms, end_ms - start_ms, stats.buffers, stats.total_latency_ms / stats.buffers, stats.max_latency_ms);
+	// the file sink plays the samples at the rate of a sound card
+	assert(end_ms - start_ms >= duration_ms - 100);
+	assert(terminated_ms - start_ms >= duration_ms - 100);
+	assert(last_word_ms - start_ms >= duration_ms / 2);
+	assert(n_words > 10);
+	assert(stats.samples > (unsigned long)n_retrieved * 99 / 100);
+	assert(stats.samples < (unsigned long)n_retrieved * 101 / 100);
+	assert(stats.underruns == 0);
+	assert(stats.buffered_ms == 0);
+	assert(stats.buffers > 0);
+	assert(stats.max_latency_ms < 1000);
+
+	assert(file_length(RAW_FILE) == (long)(stats.samples * sizeof(short)));
+}
+
+static void
+test_playback_underrun(void)
+{
+	printf("testing an underrun\n");
+
+	espeak_ng_PLAYBACK_STATS stats;
+
+	// the text of the stream stops for longer than the high watermark, part of
+	// the way through the utterance
+	assert(espeak_ng_BeginStream(espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	assert(espeak_ng_AppendText("The first sentence is spoken. The second one is too. ") == ENS_OK);
+	usleep(3000000);
+	assert(espeak_ng_AppendText("And so is the third.") == ENS_OK);
+	assert(espeak_ng_EndStream() == ENS_OK);
+	assert(espeak_ng_Synchronize() == ENS_OK);
+
+	assert(espeak_ng_GetPlaybackStats(&stats) == ENS_OK);
+	assert(stats.underruns >= 1);
+}
+
+static void
+test_playback_cancel(void)
+{
+	printf("testing a cancel while playing\n");
+
+	espeak_ng_PLAYBACK_STATS before;
+	espeak_ng_PLAYBACK_STATS after;
+	assert(espeak_ng_GetPlaybackStats(&before) == ENS_OK);
+
+	assert(espeak_ng_Synthesize(test_text, strlen(test_text)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	usleep(300000);
+	assert(espeak_IsPlaying() == 1);
+
+	double start_ms = now_ms();
+	assert(espeak_ng_Cancel() == ENS_OK);
+	double cancel_ms = now_ms() - start_ms;
+	assert(espeak_IsPlaying() == 0);
+
+	assert(espeak_ng_GetPlaybackStats(&after) == ENS_OK);
+	printf("... cancelled in %.1fms, after %lu samples\n", cancel_ms, after.samples - before.samples);
+	assert(cancel_ms < 200);
+	assert(after.buffered_ms == 0);
+	assert(after.samples - before.samples < (unsigned long)n_retrieved / 2);
+}
+
+static void
+test_playback_synchronous(void)
+{
+	printf("testing synchronous playback\n");
+
+	const char *text = "Hello world.";
+	espeak_ng_PLAYBACK_STATS stats;
+
+	assert(espeak_ng_InitializeOutput(ENOUTPUT_MODE_SPEAK_AUDIO | ENOUTPUT_MODE_SYNCHRONOUS, 0, "null") == ENS_OK);
+	double start_ms = now_ms();
+	assert(espeak_ng_Synthesize(text, strlen(text)+1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, NULL) == ENS_OK);
+	double elapsed_ms = now_ms() - start_ms;
+
+	assert(espeak_ng_GetPlaybackStats(&stats) == ENS_OK);
+	assert(stats.samples > 0);
+	assert(stats.buffered_ms == 0);
+	assert(elapsed_ms >= (stats.samples * 1000.0) / SAMPLE_RATE - 100);
+}
+
+int
+main(int argc, char **argv)
+{
+	(void)argc; // unused parameter
+	(void)argv; // unused parameter
+
+	initialize();
+	test_playback_file();
+	test_playback_underrun();
+	test_playback_cancel();
+	test_playback_synchronous();
+
+	assert(espeak_ng_Terminate() == ENS_OK);
+	remove(RAW_FILE);
+	free(retrieved);
+	return EXIT_SUCCESS;
+}